@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# compile speed benchmark (make bench)
+# compiles the large programs made by mkbench, plus programs using the
+# fatfs and littlefs drivers, and writes the timings to a JSON file;
+# the 60 object program is also compiled with 4 parse workers (-j 4)
+#
+# usage: bench.sh [compiler [mkbench [results]]]
+# BENCH_SCALE=N makes the synthetic programs N times bigger,
+# BENCH_JOBS=N runs the optimizer on N threads
+#
+
+FASTSPIN=${1:-../build/flexspin}
+MKBENCH=${2:-../build/mkbench}
+RESULTS=${3:-../build/bench.json}
+SCALE=${BENCH_SCALE:-1}
+JOBS=${BENCH_JOBS:-1}
+DIR=${TMPDIR:-/tmp}/flexspin-bench.$$
+
+mkdir -p $DIR || exit 1
+$MKBENCH -s $SCALE $DIR || exit 1
+
+endmsg="ok"
+count=0
+printf '{\n  "compiler": "%s",\n' "`$FASTSPIN --version | tail -1`" > $RESULTS.tmp
+printf '  "date": "%s",\n  "scale": %s,\n  "jobs": %s,\n  "results": [' "`date -u '+%Y-%m-%dT%H:%M:%SZ'`" $SCALE $JOBS >> $RESULTS.tmp
+
+printf '%-12s %-16s %8s %9s %9s %10s\n' name options lines seconds lines/s "peak RSS"
+
+# bench NAME FILE OPTIONS
+bench() {
+    name=$1
+    file=$2
+    shift 2
+    if $FASTSPIN -q -j $JOBS "$@" -I../include --stats=json:$DIR/$name.json -o $DIR/$name.binary $DIR/$file > $DIR/$name.log 2>&1
+    then
+        status=ok
+    else
+        status=failed
+        endmsg="BENCHMARK FAILURES"
+        cat $DIR/$name.log
+    fi
+    if [ ! -f $DIR/$name.json ]; then
+        echo '{}' > $DIR/$name.json
+    fi
+    summary=`awk '/"source_lines"/ { gsub(",", "", $2); lines = $2 }
+         /"wall_seconds"/ { gsub(",", "", $2); secs = $2 }
+         /"peak_rss_kb"/ { gsub(",", "", $2); rss = $2 }
+         END { printf "%d %.3f %.0f %d", lines, secs, (secs > 0) ? lines / secs : 0, rss }' $DIR/$name.json`
+    set -- $summary "$*"
+    printf '%-12s %-16s %8s %9s %9s %8s KB %s\n' $name "$5" $1 $2 $3 $4 $status
+    if [ $count -gt 0 ]; then
+        printf ',' >> $RESULTS.tmp
+    fi
+    count=`expr $count + 1`
+    printf '\n    {"name": "%s", "options": "%s", "status": "%s", "lines_per_second": %s,\n     "stats": ' $name "$5" $status $3 >> $RESULTS.tmp
+    sed -e '2,$s/^/     /' $DIR/$name.json >> $RESULTS.tmp
+    printf '    }' >> $RESULTS.tmp
+}
+
+bench spin2_asm bench_spin.spin2 -2
+bench spin2_nu bench_spin.spin2 -2 --interp=nu
+bench many_obj bench_many.spin2 -2
+bench many_obj_j4 bench_many.spin2 -2 -j 4
+bench c_asm bench_c.c -2
+bench c_nu bench_c.c -2 --interp=nu
+bench basic_asm bench_bas.bas -2
+bench fatfs bench_fatfs.c -2
+bench littlefs bench_lfs.c -2
+
+printf '\n  ]\n}\n' >> $RESULTS.tmp
+mv $RESULTS.tmp $RESULTS
+rm -rf $DIR
+echo "results are in $RESULTS"
+echo $endmsg
+if [ "$endmsg" != "ok" ]; then
+    exit 1
+fi
@@ -94,6 +94,8 @@ done
 
 # clean up
 rm -f FullDuplexSerial.cpp FullDuplexSerial.h
+# objects used by other tests, which the pattern below misses
+rm -f subtest113.cpp subtest113.h test001.cpp test001.h test009.cpp test009.h userdef.cpp userdef.h
 if [ "x$endmsg" = "x$ok" ]
 then
   rm -f [A-Za-r]*.h [A-Za-r]*.cpp
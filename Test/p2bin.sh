@@ -26,6 +26,279 @@ do
   fi
 done
 
+# optimizing on several threads must give exactly the same binaries
+for i in [a-c]*.spin2
+do
+  j=`basename $i .spin2`
+  $PROG -j 4 $i
+  if  diff -ub Expect/$j.obj $j.binary
+  then
+      rm -f $j.binary $j.p2asm
+      echo $j -j4 passed
+  else
+      echo $j -j4 failed
+      endmsg="TEST FAILURES"
+  fi
+done
+
+# a repeated compile must come out of the cache, unchanged
+rm -rf cache.tmp
+for i in [a-c]*.spin2
+do
+  j=`basename $i .spin2`
+  $PROG --cache-dir=cache.tmp $i
+  rm -f $j.binary
+  if $PROG --cache-dir=cache.tmp --verbose $i | grep -q "cache: hit" && diff -ub Expect/$j.obj $j.binary
+  then
+      rm -f $j.binary $j.p2asm
+      echo $j cached passed
+  else
+      echo $j cached failed
+      endmsg="TEST FAILURES"
+  fi
+done
+rm -rf cache.tmp
+
+# preprocessed C files must come out of the preprocessor output cache unchanged
+$PROG -o ppcache.binary cexec02.c
+mv ppcache.binary ppcache.ref
+$PROG --cache-dir=cache.tmp -o ppcache.binary cexec02.c
+rm -f cache.tmp/*.manifest ppcache.binary
+if $PROG --cache-dir=cache.tmp --verbose -o ppcache.binary cexec02.c 2>&1 | grep -q "cache: preprocessed .*cexec02.c reused" && cmp ppcache.ref ppcache.binary
+then
+    rm -f ppcache.ref ppcache.binary ppcache.p2asm
+    echo ppcache passed
+else
+    echo ppcache failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf cache.tmp
+
+# an object added earlier in the search path than the one the cached
+# compile found must cause a miss
+rm -rf cache.tmp objcache.tmp
+mkdir -p objcache.tmp/inc
+printf 'pub get() : r\n  return 1\n' > objcache.tmp/inc/child.spin2
+printf 'OBJ\n  c : "child"\npub main()\n  pinh(c.get())\n' > objcache.tmp/top.spin2
+$PROG --cache-dir=cache.tmp -Iobjcache.tmp/inc objcache.tmp/top.spin2
+cp objcache.tmp/inc/child.spin2 objcache.tmp/child.spin2
+if $PROG --cache-dir=cache.tmp --verbose -Iobjcache.tmp/inc objcache.tmp/top.spin2 | grep -q "cache: miss (.*child.spin2 now exists)"
+then
+    echo objcache passed
+else
+    echo objcache failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf cache.tmp objcache.tmp
+
+# when one object changes, the saved parse of the others must be used,
+# and the result must be the same as without the cache
+mkdir -p parsecache.tmp
+printf 'pub get() : r\n  return 1\n' > parsecache.tmp/child.spin2
+printf 'OBJ\n  c : "child"\npub main()\n  pinh(c.get())\n' > parsecache.tmp/top.spin2
+$PROG --cache-dir=cache.tmp -o parsecache.binary parsecache.tmp/top.spin2
+printf 'pub get() : r\n  return 2\n' > parsecache.tmp/child.spin2
+$PROG -o parsecache.binary parsecache.tmp/top.spin2
+mv parsecache.binary parsecache.ref
+if $PROG --cache-dir=cache.tmp --verbose -o parsecache.binary parsecache.tmp/top.spin2 | grep -q "cache: parse of .*top.spin2 reused" && cmp parsecache.ref parsecache.binary
+then
+    rm -f parsecache.ref parsecache.binary parsecache.p2asm
+    echo parsecache passed
+else
+    echo parsecache failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf cache.tmp parsecache.tmp
+
+# with -j the objects must be parsed by the workers, with the same
+# result as parsing them in the compile
+mkdir -p parsejobs.tmp/lib
+printf 'CON\n  K = 3\npub get() : r\n  return K\n' > parsejobs.tmp/lib/leaf.spin2
+printf 'OBJ\n  l : "lib/leaf"\npub get() : r\n  return l.get() + 1\n' > parsejobs.tmp/mid.spin2
+printf '{ OBJ x : "nothere" }\nOBJ\n  m : "mid"  '"'"' the middle\n  l : "lib/leaf"\npub main()\n  pinh(m.get() + l#K)\n' > parsejobs.tmp/top.spin2
+$PROG -o parsejobs.ref parsejobs.tmp/top.spin2
+if $PROG -j 4 --verbose -o parsejobs.binary parsejobs.tmp/top.spin2 | grep -q "^parse: 2 of 2 objects parsed by 2 workers" && cmp parsejobs.ref parsejobs.binary
+then
+    rm -f parsejobs.ref parsejobs.binary parsejobs.p2asm
+    echo parsejobs passed
+else
+    echo parsejobs failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf parsejobs.tmp
+
+# a worker parsing an object that uses other objects must not wait for
+# another worker (or read its standard input, which here stays open)
+rm -rf pjchain.tmp
+mkdir pjchain.tmp
+printf 'pub get() : r\n  return 1\n' > pjchain.tmp/c.spin2
+printf 'OBJ\n  x : "c"\npub get() : r\n  return x.get() + 1\n' > pjchain.tmp/b.spin2
+printf 'OBJ\n  x : "b"\npub get() : r\n  return x.get() + 1\n' > pjchain.tmp/a.spin2
+printf 'OBJ\n  x : "a"\npub main()\n  pinh(x.get())\n' > pjchain.tmp/top.spin2
+mkfifo pjchain.tmp/ctl
+$PROG -j 4 -o pjchain.tmp/out.binary pjchain.tmp/top.spin2 < pjchain.tmp/ctl &
+pjpid=$!
+exec 3> pjchain.tmp/ctl
+n=0
+while kill -0 $pjpid 2>/dev/null && [ $n -lt 100 ]
+do
+    sleep 0.1
+    n=`expr $n + 1`
+done
+kill $pjpid 2>/dev/null
+exec 3>&-
+wait $pjpid
+$PROG -o pjchain.tmp/ref.binary pjchain.tmp/top.spin2
+if [ $n -lt 100 ] && cmp pjchain.tmp/ref.binary pjchain.tmp/out.binary
+then
+    echo pjchain passed
+else
+    echo pjchain failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf pjchain.tmp
+
+# the optimizer must stop at its budget, and say so
+$PROG --opt-budget=1 --verbose -o budget.binary cexec02.c > budget.out 2>&1
+if grep -q "^optimizer: .* over budget" budget.out && grep -q "warning: optimization of .* stopped after 1 rounds" budget.out && [ -s budget.binary ]
+then
+    echo opt-budget passed
+else
+    echo opt-budget failed
+    endmsg="TEST FAILURES"
+fi
+rm -f budget.binary budget.out
+
+# the optimizer must cope with a very long function (about 20000
+# instructions of straight line code) in reasonable time
+awk 'BEGIN {
+    v[0] = "a"; v[1] = "b"; v[2] = "c"; v[3] = "d";
+    print "unsigned int buf[64];";
+    print "unsigned int f(unsigned int x, unsigned int y) {";
+    print "  unsigned int a=x, b=y, c=x^y, d=x+y;";
+    r = 1;
+    for (i = 0; i < 9000; i++) {
+        r = (r * 75 + 74) % 65537; k = r % 4;
+        r = (r * 75 + 74) % 65537; p = v[r % 4];
+        r = (r * 75 + 74) % 65537; q = v[r % 4];
+        r = (r * 75 + 74) % 65537; n = r % 64;
+        if (k == 0) printf "  %s = %s + buf[%d];\n", p, q, n;
+        else if (k == 1) printf "  %s = %s ^ (%s << %d);\n", p, q, p, n % 7;
+        else if (k == 2) printf "  buf[%d] = %s - %s;\n", n, p, q;
+        else printf "  %s = %s + %s;\n", p, q, p;
+    }
+    print "  return a + b + c + d;";
+    print "}";
+    print "void main() { buf[0] = f(buf[1], buf[2]); }";
+}' > optstress.c
+start=`date +%s`
+$PROG -o optstress.binary optstress.c
+status=$?
+elapsed=`expr \`date +%s\` - $start`
+if [ $status -eq 0 ] && [ -s optstress.binary ] && [ $elapsed -lt 60 ]
+then
+    echo "opt-stress passed (${elapsed}s)"
+else
+    echo "opt-stress failed (${elapsed}s)"
+    endmsg="TEST FAILURES"
+fi
+rm -f optstress.c optstress.binary optstress.p2asm
+
+# with static frames none of the functions in exec04 should need to
+# push their local registers
+$PROG -o frames.binary exec04.spin
+pushes=`grep -c "call	#pushregs_" frames.p2asm`
+$PROG -Ostatic-frames -o frames.binary exec04.spin
+if [ $pushes -gt 0 ] && [ -s frames.binary ] && ! grep -q "call	#pushregs_" frames.p2asm
+then
+    echo static-frames passed
+else
+    echo static-frames failed
+    endmsg="TEST FAILURES"
+fi
+rm -f frames.binary frames.p2asm
+
+# worst case times of loops with a constant count; each is loaded
+# into FCACHE (74 cycles plus one per long) and returns to hub code
+# (20 cycles), and the REP costs 2 more:
+#   spin8: 8 times 4 ALU ops at 2, then a mov: 74+5 + 2 + 64 + 2 + 20
+#   sum8:  2 movs, then 8 times a cog rdlong (16, plus 1 for a long)
+#          and 2 adds: 4 + 74+4 + 2 + 168 + 20
+#   id8:   a mov, then 8 times a mov, a cogid waiting for the hub (11)
+#          and an add, then a mov: 2 + 74+4 + 2 + 120 + 2 + 20
+cat > wcet.c <<'EOF'
+unsigned int buf[8];
+unsigned int spin8(unsigned int x) __attribute__(cycles(1000))
+{
+    int i;
+    for (i = 0; i < 8; i++) x = (x << 1) ^ (x >> 3);
+    return x;
+}
+unsigned int sum8(void) __attribute__(cycles(1000))
+{
+    unsigned int *p = buf, s = 0;
+    int i;
+    for (i = 0; i < 8; i++) s += *p++;
+    return s;
+}
+unsigned int id8(void) __attribute__(cycles(1000))
+{
+    unsigned int s = 0;
+    int i;
+    for (i = 0; i < 8; i++) s += _cogid();
+    return s;
+}
+void main()
+{
+    buf[3] = spin8(buf[1]);
+    buf[4] = sum8();
+    buf[5] = id8();
+    for (;;) ;
+}
+EOF
+$PROG -O2 --wcet -o wcet.binary wcet.c > wcet.txt 2>&1
+if grep -q "^ *167  _spin8 " wcet.txt && grep -q "^ *272  _sum8 " wcet.txt && grep -q "^ *224  _id8 " wcet.txt
+then
+    echo wcet passed
+else
+    echo wcet failed
+    cat wcet.txt
+    endmsg="TEST FAILURES"
+fi
+rm -f wcet.c wcet.txt wcet.binary wcet.p2asm
+
+# a rebuild in watch mode must give the same result as a fresh compile
+rm -rf watch.tmp
+mkdir watch.tmp
+printf 'OBJ\n  a : "watcha"\nPUB main()\n  a.f(1)\n  repeat\n' > watch.tmp/watchtop.spin2
+printf 'PUB f(x) : r\n  r := x + 1\n' > watch.tmp/watcha.spin2
+mkfifo watch.tmp/ctl
+$PROG --watch -o watch.tmp/out.binary watch.tmp/watchtop.spin2 < watch.tmp/ctl > watch.tmp/log 2>&1 &
+watchpid=$!
+exec 3> watch.tmp/ctl
+waitbuilds() {
+    n=0
+    while [ `grep -c "^watch: compiled" watch.tmp/log` -lt $1 ] && [ $n -lt 100 ]
+    do
+        sleep 0.1
+        n=`expr $n + 1`
+    done
+}
+waitbuilds 1
+printf 'PUB f(x) : r\n  r := x + 2\n' > watch.tmp/watcha.spin2
+waitbuilds 2
+exec 3>&-
+wait $watchpid
+$PROG -o watch.tmp/ref.binary watch.tmp/watchtop.spin2
+if grep -q "1 of 2 files reused" watch.tmp/log && cmp watch.tmp/ref.binary watch.tmp/out.binary
+then
+    echo watch passed
+else
+    echo watch failed
+    endmsg="TEST FAILURES"
+fi
+rm -rf watch.tmp
+
 # clean up
 if [ "x$endmsg" = "x$ok" ]
 then
@@ -0,0 +1,76 @@
+#!/bin/sh
+#
+# compare two code quality reports (from flexspin --quality-report=json)
+# and list the functions whose size or cycle estimates changed
+#
+# usage: qualitydiff.sh old.json new.json
+#
+
+if [ $# -ne 2 ]; then
+    echo "usage: qualitydiff.sh old.json new.json" >&2
+    exit 2
+fi
+
+awk '
+# value of "key" in a report line, or "" if absent
+function field(line, key,    s) {
+    if (!match(line, "\"" key "\": [^,}]*")) return ""
+    s = substr(line, RSTART, RLENGTH)
+    sub(/^[^:]*: */, "", s)
+    gsub(/"/, "", s)
+    return s
+}
+function bytes(line) {
+    return field(line, "cog_bytes") + field(line, "hub_bytes") + field(line, "lut_bytes")
+}
+function delta(a, b) {
+    if (a == "" || a == "null" || b == "" || b == "null") return "-"
+    return sprintf("%+d", b - a)
+}
+FNR == 1 { fileno++ }
+/"name":/ {
+    name = field($0, "name")
+    if (fileno == 1) {
+        oldline[name] = $0
+    } else {
+        newline[name] = $0
+        order[++count] = name
+    }
+}
+END {
+    printf "%-32s %8s %8s %8s %10s %10s\n", "function", "bytes", "was", "instrs", "min cycles", "max cycles"
+    for (i = 1; i <= count; i++) {
+        name = order[i]
+        n = newline[name]
+        if (!(name in oldline)) {
+            printf "%-32s %8s %8s %8s %10s %10s  (new)\n", name, bytes(n), "-", field(n, "instructions"), field(n, "min_cycles"), field(n, "max_cycles")
+            newtotal += bytes(n)
+            continue
+        }
+        o = oldline[name]
+        oldtotal += bytes(o)
+        newtotal += bytes(n)
+        if (bytes(o) == bytes(n) && field(o, "instructions") == field(n, "instructions") \
+            && field(o, "min_cycles") == field(n, "min_cycles") && field(o, "max_cycles") == field(n, "max_cycles") \
+            && field(o, "memory") == field(n, "memory")) {
+            continue
+        }
+        changed++
+        printf "%-32s %8s %8s %8s %10s %10s", name, delta(bytes(o), bytes(n)), bytes(o), \
+            delta(field(o, "instructions"), field(n, "instructions")), \
+            delta(field(o, "min_cycles"), field(n, "min_cycles")), \
+            delta(field(o, "max_cycles"), field(n, "max_cycles"))
+        if (field(o, "memory") != field(n, "memory")) {
+            printf "  (%s -> %s)", field(o, "memory"), field(n, "memory")
+        }
+        printf "\n"
+    }
+    for (name in oldline) {
+        if (!(name in newline)) {
+            o = oldline[name]
+            printf "%-32s %8s %8s %8s %10s %10s  (removed)\n", name, -bytes(o), bytes(o), "-", "-", "-"
+            oldtotal += bytes(o)
+        }
+    }
+    printf "total: %d -> %d bytes (%+d), %d functions changed\n", oldtotal, newtotal, newtotal - oldtotal, changed
+}' "$1" "$2"
@@ -0,0 +1,101 @@
+#!/bin/sh
+#
+# run the P2 execution tests (the same ones runtests_p2.sh runs on
+# hardware) in the p2sim simulator, and collect the cycle counts
+#
+# usage: runtests_sim.sh [compiler [p2sim [results]]]
+#
+
+FASTSPIN=${1:-../build/flexspin}
+P2SIM=${2:-../build/p2sim}
+RESULTS=${3:-../build/simcycles.json}
+
+PROG_ASM="$FASTSPIN -2 -O2 -g -q -I../Lib"
+# a test which has not finished after 5 simulated seconds at 160 MHz has hung
+SIM="$P2SIM --max-cycles=800000000"
+
+ok="ok"
+endmsg=$ok
+count=0
+
+echo "running tests in simulator..."
+printf '{\n  "compiler": "%s",\n  "results": [' "`$FASTSPIN --version | tail -1`" > $RESULTS.tmp
+
+# simtest FILE
+simtest() {
+  i=$1
+  j=`echo $i | sed -e 's/\.[a-z0-9]*$//'`
+  rm -f $j.json
+  simstatus=1
+  if $PROG_ASM -l -o $j.binary $i; then
+    $SIM --json=$j.json $j.binary > $j.txt
+    simstatus=$?
+  fi
+  if [ $simstatus -eq 0 ] && diff -ub Expect/$j.txt $j.txt
+  then
+    echo $j passed in simulator
+    status=ok
+  else
+    echo $j failed in simulator
+    status=failed
+    endmsg="TEST FAILURES"
+  fi
+  if [ $count -gt 0 ]; then
+    printf ',' >> $RESULTS.tmp
+  fi
+  count=`expr $count + 1`
+  printf '\n    {"name": "%s", "status": "%s", "simulation": ' $j $status >> $RESULTS.tmp
+  if [ -f $j.json ]; then
+    sed -e '2,$s/^/    /' $j.json >> $RESULTS.tmp
+  else
+    echo '{}' >> $RESULTS.tmp
+  fi
+  printf '    }' >> $RESULTS.tmp
+  if [ $status = ok ]; then
+    rm -f $j.txt $j.binary $j.lst $j.p2asm $j.json
+  fi
+}
+
+for i in basexec*.bas cexec*.c exec*.spin exec*.spin2
+do
+  simtest $i
+done
+
+printf '\n  ]\n}\n' >> $RESULTS.tmp
+mv $RESULTS.tmp $RESULTS
+echo "cycle counts are in $RESULTS"
+
+# the times p2sim measures for the builtin helpers must stay within the
+# --wcet bounds; the calls themselves are not part of the bounds, so
+# what empty() measures over its bound is taken off the others
+rm -f wcetsim.txt
+if $FASTSPIN -2 -O2 -q --wcet -D__EXIT_STATUS__ -I../include -o wcetsim.binary wcetsim.c > wcetsim.bound && $SIM wcetsim.binary > wcetsim.txt
+then
+  awk 'FNR == NR { if ($3 == "(budget") bound[substr($2, 2)] = $1; next }
+       { time[$1] = $2 }
+       END {
+         extra = time["empty"] - bound["empty"]
+         n = 0
+         for (f in time) {
+           if (!(f in bound)) { print f ": no bound"; exit 1 }
+           t = time[f] - extra
+           print f ": measured " t ", bound " bound[f]
+           if (t > bound[f]) exit 1
+           n++
+         }
+         if (n != 4) exit 1
+       }' wcetsim.bound wcetsim.txt && wcetstatus=ok
+fi
+if [ "$wcetstatus" = ok ]
+then
+  echo wcetsim passed
+  rm -f wcetsim.bound wcetsim.txt wcetsim.binary wcetsim.p2asm
+else
+  echo wcetsim failed
+  cat wcetsim.bound wcetsim.txt
+  endmsg="TEST FAILURES"
+fi
+echo $endmsg
+if [ "$endmsg" != "$ok" ]; then
+  exit 1
+fi
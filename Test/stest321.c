@@ -0,0 +1,15 @@
+//
+// headers included more than once must give the same results as if
+// they were read every time (see the include guard handling in mcpp)
+//
+#include "sub/guard1.h"
+#include "sub/guard1.h"
+#include "sub/guard2.h"
+#include "sub/guard2.h"
+#include "sub/guard3.h"
+#include "sub/guard3.h"
+
+int count(void)
+{
+    return guard1() + GUARD2_NEXT + GUARD3_VAL;
+}
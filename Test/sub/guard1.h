@@ -0,0 +1,8 @@
+/* a whole-file include guard, in the #if !defined form */
+#if !defined( GUARD1_H )
+#define GUARD1_H
+#  ifndef GUARD1_COUNT
+#  define GUARD1_COUNT 1
+#  endif
+static int guard1(void) { return GUARD1_COUNT; }
+#endif /* GUARD1_H */
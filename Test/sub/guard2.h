@@ -0,0 +1,7 @@
+// not a whole-file guard: there is text after the #endif
+#ifndef GUARD2_H
+#define GUARD2_H
+#define GUARD2_COUNT 0
+#endif
+#undef GUARD2_NEXT
+#define GUARD2_NEXT (GUARD2_COUNT+1)
@@ -0,0 +1,8 @@
+#ifndef GUARD3_H
+#define GUARD3_H
+#define GUARD3_VAL 1
+#else
+/* the second inclusion must still see this part */
+#undef GUARD3_VAL
+#define GUARD3_VAL 2
+#endif
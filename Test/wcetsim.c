@@ -0,0 +1,65 @@
+//
+// time the builtin helpers (pushregs_/popregs_, divide_ and an FCACHE
+// load) in p2sim; runtests_sim.sh checks the times against the --wcet
+// bounds of the same functions
+//
+#include <stdio.h>
+#include <propeller2.h>
+
+unsigned int buf[8];
+volatile unsigned int arg;
+volatile int num, den;
+
+// next to nothing, to measure the cost of the call and of reading
+// the counter
+unsigned int empty(void) __attribute__(cycles(100000))
+{
+    return arg;
+}
+// a local array whose address is taken puts the locals on the stack
+unsigned int framed(void) __attribute__(cycles(100000))
+{
+    unsigned int a[4];
+    unsigned int *p = a;
+    unsigned int x = arg;
+    p[x & 3] = x;
+    buf[x & 7] = (unsigned int)p;
+    return a[(x + 1) & 3];
+}
+// signed division (divide_)
+int quot(void) __attribute__(cycles(100000))
+{
+    return num / den;
+}
+// a loop with a constant count, run from FCACHE
+unsigned int sum8(void) __attribute__(cycles(100000))
+{
+    unsigned int *p = buf, s = 0;
+    int i;
+    for (i = 0; i < 8; i++) s += *p++;
+    return s;
+}
+
+unsigned int worst[4];
+
+// start each call at a different point of the hub window
+#define TIME(n, call) \
+    _waitx(1 + (i & 15)); \
+    t = _cnt(); r += call; d = _cnt() - t; \
+    if (d > worst[n]) worst[n] = d
+
+void main()
+{
+    unsigned int t, d, i, r = 0;
+    for (i = 0; i < 64; i++) {
+        arg = i;
+        num = -1000 * (int)i - 5;
+        den = 7 - (int)(i & 3);
+        TIME(0, empty());
+        TIME(1, framed());
+        TIME(2, quot());
+        TIME(3, sum8());
+    }
+    printf("empty %u\nframed %u\nquot %u\nsum8 %u\n", worst[0], worst[1], worst[2], worst[3]);
+    if (r == 1) printf("\n");
+}
@@ -6,20 +6,65 @@
 #include <string.h>
 #include <inttypes.h>
 #include "spinc.h"
+#include "util/arena.h"
+#include "passtime.h"
 
 static LexStream *s_reportas_lexdata;
 static int s_reportas_lineidx;
 
+/*
+ * AST nodes (and the identifier strings the lexer hangs off them)
+ * come from an arena rather than from malloc; there are a great
+ * many of them, and they all die at about the same time
+ */
+static Arena s_permArena;
+static Arena *s_astArena;
+
+/*
+ * set the arena used for new AST nodes; returns the old one
+ * passing NULL selects the permanent arena that lives as long
+ * as the program does
+ */
+Arena *
+SetASTArena(Arena *A)
+{
+    Arena *old = s_astArena;
+    if (!A) {
+        if (!s_permArena.chunksize) {
+            ArenaInit(&s_permArena, 0);
+        }
+        A = &s_permArena;
+    }
+    s_astArena = A;
+    return old;
+}
+
+void *
+AstAlloc(size_t size)
+{
+    if (!s_astArena) {
+        SetASTArena(NULL);
+    }
+    CountAlloc(size);
+    return ArenaAlloc(s_astArena, size);
+}
+
+char *
+AstStrdup(const char *str)
+{
+    if (!s_astArena) {
+        SetASTArena(NULL);
+    }
+    CountAlloc(strlen(str) + 1);
+    return ArenaStrdup(s_astArena, str);
+}
+
 AST *
 NewAST(enum astkind kind, AST *left, AST *right)
 {
     AST *ast;
 
-    ast = (AST *)malloc(sizeof(*ast));
-    if (!ast) {
-        fprintf(stderr, "FATAL ERROR: out of memory\n");
-        abort();
-    }
+    ast = (AST *)AstAlloc(sizeof(*ast));
     ast->kind = kind;
     ast->left = left;
     ast->right = right;
@@ -2,6 +2,7 @@
 #define SPIN_AST_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 typedef struct LineInfo {
     const char *fileName;
@@ -278,6 +279,9 @@ typedef struct ASTReportInfo {
 } ASTReportInfo;
 
 /* function declarations */
+struct Arena *SetASTArena(struct Arena *A);
+void *AstAlloc(size_t size);
+char *AstStrdup(const char *str);
 AST *NewAST(enum astkind kind, AST *left, AST *right);
 AST *AddToList(AST *list, AST *newelement);
 AST *AddToLeftList(AST *list, AST *newelement);
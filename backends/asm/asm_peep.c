@@ -50,7 +50,7 @@ typedef struct PeepholePattern {
 
 #define PEEP_OP_CLRMASK(bits, shift) (PEEP_OP_CLRBITS|(bits<<6)|(shift))
 
-static Operand *peep_ops[MAX_OPERANDS_IN_PATTERN];
+static THREAD_LOCAL Operand *peep_ops[MAX_OPERANDS_IN_PATTERN];
 
 static int PeepOperandMatch(int patrn_dst, Operand *dst, IR *ir)
 {
@@ -177,515 +177,6 @@ static int MatchPattern(PeepholePattern *patrn, IR *ir)
     return ircount;
 }
 
-// cmp + mov -> max/min
-static PeepholePattern pat_maxs[] = {
-    { COND_TRUE, OPC_CMPS, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_GT, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_maxu[] = {
-    { COND_TRUE, OPC_CMP, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_GT, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_mins[] = {
-    { COND_TRUE, OPC_CMPS, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_LT, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_minu[] = {
-    { COND_TRUE, OPC_CMP, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_LT, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-static PeepholePattern pat_maxs_off[] = {
-    { COND_TRUE, OPC_CMPS, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_GE, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH_M1S|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_maxu_off[] = {
-    { COND_TRUE, OPC_CMP, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_WCZ_OK },
-    { COND_GE, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH_M1U|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// zero/sign extend via x = (x<<N) >> N
-static PeepholePattern pat_zeroex[] = {
-    { COND_ANY, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_SET_IMM|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_signex[] = {
-    { COND_ANY, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_SET_IMM|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// wrc x; cmp x, #0 wz
-static PeepholePattern pat_wrc_cmp[] = {
-    { COND_TRUE, OPC_WRC, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_CMP, PEEP_OP_MATCH|0, PEEP_OP_IMM|0, PEEP_FLAGS_P2|PEEP_FLAGS_WCZ_OK|PEEP_FLAGS_MUST_WZ },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// muxc x,#-1; cmp x, #0 wz
-static PeepholePattern pat_muxc_cmp[] = {
-    { COND_TRUE, OPC_MUXC, PEEP_OP_SET|0, PEEP_OP_CLRMASK(0,0), PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_CMP, PEEP_OP_MATCH|0, PEEP_OP_IMM|0, PEEP_FLAGS_WCZ_OK|PEEP_FLAGS_MUST_WZ },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// subx x,x; cmp x, #0 wz
-static PeepholePattern pat_subx_cmp[] = {
-    { COND_TRUE, OPC_SUBX, PEEP_OP_SET|0, PEEP_OP_MATCH|0, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_CMP, PEEP_OP_MATCH|0, PEEP_OP_IMM|0, PEEP_FLAGS_WCZ_OK|PEEP_FLAGS_MUST_WZ },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// muxc x,#-1 wz
-static PeepholePattern pat_muxc_wz[] = {
-    { COND_TRUE, OPC_MUXC, PEEP_OP_SET|0, PEEP_OP_CLRMASK(0,0), PEEP_FLAGS_WCZ_OK|PEEP_FLAGS_MUST_WZ },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// wrc x; and x, #1 -> the AND is redundant
-static PeepholePattern pat_wrc_and[] = {
-    { COND_TRUE, OPC_WRC, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// wrc x; test x, #1 wc -> the TEST is redundant
-static PeepholePattern pat_wrc_test[] = {
-    { COND_TRUE, OPC_WRC, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_TEST, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 | PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-static PeepholePattern pat_clrc[] = {
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|0, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_TEST, PEEP_OP_MATCH_DEAD|0, PEEP_OP_IMM|1, PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_setc1[] = {
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|1, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_TEST, PEEP_OP_MATCH_DEAD|0, PEEP_OP_IMM|1, PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_setc2[] = {
-    { COND_ANY, OPC_NEG, PEEP_OP_SET|0, PEEP_OP_IMM|1, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_TEST, PEEP_OP_MATCH_DEAD|0, PEEP_OP_IMM|1, PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// XOR x,##-1 to NOT x,x
-static PeepholePattern pat_not[] = {
-    { COND_ANY, OPC_XOR, PEEP_OP_SET|0, PEEP_OP_CLRMASK(0,0), PEEP_FLAGS_P2},
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// cmps x,#0 wc; if_c neg x,x -> abs x,x wc
-// (wz is also allowed)
-static PeepholePattern pat_cmps_abs[] = {
-    { COND_ANY, OPC_CMPS, PEEP_OP_SET|0, PEEP_OP_IMM|0, PEEP_FLAGS_WCZ_OK | PEEP_FLAGS_MUST_WC },
-    { COND_C, OPC_NEG, PEEP_OP_MATCH|0, PEEP_OP_MATCH|0, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// remove redundant zero extends after rdbyte/rdword
-static PeepholePattern pat_rdbyte1[] = {
-    { COND_TRUE, OPC_RDBYTE, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_SHL, PEEP_OP_MATCH|0, PEEP_OP_IMM|24, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_IMM|24, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_rdword1[] = {
-    { COND_TRUE, OPC_RDWORD, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_SHL, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_rdbyte2[] = {
-    { COND_TRUE, OPC_RDBYTE, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_ZEROX, PEEP_OP_MATCH|0, PEEP_OP_IMM|7, PEEP_FLAGS_P2 | PEEP_FLAGS_WCZ_OK },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_rdword2[] = {
-    { COND_TRUE, OPC_RDWORD, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_ZEROX, PEEP_OP_MATCH|0, PEEP_OP_IMM|15, PEEP_FLAGS_P2 | PEEP_FLAGS_WCZ_OK},
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// potentially eliminate a redundant mov+add sequence
-static PeepholePattern pat_movadd[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ADD, PEEP_OP_SET|2, PEEP_OP_MATCH|0, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// replace mov x, #2; shl x, y; sub x, #1  with bmask x, y
-static PeepholePattern pat_bmask1[] = {
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|2, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_SHL, PEEP_OP_MATCH|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace add y, #1; decod x, y; sub x, #1  with bmask x, y
-static PeepholePattern pat_bmask2[] = {
-    { COND_ANY, OPC_ADD, PEEP_OP_SET|1, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_DECOD, PEEP_OP_SET|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace mov a, x; waitx a  with waitx x
-static PeepholePattern pat_waitx[] = {
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_WAITX, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace if_c drvh / if_nc drvl with drvc
-static PeepholePattern pat_drvc1[] = {
-    { COND_C,  OPC_DRVH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NC, OPC_DRVL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_drvc2[] = {
-    { COND_NC, OPC_DRVL, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_C,  OPC_DRVH, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace if_c drvl / if_nc drvh with drvnc
-static PeepholePattern pat_drvnc1[] = {
-    { COND_C,  OPC_DRVL, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NC, OPC_DRVH, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_drvnc2[] = {
-    { COND_NC, OPC_DRVH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_C,  OPC_DRVL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace if_c bith / if_nc bitl with bitc
-static PeepholePattern pat_bitc1[] = {
-    { COND_C,  OPC_BITH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NC, OPC_BITL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_bitc2[] = {
-    { COND_NC, OPC_BITL, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_C,  OPC_BITH, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace if_c bitl / if_nc bith with bitnc
-static PeepholePattern pat_bitnc1[] = {
-    { COND_C,  OPC_BITL, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NC, OPC_BITH, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_bitnc2[] = {
-    { COND_NC, OPC_BITH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_C,  OPC_BITL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// replace if_z drvh / if_nz drvl with drvz
-static PeepholePattern pat_drvz[] = {
-    { COND_EQ, OPC_DRVH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NE, OPC_DRVL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_drvnz1[] = {
-    { COND_NE, OPC_DRVH, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_EQ, OPC_DRVL, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_drvnz2[] = {
-    { COND_EQ, OPC_DRVL, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { COND_NE, OPC_DRVH, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// replace if_c neg / if_nc mov and smiliar patterns with NEGcc
-static PeepholePattern pat_negc1[] = {
-    { COND_C,  OPC_NEG, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NC, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negc2[] = {
-    { COND_NC, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_C,  OPC_NEG, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negnc1[] = {
-    { COND_NC, OPC_NEG, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_C,  OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negnc2[] = {
-    { COND_C,  OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NC, OPC_NEG, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negz1[] = {
-    { COND_Z,  OPC_NEG, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NZ, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negz2[] = {
-    { COND_NZ, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_Z,  OPC_NEG, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negnz1[] = {
-    { COND_NZ, OPC_NEG, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_Z,  OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_negnz2[] = {
-    { COND_Z,  OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NZ, OPC_NEG, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// replace if_c sub / if_nc add and smiliar patterns with SUMcc
-static PeepholePattern pat_sumc1[] = {
-    { COND_C,  OPC_SUB, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NC, OPC_ADD, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumc2[] = {
-    { COND_NC, OPC_ADD, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_C,  OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumnc1[] = {
-    { COND_NC, OPC_SUB, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_C,  OPC_ADD, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumnc2[] = {
-    { COND_C,  OPC_ADD, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NC, OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumz1[] = {
-    { COND_Z,  OPC_SUB, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NZ, OPC_ADD, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumz2[] = {
-    { COND_NZ, OPC_ADD, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_Z,  OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumnz1[] = {
-    { COND_NZ, OPC_SUB, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_Z,  OPC_ADD, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sumnz2[] = {
-    { COND_Z,  OPC_ADD, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_NZ, OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// replace mov x, #0 / cmp a, b wz / if_e mov x, #1
-static PeepholePattern pat_seteq[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|0, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_CMP, OPERAND_ANY, OPERAND_ANY, PEEP_FLAGS_WCZ_OK },
-    { COND_EQ,  OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_setne[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|0, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_CMP, OPERAND_ANY, OPERAND_ANY, PEEP_FLAGS_WCZ_OK },
-    { COND_NE,  OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-#if 0
-static PeepholePattern pat_sar24getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_IMM|24, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shr24getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_IMM|24, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sar16getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shr16getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sar8getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_IMM|8, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shr8getbyte[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SHR, PEEP_OP_MATCH|0, PEEP_OP_IMM|8, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_sar16getword[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_MATCH|0, PEEP_OP_IMM|(16+(15<<5)), PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shr16getword[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_SAR, PEEP_OP_MATCH|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_MATCH|0, PEEP_OP_IMM|0xffff, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-#endif
-static PeepholePattern pat_shl8setbyte[] = {
-    { COND_TRUE, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_IMM|8, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_SET|1, PEEP_OP_IMM|(8+(7<<5)), PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_OR, PEEP_OP_MATCH|1, PEEP_OP_MATCH|0, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shl16setbyte[] = {
-    { COND_TRUE, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_SET|1, PEEP_OP_IMM|(16+(7<<5)), PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_OR, PEEP_OP_MATCH|1, PEEP_OP_MATCH|0, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shl24setbyte[] = {
-    { COND_TRUE, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_IMM|24, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_SET|1, PEEP_OP_IMM|(24+(7<<5)), PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_OR, PEEP_OP_MATCH|1, PEEP_OP_MATCH|0, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_shl16setword[] = {
-    { COND_TRUE, OPC_SHL, PEEP_OP_SET|0, PEEP_OP_IMM|16, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_BITL, PEEP_OP_SET|1, PEEP_OP_IMM|(16+(15<<5)), PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_OR, PEEP_OP_MATCH|1, PEEP_OP_MATCH|0, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// mov x, y; and x, #1; add z, x => test y, #1 wz; if_nz add z, #1
-static PeepholePattern pat_mov_and_add[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_IMM|1, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ADD, PEEP_OP_SET|2, PEEP_OP_MATCH_DEAD|0, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// qmul x, y; getqx z; qmul x, y; getqy w -> qmul x, y; getqx z; getqy w
-static PeepholePattern pat_qmul_qmul1[] = {
-    { COND_TRUE, OPC_QMUL, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|2, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_QMUL, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-//    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|3, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// qmul x, y; getqy z; qmul x, y; getqx w -> qmul x, y; getqx z; getqy w
-static PeepholePattern pat_qmul_qmul2[] = {
-    { COND_TRUE, OPC_QMUL, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|2, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_QMUL, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-//    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|3, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// qdiv x, y; getqx z; qdiv x, y; getqy w -> qdiv x, y; getqx z; getqy w
-static PeepholePattern pat_qdiv_qdiv1[] = {
-    { COND_TRUE, OPC_QDIV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|2, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_QDIV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|3, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// qdiv x, y; getqx z; qdiv x, y; getqy w -> qdiv x, y; getqx z; getqy w
-static PeepholePattern pat_qdiv_qdiv2[] = {
-    { COND_TRUE, OPC_QDIV, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|2, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_QDIV, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|3, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// Fuse signed quotient+remainder (constant divider)
-static PeepholePattern pat_qdiv_qdiv_signed1[] = {
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|0,   PEEP_OP_SET|1,   PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|0, PEEP_OP_SET|2,   PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|3,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ANY,   OPERAND_ANY,     PEEP_OP_MATCH|3, PEEP_FLAGS_NONE }, // NEGC/NEGNC
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|4,   PEEP_OP_MATCH|1, PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|4, PEEP_OP_MATCH|2, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|5,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    // NEGC/NEGNC here, but we don't really care if it's actually there
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// Fuse signed remainder+quotient (constant divider)
-static PeepholePattern pat_qdiv_qdiv_signed2[] = {
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|0,   PEEP_OP_SET|1,   PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|0, PEEP_OP_SET|2,   PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|3,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ANY,   OPERAND_ANY,     PEEP_OP_MATCH|3, PEEP_FLAGS_NONE }, // NEGC/NEGNC
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|4,   PEEP_OP_MATCH|1, PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|4, PEEP_OP_MATCH|2, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|5,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    // NEGC/NEGNC here, but we don't really care if it's actually there
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// Fuse signed quotient+remainder (constant dividend)
-static PeepholePattern pat_qdiv_qdiv_signed3[] = {
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|0,   PEEP_OP_SET|1,   PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_SET|2,   PEEP_OP_MATCH|0,   PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|3,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ANY,   OPERAND_ANY,     PEEP_OP_MATCH|3, PEEP_FLAGS_NONE }, // NEGC/NEGNC
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|4,   PEEP_OP_MATCH|1, PEEP_FLAGS_P2},
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|2, PEEP_OP_MATCH|4, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|5,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    // There may be a NEG here
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// Fuse signed remainder+quotient (constant dividend, negative)
-static PeepholePattern pat_qdiv_qdiv_signed4[] = {
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|0,   PEEP_OP_SET|1,   PEEP_FLAGS_P2},
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_SET|2,   PEEP_OP_MATCH|0,   PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|3,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_NEG,   OPERAND_ANY,     PEEP_OP_MATCH|3, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|4,   PEEP_OP_MATCH|1, PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|2, PEEP_OP_MATCH|4, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|5,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    // NEGC/NEGNC here, but we don't really care if it's actually there
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-// Fuse signed remainder+quotient (constant dividend, positive)
-static PeepholePattern pat_qdiv_qdiv_signed5[] = {
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|0,   PEEP_OP_SET|1,   PEEP_FLAGS_P2},
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_SET|2,   PEEP_OP_MATCH|0,   PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQY, PEEP_OP_SET|3,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_ABS,   PEEP_OP_SET|4,   PEEP_OP_MATCH|1, PEEP_FLAGS_P2 | PEEP_FLAGS_MUST_WC | PEEP_FLAGS_WCZ_OK },
-    { COND_TRUE, OPC_QDIV,  PEEP_OP_MATCH|2, PEEP_OP_MATCH|4, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_GETQX, PEEP_OP_SET|5,   OPERAND_ANY,     PEEP_FLAGS_NONE },
-    // There may be a NEG here
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// jmp conditional followed by jmp uncoditional to same place may be elided */
-static PeepholePattern pat_jmp_jmp[] = {
-    { COND_ANY, OPC_JUMP, PEEP_OP_SET|0, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_JUMP, PEEP_OP_MATCH|0, OPERAND_ANY, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
 /* delete "arg" instructions */
 static int FixupDeleteInstr(int arg, IRList *irl, IR *ir) {
     IR *next_ir;
@@ -700,12 +191,6 @@ static int FixupDeleteInstr(int arg, IRList *irl, IR *ir) {
 
 
 // convert mov x, #255; and x, y  to getbyte x, y, #0
-static PeepholePattern pat_mov255_and[] = {
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|0, PEEP_OP_IMM|255, PEEP_FLAGS_P2 },
-    { COND_TRUE, OPC_AND, PEEP_OP_MATCH|0, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
 static int FixupMov255And(int arg, IRList *irl, IR *ir) {
     IR *next_ir = ir->next;
     DeleteIR(irl, ir);
@@ -1167,25 +652,7 @@ static int FixupQdivSigned3(int arg, IRList *irl, IR *ir0)
 //   muxq orig_0, val_2
 //
 
-static PeepholePattern pat_mux_qmux_1p[] = {
-    { COND_ANY, OPC_AND, PEEP_OP_SET|2, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|3, PEEP_OP_SET|0, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_ANDN, PEEP_OP_MATCH|3, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_OR, PEEP_OP_MATCH|3, PEEP_OP_MATCH_DEAD|2, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH_DEAD|3, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-static PeepholePattern pat_mux_qmux_2p[] = {
-    { COND_ANY, OPC_MOV, PEEP_OP_SET|3, PEEP_OP_SET|0, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_AND, PEEP_OP_SET|2, PEEP_OP_SET|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_ANDN, PEEP_OP_MATCH|3, PEEP_OP_MATCH|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_OR, PEEP_OP_MATCH|3, PEEP_OP_MATCH_DEAD|2, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_MOV, PEEP_OP_MATCH|0, PEEP_OP_MATCH_DEAD|3, PEEP_FLAGS_P2 },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-// "arg" indicates which of the patterns above matched
+// "arg" indicates which of the mux_qmux patterns in asm_peep.pat matched
 static int FixupQMux(int arg, IRList *irl, IR *ir)
 {
     IR *andir, *andnotir, *orir;
@@ -1235,27 +702,6 @@ static int FixupQMux(int arg, IRList *irl, IR *ir)
 /*
  * sign extend followed by AND, GETBYTE, or GETWORD is sometimes redundant
  */
-static PeepholePattern pat_shl_shr_and[] = {
-    { COND_ANY, OPC_SHL,   PEEP_OP_SET|0, PEEP_OP_SET_IMM|1, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_SAR,   PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_AND,   PEEP_OP_MATCH|0, PEEP_OP_SET_IMM|2, PEEP_FLAGS_NONE },
-
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-static PeepholePattern pat_signx_and[] = {
-    { COND_ANY, OPC_SIGNX, PEEP_OP_SET|0, PEEP_OP_SET_IMM|1, PEEP_FLAGS_P2 },
-    { COND_ANY, OPC_AND,   PEEP_OP_MATCH|0, PEEP_OP_SET_IMM|2, PEEP_FLAGS_P2 },
-
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
-/* AND x, #255; wrbyte x, y : we can delete the AND if x is dead after */
-static PeepholePattern pat_and_wrbyte[] = {
-    { COND_ANY, OPC_AND,   PEEP_OP_SET|0, PEEP_OP_IMM|255, PEEP_FLAGS_NONE },
-    { COND_ANY, OPC_WRBYTE,PEEP_OP_MATCH_DEAD|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-      
 static int FixupShlShrAndImm(int arg, IRList *irl, IR *ir0)
 {
     IR *ir1, *ir2;
@@ -1300,13 +746,6 @@ static int FixupSignxAndImm(int arg, IRList *irl, IR *ir0)
 // This happens often enough that it's worth optimizing to
 // mov x, objptr
 // add x, #N
-static PeepholePattern pat_lea_ptr[] = {
-    { COND_TRUE, OPC_ADD, PEEP_OP_SET|0, PEEP_OP_SET|1, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_MOV, PEEP_OP_SET|2, PEEP_OP_MATCH|0, PEEP_FLAGS_NONE },
-    { COND_TRUE, OPC_SUB, PEEP_OP_MATCH|0, PEEP_OP_MATCH|1, PEEP_FLAGS_NONE },
-    { 0, 0, 0, 0, PEEP_FLAGS_DONE }
-};
-
 static int FixupLeaPtr(int arg, IRList *irl, IR *ir) {
     IR *next_ir = NextIR(ir);
     IR *last_ir = NextIR(next_ir);
@@ -1319,135 +758,30 @@ static int FixupLeaPtr(int arg, IRList *irl, IR *ir) {
 }
 
 /*
- * the actual list of peepholes
+ * the actual list of peepholes is generated by mkpeep from asm_peep.pat
  */
 
 struct Peepholes {
     PeepholePattern *check;
     int arg;
     int (*replace)(int arg, IRList *irl, IR *ir);
-} peep2[] = {
-    { pat_maxs, OPC_MAXS, ReplaceMaxMin },
-    { pat_maxu, OPC_MAXU, ReplaceMaxMin },
-    { pat_mins, OPC_MINS, ReplaceMaxMin },
-    { pat_minu, OPC_MINU, ReplaceMaxMin },
-    { pat_maxs_off, OPC_MAXS, ReplaceMaxMin },
-    { pat_maxu_off, OPC_MAXU, ReplaceMaxMin },
-
-    { pat_zeroex, OPC_ZEROX, ReplaceExtend },
-    { pat_signex, OPC_SIGNX, ReplaceExtend },
-
-    { pat_signx_and, 0, FixupSignxAndImm },
-    { pat_shl_shr_and, 0, FixupShlShrAndImm },
-
-    { pat_and_wrbyte, 1, FixupDeleteInstr },
-    
-    { pat_drvc1, OPC_DRVC, ReplaceDrvc },
-    { pat_drvc2, OPC_DRVC, ReplaceDrvc },
-    { pat_drvnc1, OPC_DRVNC, ReplaceDrvc },
-    { pat_drvnc2, OPC_DRVNC, ReplaceDrvc },
-    { pat_bitc1, OPC_BITC, ReplaceDrvc },
-    { pat_bitc2, OPC_BITC, ReplaceDrvc },
-    { pat_bitnc1, OPC_BITNC, ReplaceDrvc },
-    { pat_bitnc2, OPC_BITNC, ReplaceDrvc },
-    { pat_drvz, OPC_DRVZ, ReplaceDrvc },
-    { pat_drvnz1, OPC_DRVNZ, ReplaceDrvc },
-    { pat_drvnz2, OPC_DRVNZ, ReplaceDrvc },
-
-    { pat_negc1, OPC_NEGC, ReplaceDrvc },
-    { pat_negc2, OPC_NEGC, ReplaceDrvc },
-    { pat_negnc1, OPC_NEGNC, ReplaceDrvc },
-    { pat_negnc2, OPC_NEGNC, ReplaceDrvc },
-    { pat_negz1, OPC_NEGZ, ReplaceDrvc },
-    { pat_negz2, OPC_NEGZ, ReplaceDrvc },
-    { pat_negnz1, OPC_NEGNZ, ReplaceDrvc },
-    { pat_negnz2, OPC_NEGNZ, ReplaceDrvc },
-
-    { pat_sumc1, OPC_SUMC, ReplaceDrvc },
-    { pat_sumc2, OPC_SUMC, ReplaceDrvc },
-    { pat_sumnc1, OPC_SUMNC, ReplaceDrvc },
-    { pat_sumnc2, OPC_SUMNC, ReplaceDrvc },
-    { pat_sumz1, OPC_SUMZ, ReplaceDrvc },
-    { pat_sumz2, OPC_SUMZ, ReplaceDrvc },
-    { pat_sumnz1, OPC_SUMNZ, ReplaceDrvc },
-    { pat_sumnz2, OPC_SUMNZ, ReplaceDrvc },
-
-    { pat_not, 0, ReplaceNot},
-
-    { pat_cmps_abs, 0, ReplaceCmpsAbs},
-
-    { pat_wrc_cmp, 0, ReplaceWrcCmp },
-    { pat_wrc_and, 1, RemoveNFlagged },
-    { pat_wrc_test, 0, ReplaceWrcTest },
-
-    { pat_muxc_cmp, 0, ReplaceWrcCmp },
-    { pat_subx_cmp, 0, ReplaceWrcCmp },
-    { pat_muxc_wz, 1, ReplaceWrcCmp },
-
-    { pat_rdbyte1, 2, RemoveNFlagged },
-    { pat_rdword1, 2, RemoveNFlagged },
-    { pat_rdbyte2, 1, RemoveNFlagged },
-    { pat_rdword2, 1, RemoveNFlagged },
-
-    { pat_movadd, 0, FixupMovAdd },
-
-    { pat_bmask1, 0, FixupBmask },
-    { pat_bmask2, 0, FixupBmask },
-
-    { pat_waitx, 0, FixupWaitx },
-
-    { pat_seteq, OPC_WRZ, FixupEq },
-    { pat_setne, OPC_WRNZ, FixupEq },
-#if 0
-    { pat_sar24getbyte, OPC_GETBYTE, FixupGetByteWord },
-    { pat_shr24getbyte, OPC_GETBYTE, FixupGetByteWord },
-    { pat_sar16getbyte, OPC_GETBYTE, FixupGetByteWord },
-    { pat_shr16getbyte, OPC_GETBYTE, FixupGetByteWord },
-    { pat_sar8getbyte, OPC_GETBYTE, FixupGetByteWord },
-    { pat_shr8getbyte, OPC_GETBYTE, FixupGetByteWord },
-
-    { pat_sar16getword, OPC_GETWORD, FixupGetByteWord },
-    { pat_shr16getword, OPC_GETWORD, FixupGetByteWord },
-#endif
-    { pat_shl8setbyte, OPC_SETBYTE, FixupSetByteWord },
-    { pat_shl16setbyte, OPC_SETBYTE, FixupSetByteWord },
-    { pat_shl24setbyte, OPC_SETBYTE, FixupSetByteWord },
-
-    { pat_shl16setword, OPC_SETWORD, FixupSetByteWord },
-
-    { pat_clrc, 0, FixupClrC },
-    { pat_setc1, 0, FixupSetC },
-    { pat_setc2, 0, FixupSetC },
-
-    { pat_mov_and_add, 0, FixupAndAdd },
-
-    { pat_qmul_qmul1, 0, FixupQmuls },
-    { pat_qmul_qmul2, 0, FixupQmuls },
-    { pat_qdiv_qdiv1, 0, FixupQmuls },
-    { pat_qdiv_qdiv2, 0, FixupQmuls },
-
-    { pat_qdiv_qdiv_signed1, 0, FixupQdivSigned},
-    { pat_qdiv_qdiv_signed2, 0, FixupQdivSigned},
-    { pat_qdiv_qdiv_signed3, 0, FixupQdivSigned2},
-    { pat_qdiv_qdiv_signed4, 0, FixupQdivSigned2},
-    { pat_qdiv_qdiv_signed5, 0, FixupQdivSigned3},
-
-    { pat_mux_qmux_1p, 1, FixupQMux },
-    { pat_mux_qmux_2p, 2, FixupQMux },
-
-    { pat_jmp_jmp, 1, FixupDeleteInstr },
-
-    { pat_mov255_and, 1, FixupMov255And },
-
-    { pat_lea_ptr, 0, FixupLeaPtr },
 };
 
+// opcode of the instruction after ir, for Peep2Candidates
+static int Peep2NextOpc(IR *ir)
+{
+    IR *next = NextIR(ir);
+    return next ? (int)next->opc : OPC_ANY;
+}
+
+#include "asm_peep_pat.h"
 
 int OptimizePeephole2(IRList *irl)
 {
     IR *ir;
     int change = 0;
     int i, r;
+    const short *cand;
 
     ir = irl->head;
     for(;;) {
@@ -1456,7 +790,10 @@ int OptimizePeephole2(IRList *irl)
         }
         if (!ir) break;
         if (!InstrIsVolatile(ir)) {
-            for (i = 0; i < sizeof(peep2) / sizeof(peep2[0]); i++) {
+            // only the patterns which start with this opcode (and
+            // the next one) can match here
+            for (cand = Peep2Candidates(ir); cand && *cand >= 0; cand++) {
+                i = *cand;
                 r = MatchPattern(peep2[i].check, ir);
                 if (r) {
                     r = (*peep2[i].replace)(peep2[i].arg, irl, ir);
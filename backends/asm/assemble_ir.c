@@ -29,6 +29,7 @@
 #include "becommon.h"
 #include "outasm.h"
 #include <ctype.h>
+#include <stdlib.h>
 
 // used for converting Spin relative addresses to absolute addresses
 // (only needed for OUTPUT_COGSPIN)
@@ -374,71 +375,114 @@ PrintOperandAsValue(struct flexbuf *fb, Operand *reg)
     }
 }
 
-static void
-PrintCond(struct flexbuf *fb, IRCond cond)
+/* name of the P2 condition prefix for "cond", or NULL if there is none */
+static const char *
+CondName(IRCond cond)
 {
     switch (cond) {
-    case COND_TRUE:
-        break;
     case COND_EQ:
-        flexbuf_addstr(fb, " if_e");
-        break;
+        return "if_e";
     case COND_NE:
-        flexbuf_addstr(fb, " if_ne");
-        break;
+        return "if_ne";
     case COND_LT:
-        flexbuf_addstr(fb, " if_b");
-        break;
+        return "if_b";
     case COND_GE:
-        flexbuf_addstr(fb, " if_ae");
-        break;
+        return "if_ae";
     case COND_GT:
-        flexbuf_addstr(fb, " if_a");
-        break;
+        return "if_a";
     case COND_LE:
-        flexbuf_addstr(fb, " if_be");
-        break;
+        return "if_be";
     // case COND_C:
-    //   flexbuf_addstr(fb, " if_c");
-    //   break;
+    //   return "if_c";
     // case COND_NC:
-    //   flexbuf_addstr(fb, " if_nc");
-    //   break;
+    //   return "if_nc";
     // case COND_NC_AND_NZ:
-    //   flexbuf_addstr(fb, " if_nc_and_nz");
-    //   break;
+    //   return "if_nc_and_nz";
     case COND_NC_AND_Z:
-        flexbuf_addstr(fb, " if_nc_and_z");
-        break;
+        return "if_nc_and_z";
     case COND_C_AND_NZ:
-        flexbuf_addstr(fb, " if_c_and_nz");
-        break;
+        return "if_c_and_nz";
     case COND_C_AND_Z:
-        flexbuf_addstr(fb, " if_c_and_z");
-        break;
+        return "if_c_and_z";
     case COND_C_OR_NZ:
-        flexbuf_addstr(fb, " if_c_or_nz");
-        break;
+        return "if_c_or_nz";
     case COND_NC_OR_NZ:
-        flexbuf_addstr(fb, " if_nc_or_nz");
-        break;
+        return "if_nc_or_nz";
     case COND_NC_OR_Z:
-        flexbuf_addstr(fb, " if_nc_or_z");
-        break;
+        return "if_nc_or_z";
     case COND_C_EQ_Z:
-        flexbuf_addstr(fb, " if_c_eq_z");
-        break;
+        return "if_c_eq_z";
     case COND_C_NE_Z:
-        flexbuf_addstr(fb, " if_c_ne_z");
-        break;
+        return "if_c_ne_z";
     default:
-        ERROR(NULL, "Internal error, unexpected condition");
-        flexbuf_addstr(fb, " if_??");
-        break;
+        return NULL;
+    }
+}
+
+static void
+PrintCond(struct flexbuf *fb, IRCond cond)
+{
+    const char *name;
+
+    if (cond != COND_TRUE) {
+        name = CondName(cond);
+        if (name) {
+            flexbuf_printf(fb, " %s", name);
+        } else {
+            ERROR(NULL, "Internal error, unexpected condition");
+            flexbuf_addstr(fb, " if_??");
+        }
     }
     flexbuf_addchar(fb, '\t');
 }
 
+/*
+ * find the names of the flag modifiers (wc, wz, and so on) that
+ * "flags" asks for; returns how many were placed in names[]
+ */
+#define MAX_FLAG_NAMES 3
+
+static int
+FlagNames(unsigned flags, const char *names[MAX_FLAG_NAMES])
+{
+    unsigned ccset = flags & (FLAG_WC|FLAG_WZ|FLAG_NR|FLAG_WR|FLAG_WCZ|FLAG_ANDC|FLAG_ANDZ|FLAG_ORC|FLAG_ORZ|FLAG_XORC|FLAG_XORZ);
+    int n = 0;
+
+    if (!ccset) {
+        return 0;
+    }
+    if (gl_p2 && ((FLAG_WC|FLAG_WZ) == (ccset & (FLAG_WC|FLAG_WZ)))) {
+        names[n++] = "wcz";
+    } else {
+        if (ccset & FLAG_WC) {
+            names[n++] = "wc";
+        }
+        if (ccset & FLAG_WZ) {
+            names[n++] = "wz";
+        }
+    }
+    if (ccset & FLAG_NR) {
+        names[n++] = "nr";
+    } else if (ccset & FLAG_WR) {
+        names[n++] = "wr";
+    } else if (ccset & FLAG_WCZ) {
+        names[n++] = "wcz";
+    } else if (ccset & FLAG_ANDC) {
+        names[n++] = "andc";
+    } else if (ccset & FLAG_ANDZ) {
+        names[n++] = "andz";
+    } else if (ccset & FLAG_ORC) {
+        names[n++] = "orc";
+    } else if (ccset & FLAG_ORZ) {
+        names[n++] = "orz";
+    } else if (ccset & FLAG_XORC) {
+        names[n++] = "xorc";
+    } else if (ccset & FLAG_XORZ) {
+        names[n++] = "xorz";
+    }
+    return n;
+}
+
 static uint32_t
 fetchUint32(uint8_t *data)
 {
@@ -1288,7 +1332,8 @@ DoAssembleIR(struct flexbuf *fb, IR *ir, Module *P)
     }
 
     if (ir->instr) {
-        int ccset;
+        const char *flagnames[MAX_FLAG_NAMES];
+        int nflags, i;
 
         if (ir->cond == COND_FALSE) {
             flexbuf_addstr(fb, "\tnop\n");
@@ -1345,41 +1390,9 @@ DoAssembleIR(struct flexbuf *fb, IR *ir, Module *P)
             }
             break;
         }
-        ccset = ir->flags & (FLAG_WC|FLAG_WZ|FLAG_NR|FLAG_WR|FLAG_WCZ|FLAG_ANDC|FLAG_ANDZ|FLAG_ORC|FLAG_ORZ|FLAG_XORC|FLAG_XORZ);
-        if (ccset) {
-            const char *sepstring = " ";
-            if (gl_p2 && ((FLAG_WC|FLAG_WZ) == (ccset & (FLAG_WC|FLAG_WZ)))) {
-                flexbuf_printf(fb, "%swcz", sepstring);
-                sepstring = ",";
-            } else {
-                if (ccset & FLAG_WC) {
-                    flexbuf_printf(fb, "%swc", sepstring);
-                    sepstring = ",";
-                }
-                if (ccset & FLAG_WZ) {
-                    flexbuf_printf(fb, "%swz", sepstring);
-                    sepstring = ",";
-                }
-            }
-            if (ccset & FLAG_NR) {
-                flexbuf_printf(fb, "%snr", sepstring);
-            } else if (ccset & FLAG_WR) {
-                flexbuf_printf(fb, "%swr", sepstring);
-            } else if (ccset & FLAG_WCZ) {
-                flexbuf_printf(fb, "%swcz", sepstring);
-            } else if (ccset & FLAG_ANDC) {
-                flexbuf_printf(fb, "%sandc", sepstring);
-            } else if (ccset & FLAG_ANDZ) {
-                flexbuf_printf(fb, "%sandz", sepstring);
-            } else if (ccset & FLAG_ORC) {
-                flexbuf_printf(fb, "%sorc", sepstring);
-            } else if (ccset & FLAG_ORZ) {
-                flexbuf_printf(fb, "%sorz", sepstring);
-            } else if (ccset & FLAG_XORC) {
-                flexbuf_printf(fb, "%sxorc", sepstring);
-            } else if (ccset & FLAG_XORZ) {
-                flexbuf_printf(fb, "%sxorz", sepstring);
-            }
+        nflags = FlagNames(ir->flags, flagnames);
+        for (i = 0; i < nflags; i++) {
+            flexbuf_printf(fb, "%s%s", i ? "," : " ", flagnames[i]);
         }
 #if 0
         if (ir->flags & FLAG_KEEP_INSTR) {
@@ -1531,13 +1544,26 @@ RenameLabels(IRList *list)
     }
 }
 
-/* assemble an IR list */
+/*
+ * where the text for one IR went, for IRBuildDat
+ */
+typedef struct IRLines {
+    IR *ir;
+    size_t start;        /* offset of its text */
+    int lines;           /* number of newlines in its text */
+    int inDat;           /* 1 if it was printed inside a DAT section */
+} IRLines;
+
+/* assemble an IR list; if irlines is non-NULL, record an IRLines for each IR in it */
 static char *
-doIRAssemble(IRList *list, Module *P, int flags)
+doIRAssemble(IRList *list, Module *P, int flags, Flexbuf *irlines)
 {
     IR *ir;
     struct flexbuf fb;
     char *ret;
+    IRLines rec;
+    const char *text;
+    size_t i;
 
     inDat = 0;
     inCon = 0;
@@ -1553,6 +1579,9 @@ doIRAssemble(IRList *list, Module *P, int flags)
     }
     flexbuf_init(&fb, 512);
     for (ir = list->head; ir; ir = ir->next) {
+        rec.ir = ir;
+        rec.start = flexbuf_curlen(&fb);
+        rec.inDat = inDat;
         if (flags && (0 != (ir->flags & FLAG_KEEP_INSTR))) {
             flexbuf_printf(&fb, "*");
         }
@@ -1563,6 +1592,14 @@ doIRAssemble(IRList *list, Module *P, int flags)
                 pending_fixup = 0;
             }
         }
+        if (irlines) {
+            text = flexbuf_peek(&fb);
+            rec.lines = 0;
+            for (i = rec.start; i < flexbuf_curlen(&fb); i++) {
+                rec.lines += (text[i] == '\n');
+            }
+            flexbuf_addmem(irlines, (char *)&rec, sizeof(rec));
+        }
     }
     if (gl_output == OUTPUT_COGSPIN) {
         flexbuf_printf(&fb, "__fixup_ptr\n\tlong\t");
@@ -1581,7 +1618,712 @@ doIRAssemble(IRList *list, Module *P, int flags)
 char *
 IRAssemble(IRList *list, Module *P)
 {
-    return doIRAssemble(list, P, 0);
+    return doIRAssemble(list, P, 0, NULL);
+}
+
+/*
+ * like IRAssemble, but also note in irlines where the text for each
+ * IR went, so that IRBuildDat can later build the DAT section from it
+ */
+char *
+IRAssembleLines(IRList *list, Module *P, Flexbuf *irlines)
+{
+    return doIRAssemble(list, P, 0, irlines);
+}
+
+/*
+ * Building the assembler's DAT section straight from the IR
+ *
+ * On P2 the text IRAssemble produces used to be handed back to the
+ * Spin parser to be turned into a DAT section again. IRBuildDat
+ * instead builds the DAT entries the parser would have made for each
+ * line, from the IR that printed the line, which saves lexing and
+ * parsing the whole program a second time. Only what we do not build
+ * (the header, CON declarations, OPC_LITERAL blocks, binary blobs and
+ * a few rare forms) is parsed from its text, a run of lines at a time.
+ * The entries all refer to lines of the text, so listings and error
+ * messages come out as before.
+ */
+
+typedef struct DatBuilder {
+    Module *Q;           /* module being built */
+    LexStream *L;        /* stream the DAT entries refer to */
+    const char *text;    /* assembly text */
+    const char *lastGlobal; /* last global label seen */
+    size_t pending;      /* start of text not yet made into DAT entries */
+    int pendingLine;     /* line number of that text */
+    int pendingDat;      /* 1 if that text is in a DAT section */
+} DatBuilder;
+
+/* set when something on the current line cannot be built */
+static int datFailed;
+
+/*
+ * what the lexer makes of a name as printed (so with any ` quotes);
+ * "instr" is set at the start of a line, where instruction names are
+ * recognized
+ */
+static AST *
+DatWord(const char *printed, int instr)
+{
+    char buf[MAX_BUF];
+    AST *ast;
+    int i = 0;
+
+    while (*printed && i < MAX_BUF-1) {
+        if (*printed == '`' && printed[1]) {
+            printed++;
+        }
+        buf[i++] = *printed++;
+    }
+    buf[i] = 0;
+    ast = *printed ? NULL : PasmWordAST(buf, instr);
+    if (!ast) {
+        datFailed = 1;
+        ast = AstInteger(0);
+    }
+    return ast;
+}
+
+/* a name in an operand: an identifier or a hardware register */
+static AST *
+DatName(const char *printed)
+{
+    AST *ast = DatWord(printed, 0);
+
+    if (ast->kind != AST_IDENTIFIER && ast->kind != AST_HWREG) {
+        datFailed = 1;
+    }
+    return ast;
+}
+
+/* an integer, as written by "%d" */
+static AST *
+DatInteger(int32_t val)
+{
+    if (val < 0) {
+        return AstOperator(K_NEGATE, NULL, AstInteger(-(int64_t)val));
+    }
+    return AstInteger(val);
+}
+
+/* "@expr": the @ binds tighter than any of our + or - offsets */
+static AST *
+DatAddrOf(AST *expr)
+{
+    return NewAST(AST_ADDROF, expr, NULL);
+}
+
+/* "#expr", "##expr", or with "abs" set "#\expr" */
+static AST *
+DatImmediate(AST *expr, int big, int abs)
+{
+    if (abs) {
+        expr = NewAST(AST_CATCH, expr, NULL);
+    }
+    return NewAST(big ? AST_BIGIMMHOLDER : AST_IMMHOLDER, expr, NULL);
+}
+
+/*
+ * the expression doPrintOperand prints for an operand, or NULL if
+ * it is one we do not build directly
+ */
+static AST *
+DatOperand(Operand *reg, int useimm, enum OperandEffect effect_orig, int maximm)
+{
+    const char *regname;
+    int usehubaddr;
+    int useabsaddr;
+    int opoffset;
+    int skipimm;
+    int addDummyZero;
+    unsigned effect = (unsigned)effect_orig;
+    AST *expr;
+
+    opoffset = ((int)effect) >> OPEFFECT_OFFSET_SHIFT;
+    effect &= ~(OPEFFECT_OFFSET_MASK);
+    skipimm = ((int)effect) & OPEFFECT_NOIMM;
+    effect &= ~(OPEFFECT_NOIMM);
+    usehubaddr = effect & OPEFFECT_FORCEHUB;
+    effect &= ~(OPEFFECT_FORCEHUB);
+    addDummyZero = effect & OPEFFECT_DUMMY_ZERO;
+    effect &= ~(OPEFFECT_DUMMY_ZERO);
+    useabsaddr = effect & OPEFFECT_FORCEABS;
+    effect &= ~OPEFFECT_FORCEABS;
+
+    if (!reg) {
+        return NULL;
+    }
+    if (effect != OPEFFECT_NONE && reg->kind != REG_HW) {
+        return NULL;
+    }
+    switch (reg->kind) {
+    case IMM_INT:
+        if (reg->name && reg->name[0]) {
+            expr = DatName(RemappedName(reg->name));
+        } else {
+            expr = DatInteger((int32_t)reg->val);
+        }
+        if (addDummyZero) {
+            expr = AstOperator('-', expr, AstInteger(0));
+        }
+        if (useabsaddr || (maximm < 0) || (reg->val >= 0 && reg->val <= maximm)) {
+            return DatImmediate(expr, 0, useabsaddr);
+        }
+        return DatImmediate(expr, 1, 0);
+    case HUBMEM_REF:
+    case COGMEM_REF:
+    {
+        Operand *regptr = (Operand *)reg->name;
+        if (!useimm || !regptr || regptr->kind != REG_HUBPTR) {
+            return NULL;
+        }
+        regptr = (Operand *)regptr->val;
+        expr = DatAddrOf(DatName(regptr->name));
+        expr = AstOperator('+', expr, DatInteger((int32_t)reg->val));
+        return DatImmediate(expr, 0, 0);
+    }
+    case STRING_DEF:
+        if (!useimm) {
+            return NULL;
+        }
+        return DatImmediate(DatAddrOf(DatName(RemappedName(reg->name))), 1, useabsaddr);
+    case IMM_HUB_LABEL:
+        expr = DatName(RemappedName(reg->name));
+        if (!useimm) {
+            return expr;
+        }
+        if (useabsaddr) {
+            expr = DatAddrOf(expr);
+        }
+        return DatImmediate(expr, 0, useabsaddr);
+    default:
+        if (!useabsaddr) {
+            useimm = 0;
+        }
+    /* fall through */
+    case IMM_COG_LABEL:
+        useimm = useimm && !skipimm;
+        if (reg->kind == REG_SUBREG) {
+            regname = OffsetName( ((Operand *)reg->name)->name, reg->val );
+        } else {
+            regname = reg->name;
+        }
+        expr = DatName(RemappedName(regname));
+        if (useimm && usehubaddr) {
+            expr = DatAddrOf(expr);
+        }
+        if ( (reg->kind == REG_HW || reg->kind == IMM_COG_LABEL) && ( (reg->val != 0) || addDummyZero ) ) {
+            int32_t off = reg->val;
+            if (effect != OPEFFECT_NONE || opoffset) {
+                return NULL;
+            }
+            if (off < 0 || (off == 0) ) {
+                expr = AstOperator('-', expr, DatInteger(-off));
+            } else {
+                expr = AstOperator('+', expr, DatInteger(off));
+            }
+        } else if (addDummyZero) {
+            if (effect != OPEFFECT_NONE || opoffset) {
+                return NULL;
+            }
+            expr = AstOperator('-', expr, AstInteger(0));
+        }
+        if (opoffset && effect != OPEFFECT_POSTINC && effect != OPEFFECT_POSTDEC) {
+            // ptra[N] is parsed as a range reference of the register
+            if (expr->kind != AST_HWREG) {
+                return NULL;
+            }
+            expr = NewAST(AST_RANGEREF, expr, NewAST(AST_RANGE, DatInteger(opoffset), NULL));
+            if (opoffset > 31 || opoffset < -32) {
+                expr = NewAST(AST_BIGIMMHOLDER, expr, NULL);
+            }
+        }
+        if (effect == OPEFFECT_PREINC) {
+            expr = AstOperator(K_INCREMENT, NULL, expr);
+        } else if (effect == OPEFFECT_PREDEC) {
+            expr = AstOperator(K_DECREMENT, NULL, expr);
+        } else if (effect == OPEFFECT_POSTINC) {
+            expr = AstOperator(K_INCREMENT, expr, NULL);
+        } else if (effect == OPEFFECT_POSTDEC) {
+            expr = AstOperator(K_DECREMENT, expr, NULL);
+        }
+        if (useimm) {
+            expr = DatImmediate(expr, 0, useabsaddr);
+        }
+        return expr;
+    }
+}
+
+/* the expression PrintOperandAsValue prints, or NULL */
+static AST *
+DatValue(Operand *reg)
+{
+    switch (reg->kind) {
+    case IMM_INT:
+        return DatInteger((int32_t)reg->val);
+    case IMM_HUB_LABEL:
+    case STRING_DEF:
+        return DatAddrOf(DatName(RemappedName(reg->name)));
+    case IMM_COG_LABEL:
+        return DatName(RemappedName(reg->name));
+    case IMM_STRING:
+        return NULL;
+    case REG_HUBPTR:
+    case REG_COGPTR:
+        return DatName(RemappedName(((Operand *)reg->val)->name));
+    default:
+        return DatOperand(reg, 0, OPEFFECT_NONE, 511);
+    }
+}
+
+/* the list of data items PrintOperandAsValue prints for a string */
+static AST *
+DatStringList(const char *s)
+{
+    AST *list = NULL;
+    AST *item;
+    const char *run = NULL;
+    char *str;
+    int c;
+
+    for (;;) {
+        c = *s++;
+        if (run && (c == 0 || c < 0x20 || c >= 0x7f || c == '\"')) {
+            str = AstStrdup(run);
+            str[s - 1 - run] = 0;
+            item = NewAST(AST_STRING, NULL, NULL);
+            item->d.string = str;
+            list = AddToList(list, NewAST(AST_EXPRLIST, item, NULL));
+            run = NULL;
+        }
+        if (c == 0) {
+            break;
+        }
+        if (c < 0x20 || c >= 0x7f || c == '\"') {
+            list = AddToList(list, NewAST(AST_EXPRLIST, DatInteger(c), NULL));
+        } else if (!run) {
+            run = s - 1;
+        }
+    }
+    return list;
+}
+
+/* add an operand to an instruction */
+static int
+DatAddOperand(AST *instr, AST *expr)
+{
+    if (!expr) {
+        return 0;
+    }
+    AddToList(instr, NewAST(AST_EXPRLIST, expr, NULL));
+    return 1;
+}
+
+/* the instruction "name" with the condition "cond" */
+static AST *
+DatInstr(const char *name, IRCond cond)
+{
+    AST *instr = PasmWordAST(name, 1);
+    AST *mod;
+
+    if (!instr || instr->kind != AST_INSTR) {
+        return NULL;
+    }
+    if (cond != COND_TRUE) {
+        name = CondName(cond);
+        mod = name ? PasmWordAST(name, 0) : NULL;
+        if (!mod || mod->kind != AST_INSTRMODIFIER) {
+            return NULL;
+        }
+        AddToList(instr, mod);
+    }
+    return instr;
+}
+
+/*
+ * the DAT entry for a line DoAssembleIR printed for an instruction
+ * (as an AST_INSTRHOLDER), or NULL
+ */
+static AST *
+DatInstrLine(IR *ir)
+{
+    const char *flagnames[MAX_FLAG_NAMES];
+    int nflags, i;
+    AST *instr;
+    AST *mod;
+    AST *op;
+
+    if (ir->cond == COND_FALSE) {
+        instr = DatInstr("nop", COND_TRUE);
+        return instr ? NewAST(AST_INSTRHOLDER, instr, NULL) : NULL;
+    }
+    instr = DatInstr(ir->instr->name, ir->cond);
+    if (!instr) {
+        return NULL;
+    }
+    switch (ir->instr->ops) {
+    case NO_OPERANDS:
+        break;
+    case P2_JUMP:
+        if (!DatAddOperand(instr, DatOperand(ir->dst, 1, ir->dsteffect, -1))) {
+            return NULL;
+        }
+        break;
+    case JMP_OPERAND:
+    case SRC_OPERAND_ONLY:
+    case DST_OPERAND_ONLY:
+    case CALL_OPERAND:
+    case P2_JINT_OPERANDS:
+    case P2_DST_CONST_OK:
+        if (!DatAddOperand(instr, DatOperand(ir->dst, 1, ir->dsteffect, 511))) {
+            return NULL;
+        }
+        break;
+    default:
+        if (ir->instr->ops == P2_RDWR_OPERANDS || (ir->dsteffect & OPEFFECT_DUMMY_ZERO) ) {
+            op = DatOperand(ir->dst, 1, ir->dsteffect, 511);
+        } else {
+            op = DatOperand(ir->dst, 0, OPEFFECT_NONE, 511);
+        }
+        if (op && ir->opc == OPC_REPEAT && ir->dst->kind != IMM_INT) {
+            if (op->kind != AST_IDENTIFIER) {
+                return NULL;
+            }
+            op = DatAddrOf(op);
+        }
+        if (!DatAddOperand(instr, op)) {
+            return NULL;
+        }
+        if (ir->src) {
+            if (ir->instr->ops == P2_RDWR_OPERANDS) {
+                op = DatOperand(ir->src, 1, ir->srceffect, 255);
+            } else {
+                op = DatOperand(ir->src, 1, ir->srceffect, 511);
+            }
+            if (!DatAddOperand(instr, op)) {
+                return NULL;
+            }
+        }
+        if (ir->src2) {
+            if (!DatAddOperand(instr, DatOperand(ir->src2, 1, OPEFFECT_NONE, 511))) {
+                return NULL;
+            }
+        }
+        break;
+    }
+    nflags = FlagNames(ir->flags, flagnames);
+    for (i = 0; i < nflags; i++) {
+        mod = PasmWordAST(flagnames[i], 0);
+        if (!mod || mod->kind != AST_INSTRMODIFIER) {
+            return NULL;
+        }
+        AddToList(instr, mod);
+    }
+    return NewAST(AST_INSTRHOLDER, instr, NULL);
+}
+
+/*
+ * the DAT entry for the single line DoAssembleIR printed for "ir", or
+ * NULL if we should parse the line instead; *skip is set if the line
+ * needs no entry at all
+ */
+static AST *
+DatLineForIR(DatBuilder *B, IR *ir, int *skip)
+{
+    AST *ast = NULL;
+    AST *list;
+    AST *val;
+    AST *instr;
+    const char *s;
+    enum astkind kind;
+
+    *skip = 0;
+    datFailed = 0;
+    if (ir->instr) {
+        ast = DatInstrLine(ir);
+    } else {
+        switch (ir->opc) {
+        case OPC_COMMENT:
+        case OPC_LIVE:
+        case OPC_DUMMY:
+        case OPC_REPEAT_END:
+            *skip = 1;
+            return NULL;
+        case OPC_LITERAL:
+            // blank lines are common, and need nothing
+            for (s = ir->dst->name; *s && isspace((unsigned char)*s); s++)
+                ;
+            *skip = (*s == 0);
+            return NULL;
+        case OPC_LABEL:
+        {
+            AST *label = DatWord(RemappedName(ir->dst->name), 1);
+            if (datFailed || label->kind != AST_IDENTIFIER) {
+                return NULL;
+            }
+            B->lastGlobal = label->d.string;
+            label = NewAST(AST_LISTHOLDER, label, NULL);
+            return NewAST(AST_LISTHOLDER, NewAST(AST_LINEBREAK, NULL, NULL), label);
+        }
+        case OPC_RET:
+            instr = DatInstr("ret", COND_TRUE);
+            ast = instr ? NewAST(AST_INSTRHOLDER, instr, NULL) : NULL;
+            break;
+        case OPC_BYTE:
+        case OPC_WORD:
+        case OPC_LONG:
+        case OPC_STRING:
+            kind = (ir->opc == OPC_LONG) ? AST_LONGLIST : (ir->opc == OPC_WORD) ? AST_WORDLIST : AST_BYTELIST;
+            if (ir->dst->kind == IMM_STRING) {
+                if (ir->src) {
+                    return NULL;
+                }
+                list = DatStringList(ir->dst->name);
+            } else {
+                val = DatValue(ir->dst);
+                if (!val) {
+                    return NULL;
+                }
+                if (ir->src) {
+                    AST *count = DatValue(ir->src);
+                    if (!count) {
+                        return NULL;
+                    }
+                    val = NewAST(AST_ARRAYDECL, val, count);
+                }
+                list = NewAST(AST_EXPRLIST, val, NULL);
+            }
+            ast = NewAST(kind, list, NULL);
+            break;
+        case OPC_RESERVE:
+            val = DatValue(ir->dst);
+            ast = val ? NewAST(AST_RES, val, NULL) : NULL;
+            break;
+        case OPC_RESERVEH:
+            val = DatValue(ir->dst);
+            if (val) {
+                val = NewAST(AST_ARRAYDECL, AstInteger(0), val);
+                ast = NewAST(AST_LONGLIST, NewAST(AST_EXPRLIST, val, NULL), NULL);
+            }
+            break;
+        case OPC_ALIGNL:
+            ast = NewAST(AST_LONGLIST, NULL, NULL);
+            break;
+        case OPC_FCACHE:
+            instr = DatInstr("callpa", COND_TRUE);
+            val = DatValue(ir->dst);
+            list = DatValue(ir->src);
+            if (!instr || !val || !list) {
+                return NULL;
+            }
+            val = AstOperator(K_SHR, AstOperator('-', val, list), AstInteger(2));
+            DatAddOperand(instr, DatImmediate(val, 0, 0));
+            DatAddOperand(instr, DatName("fcache_load_ptr_"));
+            ast = NewAST(AST_INSTRHOLDER, instr, NULL);
+            break;
+        case OPC_FIT:
+            val = DatValue(ir->dst);
+            ast = val ? NewAST(AST_FIT, val, NULL) : NULL;
+            break;
+        case OPC_ORG:
+            val = NULL;
+            if (ir->dst) {
+                val = DatValue(ir->dst);
+                if (!val) {
+                    return NULL;
+                }
+            }
+            ast = NewAST(AST_ORG, val, NULL);
+            break;
+        case OPC_ORGF:
+            val = DatValue(ir->dst);
+            ast = val ? NewAST(AST_ORGF, val, NULL) : NULL;
+            break;
+        case OPC_HUBMODE:
+            ast = NewAST(AST_ORGH, NULL, NULL);
+            break;
+        default:
+            return NULL;
+        }
+    }
+    if (!ast || datFailed) {
+        return NULL;
+    }
+    return NewAST(AST_LISTHOLDER, ast, NULL);
+}
+
+/* move the entries made by a fragment parse over to our stream */
+static void
+RebaseLines(AST *ast, LexStream *from, LexStream *to, int offset, int first, int last)
+{
+    int line;
+
+    while (ast && ast->lexdata == from) {
+        line = ast->lineidx + offset;
+        if (line < first) line = first;
+        if (line > last) line = last;
+        ast->lexdata = to;
+        ast->lineidx = line;
+        RebaseLines(ast->left, from, to, offset, first, last);
+        ast = ast->right;
+    }
+}
+
+/* parse the text we could not build directly, up to "end" */
+static void
+FlushDatText(DatBuilder *B, size_t end)
+{
+    const char *text = B->text;
+    const char *prefix = B->pendingDat ? "dat\n" : "";
+    int prefixLines = B->pendingDat ? 1 : 0;
+    int lines = 0;
+    int offset;
+    size_t i, len;
+    char *buf;
+    LexStream *S;
+    AST *datlast = B->Q->datblock_tail;
+    AST *conlast;
+
+    if (end <= B->pending) {
+        return;
+    }
+    for (i = B->pending; i < end; i++) {
+        lines += (text[i] == '\n');
+    }
+    // the lexer keeps pointers into its text, so this is never freed
+    len = strlen(prefix) + (end - B->pending);
+    buf = (char *)malloc(len + 1);
+    strcpy(buf, prefix);
+    memcpy(buf + strlen(prefix), text + B->pending, end - B->pending);
+    buf[len] = 0;
+
+    // find the ends of the lists, to see what the parse adds; the tail
+    // AddToListEx keeps is only the start of the last thing added
+    while (datlast && datlast->right) {
+        datlast = datlast->right;
+    }
+    conlast = B->Q->conblock;
+    while (conlast && conlast->right) {
+        conlast = conlast->right;
+    }
+    S = ParseAsmFragment(buf, len, B->lastGlobal);
+    B->Q->Lptr = B->L;
+    if (S->lastGlobal) {
+        B->lastGlobal = S->lastGlobal;
+    }
+
+    // line N of the fragment is our line N - 1 - prefixLines
+    offset = B->pendingLine - 1 - prefixLines;
+    RebaseLines(datlast ? datlast->right : B->Q->datblock, S, B->L, offset, B->pendingLine, B->pendingLine + lines - 1);
+    RebaseLines(conlast ? conlast->right : B->Q->conblock, S, B->L, offset, B->pendingLine, B->pendingLine + lines - 1);
+    B->pending = end;
+    B->pendingLine += lines;
+}
+
+/*
+ * make up the lexer's line table for the whole text: an empty entry
+ * 0, then one entry per line, then an empty entry for the end
+ */
+static void
+SetDatLines(LexStream *L, const char *text)
+{
+    LineInfo info;
+    const char *s;
+    size_t len = strlen(text);
+    int lines = 0;
+    char *p;
+
+    for (s = text; *s; s++) {
+        if (*s == '\n') lines++;
+    }
+    // every line (with its newline) gets a terminating 0
+    p = (char *)malloc(len + lines + 2);
+    info.fileName = L->fileName;
+    info.lineno = 0;
+    info.linedata = p;
+    *p++ = 0;
+    flexbuf_addmem(&L->lineInfo, (char *)&info, sizeof(info));
+    s = text;
+    while (*s) {
+        info.lineno++;
+        info.linedata = p;
+        while (*s && *s != '\n') {
+            *p++ = *s++;
+        }
+        if (*s) {
+            *p++ = *s++;
+        }
+        *p++ = 0;
+        flexbuf_addmem(&L->lineInfo, (char *)&info, sizeof(info));
+    }
+    info.lineno++;
+    info.linedata = (char *)"";
+    flexbuf_addmem(&L->lineInfo, (char *)&info, sizeof(info));
+    L->lineCounter = info.lineno;
+}
+
+
+/*
+ * fill in the DAT section of Q (the current module, from
+ * NewTopAsmModule) with what parsing "text", printed by
+ * IRAssembleLines, would have produced; irlines is what
+ * IRAssembleLines recorded
+ */
+void
+IRBuildDat(Flexbuf *irlines, const char *text, Module *Q)
+{
+    static AST where;
+    ASTReportInfo saveinfo;
+    DatBuilder B;
+    LexStream *L;
+    IRLines *rec = (IRLines *)flexbuf_peek(irlines);
+    int n = flexbuf_curlen(irlines) / sizeof(IRLines);
+    AST *ast;
+    int line = 1;
+    int skip;
+
+    L = (LexStream *)calloc(1, sizeof(*L));
+    L->fileName = Q->fullname;
+    L->language = Q->curLanguage;
+    flexbuf_init(&L->curLine, 16);
+    flexbuf_init(&L->lineInfo, 1024);
+    Q->Lptr = L;
+
+    memset(&B, 0, sizeof(B));
+    B.Q = Q;
+    B.L = L;
+    B.text = text;
+    B.pendingLine = 1;
+
+    where.lexdata = L;
+    for (; n > 0; n--, rec++) {
+        ast = NULL;
+        skip = 0;
+        // only whole lines in a DAT section are built directly
+        if (rec->inDat && rec->lines <= 1 && (rec->start == 0 || text[rec->start-1] == '\n')) {
+            where.lineidx = line;
+            AstReportAs(&where, &saveinfo);
+            ast = DatLineForIR(&B, rec->ir, &skip);
+            AstReportDone(&saveinfo);
+            if (ast && rec->lines != 1) {
+                ast = NULL;
+            }
+        }
+        if (ast || skip) {
+            FlushDatText(&B, rec->start);
+            if (ast) {
+                Q->datblock = AddToListEx(Q->datblock, ast, &Q->datblock_tail);
+            }
+            B.pending = (n > 1) ? rec[1].start : strlen(text);
+            B.pendingLine = line + rec->lines;
+            B.pendingDat = 1;
+        }
+        line += rec->lines;
+    }
+    FlushDatText(&B, strlen(text));
+    SetDatLines(L, text);
+    Q->Lptr = L;
 }
 
 void
@@ -1589,6 +2331,6 @@ DumpIRL(IRList *irl)
 {
     int saveLmmMode = lmmMode;
     lmmMode = 1;
-    puts(doIRAssemble(irl, NULL, 1));
+    puts(doIRAssemble(irl, NULL, 1, NULL));
     lmmMode = saveLmmMode;
 }
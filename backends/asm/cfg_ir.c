@@ -0,0 +1,698 @@
+/*
+ * Spin to Pasm converter
+ * Copyright 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * Control flow graph of a function's IR: basic blocks, dominators,
+ * post-dominators and natural loops.
+ *
+ * The optimizer passes work directly on the IRList, so the graph goes
+ * stale as soon as any instruction is added, removed, or changed into
+ * or out of a branch. GetIRCfg builds it on demand and keeps it until
+ * InvalidateIRCfg is called; OptimizeIRLocal does that whenever a pass
+ * reports a change. A pass which changes the code itself and then
+ * wants the graph again must call InvalidateIRCfg first.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "spinc.h"
+#include "outasm.h"
+
+static THREAD_LOCAL IRCfg *cachedCfg;
+
+/*
+ * map from pointers to small integers
+ */
+static size_t
+PtrHash(const void *p)
+{
+    return (size_t)(((uintptr_t)p >> 3) * 2654435761u);
+}
+
+void
+PtrMapInit(PtrMap *m, size_t n)
+{
+    size_t size = 16;
+    while (size < 2*n) size *= 2;
+    m->mask = size - 1;
+    m->count = 0;
+    m->keys = (const void **)calloc(size, sizeof(*m->keys));
+    m->vals = (int *)calloc(size, sizeof(*m->vals));
+}
+
+void
+PtrMapFree(PtrMap *m)
+{
+    free(m->keys);
+    free(m->vals);
+    m->keys = NULL;
+    m->vals = NULL;
+}
+
+// find the slot for p, which is either empty or holds p
+static size_t
+PtrMapSlot(PtrMap *m, const void *p)
+{
+    size_t i = PtrHash(p) & m->mask;
+    while (m->keys[i] && m->keys[i] != p) {
+        i = (i + 1) & m->mask;
+    }
+    return i;
+}
+
+int
+PtrMapGet(PtrMap *m, const void *p)
+{
+    size_t i = PtrMapSlot(m, p);
+    return m->keys[i] ? m->vals[i] : -1;
+}
+
+void
+PtrMapPut(PtrMap *m, const void *p, int val)
+{
+    size_t i = PtrMapSlot(m, p);
+
+    if (!m->keys[i]) {
+        if (2 * (m->count + 1) > m->mask + 1) {
+            // keep the table at most half full
+            PtrMap old = *m;
+            size_t j;
+            PtrMapInit(m, 2 * (m->mask + 1));
+            for (j = 0; j <= old.mask; j++) {
+                if (old.keys[j]) PtrMapPut(m, old.keys[j], old.vals[j]);
+            }
+            PtrMapFree(&old);
+            i = PtrMapSlot(m, p);
+        }
+        m->count++;
+    }
+    m->keys[i] = p;
+    m->vals[i] = val;
+}
+
+/*
+ * basic blocks
+ */
+
+// is ir a jump through a table of jumps (whose entries follow it)?
+static bool
+IsTableJump(IR *ir)
+{
+    return ir->cond == COND_TRUE && ir->next && ir->next->opc == OPC_LABEL
+        && ir->next->next && (ir->next->next->flags & FLAG_JMPTABLE_INSTR);
+}
+
+static void
+AddEdge(Flexbuf *fb, int b)
+{
+    flexbuf_addmem(fb, (const char *)&b, sizeof(b));
+}
+
+// block that the label (or other instruction) target starts
+static int
+TargetBlock(IRCfg *cfg, IR *target)
+{
+    int i = target ? PtrMapGet(&cfg->instrMap, target) : -1;
+    return (i < 0) ? CFG_UNKNOWN : cfg->blockOf[i];
+}
+
+static void
+FindSuccessors(IRCfg *cfg, int b, Flexbuf *fb)
+{
+    IRBlock *blk = &cfg->blocks[b];
+    IR *ir = blk->last;
+    Operand *retlabel = curfunc ? FuncData(curfunc)->asmreturnlabel : NULL;
+    bool fallthrough = true;
+
+    if (IsDummy(ir)) {
+        /* just falls through */
+    } else if (IsJump(ir)) {
+        if (ir->aux) {
+            AddEdge(fb, TargetBlock(cfg, (IR *)ir->aux));
+        } else if (retlabel && JumpDest(ir) == retlabel) {
+            AddEdge(fb, CFG_EXIT);
+        } else if (IsTableJump(ir)) {
+            IR *entry;
+            for (entry = ir->next->next; entry && (entry->flags & FLAG_JMPTABLE_INSTR); entry = entry->next) {
+                AddEdge(fb, TargetBlock(cfg, (IR *)entry->aux));
+            }
+            fallthrough = false;
+        } else {
+            AddEdge(fb, CFG_UNKNOWN);
+        }
+        if (ir->opc == OPC_JUMP && ir->cond == COND_TRUE) {
+            fallthrough = false;
+        }
+    } else if (ir->opc == OPC_RET && !(ir->flags & FLAG_USER_FCACHE)) {
+        AddEdge(fb, CFG_EXIT);
+        if (ir->cond == COND_TRUE) {
+            fallthrough = false;
+        }
+    }
+    if (fallthrough) {
+        AddEdge(fb, (b + 1 < cfg->nblocks) ? b + 1 : CFG_EXIT);
+    }
+}
+
+// can block b be entered from somewhere we do not know about?
+static bool
+HasUnknownEntry(IRCfg *cfg, int b)
+{
+    IR *label = cfg->blocks[b].first;
+    struct ir_lbljumps *list;
+
+    if (b == 0) {
+        return true;
+    }
+    if (label->opc != OPC_LABEL || (label->flags & FLAG_LABEL_NOJUMP)) {
+        return false;
+    }
+    if (label->dst && label->dst->used >= 9999) {
+        // gosub label
+        return true;
+    }
+    if (!label->aux) {
+        return true;
+    }
+    for (list = (struct ir_lbljumps *)label->aux; list; list = list->next) {
+        if (PtrMapGet(&cfg->instrMap, list->jump) < 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+FindBlocks(IRCfg *cfg)
+{
+    IR *ir;
+    int i, b, n;
+    Flexbuf edges;
+    int *e;
+
+    n = 0;
+    for (ir = cfg->irl->head; ir; ir = ir->next) n++;
+    cfg->ninstrs = n;
+    cfg->instrs = (IR **)malloc((n+1) * sizeof(IR *));
+    cfg->blockOf = (int *)malloc((n+1) * sizeof(int));
+    cfg->pos = (int *)malloc((n+1) * sizeof(int));
+    PtrMapInit(&cfg->instrMap, n);
+
+    // a block starts at a label, and after a jump or return
+    cfg->nblocks = 0;
+    for (i = 0, ir = cfg->irl->head; ir; ir = ir->next, i++) {
+        cfg->instrs[i] = ir;
+        // labels and dummies share the position of the next real instruction
+        cfg->pos[i] = (i == 0) ? 0 : cfg->pos[i-1] + !(IsDummy(ir->prev) || ir->prev->opc == OPC_LABEL);
+        PtrMapPut(&cfg->instrMap, ir, i);
+        if (i == 0 || ir->opc == OPC_LABEL) {
+            cfg->nblocks++;
+        } else if (!IsDummy(ir->prev) && (IsJump(ir->prev) || ir->prev->opc == OPC_RET)) {
+            cfg->nblocks++;
+        }
+        cfg->blockOf[i] = cfg->nblocks - 1;
+    }
+    cfg->blocks = (IRBlock *)calloc(cfg->nblocks + 1, sizeof(IRBlock));
+    for (i = 0; i < n; i++) {
+        IRBlock *blk = &cfg->blocks[cfg->blockOf[i]];
+        if (!blk->first) {
+            blk->first = cfg->instrs[i];
+            blk->start = i;
+        }
+        blk->last = cfg->instrs[i];
+        blk->end = i + 1;
+    }
+
+    // successors, then predecessors
+    flexbuf_init(&edges, 1024);
+    for (b = 0; b < cfg->nblocks; b++) {
+        size_t start = flexbuf_curlen(&edges) / sizeof(int);
+        FindSuccessors(cfg, b, &edges);
+        cfg->blocks[b].nsucc = flexbuf_curlen(&edges) / sizeof(int) - start;
+    }
+    cfg->nedges = flexbuf_curlen(&edges) / sizeof(int);
+    cfg->succs = (int *)malloc((cfg->nedges + 1) * sizeof(int));
+    memcpy(cfg->succs, flexbuf_peek(&edges), cfg->nedges * sizeof(int));
+    flexbuf_delete(&edges);
+
+    cfg->preds = (int *)malloc((cfg->nedges + 1) * sizeof(int));
+    e = cfg->succs;
+    for (b = 0; b < cfg->nblocks; b++) {
+        cfg->blocks[b].succ = e;
+        e += cfg->blocks[b].nsucc;
+        for (i = 0; i < cfg->blocks[b].nsucc; i++) {
+            int s = cfg->blocks[b].succ[i];
+            if (s >= 0) cfg->blocks[s].npred++;
+        }
+    }
+    e = cfg->preds;
+    for (b = 0; b < cfg->nblocks; b++) {
+        cfg->blocks[b].pred = e;
+        e += cfg->blocks[b].npred;
+        cfg->blocks[b].npred = 0;
+    }
+    for (b = 0; b < cfg->nblocks; b++) {
+        for (i = 0; i < cfg->blocks[b].nsucc; i++) {
+            int s = cfg->blocks[b].succ[i];
+            if (s >= 0) {
+                IRBlock *sblk = &cfg->blocks[s];
+                sblk->pred[sblk->npred++] = b;
+            }
+        }
+    }
+}
+
+/*
+ * Dominators, by the iterative method of Cooper, Harvey and Kennedy.
+ * The graph is given as a list of nodes in reverse postorder (which
+ * always starts with the single root) and the predecessors of each
+ * node; "order" maps nodes to their position in the list, or -1 for
+ * nodes not reachable from the root.
+ */
+typedef struct DomGraph {
+    int n;              // nodes, including the root
+    int *rpo;           // nodes in reverse postorder
+    int count;          // number of entries in rpo
+    int *order;
+    int **pred;
+    int *npred;
+} DomGraph;
+
+static int
+Intersect(DomGraph *g, int *idom, int a, int b)
+{
+    while (a != b) {
+        while (g->order[a] > g->order[b]) a = idom[a];
+        while (g->order[b] > g->order[a]) b = idom[b];
+    }
+    return a;
+}
+
+static void
+SolveDominators(DomGraph *g, int *idom)
+{
+    bool changed;
+    int i, j, node, p, newidom;
+    int root = g->rpo[0];
+
+    for (i = 0; i < g->n; i++) idom[i] = -1;
+    idom[root] = root;
+    do {
+        changed = false;
+        for (i = 1; i < g->count; i++) {
+            node = g->rpo[i];
+            newidom = -1;
+            for (j = 0; j < g->npred[node]; j++) {
+                p = g->pred[node][j];
+                if (g->order[p] < 0 || idom[p] < 0) continue;
+                newidom = (newidom < 0) ? p : Intersect(g, idom, p, newidom);
+            }
+            if (newidom != idom[node]) {
+                idom[node] = newidom;
+                changed = true;
+            }
+        }
+    } while (changed);
+}
+
+// depth first search to put the nodes of g in reverse postorder,
+// following the edges given by next/nnext
+static void
+OrderNodes(DomGraph *g, int root, int **next, int *nnext)
+{
+    int *stack = (int *)malloc(g->n * sizeof(int));
+    int *pos = (int *)calloc(g->n, sizeof(int));
+    unsigned char *seen = (unsigned char *)calloc(g->n, 1);
+    int sp = 0, k = g->n;
+    int i;
+
+    stack[sp++] = root;
+    seen[root] = 1;
+    while (sp > 0) {
+        int node = stack[sp-1];
+        if (pos[node] < nnext[node]) {
+            int s = next[node][pos[node]++];
+            if (!seen[s]) {
+                seen[s] = 1;
+                stack[sp++] = s;
+            }
+        } else {
+            g->rpo[--k] = node;
+            --sp;
+        }
+    }
+    // move the list down to the start of the array
+    g->count = g->n - k;
+    memmove(g->rpo, g->rpo + k, g->count * sizeof(int));
+    for (i = 0; i < g->n; i++) g->order[i] = -1;
+    for (i = 0; i < g->count; i++) g->order[g->rpo[i]] = i;
+    free(seen);
+    free(pos);
+    free(stack);
+}
+
+/*
+ * number the nodes of a tree (given by parent links) in depth first
+ * order, so that a is an ancestor of b iff
+ * pre[a] <= pre[b] && post[b] <= post[a]
+ */
+static void
+NumberTree(int n, int *parent, int root, int *pre, int *post)
+{
+    int *nchild = (int *)calloc(n + 1, sizeof(int));
+    int *child = (int *)malloc((n + 1) * sizeof(int));
+    int *start = (int *)malloc((n + 1) * sizeof(int));
+    int *stack = (int *)malloc((n + 1) * sizeof(int));
+    int *pos = (int *)calloc(n + 1, sizeof(int));
+    int i, sp, counter;
+
+    for (i = 0; i < n; i++) {
+        pre[i] = post[i] = -1;
+        if (i != root && parent[i] >= 0) nchild[parent[i]]++;
+    }
+    start[0] = 0;
+    for (i = 0; i < n; i++) start[i+1] = start[i] + nchild[i];
+    for (i = 0; i < n; i++) {
+        if (i != root && parent[i] >= 0) {
+            child[start[parent[i]] + pos[parent[i]]++] = i;
+        }
+    }
+    memset(pos, 0, (n + 1) * sizeof(int));
+    counter = 0;
+    sp = 0;
+    stack[sp++] = root;
+    pre[root] = counter++;
+    while (sp > 0) {
+        int node = stack[sp-1];
+        if (pos[node] < nchild[node]) {
+            int c = child[start[node] + pos[node]++];
+            pre[c] = counter++;
+            stack[sp++] = c;
+        } else {
+            post[node] = counter++;
+            --sp;
+        }
+    }
+    free(pos);
+    free(stack);
+    free(start);
+    free(child);
+    free(nchild);
+}
+
+//
+// The forward graph gets an extra root node (number nblocks) with an
+// edge to every block that may be entered from outside, and the
+// reverse graph an extra exit node (also nblocks) reached from every
+// block that leaves the function or jumps somewhere unknown.
+//
+static void
+FindDominators(IRCfg *cfg, bool reverse)
+{
+    int nb = cfg->nblocks;
+    int root = nb;
+    int n = nb + 1;
+    Flexbuf edges;
+    int *from, *to, *nsucc, *npred, **succ, **pred, *succList, *predList;
+    int *idom, *pre, *post;
+    int nedges, b, i, s;
+    DomGraph g;
+
+    // collect the edges as (from, to) pairs
+    flexbuf_init(&edges, 1024);
+    for (b = 0; b < nb; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        bool special = false;
+        for (i = 0; i < blk->nsucc; i++) {
+            s = blk->succ[i];
+            if (s < 0) {
+                special = true;
+            } else if (reverse) {
+                AddEdge(&edges, s);
+                AddEdge(&edges, b);
+            } else {
+                AddEdge(&edges, b);
+                AddEdge(&edges, s);
+            }
+        }
+        if (reverse ? special : HasUnknownEntry(cfg, b)) {
+            AddEdge(&edges, root);
+            AddEdge(&edges, b);
+        }
+    }
+    nedges = flexbuf_curlen(&edges) / (2 * sizeof(int));
+    from = (int *)flexbuf_peek(&edges);
+
+    // and turn them into successor and predecessor lists
+    nsucc = (int *)calloc(n, sizeof(int));
+    npred = (int *)calloc(n, sizeof(int));
+    succ = (int **)malloc(n * sizeof(int *));
+    pred = (int **)malloc(n * sizeof(int *));
+    succList = (int *)malloc((nedges + 1) * sizeof(int));
+    predList = (int *)malloc((nedges + 1) * sizeof(int));
+    for (i = 0; i < nedges; i++) {
+        nsucc[from[2*i]]++;
+        npred[from[2*i+1]]++;
+    }
+    succ[0] = succList;
+    pred[0] = predList;
+    for (b = 1; b < n; b++) {
+        succ[b] = succ[b-1] + nsucc[b-1];
+        pred[b] = pred[b-1] + npred[b-1];
+    }
+    memset(nsucc, 0, n * sizeof(int));
+    memset(npred, 0, n * sizeof(int));
+    for (i = 0; i < nedges; i++) {
+        to = &from[2*i];
+        succ[to[0]][nsucc[to[0]]++] = to[1];
+        pred[to[1]][npred[to[1]]++] = to[0];
+    }
+
+    g.n = n;
+    g.rpo = (int *)malloc(n * sizeof(int));
+    g.order = (int *)malloc(n * sizeof(int));
+    g.pred = pred;
+    g.npred = npred;
+    idom = (int *)malloc(n * sizeof(int));
+    pre = (int *)malloc(n * sizeof(int));
+    post = (int *)malloc(n * sizeof(int));
+    OrderNodes(&g, root, succ, nsucc);
+    SolveDominators(&g, idom);
+    NumberTree(n, idom, root, pre, post);
+
+    for (b = 0; b < nb; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        int d = (idom[b] == root) ? -1 : idom[b];
+        if (!reverse) {
+            blk->idom = d;
+            blk->rpo = (g.order[b] < 0) ? -1 : g.order[b] - 1;
+            blk->dompre = pre[b];
+            blk->dompost = post[b];
+        } else {
+            blk->ipdom = d;
+            blk->pdompre = pre[b];
+            blk->pdompost = post[b];
+        }
+    }
+
+    free(post);
+    free(pre);
+    free(idom);
+    free(g.order);
+    free(g.rpo);
+    free(predList);
+    free(succList);
+    free(pred);
+    free(succ);
+    free(npred);
+    free(nsucc);
+    flexbuf_delete(&edges);
+}
+
+/*
+ * natural loops: for every edge from a block to one that dominates it
+ * (the loop header), the loop is the header plus every block that
+ * can reach the edge without going through the header. Loops with
+ * the same header are merged.
+ */
+static void
+FindLoops(IRCfg *cfg)
+{
+    int nb = cfg->nblocks;
+    int *byOrder = (int *)malloc((nb + 1) * sizeof(int));
+    int *firstMember = (int *)malloc((nb + 1) * sizeof(int));
+    int *stack = (int *)malloc((cfg->nedges + nb + 1) * sizeof(int));
+    unsigned char *inloop = (unsigned char *)calloc(nb + 1, 1);
+    Flexbuf loops, members;
+    IRLoop lp;
+    int b, h, i, j, l, sp, first;
+
+    flexbuf_init(&loops, 256);
+    flexbuf_init(&members, 1024);
+    for (b = 0; b < nb; b++) {
+        byOrder[b] = -1;
+    }
+    for (b = 0; b < nb; b++) {
+        cfg->blocks[b].loop = -1;
+        if (cfg->blocks[b].rpo >= 0) {
+            byOrder[cfg->blocks[b].rpo] = b;
+        }
+    }
+    cfg->nloops = 0;
+    // look at the headers in reverse postorder, so outer loops are
+    // found before the loops inside them
+    for (i = 0; i < nb && byOrder[i] >= 0; i++) {
+        h = byOrder[i];
+        sp = 0;
+        for (j = 0; j < cfg->blocks[h].npred; j++) {
+            int p = cfg->blocks[h].pred[j];
+            if (IRCfgDominates(cfg, h, p)) {
+                stack[sp++] = p;
+            }
+        }
+        if (sp == 0) continue;
+        first = flexbuf_curlen(&members) / sizeof(int);
+        memset(inloop, 0, nb);
+        inloop[h] = 1;
+        AddEdge(&members, h);
+        while (sp > 0) {
+            b = stack[--sp];
+            if (inloop[b]) continue;
+            inloop[b] = 1;
+            AddEdge(&members, b);
+            for (j = 0; j < cfg->blocks[b].npred; j++) {
+                int p = cfg->blocks[b].pred[j];
+                if (!inloop[p] && cfg->blocks[p].rpo >= 0) stack[sp++] = p;
+            }
+        }
+        memset(&lp, 0, sizeof(lp));
+        lp.header = h;
+        lp.nblocks = flexbuf_curlen(&members) / sizeof(int) - first;
+        lp.parent = cfg->blocks[h].loop;
+        lp.depth = (lp.parent < 0) ? 1 : ((IRLoop *)flexbuf_peek(&loops))[lp.parent].depth + 1;
+        flexbuf_addmem(&loops, (const char *)&lp, sizeof(lp));
+        l = cfg->nloops++;
+        firstMember[l] = first;
+        // the innermost loop is the last one to claim a block
+        for (j = first; j < first + lp.nblocks; j++) {
+            cfg->blocks[((int *)flexbuf_peek(&members))[j]].loop = l;
+        }
+    }
+    cfg->loopBlocks = (int *)malloc(flexbuf_curlen(&members) + sizeof(int));
+    memcpy(cfg->loopBlocks, flexbuf_peek(&members), flexbuf_curlen(&members));
+    cfg->loops = (IRLoop *)malloc(flexbuf_curlen(&loops) + sizeof(IRLoop));
+    memcpy(cfg->loops, flexbuf_peek(&loops), flexbuf_curlen(&loops));
+    for (l = 0; l < cfg->nloops; l++) {
+        cfg->loops[l].blocks = cfg->loopBlocks + firstMember[l];
+    }
+    flexbuf_delete(&members);
+    flexbuf_delete(&loops);
+    free(inloop);
+    free(stack);
+    free(firstMember);
+    free(byOrder);
+}
+
+static IRCfg *
+BuildIRCfg(IRList *irl)
+{
+    IRCfg *cfg = (IRCfg *)calloc(1, sizeof(IRCfg));
+
+    cfg->irl = irl;
+    FindBlocks(cfg);
+    FindDominators(cfg, false);
+    FindDominators(cfg, true);
+    FindLoops(cfg);
+    return cfg;
+}
+
+static void
+FreeIRCfg(IRCfg *cfg)
+{
+    PtrMapFree(&cfg->instrMap);
+    free(cfg->instrs);
+    free(cfg->blockOf);
+    free(cfg->pos);
+    free(cfg->blocks);
+    free(cfg->succs);
+    free(cfg->preds);
+    free(cfg->loops);
+    free(cfg->loopBlocks);
+    free(cfg);
+}
+
+IRCfg *
+GetIRCfg(IRList *irl)
+{
+    if (cachedCfg && cachedCfg->irl != irl) {
+        InvalidateIRCfg();
+    }
+    if (!cachedCfg) {
+        cachedCfg = BuildIRCfg(irl);
+    }
+    return cachedCfg;
+}
+
+void
+InvalidateIRCfg(void)
+{
+    if (cachedCfg) {
+        FreeIRCfg(cachedCfg);
+        cachedCfg = NULL;
+    }
+}
+
+int
+IRCfgInstrIndex(IRCfg *cfg, IR *ir)
+{
+    return PtrMapGet(&cfg->instrMap, ir);
+}
+
+int
+IRCfgBlockOf(IRCfg *cfg, IR *ir)
+{
+    int i = PtrMapGet(&cfg->instrMap, ir);
+    return (i < 0) ? -1 : cfg->blockOf[i];
+}
+
+int
+IRCfgPosition(IRCfg *cfg, IR *ir)
+{
+    int i = PtrMapGet(&cfg->instrMap, ir);
+    return (i < 0) ? -1 : cfg->pos[i];
+}
+
+bool
+IRCfgDominates(IRCfg *cfg, int a, int b)
+{
+    IRBlock *A = &cfg->blocks[a];
+    IRBlock *B = &cfg->blocks[b];
+    if (A->dompre < 0 || B->dompre < 0) {
+        return false;
+    }
+    return A->dompre <= B->dompre && B->dompost <= A->dompost;
+}
+
+bool
+IRCfgPostDominates(IRCfg *cfg, int a, int b)
+{
+    IRBlock *A = &cfg->blocks[a];
+    IRBlock *B = &cfg->blocks[b];
+    if (A->pdompre < 0 || B->pdompre < 0) {
+        return false;
+    }
+    return A->pdompre <= B->pdompre && B->pdompost <= A->pdompost;
+}
+
+bool
+IRCfgInLoop(IRCfg *cfg, int b, int loop)
+{
+    int l;
+    for (l = cfg->blocks[b].loop; l >= 0; l = cfg->loops[l].parent) {
+        if (l == loop) return true;
+    }
+    return false;
+}
@@ -10,11 +10,14 @@
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <limits.h>
 #include "spinc.h"
 #include "outasm.h"
+#include "passtime.h"
 
 // forward declarations
 static bool IsReorderBarrier(IR *ir);
+static IR *NextRefAfter(IR *ir, Operand *a, Operand *b, IR *also, IR **lastp);
 
 // fcache size in longs; -1 means take a guess
 int gl_fcache_size = -1;
@@ -228,7 +231,7 @@ InstrSetsDst(IR *ir)
 // jumps and calls are both branches, but sometimes
 // we treat them differently
 
-static bool IsJump(IR *ir)
+bool IsJump(IR *ir)
 {
     switch (ir->opc) {
     case OPC_JUMP:
@@ -358,7 +361,7 @@ InstrModifies(IR *ir, Operand *reg)
         return InstrSetsDst(ir);
     }
     if (ir->opc == OPC_MOVD && reg) {
-        if (dst->kind == IMM_COG_LABEL && !strcmp(reg->name, dst->name)) {
+        if (dst->kind == IMM_COG_LABEL && reg->name == dst->name) {
             return true;
         }
     }
@@ -403,7 +406,7 @@ InstrUses(IR *ir, Operand *reg)
         return true;
     }
     if (src && src->kind == IMM_COG_LABEL && reg) {
-        if (!strcmp(reg->name, src->name)) {
+        if (reg->name == src->name) {
             return true;
         }
     }
@@ -623,18 +626,19 @@ JumpDest(IR *jmp)
  * (or equal to that instruction)
  */
 static bool
-JumpIsAfterOrEqual(IR *ir, IR *jmp)
+JumpIsAfterOrEqual(IRList *irl, IR *ir, IR *jmp)
 {
     // ptr to jump destination gets stored in aux
     if (jmp->aux) {
         IR *label = (IR *)jmp->aux;
-        if (!label) {
-            return false;
-        }
-        if (label->addr >= ir->addr) {
-            return true;
+        IRCfg *cfg = GetIRCfg(irl);
+        int lpos = IRCfgPosition(cfg, label);
+        int ipos = IRCfgPosition(cfg, ir);
+        if (lpos < 0 || ipos < 0) {
+            // added since the graph was built
+            return label->addr >= ir->addr;
         }
-        return false;
+        return lpos >= ipos;
     }
     if (curfunc && (
                 JumpDest(jmp) == FuncData(curfunc)->asmretname
@@ -644,9 +648,9 @@ JumpIsAfterOrEqual(IR *ir, IR *jmp)
 }
 
 static bool
-IsForwardJump(IR *jmp)
+IsForwardJump(IRList *irl, IR *jmp)
 {
-    return JumpIsAfterOrEqual(jmp, jmp);
+    return JumpIsAfterOrEqual(irl, jmp, jmp);
 }
 
 /* check to see if a jump is relatively close to its
@@ -730,7 +734,7 @@ NextUseAfter(IR *ir, Operand *op)
 //
 static IR* FindNextUse(IR *ir, Operand *dst)
 {
-    ir = ir->next;
+    ir = NextRefAfter(ir, dst, NULL, NULL, NULL);
     while (ir) {
         if (InstrUses(ir, dst)) {
             return ir;
@@ -745,7 +749,7 @@ static IR* FindNextUse(IR *ir, Operand *dst)
         if (ir->opc == OPC_LABEL) {
             return NULL;
         }
-        ir = ir->next;
+        ir = NextRefAfter(ir, dst, NULL, NULL, NULL);
     }
     return NULL;
 }
@@ -892,7 +896,7 @@ static inline bool CondIsSubset(IRCond super, IRCond sub) {
 }
 
 // Note: currently only valid for P2
-static int InstrMinCycles(IR *ir) {
+int InstrMinCycles(IR *ir) {
     if (IsDummy(ir)||IsLabel(ir)) return 0;
     int aug = 0;
     
@@ -912,49 +916,255 @@ static int InstrMinCycles(IR *ir) {
         return aug+2;
     }
 }
-#if 0
-// Note: currently only valid for P2, and not used yet
-static int InstrMaxCycles(IR *ir) {
+
+// longs moved by a hub read or write: more than one after a SETQ
+// or SETQ2; returns -1 if the count is not known
+static int
+HubTransferLongs(IR *ir)
+{
+    IR *prev = ir->prev;
+    while (prev && (IsDummy(prev) || prev->opc == OPC_COMMENT)) {
+        prev = prev->prev;
+    }
+    if (!prev || (prev->opc != OPC_SETQ && prev->opc != OPC_SETQ2)) {
+        return 1;
+    }
+    if (prev->dst && prev->dst->kind == IMM_INT) {
+        return 1 + (int)prev->dst->val;
+    }
+    return -1;
+}
+
+// COGID, LOCKTRY and the like wait for the cog's hub slot, plus 2
+// cycles if they return a result
+#define HUB_OP_CYCLES 11
+// marks a hub read or write in genericCycles
+#define GENERIC_HUB_READ  (-1)
+#define GENERIC_HUB_WRITE (-2)
+
+// worst case times of the P2 instructions which have no opcode of their
+// own and so come through inline assembly as OPC_GENERIC*; branches are
+// not here, and neither is anything that waits for an event or for the
+// streamer (WAITxxx, XINIT, XZERO, XCONT), which has no bound
+static const struct {
+    const char *name;
+    int cycles;
+} genericCycles[] = {
+    { "pusha", GENERIC_HUB_WRITE }, { "pushb", GENERIC_HUB_WRITE },
+    { "wmlong", GENERIC_HUB_WRITE },
+    { "popa", GENERIC_HUB_READ }, { "popb", GENERIC_HUB_READ },
+    { "coginit", HUB_OP_CYCLES },
+    { "rdfast", 24 }, { "wrfast", 24 },
+    { "addpix", 7 }, { "mulpix", 7 }, { "blnpix", 7 }, { "mixpix", 7 },
+    { "execf", 4 },
+    { "rdlut", 3 },
+
+    { "sal", 2 }, { "adds", 2 }, { "subs", 2 }, { "cmpx", 2 }, { "cmpsx", 2 },
+    { "cmpr", 2 }, { "cmpm", 2 }, { "cmpsub", 2 }, { "bitz", 2 }, { "bitnz", 2 },
+    { "bitrnd", 2 }, { "incmod", 2 }, { "decmod", 2 }, { "testn", 2 },
+    { "setnib", 2 }, { "rolnib", 2 }, { "rolbyte", 2 }, { "rolword", 2 },
+    { "altsn", 2 }, { "altgn", 2 }, { "altsb", 2 }, { "altgb", 2 },
+    { "altsw", 2 }, { "altgw", 2 }, { "altr", 2 }, { "altb", 2 }, { "alti", 2 },
+    { "setr", 2 }, { "setd", 2 }, { "sets", 2 }, { "crcbit", 2 }, { "crcnib", 2 },
+    { "muxnits", 2 }, { "muxnibs", 2 }, { "movbyts", 2 }, { "sca", 2 }, { "scas", 2 },
+    { "addct2", 2 }, { "addct3", 2 }, { "rqpin", 2 }, { "wrlut", 2 },
+    { "setpat", 2 }, { "wrpin", 2 }, { "akpin", 2 }, { "wxpin", 2 }, { "wypin", 2 },
+    { "fblock", 2 }, { "xstop", 2 },
+    { "rfbyte", 2 }, { "rfword", 2 }, { "rflong", 2 }, { "rfvar", 2 }, { "rfvars", 2 },
+    { "wfbyte", 2 }, { "wfword", 2 }, { "wflong", 2 },
+    { "setdacs", 2 }, { "setxfrq", 2 }, { "getxacc", 2 },
+    { "setse1", 2 }, { "setse2", 2 }, { "setse3", 2 }, { "setse4", 2 },
+    { "pollint", 2 }, { "pollct1", 2 }, { "pollct2", 2 }, { "pollct3", 2 },
+    { "pollse1", 2 }, { "pollse2", 2 }, { "pollse3", 2 }, { "pollse4", 2 },
+    { "pollpat", 2 }, { "pollfbw", 2 }, { "pollxmt", 2 }, { "pollxfi", 2 },
+    { "pollxro", 2 }, { "pollxrl", 2 }, { "pollatn", 2 }, { "pollqmt", 2 },
+    { "allowi", 2 }, { "stalli", 2 },
+    { "trgint1", 2 }, { "trgint2", 2 }, { "trgint3", 2 },
+    { "nixint1", 2 }, { "nixint2", 2 }, { "nixint3", 2 },
+    { "setint1", 2 }, { "setint2", 2 }, { "setint3", 2 },
+    { "skip", 2 }, { "skipf", 2 }, { "getptr", 2 }, { "getbrk", 2 }, { "cogbrk", 2 },
+    { "setluts", 2 }, { "lutsoff", 2 }, { "lutson", 2 },
+    { "setcy", 2 }, { "setci", 2 }, { "setcq", 2 }, { "setcfrq", 2 }, { "setcmod", 2 },
+    { "setpiv", 2 }, { "setpix", 2 }, { "cogatn", 2 }, { "testp", 2 }, { "testpn", 2 },
+    { "dirl", 2 }, { "dirh", 2 }, { "dirc", 2 }, { "dirnc", 2 }, { "dirz", 2 },
+    { "dirnz", 2 }, { "dirrnd", 2 }, { "dirnot", 2 },
+    { "outl", 2 }, { "outh", 2 }, { "outc", 2 }, { "outnc", 2 }, { "outz", 2 },
+    { "outnz", 2 }, { "outrnd", 2 }, { "outnot", 2 },
+    { "fltl", 2 }, { "flth", 2 }, { "fltc", 2 }, { "fltnc", 2 }, { "fltz", 2 },
+    { "fltnz", 2 }, { "fltrnd", 2 }, { "fltnot", 2 }, { "drvrnd", 2 }, { "drvnot", 2 },
+    { "splitb", 2 }, { "mergeb", 2 }, { "splitw", 2 }, { "mergew", 2 },
+    { "seussf", 2 }, { "seussr", 2 }, { "rgbsqz", 2 }, { "rgbexp", 2 }, { "xoro32", 2 },
+    { "rczr", 2 }, { "rczl", 2 }, { "modcz", 2 }, { "modc", 2 }, { "modz", 2 },
+    { "setscp", 2 }, { "getscp", 2 }, { "loc", 2 }, { "augs", 2 }, { "augd", 2 },
+};
+
+// worst case for a hub read or write taking "base" cycles for one long
+static int
+HubTransferCycles(IR *ir, int base)
+{
+    int longs = HubTransferLongs(ir);
+    return (longs < 0) ? CYCLES_UNBOUNDED : base + longs;
+}
+
+static int
+GenericMaxCycles(IR *ir, bool hubexec)
+{
+    size_t i;
+
+    if (!ir->instr) {
+        return CYCLES_UNBOUNDED;
+    }
+    for (i = 0; i < sizeof(genericCycles) / sizeof(genericCycles[0]); i++) {
+        if (!strcmp(ir->instr->name, genericCycles[i].name)) {
+            switch (genericCycles[i].cycles) {
+            case GENERIC_HUB_READ:
+                return HubTransferCycles(ir, HUB_READ_CYCLES(hubexec));
+            case GENERIC_HUB_WRITE:
+                return HubTransferCycles(ir, HUB_WRITE_CYCLES(hubexec));
+            default:
+                return genericCycles[i].cycles;
+            }
+        }
+    }
+    return CYCLES_UNBOUNDED;
+}
+
+// Note: currently only valid for P2
+// the most cycles ir can take, not counting any function it calls;
+// taken branches are slower in hub code. Returns CYCLES_UNBOUNDED
+// if there is no limit (e.g. for a WAITCNT) or if we do not know
+// the instruction
+int InstrMaxCycles(IR *ir, bool hubexec) {
     if (IsDummy(ir)||IsLabel(ir)) return 0;
-    if (IsBranch(ir)) return 100000; // No good.
 
     int aug = 0;
-    if (ir->src && ir->src->kind == IMM_INT && ir->src->val > 511) aug += 2;
-    if (ir->dst && ir->dst->kind == IMM_INT && ir->dst->val > 511) aug += 2;
+    int cyc;
+    if (NeedsImmAug(ir->src)) aug += 2;
+    if (NeedsImmAug(ir->dst)) aug += 2;
 
     switch (ir->opc) {
     case OPC_WRBYTE:
-        return aug+26; // Can never be unaligned
+        return aug+HUB_WRITE_CYCLES(hubexec); // Can never be unaligned
     case OPC_WRWORD:
     case OPC_WRLONG:
-        return aug+27;
+        cyc = HubTransferCycles(ir, HUB_WRITE_CYCLES(hubexec));
+        return (cyc == CYCLES_UNBOUNDED) ? cyc : aug+cyc;
     case OPC_RDBYTE:
-        return aug+20; // Can never be unaligned
+        return aug+HUB_READ_CYCLES(hubexec); // Can never be unaligned
     case OPC_RDWORD:
     case OPC_RDLONG:
-        return aug+21;
+        cyc = HubTransferCycles(ir, HUB_READ_CYCLES(hubexec));
+        return (cyc == CYCLES_UNBOUNDED) ? cyc : aug+cyc;
+    case OPC_COGID:
+    case OPC_COGSTOP:
+    case OPC_HUBSET:
+    case OPC_LOCKNEW:
+    case OPC_LOCKRET:
+    case OPC_LOCKTRY:
+    case OPC_LOCKREL:
+        return aug+HUB_OP_CYCLES;
+    case OPC_WAITX:
+        if (ir->dst && ir->dst->kind == IMM_INT) {
+            return aug+2+(int)ir->dst->val;
+        }
+        return CYCLES_UNBOUNDED;
+    case OPC_WAITCNT:
+    case OPC_BREAK:
+        // a BRK may run the debugger
+        return CYCLES_UNBOUNDED;
     case OPC_GENERIC:
     case OPC_GENERIC_NR:
-    case OPC_GENERIC_DELAY:
-    case OPC_GENERIC_BRANCH:
-    case OPC_GENERIC_BRCOND:
     case OPC_GENERIC_NR_NOFLAGS:
     case OPC_GENERIC_NOFLAGS:
-    case OPC_WAITX:
-    case OPC_WAITCNT:
-        return 100000; // No good;
+    case OPC_GENERIC_DELAY:
+        cyc = GenericMaxCycles(ir, hubexec);
+        return (cyc == CYCLES_UNBOUNDED) ? cyc : aug+cyc;
     case OPC_QMUL:
     case OPC_QDIV:
     case OPC_QFRAC:
     case OPC_QSQRT:
+    case OPC_QROTATE:
+    case OPC_QVECTOR:
     case OPC_QLOG:
     case OPC_QEXP:
         return aug+9;
+    case OPC_GETQX:
+    case OPC_GETQY:
+        return aug+58; // waiting for the CORDIC result
+    case OPC_REPEAT:
+        return aug+2;
+    case OPC_REPEAT_END:
+        return 0;
     default:
+        if (IsBranch(ir) || ir->opc == OPC_RET) {
+            return aug + BRANCH_CYCLES(hubexec);
+        }
         return aug+2;
     }
 }
-#endif
+
+//
+// collect the size and speed estimates for the instructions from
+// first to last (for --quality-report); the cycle counts are for
+// running each instruction once, as if there were no loops, and
+// leave out any time spent in called functions
+//
+void
+AnalyzeCodeQuality(IR *first, IR *last, bool hubexec, CodeQuality *Q)
+{
+    IR *ir;
+    int cyc;
+
+    memset(Q, 0, sizeof(*Q));
+    for (ir = first; ir; ir = ir->next) {
+        if (!IsDummy(ir) && ir->opc <= OPC_GENERIC_BRCOND && ir->opc != OPC_REPEAT_END) {
+            Q->instrs++;
+            if (NeedsImmAug(ir->src)) Q->augs++;
+            if (NeedsImmAug(ir->dst)) Q->augd++;
+            // P1 LMM branches are followed by a long with the address
+            if (!gl_p2 && hubexec && IsBranch(ir)) Q->bytes += 4;
+            switch (ir->opc) {
+            case OPC_RDBYTE:
+            case OPC_RDWORD:
+            case OPC_RDLONG:
+            case OPC_WRBYTE:
+            case OPC_WRWORD:
+            case OPC_WRLONG:
+                Q->hubAccesses++;
+                break;
+            case OPC_QMUL:
+            case OPC_QDIV:
+            case OPC_QFRAC:
+            case OPC_QSQRT:
+            case OPC_QROTATE:
+            case OPC_QVECTOR:
+            case OPC_QLOG:
+            case OPC_QEXP:
+                Q->cordicOps++;
+                break;
+            case OPC_CALL:
+                Q->calls++;
+                break;
+            default:
+                if (IsJump(ir) && ir->opc != OPC_REPEAT) {
+                    Q->branches++;
+                }
+                break;
+            }
+            if (gl_p2) {
+                Q->minCycles += InstrMinCycles(ir);
+                cyc = InstrMaxCycles(ir, hubexec);
+                if (cyc == CYCLES_UNBOUNDED || Q->maxCycles == CYCLES_UNBOUNDED) {
+                    Q->maxCycles = CYCLES_UNBOUNDED;
+                } else {
+                    Q->maxCycles += cyc;
+                }
+            }
+        }
+        if (ir == last) break;
+    }
+    Q->bytes += 4 * (Q->instrs + Q->augs + Q->augd);
+}
 
 static int
 AddSubVal(IR *ir)
@@ -1101,6 +1311,384 @@ IsSafeALUOp(IROpcode opc) {
     }
 }
 
+static Operand *
+BaseReg(Operand *op)
+{
+    if (op && op->kind == REG_SUBREG) {
+        op = (Operand *)op->name;
+    }
+    return op;
+}
+
+/*
+ * Register reference index
+ *
+ * Most of the forward searches below (IsDeadAfter, SafeToReplaceForward,
+ * PropagateConstForward and so on) walk from an instruction until they
+ * find one that mentions a particular register, or one that changes the
+ * flow of control. OptimizeMoves and ReuseLocalRegisters run such searches
+ * for nearly every instruction, and in a long stretch of straight line
+ * code most of the instructions passed over are irrelevant, so those
+ * passes are quadratic.
+ *
+ * While a pass has an index active (BeginRefIndex/EndRefIndex), each
+ * register has a list of the instructions that refer to it, in order,
+ * and there is a list of the "stop" instructions (labels, branches,
+ * calls, returns and so on) that every search must look at. A search
+ * then goes straight from one interesting instruction to the next.
+ *
+ * The index is built when it is first needed, and tolerates the changes
+ * those passes make: deleted instructions are skipped, an operand that
+ * is removed just leaves a harmless extra entry, and code that gives an
+ * instruction a new operand must call RefIndexNote. Inserting an
+ * instruction (which is rare) throws the index away, to be built again
+ * on the next search.
+ */
+
+typedef struct IRRef {
+    int pos;            // position of ir when the index was built
+    IR *ir;
+} IRRef;
+
+typedef struct IRRefList {
+    int n;
+    int size;
+    IRRef *refs;        // sorted by pos
+} IRRefList;
+
+typedef struct IRRefIndex {
+    IRList *irl;
+    bool built;
+    PtrMap posMap;      // IR -> position
+    PtrMap regMap;      // register -> list number
+    PtrMap nameMap;     // name of a cog label -> list number
+    int nlists;
+    int maxlists;
+    IRRefList *lists;
+    IRRefList stops;
+} IRRefIndex;
+
+static THREAD_LOCAL IRRefIndex *activeRefs;
+
+// instructions that every forward search has to look at
+static bool
+IsRefStop(IR *ir)
+{
+    switch (ir->opc) {
+    case OPC_LABEL:
+    case OPC_CALL:
+    case OPC_RET:
+    case OPC_LIVE:
+        return true;
+    default:
+        break;
+    }
+    if (IsJump(ir)) {
+        return true;
+    }
+    return ir->src && ir->src->kind == REG_SUBREG;
+}
+
+static IRRefList *
+RefList(IRRefIndex *X, PtrMap *map, const void *key, bool create)
+{
+    int i = PtrMapGet(map, key);
+
+    if (i < 0) {
+        if (!create) {
+            return NULL;
+        }
+        if (X->nlists == X->maxlists) {
+            X->maxlists = X->maxlists ? 2 * X->maxlists : 64;
+            X->lists = (IRRefList *)realloc(X->lists, X->maxlists * sizeof(IRRefList));
+        }
+        i = X->nlists++;
+        memset(&X->lists[i], 0, sizeof(IRRefList));
+        PtrMapPut(map, key, i);
+    }
+    return &X->lists[i];
+}
+
+// first entry in L after position pos
+static int
+RefListFind(IRRefList *L, int pos)
+{
+    int lo = 0, hi = L->n;
+
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (L->refs[mid].pos <= pos) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void
+RefListAdd(IRRefList *L, int pos, IR *ir)
+{
+    int i;
+
+    if (L->n > 0 && L->refs[L->n-1].pos < pos) {
+        i = L->n;  // the usual case, while building the index
+    } else {
+        i = RefListFind(L, pos);
+        if (i > 0 && L->refs[i-1].pos == pos) {
+            return;  // already there
+        }
+    }
+    if (L->n == L->size) {
+        L->size = L->size ? 2 * L->size : 4;
+        L->refs = (IRRef *)realloc(L->refs, L->size * sizeof(IRRef));
+    }
+    memmove(&L->refs[i+1], &L->refs[i], (L->n - i) * sizeof(IRRef));
+    L->refs[i].pos = pos;
+    L->refs[i].ir = ir;
+    L->n++;
+}
+
+static void
+IndexOperand(IRRefIndex *X, Operand *op, int pos, IR *ir)
+{
+    if (!op || op->kind == IMM_INT) {
+        return;
+    }
+    RefListAdd(RefList(X, &X->regMap, BaseReg(op), true), pos, ir);
+    if (op->kind == IMM_COG_LABEL && op->name) {
+        RefListAdd(RefList(X, &X->nameMap, op->name, true), pos, ir);
+    }
+}
+
+static void
+IndexInstr(IRRefIndex *X, IR *ir, int pos)
+{
+    IndexOperand(X, ir->dst, pos, ir);
+    IndexOperand(X, ir->src, pos, ir);
+    IndexOperand(X, ir->src2, pos, ir);
+    if (IsRefStop(ir)) {
+        RefListAdd(&X->stops, pos, ir);
+    }
+}
+
+static void
+ClearRefIndex(IRRefIndex *X)
+{
+    int i;
+
+    if (!X->built) {
+        return;
+    }
+    for (i = 0; i < X->nlists; i++) {
+        free(X->lists[i].refs);
+    }
+    free(X->lists);
+    free(X->stops.refs);
+    PtrMapFree(&X->posMap);
+    PtrMapFree(&X->regMap);
+    PtrMapFree(&X->nameMap);
+    X->lists = NULL;
+    X->nlists = X->maxlists = 0;
+    memset(&X->stops, 0, sizeof(X->stops));
+    X->built = false;
+}
+
+static IRRefIndex *
+BeginRefIndex(IRList *irl)
+{
+    IRRefIndex *X;
+
+    if (activeRefs) {
+        return NULL;
+    }
+    X = (IRRefIndex *)calloc(1, sizeof(*X));
+    X->irl = irl;
+    activeRefs = X;
+    return X;
+}
+
+static void
+EndRefIndex(IRRefIndex *X)
+{
+    if (!X) {
+        return;
+    }
+    ClearRefIndex(X);
+    if (activeRefs == X) {
+        activeRefs = NULL;
+    }
+    free(X);
+}
+
+// returns the active index, building it if necessary, or NULL
+static IRRefIndex *
+GetRefIndex(void)
+{
+    IRRefIndex *X = activeRefs;
+    IR *ir;
+    int pos = 0;
+
+    if (!X) {
+        return NULL;
+    }
+    if (!X->built) {
+        for (ir = X->irl->head; ir; ir = ir->next) {
+            pos++;
+        }
+        PtrMapInit(&X->posMap, pos);
+        PtrMapInit(&X->regMap, 64);
+        PtrMapInit(&X->nameMap, 16);
+        pos = 0;
+        for (ir = X->irl->head; ir; ir = ir->next) {
+            PtrMapPut(&X->posMap, ir, pos);
+            IndexInstr(X, ir, pos);
+            pos++;
+        }
+        X->built = true;
+    }
+    return X;
+}
+
+// is ir still in the list?
+static bool
+RefIsLinked(IRRefIndex *X, IR *ir)
+{
+    return ir->prev ? ir->prev->next == ir : X->irl->head == ir;
+}
+
+// position of ir in the active index, or -1
+static int
+RefPos(IR *ir)
+{
+    IRRefIndex *X = GetRefIndex();
+    return X ? PtrMapGet(&X->posMap, ir) : -1;
+}
+
+// find the lists of instructions which may mention op; returns false
+// if there is no index
+static bool
+RefListsFor(Operand *op, IRRefList *lists[2])
+{
+    IRRefIndex *X = GetRefIndex();
+
+    op = BaseReg(op);
+    if (!X || !op) {
+        return false;
+    }
+    lists[0] = RefList(X, &X->regMap, op, false);
+    lists[1] = op->name ? RefList(X, &X->nameMap, op->name, false) : NULL;
+    return true;
+}
+
+// first instruction still in the list that appears in L after position pos
+static IRRef *
+RefListNext(IRRefIndex *X, IRRefList *L, int pos)
+{
+    int i;
+
+    if (!L) {
+        return NULL;
+    }
+    for (i = RefListFind(L, pos); i < L->n; i++) {
+        if (RefIsLinked(X, L->refs[i].ir)) {
+            return &L->refs[i];
+        }
+    }
+    return NULL;
+}
+
+static void
+RefNextFor(IRRefIndex *X, Operand *op, int pos, IRRef **best)
+{
+    IRRef *r;
+
+    op = BaseReg(op);
+    if (!op) {
+        return;
+    }
+    r = RefListNext(X, RefList(X, &X->regMap, op, false), pos);
+    if (r && (!*best || r->pos < (*best)->pos)) {
+        *best = r;
+    }
+    if (op->name) {
+        r = RefListNext(X, RefList(X, &X->nameMap, op->name, false), pos);
+        if (r && (!*best || r->pos < (*best)->pos)) {
+            *best = r;
+        }
+    }
+}
+
+//
+// step forward from ir to the next instruction that a search for
+// registers a and b (either may be NULL) needs to look at: the
+// skipped instructions neither mention a or b nor are stops, nor are
+// they "also".
+// If lastp is given, *lastp is set to the last skipped instruction
+// that is not a dummy, if there is one.
+//
+static IR *
+NextRefAfter(IR *ir, Operand *a, Operand *b, IR *also, IR **lastp)
+{
+    IRRefIndex *X = GetRefIndex();
+    IRRef *best = NULL;
+    IR *next, *skip;
+    int pos, alsopos;
+
+    if (!X || (pos = PtrMapGet(&X->posMap, ir)) < 0) {
+        return ir->next;
+    }
+    best = RefListNext(X, &X->stops, pos);
+    RefNextFor(X, a, pos, &best);
+    RefNextFor(X, b, pos, &best);
+    next = best ? best->ir : NULL;
+    if (also && RefIsLinked(X, also) && (alsopos = PtrMapGet(&X->posMap, also)) > pos
+        && (!best || alsopos < best->pos))
+    {
+        next = also;
+    }
+    if (lastp && next != ir->next) {
+        for (skip = next ? next->prev : X->irl->tail; skip && skip != ir; skip = skip->prev) {
+            if (!IsDummy(skip)) {
+                *lastp = skip;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+//
+// record that ir may have been given new operands
+//
+static void
+RefIndexNote(IR *ir)
+{
+    IRRefIndex *X = activeRefs;
+    int pos;
+
+    if (!X || !X->built) {
+        return;
+    }
+    pos = PtrMapGet(&X->posMap, ir);
+    if (pos < 0) {
+        ClearRefIndex(X);
+    } else {
+        IndexInstr(X, ir, pos);
+    }
+}
+
+//
+// called whenever an instruction is inserted
+//
+void
+IRNoteInsert(IRList *irl)
+{
+    if (activeRefs && activeRefs->irl == irl) {
+        ClearRefIndex(activeRefs);
+    }
+}
+
 /*
  * return TRUE if the operand's value does not need to be preserved
  * after instruction instr
@@ -1129,7 +1717,7 @@ doIsDeadAfter(IR *instr, Operand *op, int level, IR **stack)
         // give up!
         return false;
     }
-    for (ir = instr->next; ir; ir = ir->next) {
+    for (ir = NextRefAfter(instr, op, NULL, stack[0], NULL); ir; ir = NextRefAfter(ir, op, NULL, stack[0], NULL)) {
         if (InstrUses(ir, op) && !IsDummy(ir)) {
             // value is used, so definitely not dead
             // well, unless the value is used only to update itself:
@@ -1278,19 +1866,701 @@ done:
     }
 }
 
-bool
-IRIsDeadAfter(IR *instr, Operand *op)
+/*
+ * Liveness analysis
+ *
+ * For passes that ask IsDeadAfter about most of the instructions in a
+ * function, the forward scan above is quadratic. Instead the live
+ * registers after every instruction can be computed once, by the
+ * usual backward data flow over the basic blocks, with one bit per
+ * register; IsDeadAfter is then a table lookup.
+ *
+ * The rules for what uses and what kills a register are the same as
+ * in doIsDeadAfter, but every path is followed, so some registers are
+ * found dead that the scan has to give up on.
+ *
+ * The results are only valid while the function is unchanged, so a
+ * pass must only use them (via BeginLiveness/EndLiveness) if it does
+ * not make any register live that was dead: deleting instructions is
+ * fine, but replacing one register with another is not.
+ */
+
+typedef uint32_t LiveWord;
+#define LIVE_BITS 32
+
+// upper limit on the size of the tables, in words; bigger functions
+// use the scan
+#define MAX_LIVE_WORDS (16*1024*1024)
+
+typedef struct IRLiveness {
+    IRList *irl;
+    bool computed;
+    bool valid;         // false if the function was too big
+    IRCfg *cfg;
+    int nregs;
+    int words;          // words per set of registers
+    Operand **regs;
+    int *sameName;      // next register with the same name, or -1
+    int *cand;          // room for CandidateRegs (nregs + 2 entries)
+    PtrMap regMap;      // Operand -> register index
+    PtrMap nameMap;     // register name -> first register index
+    unsigned char *partial; // registers accessed as sub-registers
+    LiveWord *globals;  // registers which are live across calls
+    LiveWord *atExit;   // registers which are live at the end
+    LiveWord *liveOut;  // ninstrs sets: live registers after each instruction
+} IRLiveness;
+
+static THREAD_LOCAL IRLiveness *activeLiveness;
+
+#define LIVESET(L, i) ((L)->liveOut + (size_t)(i) * (L)->words)
+#define SETBIT(set, r) ((set)[(r) / LIVE_BITS] |= (LiveWord)1 << ((r) % LIVE_BITS))
+#define CLRBIT(set, r) ((set)[(r) / LIVE_BITS] &= ~((LiveWord)1 << ((r) % LIVE_BITS)))
+#define TSTBIT(set, r) (((set)[(r) / LIVE_BITS] >> ((r) % LIVE_BITS)) & 1)
+
+static void
+AddLiveReg(IRLiveness *L, Operand *op)
 {
-    IR *stack[MAX_FOLLOWED_JUMPS];
-    stack[0] = instr;
-    return doIsDeadAfter(instr, op, 1, stack);
+    Operand *base = BaseReg(op);
+    int r;
+
+    if (!base || !IsRegister(base->kind) || base->kind == REG_HW || base->kind == REG_SUBREG) {
+        return;
+    }
+    r = PtrMapGet(&L->regMap, base);
+    if (r < 0) {
+        r = L->nregs++;
+        PtrMapPut(&L->regMap, base, r);
+        L->regs[r] = base;
+    }
+    if (op != base) {
+        L->partial[r] = 1;
+    }
 }
 
-static IR*
-SafeToReplaceBack(IR *instr, Operand *orig, Operand *replace)
+// registers ir might refer to; at most L->nregs + 2 of them
+static int
+CandidateRegs(IRLiveness *L, IR *ir, int *cand)
 {
-    IR *last_ir = NULL;
-    int usecount = 0;
+    int n = 0;
+    int r;
+    Operand *op;
+
+    if ( (r = PtrMapGet(&L->regMap, BaseReg(ir->dst))) >= 0) cand[n++] = r;
+    if ( (r = PtrMapGet(&L->regMap, BaseReg(ir->src))) >= 0) cand[n++] = r;
+    // an immediate address refers to the register by name
+    op = ir->src;
+    if (!op || op->kind != IMM_COG_LABEL) {
+        op = (ir->opc == OPC_MOVD) ? ir->dst : NULL;
+    }
+    if (op && op->kind == IMM_COG_LABEL && op->name) {
+        for (r = PtrMapGet(&L->nameMap, op->name); r >= 0; r = L->sameName[r]) {
+            cand[n++] = r;
+        }
+    }
+    return n;
+}
+
+//
+// find the registers ir kills and the ones it makes live, so that
+// live before = (live after - kill) + gen
+//
+static void
+InstrLiveEffect(IRLiveness *L, IR *ir, LiveWord *kill, LiveWord *gen)
+{
+    int *cand = L->cand;
+    int n, i, r;
+    Operand *reg;
+
+    memset(kill, 0, L->words * sizeof(LiveWord));
+    memset(gen, 0, L->words * sizeof(LiveWord));
+    if (IsDummy(ir)) {
+        return;
+    }
+    if (ir->opc == OPC_CALL) {
+        // see the OPC_CALL case in doIsDeadAfter
+        for (r = 0; r < L->nregs; r++) {
+            reg = L->regs[r];
+            if (IsLocal(reg)) {
+                continue;
+            }
+            if (IsArg(reg)) {
+                if (!FuncUsesArg(ir->dst, reg)) {
+                    /* not touched */
+                } else if (!FuncUsesArgEx(ir->dst, reg, true)) {
+                    SETBIT(kill, r);
+                } else {
+                    SETBIT(gen, r);
+                }
+            } else if (isResult(reg)) {
+                if (isMulDivFunc(ir->dst) || (putcogreg && ir->dst == putcogreg)) {
+                    /* not touched */
+                } else if (ir->cond == COND_TRUE) {
+                    SETBIT(kill, r);
+                }
+            }
+        }
+        for (i = 0; i < L->words; i++) {
+            gen[i] |= L->globals[i];
+        }
+    }
+    n = CandidateRegs(L, ir, cand);
+    // kills
+    for (i = 0; i < n; i++) {
+        r = cand[i];
+        reg = L->regs[r];
+        // movd only changes part of the register
+        if (InstrModifies(ir, reg) && !InstrUses(ir, reg) && ir->opc != OPC_MOVD
+            && ir->cond == COND_TRUE && !L->partial[r]
+            && !(ir->dst && ir->dst->kind == REG_SUBREG))
+        {
+            SETBIT(kill, r);
+            CLRBIT(gen, r);
+        }
+    }
+    // uses
+    for (i = 0; i < n; i++) {
+        r = cand[i];
+        reg = L->regs[r];
+        if (InstrUses(ir, reg)) {
+            // a value used only to update itself is not needed
+            if (ir->dst == reg && !InstrSetsAnyFlags(ir) && IsSafeALUOp(ir->opc)) {
+                continue;
+            }
+            SETBIT(gen, r);
+        }
+    }
+    if ( (r = PtrMapGet(&L->regMap, BaseReg(ir->src2))) >= 0) {
+        SETBIT(gen, r);
+    }
+}
+
+static void
+ComputeLiveness(IRLiveness *L)
+{
+    IRCfg *cfg;
+    IR *ir;
+    int n, i, j, b, r, nblocks;
+    LiveWord *kill, *gen, *bkill, *bgen, *bin, *bout, *x;
+    bool changed;
+    size_t nwords;
+
+    L->computed = true;
+    L->cfg = cfg = GetIRCfg(L->irl);
+    n = cfg->ninstrs;
+    nblocks = cfg->nblocks;
+
+    // number the registers
+    L->regs = (Operand **)malloc((3*n+1) * sizeof(Operand *));
+    L->partial = (unsigned char *)calloc(3*n+1, 1);
+    PtrMapInit(&L->regMap, 3*n);
+    for (i = 0; i < n; i++) {
+        ir = cfg->instrs[i];
+        if (!IsDummy(ir)) {
+            AddLiveReg(L, ir->dst);
+            AddLiveReg(L, ir->src);
+            AddLiveReg(L, ir->src2);
+        }
+    }
+    L->words = (L->nregs + LIVE_BITS - 1) / LIVE_BITS;
+    nwords = (size_t)(n + 1) * L->words;
+    if (L->nregs == 0 || nwords > MAX_LIVE_WORDS) {
+        return;
+    }
+    L->sameName = (int *)malloc(L->nregs * sizeof(int));
+    L->cand = (int *)malloc((L->nregs + 2) * sizeof(int));
+    PtrMapInit(&L->nameMap, L->nregs);
+    for (r = L->nregs - 1; r >= 0; --r) {
+        const char *name = OperandHasName(L->regs[r]->kind) ? L->regs[r]->name : NULL;
+        L->sameName[r] = -1;
+        if (!name) continue;
+        L->sameName[r] = PtrMapGet(&L->nameMap, name);
+        PtrMapPut(&L->nameMap, name, r);
+    }
+    L->globals = (LiveWord *)calloc(L->words, sizeof(LiveWord));
+    L->atExit = (LiveWord *)calloc(L->words, sizeof(LiveWord));
+    for (r = 0; r < L->nregs; r++) {
+        Operand *reg = L->regs[r];
+        if (!IsLocal(reg) && !IsArg(reg) && !isResult(reg)) {
+            SETBIT(L->globals, r);
+        }
+        if (isResult(reg)) {
+            if (reg->val < curfunc->numresults) {
+                SETBIT(L->atExit, r);
+            }
+        } else if (!IsLocalOrArg(reg)) {
+            SETBIT(L->atExit, r);
+        }
+    }
+
+    // summarize each block
+    kill = (LiveWord *)malloc(2 * L->words * sizeof(LiveWord));
+    gen = kill + L->words;
+    bkill = (LiveWord *)calloc((size_t)nblocks * L->words * 4, sizeof(LiveWord));
+    bgen = bkill + (size_t)nblocks * L->words;
+    bin = bgen + (size_t)nblocks * L->words;
+    bout = bin + (size_t)nblocks * L->words;
+    for (b = 0; b < nblocks; b++) {
+        LiveWord *K = bkill + (size_t)b * L->words;
+        LiveWord *G = bgen + (size_t)b * L->words;
+        for (i = cfg->blocks[b].end - 1; i >= cfg->blocks[b].start; --i) {
+            InstrLiveEffect(L, cfg->instrs[i], kill, gen);
+            for (j = 0; j < L->words; j++) {
+                K[j] |= kill[j];
+                G[j] = (G[j] & ~kill[j]) | gen[j];
+            }
+        }
+    }
+
+    // solve for the registers live out of each block
+    do {
+        changed = false;
+        for (b = nblocks - 1; b >= 0; --b) {
+            IRBlock *blk = &cfg->blocks[b];
+            LiveWord *out = bout + (size_t)b * L->words;
+            LiveWord *in = bin + (size_t)b * L->words;
+            LiveWord *K = bkill + (size_t)b * L->words;
+            LiveWord *G = bgen + (size_t)b * L->words;
+            for (i = 0; i < blk->nsucc; i++) {
+                int s = blk->succ[i];
+                for (j = 0; j < L->words; j++) {
+                    LiveWord w;
+                    if (s == CFG_UNKNOWN) {
+                        w = ~(LiveWord)0;
+                    } else if (s == CFG_EXIT) {
+                        w = L->atExit[j];
+                    } else {
+                        w = bin[(size_t)s * L->words + j];
+                    }
+                    out[j] |= w;
+                }
+            }
+            for (j = 0; j < L->words; j++) {
+                LiveWord w = (out[j] & ~K[j]) | G[j];
+                if (w != in[j]) {
+                    in[j] = w;
+                    changed = true;
+                }
+            }
+        }
+    } while (changed);
+
+    // and finally the registers live after each instruction
+    L->liveOut = (LiveWord *)malloc(nwords * sizeof(LiveWord));
+    for (b = 0; b < nblocks; b++) {
+        x = bout + (size_t)b * L->words;
+        for (i = cfg->blocks[b].end - 1; i >= cfg->blocks[b].start; --i) {
+            memcpy(LIVESET(L, i), x, L->words * sizeof(LiveWord));
+            InstrLiveEffect(L, cfg->instrs[i], kill, gen);
+            for (j = 0; j < L->words; j++) {
+                x[j] = (x[j] & ~kill[j]) | gen[j];
+            }
+        }
+    }
+    L->valid = true;
+
+    free(kill);
+    free(bkill);
+}
+
+//
+// start using liveness information for irl; it is computed the first
+// time it is needed
+//
+static IRLiveness *
+BeginLiveness(IRList *irl)
+{
+    IRLiveness *L = (IRLiveness *)calloc(1, sizeof(IRLiveness));
+    L->irl = irl;
+    activeLiveness = L;
+    return L;
+}
+
+static void
+EndLiveness(IRLiveness *L)
+{
+    activeLiveness = NULL;
+    if (L->computed) {
+        free(L->regs);
+        free(L->partial);
+        free(L->sameName);
+        free(L->cand);
+        free(L->globals);
+        free(L->atExit);
+        free(L->liveOut);
+        PtrMapFree(&L->regMap);
+        if (L->sameName) {
+            PtrMapFree(&L->nameMap);
+        }
+    }
+    free(L);
+}
+
+//
+// returns 1 if op is dead after instr, 0 if it is live, or -1 if
+// the liveness information does not cover it
+//
+static int
+LivenessDeadAfter(IRLiveness *L, IR *instr, Operand *op)
+{
+    int i, r;
+
+    if (!L->computed) {
+        ComputeLiveness(L);
+    }
+    if (!L->valid) {
+        return -1;
+    }
+    r = PtrMapGet(&L->regMap, BaseReg(op));
+    if (r < 0) {
+        return -1;
+    }
+    i = IRCfgInstrIndex(L->cfg, instr);
+    if (i < 0) {
+        return -1;
+    }
+    return !TSTBIT(LIVESET(L, i), r);
+}
+
+bool
+IRIsDeadAfter(IR *instr, Operand *op)
+{
+    IR *stack[MAX_FOLLOWED_JUMPS];
+    int dead;
+
+    if (activeLiveness && op->kind != REG_HW && (dead = LivenessDeadAfter(activeLiveness, instr, op)) >= 0) {
+        return dead;
+    }
+    stack[0] = instr;
+    return doIsDeadAfter(instr, op, 1, stack);
+}
+
+/*
+ * Register allocation for locals (-Oregalloc)
+ *
+ * Normally RenameLocalRegs gives every local of a function a register
+ * of its own. With -Oregalloc the locals are colored instead, using the
+ * liveness information above: two locals may share a register unless
+ * one of them is written while the other is live. A function then needs
+ * only as many registers as it has values live at the same time.
+ *
+ * In a function which calls others, the locals that are never live
+ * across a call may also go in the scratch registers (_varNN) which the
+ * leaf functions use for their locals. No value in those registers is
+ * ever live across a call, so they need not be saved and restored, and
+ * all the functions in the program share them.
+ *
+ * A local that is reached other than as a plain register operand (by
+ * name, through a pointer, or by a block transfer) keeps a register of
+ * its own, which is never a scratch one.
+ */
+
+// functions with more locals than this get a register for each one
+#define MAX_ALLOC_LOCALS 4096
+
+static void AssignTemporaryAddresses(IRList *irl, Operand *retlabel);
+static int CheckLabelUsage(IRList *irl);
+
+typedef struct NamedOperand {
+    const char *name;
+    Operand *op;
+} NamedOperand;
+
+static int
+CompareNamedOperands(const void *a, const void *b)
+{
+    const NamedOperand *x = (const NamedOperand *)a;
+    const NamedOperand *y = (const NamedOperand *)b;
+    return strcmp(x->name, y->name);
+}
+
+// can ir run code which uses the scratch registers?
+static bool
+IsCallPoint(IR *ir)
+{
+    switch (ir->opc) {
+    case OPC_CALL:
+        return !isMulDivFunc(ir->dst);
+    case OPC_GENERIC_BRANCH:
+    case OPC_GENERIC_BRCOND:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static void
+AddAllocLocal(LocalRegAlloc *A, PtrMap *map, Operand *op)
+{
+    if (!op || op->kind == REG_SUBREG || !IsLocal(op) || PtrMapGet(map, op) >= 0) {
+        return;
+    }
+    PtrMapPut(map, op, A->nlocals);
+    A->locals[A->nlocals++] = op;
+}
+
+static void
+PinAllocLocal(PtrMap *map, unsigned char *pinned, Operand *op)
+{
+    int x = op ? PtrMapGet(map, op) : -1;
+    if (x >= 0) {
+        pinned[x] = 1;
+    }
+}
+
+//
+// pin the locals which something other than a plain register operand
+// may refer to
+//
+static void
+PinIndirectLocals(IRList *irl, PtrMap *map, unsigned char *pinned)
+{
+    NamedOperand *names;
+    size_t nnames = 0, maxnames = 0, i, j, k;
+    Operand *ops[2];
+    IR *ir;
+    bool blockXfer = false;
+
+    for (ir = irl->head; ir; ir = ir->next) {
+        maxnames += 2;
+    }
+    names = (NamedOperand *)malloc(maxnames * sizeof(NamedOperand) + 1);
+    for (ir = irl->head; ir; ir = ir->next) {
+        if (IsDummy(ir)) continue;
+        ops[0] = ir->dst;
+        ops[1] = ir->src;
+        for (i = 0; i < 2; i++) {
+            if (!ops[i]) continue;
+            if (ops[i]->kind == COGMEM_REF) {
+                PinAllocLocal(map, pinned, (Operand *)ops[i]->name);
+            } else if (OperandHasName(ops[i]->kind) && ops[i]->name) {
+                names[nnames].name = ops[i]->name;
+                names[nnames++].op = ops[i];
+            }
+            // the instruction after a setq may transfer a block of registers
+            if (blockXfer || ops[i]->size > LONG_SIZE) {
+                PinAllocLocal(map, pinned, ops[i]);
+            }
+        }
+        PinAllocLocal(map, pinned, ir->src2);
+        blockXfer = (ir->opc == OPC_SETQ || ir->opc == OPC_SETQ2);
+    }
+    // renaming a register also renames other operands with its name
+    qsort(names, nnames, sizeof(NamedOperand), CompareNamedOperands);
+    for (i = 0; i < nnames; i = j) {
+        bool shared = false;
+        for (j = i + 1; j < nnames && !strcmp(names[i].name, names[j].name); j++) {
+            if (names[j].op != names[i].op) {
+                shared = true;
+            }
+        }
+        if (shared) {
+            for (k = i; k < j; k++) {
+                PinAllocLocal(map, pinned, names[k].op);
+            }
+        }
+    }
+    free(names);
+}
+
+// add an edge between x and every local live in set (except "except")
+static void
+AddInterference(IRLiveness *L, LiveWord *matrix, int words, const int *localOf,
+                const LiveWord *set, int x, int except)
+{
+    int j, b, y;
+    LiveWord w;
+
+    for (j = 0; j < L->words; j++) {
+        for (w = set[j], b = 0; w; w >>= 1, b++) {
+            if (!(w & 1)) continue;
+            y = localOf[j * LIVE_BITS + b];
+            if (y < 0 || y == x || y == except) continue;
+            SETBIT(matrix + (size_t)x * words, y);
+            SETBIT(matrix + (size_t)y * words, x);
+        }
+    }
+}
+
+//
+// choose registers for the locals of irl, which must be the body of
+// curfunc; if useScratch is set, locals which are not live across
+// calls go in scratch registers. Returns false (with nothing
+// allocated) if the function is not suitable.
+//
+bool
+AllocateLocalRegs(IRList *irl, bool useScratch, LocalRegAlloc *A)
+{
+    IRLiveness *L;
+    IRCfg *cfg;
+    IR *ir;
+    PtrMap localMap;
+    size_t maxlocals = 0;
+    int *localOf = NULL;    // liveness register -> local, or -1
+    int *partner = NULL;    // a local moved to or from this one, or -1
+    int *stamp = NULL;      // colors seen while coloring a local
+    unsigned char *pinned, *crossing;
+    LiveWord *matrix = NULL;
+    int n, words, i, x, y, r, c, b, j, except;
+    LiveWord w;
+    bool ok = false;
+
+    memset(A, 0, sizeof(*A));
+    for (ir = irl->head; ir; ir = ir->next) {
+        maxlocals += 2;
+    }
+    if (maxlocals == 0) {
+        return false;
+    }
+    A->locals = (Operand **)malloc(maxlocals * sizeof(Operand *));
+    PtrMapInit(&localMap, maxlocals);
+    for (ir = irl->head; ir; ir = ir->next) {
+        if (!IsDummy(ir)) {
+            AddAllocLocal(A, &localMap, ir->dst);
+            AddAllocLocal(A, &localMap, ir->src);
+        }
+    }
+    n = A->nlocals;
+    if (n == 0 || n > MAX_ALLOC_LOCALS) {
+        PtrMapFree(&localMap);
+        FreeLocalRegAlloc(A);
+        return false;
+    }
+    A->color = (int *)malloc(n * sizeof(int));
+    A->scratch = (bool *)calloc(n, sizeof(bool));
+    pinned = (unsigned char *)calloc(2 * n, 1);
+    crossing = pinned + n;
+    PinIndirectLocals(irl, &localMap, pinned);
+
+    // the control flow graph needs the jumps matched up with their labels
+    InvalidateIRCfg();
+    AssignTemporaryAddresses(irl, FuncData(curfunc)->asmreturnlabel);
+    CheckLabelUsage(irl);
+    L = BeginLiveness(irl);
+    ComputeLiveness(L);
+    if (!L->valid) {
+        goto done;
+    }
+    cfg = L->cfg;
+    localOf = (int *)malloc((size_t)L->words * LIVE_BITS * sizeof(int));
+    for (r = 0; r < L->words * LIVE_BITS; r++) {
+        localOf[r] = -1;
+    }
+    for (x = 0; x < n; x++) {
+        r = PtrMapGet(&L->regMap, A->locals[x]);
+        if (r < 0 || L->partial[r]) {
+            pinned[x] = 1;
+        }
+        if (r >= 0) {
+            localOf[r] = x;
+        }
+    }
+
+    // build the interference graph, and find the locals live across calls
+    words = (n + LIVE_BITS - 1) / LIVE_BITS;
+    matrix = (LiveWord *)calloc((size_t)n * words, sizeof(LiveWord));
+    partner = (int *)malloc(n * sizeof(int));
+    for (x = 0; x < n; x++) {
+        partner[x] = -1;
+    }
+    for (i = 0; i < cfg->ninstrs; i++) {
+        LiveWord *live = LIVESET(L, i);
+        ir = cfg->instrs[i];
+        if (IsDummy(ir)) continue;
+        if (IsCallPoint(ir)) {
+            for (j = 0; j < L->words; j++) {
+                for (w = live[j], b = 0; w; w >>= 1, b++) {
+                    if ((w & 1) && (x = localOf[j * LIVE_BITS + b]) >= 0) {
+                        crossing[x] = 1;
+                    }
+                }
+            }
+        }
+        if (ir->dst && (x = PtrMapGet(&localMap, ir->dst)) >= 0 && InstrModifies(ir, ir->dst)) {
+            except = -1;
+            // after "mov x, y" the two hold the same value
+            if (ir->opc == OPC_MOV && ir->cond == COND_TRUE && ir->src
+                && (except = PtrMapGet(&localMap, ir->src)) >= 0)
+            {
+                if (partner[x] < 0) partner[x] = except;
+                if (partner[except] < 0) partner[except] = x;
+            }
+            AddInterference(L, matrix, words, localOf, live, x, except);
+        }
+        if (ir->src && (x = PtrMapGet(&localMap, ir->src)) >= 0 && InstrModifies(ir, ir->src)) {
+            AddInterference(L, matrix, words, localOf, live, x, -1);
+        }
+    }
+
+    // now color the graph greedily, in order of first appearance
+    stamp = (int *)calloc(2 * (n + 1), sizeof(int));
+    for (x = 0; x < n; x++) {
+        A->color[x] = -1;
+    }
+    for (x = 0; x < n; x++) {
+        int *seen;
+        if (pinned[x]) continue;
+        A->scratch[x] = useScratch && !crossing[x];
+        seen = stamp + (A->scratch[x] ? n + 1 : 0);
+        for (j = 0; j < words; j++) {
+            for (w = matrix[(size_t)x * words + j], b = 0; w; w >>= 1, b++) {
+                y = j * LIVE_BITS + b;
+                if ((w & 1) && A->color[y] >= 0 && A->scratch[y] == A->scratch[x]) {
+                    seen[A->color[y]] = x + 1;
+                }
+            }
+        }
+        y = partner[x];
+        if (y >= 0 && A->color[y] >= 0 && A->scratch[y] == A->scratch[x]
+            && seen[A->color[y]] != x + 1)
+        {
+            c = A->color[y];
+        } else {
+            for (c = 0; seen[c] == x + 1; c++)
+                ;
+        }
+        A->color[x] = c;
+        if (A->scratch[x]) {
+            if (c >= A->nscratch) A->nscratch = c + 1;
+        } else {
+            if (c >= A->ncolors) A->ncolors = c + 1;
+        }
+    }
+    for (x = 0; x < n; x++) {
+        if (pinned[x]) {
+            A->color[x] = A->ncolors++;
+        }
+    }
+    ok = true;
+
+done:
+    EndLiveness(L);
+    InvalidateIRCfg();
+    PtrMapFree(&localMap);
+    free(localOf);
+    free(partner);
+    free(stamp);
+    free(matrix);
+    free(pinned);
+    if (!ok) {
+        FreeLocalRegAlloc(A);
+    }
+    return ok;
+}
+
+void
+FreeLocalRegAlloc(LocalRegAlloc *A)
+{
+    free(A->locals);
+    free(A->color);
+    free(A->scratch);
+    memset(A, 0, sizeof(*A));
+}
+
+static IR*
+SafeToReplaceBack(IRList *irl, IR *instr, Operand *orig, Operand *replace)
+{
+    IR *last_ir = NULL;
+    int usecount = 0;
 
     if (SrcOnlyHwReg(replace) || !IsRegister(replace->kind))
         return NULL;
@@ -1321,7 +2591,7 @@ SafeToReplaceBack(IR *instr, Operand *orig, Operand *replace)
             if (!(curfunc->optimize_flags & OPT_EXPERIMENTAL) || IsHwReg(replace)) {
                 // Safety fail
                 goto fail;
-            } else if (IsForwardJump(ir)) {
+            } else if (IsForwardJump(irl, ir)) {
                 // Could probably also handle down labels in separate list...
                 goto fail;
             } else {
@@ -1395,7 +2665,7 @@ SrcOnlyHwReg(Operand *orig)
 // or NULL if replacement is unsafe
 //
 static IR*
-SafeToReplaceForward(IR *first_ir, Operand *orig, Operand *replace, IRCond setterCond)
+SafeToReplaceForward(IRList *irl, IR *first_ir, Operand *orig, Operand *replace, IRCond setterCond)
 {
     IR *ir;
     IR *last_ir = NULL;
@@ -1424,7 +2694,9 @@ SafeToReplaceForward(IR *first_ir, Operand *orig, Operand *replace, IRCond sette
         return first_ir;
     }
 #endif
-    for (ir = first_ir; ir; ir = ir->next) {
+    // instructions that mention neither orig nor replace only update
+    // last_ir, so if the condition does not matter we can skip them
+    for (ir = first_ir; ir; ir = isCond ? ir->next : NextRefAfter(ir, orig, replace, NULL, &last_ir)) {
         if (IsDummy(ir)) {
             continue;
         }
@@ -1435,10 +2707,10 @@ SafeToReplaceForward(IR *first_ir, Operand *orig, Operand *replace, IRCond sette
             assignments_are_safe = false;
         }
 #endif
-        if (ir->opc == OPC_LIVE && !strcmp(orig->name, ir->dst->name)) {
+        if (ir->opc == OPC_LIVE && orig->name == ir->dst->name) {
             return NULL;
         }
-        if (ir->opc == OPC_LIVE && !strcmp(replace->name, ir->dst->name)) {
+        if (ir->opc == OPC_LIVE && replace->name == ir->dst->name) {
             return NULL;
         }
         if (ir->opc == OPC_RET && !(ir->flags & FLAG_USER_FCACHE)) {
@@ -1472,10 +2744,10 @@ SafeToReplaceForward(IR *first_ir, Operand *orig, Operand *replace, IRCond sette
             if (ir->aux && IsDeadAfter((IR *)ir->aux,replace) && IsDeadAfter((IR *)ir->aux,orig)) {
                 // both regs are dead after branch, so we don't care
             } else {
-                if (!JumpIsAfterOrEqual(first_ir, ir)) {
+                if (!JumpIsAfterOrEqual(irl, first_ir, ir)) {
                     return NULL;
                 }
-                if (assignments_are_safe && IsForwardJump(ir) && ir->aux) {
+                if (assignments_are_safe && IsForwardJump(irl, ir) && ir->aux) {
                     IR *jmpdst = (IR *)ir->aux;
                     assignments_are_safe = IsDeadAfter(jmpdst, orig);
                 } else {
@@ -1599,23 +2871,37 @@ ReplaceBack(IR *instr, Operand *orig, Operand *replace, IR *stop_ir)
     IR *ir;
     for (ir = instr; ir; ir = ir->prev) {
         if (ir->dst == orig) ir->dst = replace;
-        if (ir == stop_ir) break;
+        if (ir == stop_ir) {
+            RefIndexNote(ir);
+            break;
+        }
         if (ir->src == orig) ir->src = replace;
+        RefIndexNote(ir);
     }
 }
 
 static void
 ReplaceForward(IR *instr, Operand *orig, Operand *replace, IR *stop_ir)
 {
-    IR *ir;
-    for (ir = instr; ir; ir = ir->next) {
+    IR *ir, *next;
+    int stop;
+    for (ir = instr; ir; ir = next) {
         if (ir->src == orig) {
             ir->src = replace;
+            RefIndexNote(ir);
         }
         if (ir->dst == orig) {
             ir->dst = replace;
+            RefIndexNote(ir);
         }
         if (ir == stop_ir) break;
+        next = ir->next;
+        // skip over instructions that do not mention orig
+        stop = stop_ir ? RefPos(stop_ir) : INT_MAX;
+        if (stop >= 0 && RefPos(ir) >= 0) {
+            next = NextRefAfter(ir, orig, NULL, NULL, NULL);
+            if (next && RefPos(next) > stop) break;
+        }
     }
 }
 
@@ -2059,9 +3345,26 @@ static bool
 IsOnlySetterFor(IRList *irl, IR *orig_ir, Operand *orig)
 {
     IR *ir;
+    IRRefList *lists[2];
+    int i, j;
     if (!IsLocal(orig)) {
         return false;
     }
+    if (RefListsFor(orig, lists)) {
+        // only the instructions which mention orig can modify it
+        for (i = 0; i < 2; i++) {
+            for (j = 0; lists[i] && j < lists[i]->n; j++) {
+                ir = lists[i]->refs[j].ir;
+                if (ir == orig_ir || !RefIsLinked(activeRefs, ir) || IsDummy(ir) || IsLabel(ir)) {
+                    continue;
+                }
+                if (InstrModifies(ir, orig)) {
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
     for (ir = irl->head; ir; ir = ir->next) {
         if (IsDummy(ir) || IsLabel(ir)) {
             continue;
@@ -2093,7 +3396,7 @@ PropagateConstForward(IRList *irl, IR *orig_ir, Operand *orig, Operand *immval)
     }
 
     unconditional = IsOnlySetterFor(irl, orig_ir, orig);
-    for (ir = orig_ir->next; ir; ir = ir->next) {
+    for (ir = NextRefAfter(orig_ir, orig, NULL, NULL, NULL); ir; ir = NextRefAfter(ir, orig, NULL, NULL, NULL)) {
         if (IsDummy(ir)) {
             continue;
         }
@@ -2105,7 +3408,7 @@ PropagateConstForward(IRList *irl, IR *orig_ir, Operand *orig, Operand *immval)
                 return change;
             }
         }
-        if (IsJump(ir) && !JumpIsAfterOrEqual(orig_ir, ir)) {
+        if (IsJump(ir) && !JumpIsAfterOrEqual(irl, orig_ir, ir)) {
             if (unconditional) {
                 continue;
             }
@@ -2127,8 +3430,10 @@ PropagateConstForward(IRList *irl, IR *orig_ir, Operand *orig, Operand *immval)
             } else if (ir->dst == orig) {
                 // we can perhaps replace the operation with a mov
                 change |= TransformConstDst(irl, ir, immval);
+                RefIndexNote(ir);
             } else if (ir->src == orig) {
                 ir->src = immval;
+                RefIndexNote(ir);
                 change = 1;
             }
         }
@@ -2450,12 +3755,19 @@ OptimizeMoves(IRList *irl)
     int change;
     int everchange = 0;
     int32_t cval;
+    IRLiveness *live = BeginLiveness(irl);
+    IRRefIndex *refs = BeginRefIndex(irl);
 
     do {
         change = 0;
         ir = irl->head;
         while (ir) {
             ir_next = ir->next;
+            if (change && live) {
+                // the code no longer matches the liveness information
+                EndLiveness(live);
+                live = NULL;
+            }
             if (InstrIsVolatile(ir)) {
                 /* do nothing */
             } else if (ir->opc == OPC_MOV && ir->src == ir->dst) {
@@ -2489,6 +3801,10 @@ OptimizeMoves(IRList *irl)
                         change |= 1;
                     };
                 }
+                if (change && live) {
+                    EndLiveness(live);
+                    live = NULL;
+                }
                 change |= (sawchange = PropagateConstForward(irl, ir, ir->dst, ir->src));
                 if (sawchange && !InstrSetsAnyFlags(ir) && IsDeadAfter(ir, ir->dst)) {
                     // we no longer need the original mov
@@ -2498,12 +3814,12 @@ OptimizeMoves(IRList *irl)
                 if (ir->src == ir->dst && !InstrSetsAnyFlags(ir)) {
                     DeleteIR(irl, ir);
                     change = 1;
-                } else if (!InstrSetsAnyFlags(ir) && ir->cond == COND_TRUE && IsDeadAfter(ir, ir->src) && (stop_ir = SafeToReplaceBack(ir->prev, ir->src, ir->dst))) {
+                } else if (!InstrSetsAnyFlags(ir) && ir->cond == COND_TRUE && IsDeadAfter(ir, ir->src) && (stop_ir = SafeToReplaceBack(irl, ir->prev, ir->src, ir->dst))) {
                     ReplaceBack(ir->prev, ir->src, ir->dst, stop_ir);
                     DeleteIR(irl, ir);
                     change = 1;
                 }
-                else if ( !InstrSetsAnyFlags(ir) && 0 != (stop_ir = SafeToReplaceForward(ir->next, ir->dst, ir->src,ir->cond)) ) {
+                else if ( !InstrSetsAnyFlags(ir) && 0 != (stop_ir = SafeToReplaceForward(irl, ir->next, ir->dst, ir->src,ir->cond)) ) {
                     ReplaceForward(ir->next, ir->dst, ir->src, stop_ir);
                     DeleteIR(irl, ir);
                     change = 1;
@@ -2511,6 +3827,7 @@ OptimizeMoves(IRList *irl)
             } else if (isMoveLikeOp(ir) && (stop_ir = FindPrevSetterForReplace(ir,ir->src)) && stop_ir->opc == OPC_MOV
                        && !InstrIsVolatile(stop_ir) && !InstrSetsAnyFlags(stop_ir) && (ir->src==ir->dst||IsDeadAfter(ir,ir->src))) {
                 ir->src = stop_ir->src;
+                RefIndexNote(ir);
                 if (ir->cond == COND_TRUE) DeleteIR(irl,stop_ir);
                 change = 1;
             }
@@ -2518,6 +3835,10 @@ OptimizeMoves(IRList *irl)
         }
         everchange |= change;
     } while (change && 0);
+    if (live) {
+        EndLiveness(live);
+    }
+    EndRefIndex(refs);
     return everchange;
 }
 
@@ -2672,19 +3993,37 @@ MeaninglessMath(IR *ir)
 }
 
 //
-// see if all instructions between ir and the label "lab" are
+// see if all instructions skipped by the forward jump "jmp" are
 // conditional, and have condition "cond"
 //
 static bool
-AllInstructionsConditional(IRCond cond, IR *ir, Operand *lab)
+AllInstructionsConditional(IRList *irl, IRCond cond, IR *jmp)
 {
-    while (ir) {
-        if (ir->opc == OPC_LABEL) {
-            if (ir->dst == lab) {
-                return true;
-            }
-            return false; // some other jump may go in here
-        } else if (!IsDummy(ir)) {
+    IRCfg *cfg;
+    IR *ir;
+    int i, j, l, b;
+
+    if (!jmp->aux) {
+        return false;
+    }
+    cfg = GetIRCfg(irl);
+    j = IRCfgInstrIndex(cfg, jmp);
+    l = IRCfgInstrIndex(cfg, (IR *)jmp->aux);
+    if (j < 0 || l <= j) {
+        return false;
+    }
+    // some other jump may go in here if a block in between starts with a label
+    for (b = cfg->blockOf[j] + 1; b < cfg->blockOf[l]; b++) {
+        if (cfg->blocks[b].first->opc == OPC_LABEL) {
+            return false;
+        }
+    }
+    for (i = j + 1; i < l; i++) {
+        ir = cfg->instrs[i];
+        if (cfg->instrs[i-1]->next != ir) {
+            return false; // graph is out of date
+        }
+        if (!IsDummy(ir)) {
             if (InstrSetsAnyFlags(ir)) {
                 return false;
             }
@@ -2692,9 +4031,8 @@ AllInstructionsConditional(IRCond cond, IR *ir, Operand *lab)
                 return false;
             }
         }
-        ir = ir->next;
     }
-    return false;
+    return cfg->instrs[l-1]->next == cfg->instrs[l];
 }
 
 //
@@ -2720,6 +4058,8 @@ int EliminateDeadCode(IRList *irl)
     int change;
     IR *ir, *ir_next;
     int remove_jumps;
+    IRLiveness *live;
+    IRRefIndex *refs;
     change = 0;
 
     if (curfunc) {
@@ -2736,7 +4076,13 @@ int EliminateDeadCode(IRList *irl)
         DeleteIR(irl, ir);
         change = 1;
     }
-    // now look for other dead code
+    // now look for other dead code; this only deletes instructions,
+    // so liveness computed up front stays good enough
+    if (change) {
+        InvalidateIRCfg();
+    }
+    live = BeginLiveness(irl);
+    refs = BeginRefIndex(irl);
     for (ir = irl->head; ir; ir = ir_next) {
         ir_next = ir->next;
 
@@ -2754,7 +4100,7 @@ int EliminateDeadCode(IRList *irl)
             } else if (ir->cond == COND_FALSE) {
                 DeleteIR(irl, ir);
                 change = 1;
-            } else if (ir->dst && !IsRegister(ir->dst->kind) && ir_next && AllInstructionsConditional(InvertCond(ir->cond), ir_next, ir->dst)) {
+            } else if (ir->dst && !IsRegister(ir->dst->kind) && ir_next && AllInstructionsConditional(irl, InvertCond(ir->cond), ir)) {
                 /* if the branch skips over things that already have the right
                     condition, delete it
                 */
@@ -2783,6 +4129,8 @@ int EliminateDeadCode(IRList *irl)
             change = 1;
         }
     }
+    EndRefIndex(refs);
+    EndLiveness(live);
     return change;
 }
 
@@ -2953,12 +4301,12 @@ int OptimizeReturnValues(IRList *irl) {
             for (IR *ir=irl->head;ir;ir=ir->next) {
                 if (ir->src == local) {
                     ir->src = res;
-                } else if (ir->src && ir->src->kind == IMM_COG_LABEL && !strcmp(ir->src->name,local->name)) {
+                } else if (ir->src && ir->src->kind == IMM_COG_LABEL && ir->src->name == local->name) {
                     ir->src = NewOperand(IMM_COG_LABEL,res->name,ir->src->val);
                 } 
                 if (ir->dst == local) {
                     ir->dst = res;
-                } else if (ir->dst && ir->dst->kind == IMM_COG_LABEL && !strcmp(ir->dst->name,local->name)) {
+                } else if (ir->dst && ir->dst->kind == IMM_COG_LABEL && ir->dst->name == local->name) {
                     ir->dst = NewOperand(IMM_COG_LABEL,res->name,ir->dst->val);
                 }
             }
@@ -3346,38 +4694,56 @@ AssignTemporaryAddresses(IRList *irl, Operand *retlabel)
     }
 }
 
+//
+// a reference to an operand by an instruction; CheckLabelUsage sorts
+// these by operand so that each label's references can be found without
+// scanning the whole function again
+//
+typedef struct LabelRef {
+    Operand *op;
+    IR *ir;
+    unsigned seq;   // position of ir in the function
+} LabelRef;
+
+static int
+CompareLabelRefs(const void *a, const void *b)
+{
+    const LabelRef *x = (const LabelRef *)a;
+    const LabelRef *y = (const LabelRef *)b;
+    if (x->op != y->op) {
+        return ((uintptr_t)x->op < (uintptr_t)y->op) ? -1 : 1;
+    }
+    return (x->seq < y->seq) ? -1 : (x->seq > y->seq);
+}
+
 //
 // find out if a label is referenced (perhaps indirectly)
-// if there is a unique jump to it, return a pointer to it
+// if there is a unique jump to it, return a pointer to it;
+// refs[0..n-1] are the references to the label, in order
 //
 static void
-MarkLabelUses(IRList *irl, IR *irlabel)
+MarkLabelUses(IR *irlabel, LabelRef *refs, size_t n)
 {
     IR *ir;
     Operand *label = irlabel->dst;
-    Operand *dst;
+    size_t i;
 
     if (label->used >= 9999) {
         // GOSUB labels get flagged with a large used value so they do not get taken away
         irlabel->flags |= FLAG_LABEL_USED;
     }
-    for (ir = irl->head; ir; ir = ir->next) {
-        if (IsDummy(ir)) continue;
+    for (i = 0; i < n; i++) {
+        ir = refs[i].ir;
         if (IsJump(ir)) {
-            dst = JumpDest(ir);
-            if (dst == label) {
-                ir->aux = irlabel; // record where the jump goes to
-                // Append to list of label uses if not invalidated
-                if (!(irlabel->flags & FLAG_LABEL_USED) || irlabel->aux) {
-                    AppendLblJump(irlabel,ir);
-                    irlabel->flags |= FLAG_LABEL_USED;
-                }
+            ir->aux = irlabel; // record where the jump goes to
+            // Append to list of label uses if not invalidated
+            if (!(irlabel->flags & FLAG_LABEL_USED) || irlabel->aux) {
+                AppendLblJump(irlabel,ir);
+                irlabel->flags |= FLAG_LABEL_USED;
             }
         } else if (ir != irlabel) {
-            if (ir->src == label || ir->dst == label) {
-                irlabel->flags |= FLAG_LABEL_USED;
-                irlabel->aux = NULL; // invalidate use list
-            }
+            irlabel->flags |= FLAG_LABEL_USED;
+            irlabel->aux = NULL; // invalidate use list
         }
     }
 }
@@ -3399,13 +4765,57 @@ static int
 CheckLabelUsage(IRList *irl)
 {
     IR *ir, *ir_next;
-    ir = irl->head;
+    LabelRef *refs, *first, *last, key;
+    size_t nrefs = 0, maxrefs = 0;
+    unsigned seq = 0;
     int change = 0;
 
+    // collect the jump targets and operands of all the instructions
+    for (ir = irl->head; ir; ir = ir->next) {
+        maxrefs += 2;
+    }
+    refs = (LabelRef *)malloc(maxrefs * sizeof(LabelRef) + 1);
+    for (ir = irl->head; ir; ir = ir->next, seq++) {
+        if (IsDummy(ir)) continue;
+        if (IsJump(ir)) {
+            refs[nrefs].op = JumpDest(ir);
+            refs[nrefs].ir = ir;
+            refs[nrefs++].seq = seq;
+        } else {
+            if (ir->src) {
+                refs[nrefs].op = ir->src;
+                refs[nrefs].ir = ir;
+                refs[nrefs++].seq = seq;
+            }
+            if (ir->dst && ir->dst != ir->src) {
+                refs[nrefs].op = ir->dst;
+                refs[nrefs].ir = ir;
+                refs[nrefs++].seq = seq;
+            }
+        }
+    }
+    qsort(refs, nrefs, sizeof(LabelRef), CompareLabelRefs);
+
+    ir = irl->head;
     while (ir) {
         ir_next = ir->next;
         if (ir->opc == OPC_LABEL) {
-            MarkLabelUses(irl, ir);
+            // find the references to this label
+            key.op = ir->dst;
+            key.seq = 0;
+            first = refs;
+            last = refs + nrefs;
+            while (first < last) {
+                LabelRef *mid = first + (last - first) / 2;
+                if (CompareLabelRefs(mid, &key) < 0) {
+                    first = mid + 1;
+                } else {
+                    last = mid;
+                }
+            }
+            for (last = first; last < refs + nrefs && last->op == ir->dst; last++)
+                ;
+            MarkLabelUses(ir, first, last - first);
             if ( IsTemporaryLabel(ir->dst) && !(ir->flags & (FLAG_LABEL_USED|FLAG_KEEP_INSTR))) {
                 DeleteIR(irl, ir);
                 change = 1;
@@ -3413,6 +4823,7 @@ CheckLabelUsage(IRList *irl)
         }
         ir = ir_next;
     }
+    free(refs);
 
     return change;
 }
@@ -3645,7 +5056,7 @@ OptimizePeepholes(IRList *irl)
                 if (opc == OPC_AND && ((oldmask & newmask) == oldmask)) {
                     if (InstrSetsFlags(ir, FLAG_WZ)) {
                         ReplaceOpcode(ir, OPC_CMP);
-                        ir->src->val = 0;
+                        ir->src = NewImmediate(0);
                         changed = 1;
                     } else if (!InstrSetsAnyFlags(ir)) {
                         DeleteIR(irl, ir);
@@ -3655,7 +5066,7 @@ OptimizePeepholes(IRList *irl)
                 } else if (opc == OPC_OR && ((oldmask | newmask) == oldmask)) {
                     if (InstrSetsFlags(ir, FLAG_WZ)) {
                         ReplaceOpcode(ir, OPC_CMP);
-                        ir->src->val = 0;
+                        ir->src = NewImmediate(0);
                         changed = 1;
                     } else if (!InstrSetsAnyFlags(ir)) {
                         DeleteIR(irl, ir);
@@ -4281,7 +5692,7 @@ OptimizeIncDec(IRList *irl)
  * use the name "name". This is needed because some indirect operations
  * create COG labels that don't point back to the original Operand; to
  * de-reference those and convert back to the original we need to search
- * for it
+ * for it; operand names are interned, so "name" is compared by address
  */
 static Operand *
 FindNamedOperand(IRList *irl, const char *name, int val)
@@ -4290,12 +5701,12 @@ FindNamedOperand(IRList *irl, const char *name, int val)
     for (ir = irl->head; ir; ir = ir->next) {
         if (IsDummy(ir) || IsLabel(ir)) continue;
         if (ir->dst && IsRegister(ir->dst->kind) && ir->dst->val == val) {
-            if (!strcmp(ir->dst->name, name)) {
+            if (ir->dst->name == name) {
                 return ir->dst;
             }
         }
         if (ir->src && IsRegister(ir->src->kind) && ir->src->val == val) {
-            if (!strcmp(ir->src->name, name)) {
+            if (ir->src->name == name) {
                 return ir->src;
             }
         }
@@ -4371,10 +5782,10 @@ OptimizeCogWrites(IRList *irl)
             Operand *src = ir->src;
             Operand *dst = ir_next->src;
 
-            if (!strcmp(src->name, ir_prev->dst->name)) {
+            if (src->name == ir_prev->dst->name) {
                 src = ir_prev->dst;
             }
-            if (!strcmp(dst->name, ir_prev->dst->name)) {
+            if (dst->name == ir_prev->dst->name) {
                 dst = ir_prev->dst;
             }
             if (dst->kind == IMM_COG_LABEL) {
@@ -4638,162 +6049,1106 @@ IsNonReadWriteOpcode(IR *ir)
     if (opc < OPC_GENERIC && !IsReadWrite(ir)) {
         return true;
     }
-    return false;
+    return false;
+}
+
+//
+// return true if it's OK to swap IR a and b
+// if a changes b's src, then no
+//
+static bool
+CanSwap(IR *a, IR *b)
+{
+    if (InstrSetsAnyFlags(a) || InstrSetsAnyFlags(b)) return false;
+    if (a->cond != b->cond) return false;
+    if (InstrIsVolatile(a) || InstrIsVolatile(b)) return false;
+    if (IsBranch(a) || IsBranch(b)) return false;
+    if (InstrModifies(a, b->src)) return false;
+    if (InstrModifies(a, b->dst)) return false;
+    if (InstrUses(b, a->dst)) return false;
+    if (InstrModifies(b, a->src)) return false;
+    if (InstrUses(a, b->dst)) return false;
+    return true;
+}
+
+//
+// optimize read/write calls
+//   rdlong a,b
+//   rdlong c,b
+// can become
+//   rdlong a, b
+//   mov    c, a
+// also in:
+//   rdbyte a, b
+//   and a, #255
+// we can skip the "and"
+
+static int
+OptimizeReadWrite(IRList *irl)
+{
+    Operand *base;
+    Operand *dst1;
+    IR *ir;
+    IR *nextread;
+    IR *next_ir, *prev_ir;
+    int change = 0;
+
+restart_check:
+    prev_ir = next_ir = NULL;
+    ir = irl->head;
+    while (ir) {
+        next_ir = ir->next;
+        while (next_ir && IsDummy(next_ir)) {
+            next_ir = next_ir->next;
+        }
+        if (InstrIsVolatile(ir)) {
+            goto get_next;
+        }
+        if (ir->srceffect != OPEFFECT_NONE || ir->dsteffect != OPEFFECT_NONE) {
+            goto get_next;
+        }
+        if (ir->opc == OPC_RDLONG || ir->opc == OPC_WRLONG
+                ||  ir->opc == OPC_RDWORD || ir->opc == OPC_WRWORD
+                ||  ir->opc == OPC_RDBYTE || ir->opc == OPC_WRBYTE) {
+            // don't mess with it if prev instr was OPC_SETQ
+            if (prev_ir && (prev_ir->opc == OPC_SETQ || prev_ir->opc == OPC_SETQ2)) {
+                prev_ir->flags |= FLAG_KEEP_INSTR;
+                goto get_next;
+            }
+            dst1 = ir->dst;
+            base = ir->src;
+            int size = MemoryOpSize(ir);
+            bool write = IsWrite(ir);
+            // don't mess with it if src==dst
+            if (!write && ir->src == ir->dst) goto get_next;
+            nextread = FindNextRead(ir, dst1, base, (curfunc->optimize_flags & OPT_EXPERIMENTAL) && IsMemoryOrderSafe(ir->src));
+            int nextsize = MemoryOpSize(nextread);
+            if (nextread && CondIsSubset(ir->cond,nextread->cond)) {
+                // wrlong a, b ... rdlong c, b  -> mov c, a
+                // rdlong a, b ... rdlong c, b  -> mov c, a
+                if(size == nextsize && (!write || size==4 || gl_p2) 
+                        && ((gl_p2 && size==4) || !InstrSetsFlags(nextread,FLAG_WC))
+                        && (!write || size==4 || !InstrSetsFlags(nextread,FLAG_WZ))) {
+                    nextread->src = dst1;
+                    if (!write || size == 4) {
+                        ReplaceOpcode(nextread, OPC_MOV);
+                    } else if (size == 2) {
+                        ReplaceOpcode(nextread,OPC_GETWORD);
+                        nextread->src2 = NewImmediate(0);
+                    } else if (size == 1) {
+                        ReplaceOpcode(nextread,OPC_GETBYTE);
+                        nextread->src2 = NewImmediate(0);
+                    }
+                    change = 1;
+                    goto get_next;
+                }
+            }
+#if 1
+            // bit of a hacky optimization for some tests
+            // rdlong a, b + mov c, a -> rdlong c, b if a is dead
+            else if (IsRead(ir) && next_ir && next_ir->opc == OPC_MOV
+                    && !InstrIsVolatile(next_ir) && !InstrSetsAnyFlags(next_ir)
+                    && SameRegister(next_ir->src, ir->dst)
+                    && IsLocalOrArg(next_ir->src) && ir->cond == next_ir->cond
+                    && IsDeadAfter(next_ir, ir->dst)) {
+                Operand *tmp = ir->dst;
+                ir->dst = next_ir->dst;
+                next_ir->dst = tmp;
+                ReplaceOpcode(next_ir, OPC_MOV);
+                change = 1;
+                goto get_next;
+            }
+#endif
+        }
+        if (ir->opc == OPC_RDBYTE || ir->opc == OPC_RDWORD) {
+            int32_t mval;
+            dst1 = ir->dst;
+            int mask = ir->opc == OPC_RDBYTE ? 0xFF : 0xFFFF;
+            nextread = FindNextUse(ir, dst1);
+            if (nextread
+                    && nextread->cond == ir->cond
+                    && !FlagsChangeInRange(ir->next,nextread->prev,FlagsUsedByCond(ir->cond))
+                    && nextread->dst == dst1
+                    && (nextread->flags & FLAG_WZ) == nextread->flags
+                    && isMaskingOp(nextread,&mval)
+                    && mval == mask)
+            {
+                // don't need zero extend after rdbyte (change to MOV, gets eliminated next pass)
+                ReplaceOpcode(nextread,OPC_MOV);
+                nextread->src = nextread->dst;
+                change = 1;
+            }
+        }
+        // cut unneccessary bits for immediate write values
+        if (gl_p2 && (ir->opc == OPC_WRBYTE || ir->opc == OPC_WRWORD) && ir->dst && ir->dst->kind == IMM_INT) {
+            int mask = ir->opc == OPC_WRBYTE ? 0xFF : 0xFFFF;
+            if ((ir->dst->val & mask) != ir->dst->val) {
+                ir->dst = NewImmediate(ir->dst->val & mask);
+                change = 1;
+            }
+        }
+#if 1
+        // try to avoid having two read/write ops in a row
+        if (IsReadWrite(ir) && IsReadWrite(next_ir) && IsNonReadWriteOpcode(prev_ir)) {
+            if (CanSwap(ir, prev_ir) && !IsCordicCommand(prev_ir)) {
+                // want to swap prev_ir and ir here
+                DeleteIR(irl, prev_ir);  // remove prev_ir from list
+                prev_ir->next = NULL;
+                InsertAfterIR(irl, ir, prev_ir); // move it to later
+                ir = prev_ir;
+                change = 1;
+                goto restart_check;
+            }
+        }
+#endif
+get_next:
+        prev_ir = ir;
+        ir = next_ir;
+    }
+    return change;
+}
+
+/*
+ * Global value numbering (-Ogvn)
+ *
+ * Finds instructions which compute a value that some register already
+ * holds, anywhere in the function rather than just in straight line
+ * code, and replaces them by a move from that register (or deletes
+ * them, if the destination already holds the value).
+ *
+ * The function is put into SSA form implicitly: a register gets a new
+ * value at each instruction which sets it, and at the blocks in the
+ * iterated dominance frontier of those instructions (where the phi
+ * functions would go). The blocks are then visited in dominator tree
+ * order, so every value a block sees was computed on every path to it
+ * (Briggs, Cooper and Simpson's dominator based value numbering).
+ *
+ * HUB memory is treated as one more register, which gets a new
+ * version at every store and at every instruction the pass does not
+ * understand (calls, waits, locks and so on). A load is keyed on its
+ * address and the memory version, so two loads of the same address
+ * with no store in between get the same value, and a long load right
+ * after a long store to the same address gets the stored value.
+ * Addresses are tracked as a base value plus a constant offset, so
+ * with -Oaggressive-mem a load may also look past stores which cannot
+ * overlap it. Other COGs may change HUB memory, so memory also gets a
+ * new version at the head of every loop, and the pass never keeps a
+ * value across an instruction that waits.
+ */
+
+#define GVN_CONST   (OPC_UNKNOWN + 1)  // key for an integer constant
+#define GVN_OFFSET  (OPC_UNKNOWN + 2)  // key for base value + constant
+#define GVN_MAX_STORE_WALK 8           // stores a load may look past
+
+typedef struct GVNKey {
+    int op;
+    int a, b, c;
+} GVNKey;
+
+// one version of HUB memory
+typedef struct GVNMem {
+    int prev;           // version before the store which made this one, or -1
+    int addr;           // value number of the address stored to
+    int size;
+} GVNMem;
+
+typedef struct GVNUndo {
+    int slot;           // register index, or -(value+1) for a holder
+    int old;
+} GVNUndo;
+
+typedef struct GVNState {
+    IRList *irl;
+    IRCfg *cfg;
+    int nregs;          // hub memory is register number nregs
+    Operand **regs;
+    PtrMap regMap;      // register -> index
+    PtrMap nameMap;     // register name -> index
+    PtrMap constMap;    // label -> value number
+    int *cur;           // current value of each register, version of memory
+
+    // value numbers
+    int nvals, maxvals;
+    int *base;          // value this one is a constant offset from
+    int32_t *offset;
+    int *holder;        // register which last got the value, or -1
+    Operand **imm;      // immediate which has the value, or NULL
+
+    int nmems, maxmems;
+    GVNMem *mems;
+
+    // expression -> value number
+    size_t mask, count;
+    GVNKey *keys;
+    int *vals;
+
+    int nundo, maxundo;
+    GVNUndo *undo;
+} GVNState;
+
+static int
+GVNNewValue(GVNState *S)
+{
+    int v = S->nvals++;
+    if (v >= S->maxvals) {
+        S->maxvals = 2 * S->maxvals + 64;
+        S->base = (int *)realloc(S->base, S->maxvals * sizeof(int));
+        S->offset = (int32_t *)realloc(S->offset, S->maxvals * sizeof(int32_t));
+        S->holder = (int *)realloc(S->holder, S->maxvals * sizeof(int));
+        S->imm = (Operand **)realloc(S->imm, S->maxvals * sizeof(Operand *));
+    }
+    S->base[v] = v;
+    S->offset[v] = 0;
+    S->holder[v] = -1;
+    S->imm[v] = NULL;
+    return v;
+}
+
+static int
+GVNNewMem(GVNState *S, int prev, int addr, int size)
+{
+    int m = S->nmems++;
+    if (m >= S->maxmems) {
+        S->maxmems = 2 * S->maxmems + 64;
+        S->mems = (GVNMem *)realloc(S->mems, S->maxmems * sizeof(GVNMem));
+    }
+    S->mems[m].prev = prev;
+    S->mems[m].addr = addr;
+    S->mems[m].size = size;
+    return m;
+}
+
+static size_t
+GVNHash(const GVNKey *k)
+{
+    size_t h = (size_t)k->op;
+    h = h * 2654435761u + (size_t)k->a;
+    h = h * 2654435761u + (size_t)k->b;
+    h = h * 2654435761u + (size_t)k->c;
+    return h ^ (h >> 15);
+}
+
+static size_t
+GVNSlot(GVNState *S, const GVNKey *k)
+{
+    size_t i = GVNHash(k) & S->mask;
+    while (S->vals[i] >= 0 && memcmp(&S->keys[i], k, sizeof(*k)) != 0) {
+        i = (i + 1) & S->mask;
+    }
+    return i;
+}
+
+static void
+GVNPutKey(GVNState *S, const GVNKey *k, int v)
+{
+    size_t i;
+
+    if (2 * (S->count + 1) > S->mask + 1) {
+        // keep the table at most half full
+        size_t oldsize = S->mask + 1;
+        GVNKey *oldkeys = S->keys;
+        int *oldvals = S->vals;
+        S->mask = 2 * oldsize - 1;
+        S->keys = (GVNKey *)calloc(2 * oldsize, sizeof(GVNKey));
+        S->vals = (int *)malloc(2 * oldsize * sizeof(int));
+        memset(S->vals, 0xff, 2 * oldsize * sizeof(int));
+        for (i = 0; i < oldsize; i++) {
+            if (oldvals[i] >= 0) {
+                size_t j = GVNSlot(S, &oldkeys[i]);
+                S->keys[j] = oldkeys[i];
+                S->vals[j] = oldvals[i];
+            }
+        }
+        free(oldkeys);
+        free(oldvals);
+    }
+    i = GVNSlot(S, k);
+    if (S->vals[i] < 0) {
+        S->count++;
+        S->keys[i] = *k;
+    }
+    S->vals[i] = v;
+}
+
+static GVNKey
+GVNMakeKey(int op, int a, int b, int c)
+{
+    GVNKey k;
+    k.op = op; k.a = a; k.b = b; k.c = c;
+    return k;
+}
+
+// value number for an expression; a new one if it was not seen before
+static int
+GVNLookup(GVNState *S, int op, int a, int b, int c, bool create)
+{
+    GVNKey k = GVNMakeKey(op, a, b, c);
+    size_t i;
+    int v;
+
+    i = GVNSlot(S, &k);
+    if (S->vals[i] >= 0 || !create) {
+        return S->vals[i];
+    }
+    v = GVNNewValue(S);
+    GVNPutKey(S, &k, v);
+    return v;
+}
+
+// record that the expression has value v
+static void
+GVNRecord(GVNState *S, int op, int a, int b, int c, int v)
+{
+    GVNKey k = GVNMakeKey(op, a, b, c);
+    GVNPutKey(S, &k, v);
+}
+
+static void
+GVNLog(GVNState *S, int slot, int old)
+{
+    if (S->nundo == S->maxundo) {
+        S->maxundo = 2 * S->maxundo + 256;
+        S->undo = (GVNUndo *)realloc(S->undo, S->maxundo * sizeof(GVNUndo));
+    }
+    S->undo[S->nundo].slot = slot;
+    S->undo[S->nundo].old = old;
+    S->nundo++;
+}
+
+static void
+GVNUndoTo(GVNState *S, int mark)
+{
+    while (S->nundo > mark) {
+        GVNUndo *u = &S->undo[--S->nundo];
+        if (u->slot >= 0) {
+            S->cur[u->slot] = u->old;
+        } else {
+            S->holder[-u->slot - 1] = u->old;
+        }
+    }
+}
+
+// register r (or memory) now has value v
+static void
+GVNSet(GVNState *S, int r, int v)
+{
+    GVNLog(S, r, S->cur[r]);
+    S->cur[r] = v;
+    if (r < S->nregs && S->holder[v] != r) {
+        GVNLog(S, -v - 1, S->holder[v]);
+        S->holder[v] = r;
+    }
+}
+
+static void
+GVNClobber(GVNState *S, int r)
+{
+    if (r == S->nregs) {
+        GVNSet(S, r, GVNNewMem(S, -1, -1, 0));
+    } else {
+        GVNSet(S, r, GVNNewValue(S));
+    }
+}
+
+// registers the pass follows
+static bool
+GVNTracked(Operand *op)
+{
+    if (!op) return false;
+    switch (op->kind) {
+    case REG_REG:
+    case REG_LOCAL:
+    case REG_TEMP:
+    case REG_ARG:
+    case REG_RESULT:
+    case REG_HUBPTR:
+    case REG_COGPTR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+static int
+GVNRegIndex(GVNState *S, Operand *op)
+{
+    return GVNTracked(op) ? PtrMapGet(&S->regMap, op) : -1;
+}
+
+//
+// value of an operand, or -1 if it is not known; if isSrc is set
+// an immediate may be reused as the source of a move
+//
+static int
+GVNOperandValue(GVNState *S, Operand *op, bool isSrc)
+{
+    int v, r;
+
+    if (!op) return -1;
+    switch (op->kind) {
+    case IMM_INT:
+        v = GVNLookup(S, GVN_CONST, (int32_t)op->val, 0, 0, true);
+        break;
+    case IMM_COG_LABEL:
+    case IMM_HUB_LABEL:
+        v = PtrMapGet(&S->constMap, op);
+        if (v < 0) {
+            v = GVNNewValue(S);
+            PtrMapPut(&S->constMap, op, v);
+        }
+        break;
+    default:
+        r = GVNRegIndex(S, op);
+        return (r < 0) ? -1 : S->cur[r];
+    }
+    if (isSrc && !S->imm[v]) {
+        if (op->kind != IMM_INT || gl_p2 || (uint32_t)op->val < 512) {
+            S->imm[v] = op;
+        }
+    }
+    return v;
+}
+
+// value v + off
+static int
+GVNOffsetValue(GVNState *S, int v, uint32_t off)
+{
+    int b = S->base[v];
+    int32_t o = (int32_t)((uint32_t)S->offset[v] + off);
+    int w;
+
+    if (o == 0) {
+        return b;
+    }
+    w = GVNLookup(S, GVN_OFFSET, b, o, 0, true);
+    S->base[w] = b;
+    S->offset[w] = o;
+    return w;
+}
+
+// true if accesses of sizes sa and sb at values a and b cannot overlap
+static bool
+GVNDisjoint(GVNState *S, int a, int sa, int b, int sb)
+{
+    int32_t oa, ob;
+
+    if (S->base[a] != S->base[b]) return false;
+    oa = S->offset[a];
+    ob = S->offset[b];
+    if (oa > 0x40000000 || oa < -0x40000000 || ob > 0x40000000 || ob < -0x40000000) {
+        return false;
+    }
+    return oa - ob >= sb || ob - oa >= sa;
+}
+
+// instructions which only compute a value from their operands
+static bool
+GVNIsPureOp(IR *ir)
+{
+    switch (ir->opc) {
+    case OPC_ABS:
+    case OPC_ADD:
+    case OPC_AND:
+    case OPC_ANDN:
+    case OPC_MAXS:
+    case OPC_MINS:
+    case OPC_MAXU:
+    case OPC_MINU:
+    case OPC_NEG:
+    case OPC_OR:
+    case OPC_ROL:
+    case OPC_ROR:
+    case OPC_SAR:
+    case OPC_SHL:
+    case OPC_SHR:
+    case OPC_SUB:
+    case OPC_XOR:
+    case OPC_BMASK:
+    case OPC_DECOD:
+    case OPC_ENCOD:
+    case OPC_MULS:
+    case OPC_MULU:
+    case OPC_NOT:
+    case OPC_ONES:
+    case OPC_SIGNX:
+    case OPC_ZEROX:
+    case OPC_SUBR:
+        return ir->src2 == NULL;
+    case OPC_GETBYTE:
+    case OPC_GETNIB:
+    case OPC_GETWORD:
+    case OPC_SETBYTE:
+    case OPC_SETWORD:
+        return ir->src2 != NULL;
+    default:
+        return false;
+    }
+}
+
+static bool
+GVNIsCommutative(IROpcode opc)
+{
+    switch (opc) {
+    case OPC_ADD:
+    case OPC_AND:
+    case OPC_OR:
+    case OPC_XOR:
+    case OPC_MULS:
+    case OPC_MULU:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// instructions which neither touch HUB memory nor wait
+static bool
+GVNLeavesMemory(IR *ir)
+{
+    if (GVNIsPureOp(ir)) return true;
+    switch (ir->opc) {
+    case OPC_MOV:
+    case OPC_RDBYTE:
+    case OPC_RDWORD:
+    case OPC_RDLONG:
+    case OPC_ADDX:
+    case OPC_ADDSX:
+    case OPC_SUBX:
+    case OPC_SUBSX:
+    case OPC_CMP:
+    case OPC_CMPS:
+    case OPC_TEST:
+    case OPC_TESTN:
+    case OPC_TESTB:
+    case OPC_TESTBN:
+    case OPC_MUXC:
+    case OPC_MUXNC:
+    case OPC_MUXZ:
+    case OPC_MUXNZ:
+    case OPC_NEGC:
+    case OPC_NEGNC:
+    case OPC_NEGZ:
+    case OPC_NEGNZ:
+    case OPC_SUMC:
+    case OPC_SUMNC:
+    case OPC_SUMZ:
+    case OPC_SUMNZ:
+    case OPC_RCL:
+    case OPC_RCR:
+    case OPC_WRC:
+    case OPC_WRNC:
+    case OPC_WRZ:
+    case OPC_WRNZ:
+    case OPC_BITC:
+    case OPC_BITNC:
+    case OPC_BITH:
+    case OPC_BITL:
+    case OPC_BITNOT:
+    case OPC_JUMP:
+    case OPC_DJNZ:
+    case OPC_QDIV:
+    case OPC_QFRAC:
+    case OPC_QMUL:
+    case OPC_QROTATE:
+    case OPC_QSQRT:
+    case OPC_QVECTOR:
+    case OPC_QLOG:
+    case OPC_QEXP:
+    case OPC_GETQX:
+    case OPC_GETQY:
+    case OPC_NOP:
+    case OPC_LABEL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+//
+// find the registers of the function; returns false if it does
+// something the pass cannot follow, like changing registers
+// indirectly
+//
+static bool
+GVNAddReg(GVNState *S, Operand *op)
+{
+    int r;
+
+    if (!op) return true;
+    switch (op->kind) {
+    case REG_SUBREG:
+    case HUBMEM_REF:
+    case COGMEM_REF:
+        return false;
+    default:
+        break;
+    }
+    if (!GVNTracked(op) || PtrMapGet(&S->regMap, op) >= 0) {
+        return true;
+    }
+    if (PtrMapGet(&S->nameMap, op->name) >= 0) {
+        // two operands for the same register
+        return false;
+    }
+    r = S->nregs++;
+    S->regs = (Operand **)realloc(S->regs, S->nregs * sizeof(Operand *));
+    S->regs[r] = op;
+    PtrMapPut(&S->regMap, op, r);
+    PtrMapPut(&S->nameMap, op->name, r);
+    return true;
+}
+
+static bool
+GVNFindRegs(GVNState *S)
+{
+    IRCfg *cfg = S->cfg;
+    IR *ir;
+    int i;
+
+    for (i = 0; i < cfg->ninstrs; i++) {
+        ir = cfg->instrs[i];
+        switch (ir->opc) {
+        case OPC_COMMENT:
+        case OPC_LABEL:
+        case OPC_LIVE:
+        case OPC_CONST:
+        case OPC_DUMMY:
+            break;
+        case OPC_ALTD:
+        case OPC_ALTS:
+        case OPC_MOVD:
+        case OPC_MOVS:
+        case OPC_SETQ:
+        case OPC_SETQ2:
+        case OPC_JMPRET:
+            return false;
+        case OPC_CALL:
+            if (ir->dst && ir->dst->name
+                && (!strcmp(ir->dst->name, "__setjmp") || !strcmp(ir->dst->name, "gosub_")))
+            {
+                // returns more than once
+                return false;
+            }
+            break;
+        default:
+            if (ir->opc >= OPC_GENERIC) {
+                return false;
+            }
+            break;
+        }
+        if (!GVNAddReg(S, ir->dst) || !GVNAddReg(S, ir->src) || !GVNAddReg(S, ir->src2)) {
+            return false;
+        }
+    }
+    // a register whose address is taken may be changed behind our back
+    for (i = 0; i < cfg->ninstrs; i++) {
+        ir = cfg->instrs[i];
+        if (ir->src && ir->src->kind == IMM_COG_LABEL && PtrMapGet(&S->nameMap, ir->src->name) >= 0) {
+            return false;
+        }
+        if (ir->dst && ir->dst->kind == IMM_COG_LABEL && PtrMapGet(&S->nameMap, ir->dst->name) >= 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+GVNReachable(IRCfg *cfg, int b)
+{
+    return cfg->blocks[b].rpo >= 0;
+}
+
+//
+// call f(S, r, b) for each register r set in block b (memory is S->nregs)
+//
+static void
+GVNBlockDefs(GVNState *S, int b, void (*f)(void *, int, int), void *arg)
+{
+    IRCfg *cfg = S->cfg;
+    IRBlock *blk = &cfg->blocks[b];
+    int i, r;
+    IR *ir;
+
+    for (i = blk->start; i < blk->end; i++) {
+        ir = cfg->instrs[i];
+        if (IsDummy(ir) || ir->opc == OPC_LABEL) continue;
+        if (ir->opc == OPC_CALL) {
+            for (r = 0; r < S->nregs; r++) {
+                if (!IsLocal(S->regs[r])) f(arg, r, b);
+            }
+        }
+        if (!GVNLeavesMemory(ir)) {
+            f(arg, S->nregs, b);
+        }
+        if (ir->dst && InstrSetsDst(ir) && (r = GVNRegIndex(S, ir->dst)) >= 0) {
+            f(arg, r, b);
+        }
+        if ((ir->srceffect & 0xff) != OPEFFECT_NONE && (r = GVNRegIndex(S, ir->src)) >= 0) {
+            f(arg, r, b);
+        }
+    }
+}
+
+typedef struct GVNPairs {
+    Flexbuf fb;
+    int lastReg, lastBlock;
+} GVNPairs;
+
+static void
+GVNAddPair(void *arg, int r, int b)
+{
+    GVNPairs *P = (GVNPairs *)arg;
+    int pair[2];
+
+    if (r == P->lastReg && b == P->lastBlock) return;
+    pair[0] = r;
+    pair[1] = b;
+    flexbuf_addmem(&P->fb, (const char *)pair, sizeof(pair));
+    P->lastReg = r;
+    P->lastBlock = b;
+}
+
+// group (key, item) pairs by key; returns the start of each key's
+// items in *list (n + 1 entries) and the items themselves
+static int *
+GVNGroup(int *pairs, int npairs, int n, int **list)
+{
+    int *start = (int *)calloc(n + 1, sizeof(int));
+    int *fill = (int *)malloc((n + 1) * sizeof(int));
+    int *items = (int *)malloc((npairs + 1) * sizeof(int));
+    int i;
+
+    for (i = 0; i < npairs; i++) start[pairs[2*i] + 1]++;
+    for (i = 0; i < n; i++) start[i+1] += start[i];
+    memcpy(fill, start, (n + 1) * sizeof(int));
+    for (i = 0; i < npairs; i++) items[fill[pairs[2*i]]++] = pairs[2*i+1];
+    free(fill);
+    *list = items;
+    return start;
+}
+
+//
+// find where each register needs a phi function: the iterated
+// dominance frontier of the blocks which set it; memory also gets
+// one at every loop header
+// returns the start of each block's list in phiStart
+//
+static int *
+GVNPlacePhis(GVNState *S, int **phiRegs)
+{
+    IRCfg *cfg = S->cfg;
+    int nb = cfg->nblocks;
+    int nr = S->nregs + 1;
+    GVNPairs defs, df, phis;
+    int *lastAdded, *dfStart, *dfList, *defStart, *defList;
+    int *hasPhi, *onList, *work;
+    int *phiStart;
+    int b, i, p, r, nwork;
+
+    // definitions of each register
+    flexbuf_init(&defs.fb, 1024);
+    defs.lastReg = defs.lastBlock = -1;
+    flexbuf_init(&phis.fb, 1024);
+    phis.lastReg = phis.lastBlock = -1;
+    for (b = 0; b < nb; b++) {
+        if (GVNReachable(cfg, b)) {
+            GVNBlockDefs(S, b, GVNAddPair, &defs);
+        }
+    }
+    for (i = 0; i < cfg->nloops; i++) {
+        GVNAddPair(&defs, S->nregs, cfg->loops[i].header);
+        GVNAddPair(&phis, cfg->loops[i].header, S->nregs);
+    }
+    defStart = GVNGroup((int *)flexbuf_peek(&defs.fb), flexbuf_curlen(&defs.fb) / (2*sizeof(int)), nr, &defList);
+
+    // dominance frontiers
+    flexbuf_init(&df.fb, 1024);
+    df.lastReg = df.lastBlock = -1;
+    lastAdded = (int *)malloc(nb * sizeof(int));
+    for (b = 0; b < nb; b++) lastAdded[b] = -1;
+    for (b = 0; b < nb; b++) {
+        IRBlock *blk = &cfg->blocks[b];
+        if (blk->npred < 2 || !GVNReachable(cfg, b)) continue;
+        for (i = 0; i < blk->npred; i++) {
+            p = blk->pred[i];
+            if (!GVNReachable(cfg, p)) continue;
+            while (p >= 0 && p != blk->idom && lastAdded[p] != b) {
+                lastAdded[p] = b;
+                GVNAddPair(&df, p, b);
+                p = cfg->blocks[p].idom;
+            }
+        }
+    }
+    dfStart = GVNGroup((int *)flexbuf_peek(&df.fb), flexbuf_curlen(&df.fb) / (2*sizeof(int)), nb, &dfList);
+
+    // iterate them from the definitions of each register
+    hasPhi = (int *)calloc(nb, sizeof(int));
+    onList = (int *)calloc(nb, sizeof(int));
+    work = (int *)malloc((nb + 1) * sizeof(int));
+    for (r = 0; r < nr; r++) {
+        nwork = 0;
+        for (i = defStart[r]; i < defStart[r+1]; i++) {
+            b = defList[i];
+            if (onList[b] != r + 1) {
+                onList[b] = r + 1;
+                work[nwork++] = b;
+            }
+        }
+        while (nwork > 0) {
+            b = work[--nwork];
+            for (i = dfStart[b]; i < dfStart[b+1]; i++) {
+                p = dfList[i];
+                if (hasPhi[p] == r + 1) continue;
+                hasPhi[p] = r + 1;
+                GVNAddPair(&phis, p, r);
+                if (onList[p] != r + 1) {
+                    onList[p] = r + 1;
+                    work[nwork++] = p;
+                }
+            }
+        }
+    }
+    phiStart = GVNGroup((int *)flexbuf_peek(&phis.fb), flexbuf_curlen(&phis.fb) / (2*sizeof(int)), nb, phiRegs);
+
+    free(work);
+    free(onList);
+    free(hasPhi);
+    free(dfList);
+    free(dfStart);
+    free(lastAdded);
+    free(defList);
+    free(defStart);
+    flexbuf_delete(&phis.fb);
+    flexbuf_delete(&df.fb);
+    flexbuf_delete(&defs.fb);
+    return phiStart;
+}
+
+//
+// value loaded by a read of the given size from address value addr,
+// or -1 if it is not known
+//
+static int
+GVNLoadValue(GVNState *S, IROpcode opc, int addr, int size)
+{
+    int m = S->cur[S->nregs];
+    int v, steps;
+
+    for (steps = 0; steps < GVN_MAX_STORE_WALK; steps++) {
+        v = GVNLookup(S, opc, addr, m, 0, false);
+        if (v >= 0) {
+            return v;
+        }
+        if (S->mems[m].prev < 0 || !IsMemoryOrderSafe(NULL)
+            || !GVNDisjoint(S, addr, size, S->mems[m].addr, S->mems[m].size))
+        {
+            break;
+        }
+        m = S->mems[m].prev;
+    }
+    return -1;
 }
 
-//
-// return true if it's OK to swap IR a and b
-// if a changes b's src, then no
-//
-static bool
-CanSwap(IR *a, IR *b)
+// replace ir, which computes v, by a move from somewhere holding v
+static int
+GVNReuse(GVNState *S, IR *ir, int d, int v)
 {
-    if (InstrSetsAnyFlags(a) || InstrSetsAnyFlags(b)) return false;
-    if (a->cond != b->cond) return false;
-    if (InstrIsVolatile(a) || InstrIsVolatile(b)) return false;
-    if (IsBranch(a) || IsBranch(b)) return false;
-    if (InstrModifies(a, b->src)) return false;
-    if (InstrModifies(a, b->dst)) return false;
-    if (InstrUses(b, a->dst)) return false;
-    if (InstrModifies(b, a->src)) return false;
-    if (InstrUses(a, b->dst)) return false;
-    return true;
-}
+    int h = S->holder[v];
+    Operand *src = NULL;
 
-//
-// optimize read/write calls
-//   rdlong a,b
-//   rdlong c,b
-// can become
-//   rdlong a, b
-//   mov    c, a
-// also in:
-//   rdbyte a, b
-//   and a, #255
-// we can skip the "and"
+    if (InstrIsVolatile(ir) || InstrSetsAnyFlags(ir)) {
+        return 0;
+    }
+    if (S->cur[d] == v) {
+        DeleteIR(S->irl, ir);
+        return 1;
+    }
+    if (ir->cond != COND_TRUE || ir->opc == OPC_MOV) {
+        return 0;
+    }
+    if (h >= 0 && S->cur[h] == v) {
+        src = S->regs[h];
+    } else if (S->imm[v]) {
+        src = S->imm[v];
+    } else {
+        return 0;
+    }
+    ReplaceOpcode(ir, OPC_MOV);
+    ir->src = src;
+    ir->src2 = NULL;
+    return 1;
+}
 
 static int
-OptimizeReadWrite(IRList *irl)
+GVNBlock(GVNState *S, int b)
 {
-    Operand *base;
-    Operand *dst1;
-    IR *ir;
-    IR *nextread;
-    IR *next_ir, *prev_ir;
+    IRCfg *cfg = S->cfg;
+    IRBlock *blk = &cfg->blocks[b];
     int change = 0;
+    int i, r, d, v, a, c, addr, size;
+    IR *ir;
 
-restart_check:
-    prev_ir = next_ir = NULL;
-    ir = irl->head;
-    while (ir) {
-        next_ir = ir->next;
-        while (next_ir && IsDummy(next_ir)) {
-            next_ir = next_ir->next;
-        }
-        if (InstrIsVolatile(ir)) {
-            goto get_next;
-        }
-        if (ir->srceffect != OPEFFECT_NONE || ir->dsteffect != OPEFFECT_NONE) {
-            goto get_next;
-        }
-        if (ir->opc == OPC_RDLONG || ir->opc == OPC_WRLONG
-                ||  ir->opc == OPC_RDWORD || ir->opc == OPC_WRWORD
-                ||  ir->opc == OPC_RDBYTE || ir->opc == OPC_WRBYTE) {
-            // don't mess with it if prev instr was OPC_SETQ
-            if (prev_ir && (prev_ir->opc == OPC_SETQ || prev_ir->opc == OPC_SETQ2)) {
-                prev_ir->flags |= FLAG_KEEP_INSTR;
-                goto get_next;
-            }
-            dst1 = ir->dst;
-            base = ir->src;
-            int size = MemoryOpSize(ir);
-            bool write = IsWrite(ir);
-            // don't mess with it if src==dst
-            if (!write && ir->src == ir->dst) goto get_next;
-            nextread = FindNextRead(ir, dst1, base, (curfunc->optimize_flags & OPT_EXPERIMENTAL) && IsMemoryOrderSafe(ir->src));
-            int nextsize = MemoryOpSize(nextread);
-            if (nextread && CondIsSubset(ir->cond,nextread->cond)) {
-                // wrlong a, b ... rdlong c, b  -> mov c, a
-                // rdlong a, b ... rdlong c, b  -> mov c, a
-                if(size == nextsize && (!write || size==4 || gl_p2) 
-                        && ((gl_p2 && size==4) || !InstrSetsFlags(nextread,FLAG_WC))
-                        && (!write || size==4 || !InstrSetsFlags(nextread,FLAG_WZ))) {
-                    nextread->src = dst1;
-                    if (!write || size == 4) {
-                        ReplaceOpcode(nextread, OPC_MOV);
-                    } else if (size == 2) {
-                        ReplaceOpcode(nextread,OPC_GETWORD);
-                        nextread->src2 = NewImmediate(0);
-                    } else if (size == 1) {
-                        ReplaceOpcode(nextread,OPC_GETBYTE);
-                        nextread->src2 = NewImmediate(0);
+    for (i = blk->start; i < blk->end; i++) {
+        ir = cfg->instrs[i];
+        if (IsDummy(ir) || ir->opc == OPC_LABEL) continue;
+        d = (ir->dst && InstrSetsDst(ir)) ? GVNRegIndex(S, ir->dst) : -1;
+        v = -1;
+        if (d >= 0 && ir->srceffect == OPEFFECT_NONE && ir->dsteffect == OPEFFECT_NONE) {
+            if (ir->opc == OPC_MOV) {
+                v = GVNOperandValue(S, ir->src, true);
+            } else if (MemoryOpSize(ir) && !IsWrite(ir)) {
+                addr = GVNOperandValue(S, ir->src, false);
+                if (addr >= 0 && !InstrIsVolatile(ir)) {
+                    v = GVNLoadValue(S, ir->opc, addr, MemoryOpSize(ir));
+                    if (v < 0) {
+                        v = GVNNewValue(S);
                     }
-                    change = 1;
-                    goto get_next;
+                    GVNRecord(S, ir->opc, addr, S->cur[S->nregs], 0, v);
+                }
+            } else if (GVNIsPureOp(ir)) {
+                a = InstrReadsDst(ir) ? S->cur[d] : -1;
+                r = GVNOperandValue(S, ir->src, true);
+                c = ir->src2 ? GVNOperandValue(S, ir->src2, false) : -1;
+                if (r < 0 || (ir->src2 && c < 0)) {
+                    v = -1;
+                } else if ((ir->opc == OPC_ADD || ir->opc == OPC_SUB) && ir->src->kind == IMM_INT) {
+                    uint32_t off = (uint32_t)ir->src->val;
+                    v = GVNOffsetValue(S, a, (ir->opc == OPC_SUB) ? -off : off);
+                } else {
+                    if (GVNIsCommutative(ir->opc) && a > r) {
+                        int t = a; a = r; r = t;
+                    }
+                    v = GVNLookup(S, ir->opc, a, r, c, true);
                 }
             }
-#if 1
-            // bit of a hacky optimization for some tests
-            // rdlong a, b + mov c, a -> rdlong c, b if a is dead
-            else if (IsRead(ir) && next_ir && next_ir->opc == OPC_MOV
-                    && !InstrIsVolatile(next_ir) && !InstrSetsAnyFlags(next_ir)
-                    && SameRegister(next_ir->src, ir->dst)
-                    && IsLocalOrArg(next_ir->src) && ir->cond == next_ir->cond
-                    && IsDeadAfter(next_ir, ir->dst)) {
-                Operand *tmp = ir->dst;
-                ir->dst = next_ir->dst;
-                next_ir->dst = tmp;
-                ReplaceOpcode(next_ir, OPC_MOV);
-                change = 1;
-                goto get_next;
-            }
-#endif
         }
-        if (ir->opc == OPC_RDBYTE || ir->opc == OPC_RDWORD) {
-            int32_t mval;
-            dst1 = ir->dst;
-            int mask = ir->opc == OPC_RDBYTE ? 0xFF : 0xFFFF;
-            nextread = FindNextUse(ir, dst1);
-            if (nextread
-                    && nextread->cond == ir->cond
-                    && !FlagsChangeInRange(ir->next,nextread->prev,FlagsUsedByCond(ir->cond))
-                    && nextread->dst == dst1
-                    && (nextread->flags & FLAG_WZ) == nextread->flags
-                    && isMaskingOp(nextread,&mval)
-                    && mval == mask)
-            {
-                // don't need zero extend after rdbyte (change to MOV, gets eliminated next pass)
-                ReplaceOpcode(nextread,OPC_MOV);
-                nextread->src = nextread->dst;
-                change = 1;
+        if (v >= 0 && (ir->cond == COND_TRUE || S->cur[d] == v)) {
+            int chg = GVNReuse(S, ir, d, v);
+            change |= chg;
+            if (chg && S->cur[d] == v) {
+                continue;   // deleted
             }
+            GVNSet(S, d, v);
+        } else if (d >= 0) {
+            GVNClobber(S, d);
         }
-        // cut unneccessary bits for immediate write values
-        if (gl_p2 && (ir->opc == OPC_WRBYTE || ir->opc == OPC_WRWORD) && ir->dst && ir->dst->kind == IMM_INT) {
-            int mask = ir->opc == OPC_WRBYTE ? 0xFF : 0xFFFF;
-            if ((ir->dst->val & mask) != ir->dst->val) {
-                ir->dst = NewImmediate(ir->dst->val & mask);
-                change = 1;
+        if ((ir->srceffect & 0xff) != OPEFFECT_NONE && (r = GVNRegIndex(S, ir->src)) >= 0) {
+            GVNClobber(S, r);
+        }
+        if (ir->opc == OPC_CALL) {
+            for (r = 0; r < S->nregs; r++) {
+                if (!IsLocal(S->regs[r])) GVNClobber(S, r);
+            }
+        }
+        // memory
+        if (IsWrite(ir) && MemoryOpSize(ir)) {
+            int m = S->cur[S->nregs];
+            size = MemoryOpSize(ir);
+            addr = (ir->srceffect == OPEFFECT_NONE && ir->dsteffect == OPEFFECT_NONE && !InstrIsVolatile(ir))
+                ? GVNOperandValue(S, ir->src, false) : -1;
+            if (addr < 0) {
+                GVNClobber(S, S->nregs);
+            } else {
+                GVNSet(S, S->nregs, GVNNewMem(S, m, addr, size));
+                v = GVNOperandValue(S, ir->dst, false);
+                if (ir->cond == COND_TRUE && size == 4 && v >= 0) {
+                    GVNRecord(S, OPC_RDLONG, addr, S->cur[S->nregs], 0, v);
+                }
             }
+        } else if (!GVNLeavesMemory(ir)) {
+            GVNClobber(S, S->nregs);
         }
-#if 1
-        // try to avoid having two read/write ops in a row
-        if (IsReadWrite(ir) && IsReadWrite(next_ir) && IsNonReadWriteOpcode(prev_ir)) {
-            if (CanSwap(ir, prev_ir) && !IsCordicCommand(prev_ir)) {
-                // want to swap prev_ir and ir here
-                DeleteIR(irl, prev_ir);  // remove prev_ir from list
-                prev_ir->next = NULL;
-                InsertAfterIR(irl, ir, prev_ir); // move it to later
-                ir = prev_ir;
-                change = 1;
-                goto restart_check;
+    }
+    return change;
+}
+
+static int
+OptimizeValueNumbers(IRList *irl)
+{
+    GVNState S;
+    IRCfg *cfg;
+    int *phiStart, *phiRegs;
+    int *byPre, *stack, *marks;
+    int nb, i, b, r, depth;
+    int change = 0;
+
+    cfg = GetIRCfg(irl);
+    nb = cfg->nblocks;
+    if (nb == 0) return 0;
+
+    memset(&S, 0, sizeof(S));
+    S.irl = irl;
+    S.cfg = cfg;
+    PtrMapInit(&S.regMap, 64);
+    PtrMapInit(&S.nameMap, 64);
+    PtrMapInit(&S.constMap, 64);
+    S.mask = 255;
+    S.keys = (GVNKey *)calloc(S.mask + 1, sizeof(GVNKey));
+    S.vals = (int *)malloc((S.mask + 1) * sizeof(int));
+    memset(S.vals, 0xff, (S.mask + 1) * sizeof(int));
+
+    if (!GVNFindRegs(&S)) {
+        goto done;
+    }
+    S.cur = (int *)calloc(S.nregs + 1, sizeof(int));
+    phiStart = GVNPlacePhis(&S, &phiRegs);
+
+    // walk the dominator tree in preorder, undoing the changes made
+    // in a block when leaving its subtree
+    // (the tree numbering counts both entry and exit of each node)
+    byPre = (int *)malloc(2 * (nb + 1) * sizeof(int));
+    stack = (int *)malloc((nb + 1) * sizeof(int));
+    marks = (int *)malloc((nb + 1) * sizeof(int));
+    for (i = 0; i < 2 * (nb + 1); i++) byPre[i] = -1;
+    for (b = 0; b < nb; b++) {
+        if (GVNReachable(cfg, b) && cfg->blocks[b].dompre >= 0) {
+            byPre[cfg->blocks[b].dompre] = b;
+        }
+    }
+    depth = 0;
+    for (i = 0; i < 2 * (nb + 1); i++) {
+        b = byPre[i];
+        if (b < 0) continue;
+        while (depth > 0 && !IRCfgDominates(cfg, stack[depth-1], b)) {
+            depth--;
+            GVNUndoTo(&S, marks[depth]);
+        }
+        stack[depth] = b;
+        marks[depth] = S.nundo;
+        depth++;
+        if (cfg->blocks[b].idom < 0) {
+            // may be entered from anywhere
+            for (r = 0; r <= S.nregs; r++) {
+                GVNClobber(&S, r);
+            }
+        } else {
+            for (r = phiStart[b]; r < phiStart[b+1]; r++) {
+                GVNClobber(&S, phiRegs[r]);
             }
         }
-#endif
-get_next:
-        prev_ir = ir;
-        ir = next_ir;
+        change |= GVNBlock(&S, b);
     }
+
+    free(marks);
+    free(stack);
+    free(byPre);
+    free(phiRegs);
+    free(phiStart);
+done:
+    free(S.undo);
+    free(S.vals);
+    free(S.keys);
+    free(S.mems);
+    free(S.imm);
+    free(S.holder);
+    free(S.offset);
+    free(S.base);
+    free(S.cur);
+    free(S.regs);
+    PtrMapFree(&S.constMap);
+    PtrMapFree(&S.nameMap);
+    PtrMapFree(&S.regMap);
     return change;
 }
 
@@ -4805,7 +7160,7 @@ OptimizeLoopPtrOffset(IRList *irl) {
     // Find loops
     for (IR *ir=irl->head; ir; ir=ir->next) {
         IR *end;
-        if (IsLabel(ir) && ir->prev && (end = UniqJumpForLabel(ir)) && IsJump(end) && !IsForwardJump(end)) {
+        if (IsLabel(ir) && ir->prev && (end = UniqJumpForLabel(ir)) && IsJump(end) && !IsForwardJump(irl, end)) {
             // Find top add/sub
             IR *nexttop;
             for(IR *top=ir->next; top&&top!=end; top=nexttop) {
@@ -4950,9 +7305,20 @@ struct reorder_block {
     IR *top,*bottom;
 };
 
+// the first (or last) instruction of the basic block holding ir;
+// a reorder block never extends past it
+static IR *
+ReorderLimit(IRList *irl, IR *ir, bool last) {
+    IRCfg *cfg = GetIRCfg(irl);
+    int b = IRCfgBlockOf(cfg, ir);
+    if (b < 0) return NULL;
+    return last ? cfg->blocks[b].last : cfg->blocks[b].first;
+}
+
 static struct reorder_block
-FindBlockForReorderingDownward(IR *after) {
+FindBlockForReorderingDownward(IRList *irl, IR *after) {
     IR *bottom = after;
+    IR *limit = ReorderLimit(irl, after, false);
     DEBUG(NULL,"Looking for a block to move down... (in %s)",curfunc->name);
     // Are the flags used at after?
     bool volatileC = FlagsUsedAt(after,FLAG_WC);
@@ -4966,7 +7332,7 @@ FindBlockForReorderingDownward(IR *after) {
     struct dependency *depends = NULL;
     // Hunt for the start of a potential reordering block
     for (;;) {
-        bottom = bottom->prev;
+        bottom = (bottom == limit) ? NULL : bottom->prev;
         if (!bottom || IsReorderBarrier(bottom)) return (struct reorder_block) {
             0
         };
@@ -4975,7 +7341,7 @@ FindBlockForReorderingDownward(IR *after) {
         bool needC = false, needZ = false;
         unsigned count = 0;
 
-        for (top=bottom; top; top=top->prev) {
+        for (top=bottom; top; top = (top == limit) ? NULL : top->prev) {
             count++;
             if (IsReorderBarrier(top)) break;
             if (InstrSetsFlags(top,FLAG_WC)) {
@@ -5032,8 +7398,9 @@ FindBlockForReorderingDownward(IR *after) {
 }
 
 static struct reorder_block
-FindBlockForReorderingUpward(IR *before) {
+FindBlockForReorderingUpward(IRList *irl, IR *before) {
     IR *top = before;
+    IR *limit = ReorderLimit(irl, before, true);
     DEBUG(NULL,"Looking for a block to move up... (in %s)",curfunc->name);
     // Are the flags used at before?
     bool volatileC = FlagsUsedAt(before,FLAG_WC);
@@ -5044,7 +7411,7 @@ FindBlockForReorderingUpward(IR *before) {
     struct dependency *depends = NULL;
     // Hunt for the start of a potential reordering block
     for (;;) {
-        top = top->next;
+        top = (top == limit) ? NULL : top->next;
         if (!top || IsReorderBarrier(top)) return (struct reorder_block) {
             0
         };
@@ -5054,7 +7421,7 @@ FindBlockForReorderingUpward(IR *before) {
         // Have a flag setter in the block?
         bool foundClocal = false, foundZlocal = false;
         unsigned count = 0;
-        for (bottom=top; bottom; bottom=bottom->next) {
+        for (bottom=top; bottom; bottom = (bottom == limit) ? NULL : bottom->next) {
             count++;
             if (IsReorderBarrier(bottom)) break;
             // if we use a flag that isn't set inside the block but we want to reorder over another flag write, abort
@@ -5108,7 +7475,7 @@ FindBlockForReorderingUpward(IR *before) {
 #define CORDIC_PIPE_LENGTH 56
 
 // Try to move code between QMUL/QDIV and GETQ* to amortize CORDIC latency
-static bool
+static int
 OptimizeCORDIC(IRList *irl) {
     // Search for QMUL/QDIV
     bool change = false;
@@ -5126,10 +7493,11 @@ OptimizeCORDIC(IRList *irl) {
         // Try pulling down blocks
         // (The cycle limit only applies in pathological cases)
         while (cycles<CORDIC_PIPE_LENGTH) {
-            struct reorder_block blk = FindBlockForReorderingDownward(ir);
+            struct reorder_block blk = FindBlockForReorderingDownward(irl, ir);
             if (blk.count == 0) break; // No block found
             DEBUG(NULL,"Reordering block of %d instructions down",blk.count);
             DoReorderBlock(irl,ir,blk.top,blk.bottom);
+            InvalidateIRCfg();
             cycles += MinCyclesInRange(blk.top,blk.bottom);
             change = true;
         }
@@ -5149,10 +7517,11 @@ OptimizeCORDIC(IRList *irl) {
         // Try pulling up blocks
         // (The cycle limit only applies in pathological cases)
         while (cycles<CORDIC_PIPE_LENGTH) {
-            struct reorder_block blk = FindBlockForReorderingUpward(ir);
+            struct reorder_block blk = FindBlockForReorderingUpward(irl, ir);
             if (blk.count == 0) break; // No block found
             DEBUG(NULL,"Reordering block of %d instructions up",blk.count);
             DoReorderBlock(irl,ir->prev,blk.top,blk.bottom);
+            InvalidateIRCfg();
             cycles += MinCyclesInRange(blk.top,blk.bottom);
             change = true;
         }
@@ -5161,7 +7530,7 @@ OptimizeCORDIC(IRList *irl) {
 }
 
 //
-static bool
+static int
 CORDICconstPropagate(IRList *irl) {
     bool constantCommand=false,change=false,foundX=false,foundY=false;
     int32_t const_x=0,const_y=0;
@@ -5239,7 +7608,7 @@ CORDICconstPropagate(IRList *irl) {
 // Optimization may have created lone CORDIC commands
 // which will lead to strange results.
 // Thus, we shall remove these.
-static bool
+static int
 FixupLoneCORDIC(IRList *irl) {
     bool seenCommand = true, change = false;
     for(IR *ir=irl->tail; ir; ir=ir->prev) {
@@ -5265,11 +7634,12 @@ static void addKnownReg(struct dependency **list, Operand *op, bool arg) {
     if (op && op->kind != REG_SUBREG && (arg?IsArg(op)||isResult(op):IsLocal(op)) && !CheckDependency(list,op)) PrependDependency(list,op);
 }
 
-static bool
+static int
 ReuseLocalRegisters(IRList *irl) {
     struct dependency *known_regs = NULL;
     bool change = false;
     IR *stop_ir;
+    IRRefIndex *refs = BeginRefIndex(irl);
 
      for(IR *ir=irl->head; ir; ir=ir->next) {
         // Find all the arg/result regs first
@@ -5281,10 +7651,11 @@ ReuseLocalRegisters(IRList *irl) {
         // Start of new dependency chain
         if (ir->dst && ir->dst != ir->src && IsLocal(ir->dst) && ir->dst->kind != REG_SUBREG && InstrModifies(ir,ir->dst) && !InstrUses(ir,ir->dst) && !InstrIsVolatile(ir) && !CheckDependency(&known_regs,ir->dst)) {
             for (struct dependency *tmp=known_regs; tmp; tmp=tmp->link) {
-                if (tmp->reg!=ir->dst && IsDeadAfter(ir,tmp->reg) && (stop_ir = SafeToReplaceForward(ir->next,ir->dst,tmp->reg,ir->cond))) {
+                if (tmp->reg!=ir->dst && IsDeadAfter(ir,tmp->reg) && (stop_ir = SafeToReplaceForward(irl, ir->next,ir->dst,tmp->reg,ir->cond))) {
                     //DEBUG(NULL,"Using %s instead of %s",tmp->reg->name,ir->dst->name);
                     ReplaceForward(ir->next,ir->dst,tmp->reg,stop_ir);
                     ir->dst = tmp->reg;
+                    RefIndexNote(ir);
                     change = true;
                     break;
                 }
@@ -5294,6 +7665,7 @@ ReuseLocalRegisters(IRList *irl) {
         addKnownReg(&known_regs,ir->src,false);
         addKnownReg(&known_regs,ir->dst,false);
     }
+    EndRefIndex(refs);
     return change;
 }
 
@@ -5356,19 +7728,151 @@ static void append_disasm(Flexbuf *fb,IRList *irl) {
     free(buf);
 }
 
-#define OPT_PASS(call) { \
-    int passchg = call;\
-    if (hooked) {\
-        DEBUG(NULL,"%s Opt pass " #call " change: %d",FuncData(curfunc)->asmname->name,passchg);\
-        flexbuf_addstr(&hookfb,"Pass " #call ":\n");\
-        if (passchg) {\
-            append_disasm(&hookfb,irl);\
-        } else {\
-            flexbuf_addstr(&hookfb,"NO CHANGE!\n");\
-        }\
-        flexbuf_addstr(&hookfb,"\n");\
-    }\
-    change |= passchg;\
+//
+// the local optimizer passes, in the order they are run
+//
+typedef struct OptPass {
+    const char *name;
+    int (*run)(IRList *irl);
+    int (*runf)(IRList *irl, Function *f);
+    int needflags;      // all of these optimize flags must be set
+    bool p2only;
+} OptPass;
+
+static int
+TailCallsPass(IRList *irl, Function *f)
+{
+    return OptimizeTailCalls(irl, f);
+}
+
+// these are repeated until none of them changes anything
+static const OptPass loopPasses[] = {
+    { "CheckLabelUsage", CheckLabelUsage, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeReadWrite", OptimizeReadWrite, NULL, OPT_BASIC_REGS, false },
+    { "EliminateDeadCode", EliminateDeadCode, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeCogWrites", OptimizeCogWrites, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeSimpleAssignments", OptimizeSimpleAssignments, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeMoves", OptimizeMoves, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeReturnValues", OptimizeReturnValues, NULL, OPT_BASIC_REGS|OPT_EXPERIMENTAL, false },
+    { "OptimizeImmediates", OptimizeImmediates, NULL, OPT_CONST_PROPAGATE, false },
+    { "OptimizeCompares", OptimizeCompares, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeAddSub", OptimizeAddSub, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeLoopPtrOffset", OptimizeLoopPtrOffset, NULL, OPT_BASIC_REGS, false },
+    { "OptimizePeepholes", OptimizePeepholes, NULL, OPT_PEEPHOLE, false },
+    { "OptimizePeephole2", OptimizePeephole2, NULL, OPT_PEEPHOLE, false },
+    { "OptimizeBranchCommonOps", OptimizeBranchCommonOps, NULL, OPT_BRANCHES|OPT_EXPERIMENTAL, false },
+    { "OptimizeShortBranches", OptimizeShortBranches, NULL, OPT_BRANCHES, false },
+    { "OptimizeIncDec", OptimizeIncDec, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeJumps", OptimizeJumps, NULL, OPT_BASIC_REGS, false },
+    { "OptimizeP2", OptimizeP2, NULL, OPT_BASIC_REGS, true },
+    { "OptimizeLongfill", OptimizeLongfill, NULL, 0, true },
+    { "FixupLoneCORDIC", FixupLoneCORDIC, NULL, 0, true },
+    { "CORDICconstPropagate", CORDICconstPropagate, NULL, OPT_CONST_PROPAGATE, true },
+};
+
+// these run once the loop above settles; if one of them changes
+// anything, the loop is started again
+static const OptPass finalPasses[] = {
+    { "OptimizeValueNumbers", OptimizeValueNumbers, NULL, OPT_GVN, false },
+    { "OptimizeTailCalls", NULL, TailCallsPass, OPT_TAIL_CALLS, false },
+    { "OptimizeCORDIC", OptimizeCORDIC, NULL, OPT_CORDIC_REORDER, true },
+    { "ReuseLocalRegisters", ReuseLocalRegisters, NULL, OPT_LOCAL_REUSE, false },
+};
+
+#define NUM_LOOP_PASSES (sizeof(loopPasses) / sizeof(loopPasses[0]))
+#define NUM_FINAL_PASSES (sizeof(finalPasses) / sizeof(finalPasses[0]))
+#define NUM_PASSES (1 + NUM_LOOP_PASSES + NUM_FINAL_PASSES)
+
+// per pass statistics, for --verbose and --time-passes
+typedef struct OptPassStats {
+    unsigned runs;      // times the pass was run
+    unsigned changes;   // times it changed something
+    unsigned skipped;   // times it was skipped because nothing had changed
+    double secs;        // time spent in the pass (only with --time-passes)
+    size_t alloc;       // bytes allocated by the pass (ditto)
+} OptPassStats;
+
+static OptPassStats passStats[NUM_PASSES];
+static unsigned statFuncs, statRounds, statOverBudget;
+
+//
+// state of the optimizer for one function
+//
+typedef struct OptState {
+    IRList *irl;
+    Function *f;
+    unsigned gen;                   // bumped each time a pass changes something
+    unsigned cleangen[NUM_PASSES];  // gen + 1 when the pass last found nothing to do
+    OptPassStats stats[NUM_PASSES];
+    bool hooked;
+    Flexbuf hookfb;
+} OptState;
+
+static bool
+PassEnabled(const OptPass *pass, int flags)
+{
+    if (pass->p2only && !gl_p2) return false;
+    return (flags & pass->needflags) == pass->needflags;
+}
+
+//
+// run one pass; if no pass has changed anything since the last time
+// this one found nothing to do, running it again would find nothing
+// either, so skip it
+//
+static int
+RunPass(OptState *st, const OptPass *pass, int idx)
+{
+    IRList *irl = st->irl;
+    int passchg;
+
+    if (st->cleangen[idx] == st->gen + 1) {
+        st->stats[idx].skipped++;
+        return 0;
+    }
+    if (gl_time_passes) {
+        double start = PassTimeNow();
+        size_t startAlloc = PassTimeThreadAlloc();
+        passchg = pass->run ? pass->run(irl) : pass->runf(irl, st->f);
+        st->stats[idx].secs += PassTimeNow() - start;
+        st->stats[idx].alloc += PassTimeThreadAlloc() - startAlloc;
+    } else {
+        passchg = pass->run ? pass->run(irl) : pass->runf(irl, st->f);
+    }
+    st->stats[idx].runs++;
+    if (passchg) {
+        st->stats[idx].changes++;
+        st->gen++;
+        InvalidateIRCfg();
+    } else {
+        st->cleangen[idx] = st->gen + 1;
+    }
+    if (st->hooked) {
+        DEBUG(NULL,"%s Opt pass %s change: %d",FuncData(curfunc)->asmname->name,pass->name,passchg);
+        flexbuf_printf(&st->hookfb,"Pass %s:\n",pass->name);
+        if (passchg) {
+            append_disasm(&st->hookfb,irl);
+        } else {
+            flexbuf_addstr(&st->hookfb,"NO CHANGE!\n");
+        }
+        flexbuf_addstr(&st->hookfb,"\n");
+    }
+    return passchg;
+}
+
+static const OptPass mulDivPass = { "OptimizeMulDiv", OptimizeMulDiv, NULL, 0, false };
+
+// the pass whose statistics are at index i
+static const OptPass *
+PassByIndex(unsigned i)
+{
+    if (i == 0) {
+        return &mulDivPass;
+    } else if (i <= NUM_LOOP_PASSES) {
+        return &loopPasses[i-1];
+    } else {
+        return &finalPasses[i-1-NUM_LOOP_PASSES];
+    }
 }
 
 // optimize an isolated piece of IRList
@@ -5376,93 +7880,110 @@ static void append_disasm(Flexbuf *fb,IRList *irl) {
 void
 OptimizeIRLocal(IRList *irl, Function *f)
 {
-    int change = 0;
+    OptState st;
+    int change;
     int flags = f->optimize_flags;
+    unsigned rounds = 0;
+    bool overBudget = false;
+    unsigned i;
+    double start = 0.0;
     if (gl_errors > 0) return;
     if (!irl->head) return;
-    
-    Flexbuf hookfb;
-    bool hooked = false;//!strcmp(FuncData(curfunc)->asmname->name,"_libc_a_fopen");
-    if (hooked) {
-        flexbuf_init(&hookfb,512);
-        flexbuf_addstr(&hookfb,"OPTIMIZE_IR DEBUG HOOK LOG for");
-        flexbuf_addstr(&hookfb,FuncData(curfunc)->asmname->name);
-        flexbuf_addstr(&hookfb,"\n\nInital:\n");
-        append_disasm(&hookfb,irl);
+
+    if (gl_time_passes) {
+        start = PassTimeNow();
+    }
+    memset(&st, 0, sizeof(st));
+    st.irl = irl;
+    st.f = f;
+    st.hooked = false;//!strcmp(FuncData(curfunc)->asmname->name,"_libc_a_fopen");
+    if (st.hooked) {
+        flexbuf_init(&st.hookfb,512);
+        flexbuf_addstr(&st.hookfb,"OPTIMIZE_IR DEBUG HOOK LOG for");
+        flexbuf_addstr(&st.hookfb,FuncData(curfunc)->asmname->name);
+        flexbuf_addstr(&st.hookfb,"\n\nInital:\n");
+        append_disasm(&st.hookfb,irl);
     }
 
     // multiply divide optimization need only be performed once,
     // and should be done before other optimizations confuse things
-    OPT_PASS(OptimizeMulDiv(irl));
-again:
+    RunPass(&st, &mulDivPass, 0);
     do {
-        change = 0;
-        AssignTemporaryAddresses(irl, FuncData(f)->asmreturnlabel);
-        if (flags & OPT_BASIC_REGS) {
-            OPT_PASS(CheckLabelUsage(irl));
-            OPT_PASS(OptimizeReadWrite(irl));
-            OPT_PASS(EliminateDeadCode(irl));
-            OPT_PASS(OptimizeCogWrites(irl));
-            OPT_PASS(OptimizeSimpleAssignments(irl));
-            OPT_PASS(OptimizeMoves(irl));
-            if (flags & OPT_EXPERIMENTAL) {
-                OPT_PASS(OptimizeReturnValues(irl));
+        do {
+            if (gl_opt_budget && rounds >= (unsigned)gl_opt_budget) {
+                overBudget = true;
+                goto done;
             }
-        }
-        if (flags & OPT_CONST_PROPAGATE) {
-            OPT_PASS(OptimizeImmediates(irl));
-        }
-        if (flags & OPT_BASIC_REGS) {
-            OPT_PASS(OptimizeCompares(irl));
-            OPT_PASS(OptimizeAddSub(irl));
-            OPT_PASS(OptimizeLoopPtrOffset(irl));
-        }
-        if (flags & OPT_PEEPHOLE) {
-            OPT_PASS(OptimizePeepholes(irl));
-            OPT_PASS(OptimizePeephole2(irl));
-        }
-        if (flags & OPT_BRANCHES) {
-            if (flags & OPT_EXPERIMENTAL) {
-                OPT_PASS(OptimizeBranchCommonOps(irl));
+            rounds++;
+            change = 0;
+            InvalidateIRCfg();
+            AssignTemporaryAddresses(irl, FuncData(f)->asmreturnlabel);
+            for (i = 0; i < NUM_LOOP_PASSES; i++) {
+                if (PassEnabled(&loopPasses[i], flags)) {
+                    change |= RunPass(&st, &loopPasses[i], 1 + i);
+                }
             }
-            OPT_PASS(OptimizeShortBranches(irl));
-        }
-        if (flags & OPT_BASIC_REGS) {
-            OPT_PASS(OptimizeIncDec(irl));
-            OPT_PASS(OptimizeJumps(irl));
-        }
-        if (gl_p2 && (flags & OPT_BASIC_REGS)) {
-            OPT_PASS(OptimizeP2(irl));
-        }
-        if (gl_p2) {
-            OPT_PASS(OptimizeLongfill(irl));
-            OPT_PASS(FixupLoneCORDIC(irl));
-            if (flags & OPT_CONST_PROPAGATE) {
-                OPT_PASS(CORDICconstPropagate(irl));
+        } while (change != 0);
+        for (i = 0; i < NUM_FINAL_PASSES && !change; i++) {
+            if (PassEnabled(&finalPasses[i], flags)) {
+                change = RunPass(&st, &finalPasses[i], 1 + NUM_LOOP_PASSES + i);
             }
         }
     } while (change != 0);
-    if (flags & OPT_TAIL_CALLS) {
-        OPT_PASS(OptimizeTailCalls(irl, f));
-    }
-    if (change) goto again;
-    if (gl_p2 && (flags & OPT_CORDIC_REORDER)) {
-        OPT_PASS(OptimizeCORDIC(irl));
-    }
-    if (change) goto again;
-    if (flags & OPT_LOCAL_REUSE) {
-        OPT_PASS(ReuseLocalRegisters(irl));
-    }
-    if (change) goto again;
-
-    if (hooked) {
+done:
+    InvalidateIRCfg();
+    WorkPoolLock();
+    for (i = 0; i < NUM_PASSES; i++) {
+        passStats[i].runs += st.stats[i].runs;
+        passStats[i].changes += st.stats[i].changes;
+        passStats[i].skipped += st.stats[i].skipped;
+        if (gl_time_passes && (st.stats[i].runs || st.stats[i].skipped)) {
+            PassTimeAddPass(PassByIndex(i)->name, st.stats[i].runs, st.stats[i].changes,
+                            st.stats[i].skipped, st.stats[i].secs, st.stats[i].alloc);
+        }
+    }
+    statFuncs++;
+    statRounds += rounds;
+    if (overBudget) {
+        statOverBudget++;
+        WARNING(f->decl, "optimization of %s stopped after %u rounds (--opt-budget)",
+                f->user_name, rounds);
+    }
+    if (gl_time_passes) {
+        PassTimeAddFunction(FuncData(f)->asmname->name, 0.0, PassTimeNow() - start);
+    }
+    WorkPoolUnlock();
+
+    if (st.hooked) {
         char fbuf[256];
         static int hookcnt = 0;
         snprintf(fbuf,255,"opthook_%d_%s.txt",++hookcnt,FuncData(curfunc)->asmname->name);
         FILE *logf = fopen(fbuf,"w");
-        fputs(flexbuf_peek(&hookfb),logf);
+        fputs(flexbuf_peek(&st.hookfb),logf);
         fclose(logf);
-        flexbuf_delete(&hookfb);
+        flexbuf_delete(&st.hookfb);
+    }
+}
+
+//
+// print how often each optimizer pass ran and made changes
+//
+void
+PrintOptimizerStats(FILE *f)
+{
+    unsigned i;
+
+    if (!statFuncs) return;
+    fprintf(f, "optimizer: %u functions, %u rounds", statFuncs, statRounds);
+    if (statOverBudget) {
+        fprintf(f, ", %u over budget", statOverBudget);
+    }
+    fprintf(f, "\n");
+    for (i = 0; i < NUM_PASSES; i++) {
+        if (passStats[i].runs || passStats[i].skipped) {
+            fprintf(f, "  %-26s %8u runs %8u changes %8u skipped\n", PassByIndex(i)->name,
+                    passStats[i].runs, passStats[i].changes, passStats[i].skipped);
+        }
     }
 }
 
@@ -5529,6 +8050,13 @@ AnalyzeInlineEligibility(Function *f)
     } else {
         threshold = INLINE_THRESHOLD_P1;
     }
+    // with --profile-use, inline busy functions more readily, and
+    // functions which never ran only if that saves space
+    if (f->profile_hot && !f->prefer_inline) {
+        threshold *= 2;
+    } else if (f->profile_cold) {
+        threshold = 0;
+    }
 
     if (!(gl_optimize_flags & (OPT_INLINE_SMALLFUNCS|OPT_INLINE_SINGLEUSE))) {
         return false;
@@ -5726,7 +8254,7 @@ LoopCanBeFcached(IRList *irl, IR *root, int size_left)
     while (endlabel->next && endlabel->next->opc == OPC_LABEL && endlabel->next->addr != 0) {
         endlabel = endlabel->next;
     }
-    if (IsForwardJump(endjmp)) {
+    if (IsForwardJump(irl, endjmp)) {
         return 0;
     }
 
@@ -5757,9 +8285,9 @@ call_ok:
             return 0;
         }
         if (IsJump(ir)) {
-            if (!JumpIsAfterOrEqual(root, ir))
+            if (!JumpIsAfterOrEqual(irl, root, ir))
                 return 0;
-            if (JumpDest(ir) != endlabel->dst && JumpIsAfterOrEqual(endlabel, ir))
+            if (JumpDest(ir) != endlabel->dst && JumpIsAfterOrEqual(irl, endlabel, ir))
                 return 0;
         }
         if (!IsDummy(ir) && ir->opc != OPC_LABEL) {
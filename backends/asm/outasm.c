@@ -13,6 +13,8 @@
 #include "spinc.h"
 #include "becommon.h"
 #include "outasm.h"
+#include "compcache.h"
+#include "passtime.h"
 
 #define iabs(x) labs((long)(x))
 
@@ -144,6 +146,103 @@ static struct flexbuf cogGlobalVars;
 // global variables in hub memory (really holds struct AsmVariables)
 static struct flexbuf hubGlobalVars;
 
+// hash index from (interned) name to position in one of the above;
+// big programs have thousands of globals, too many for a linear search
+typedef struct AsmVarIndex {
+    struct flexbuf *fb;
+    size_t *slot;   // position + 1 of the variable, or 0 if empty
+    size_t mask;
+    size_t count;   // number of variables indexed so far
+} AsmVarIndex;
+
+static AsmVarIndex cogGlobalIndex = { &cogGlobalVars };
+static AsmVarIndex hubGlobalIndex = { &hubGlobalVars };
+
+static AsmVarIndex *
+AsmVarIndexFor(struct flexbuf *fb)
+{
+    if (fb == &cogGlobalVars) return &cogGlobalIndex;
+    if (fb == &hubGlobalVars) return &hubGlobalIndex;
+    return NULL;
+}
+
+static size_t
+AsmVarSlot(AsmVarIndex *X, const char *name)
+{
+    return (((uintptr_t)name >> 3) * 2654435761u) & X->mask;
+}
+
+// forget all positions (e.g. after the variables are sorted)
+static void
+InvalidateAsmVarIndex(struct flexbuf *fb)
+{
+    AsmVarIndex *X = AsmVarIndexFor(fb);
+    if (X && X->slot) {
+        memset(X->slot, 0, (X->mask + 1) * sizeof(size_t));
+        X->count = 0;
+    }
+}
+
+// bring the index up to date with the variables in X->fb
+static void
+UpdateAsmVarIndex(AsmVarIndex *X)
+{
+    size_t siz = flexbuf_curlen(X->fb) / sizeof(AsmVariable);
+    AsmVariable *g = (AsmVariable *)flexbuf_peek(X->fb);
+    size_t i, h;
+
+    if (X->slot && X->count == siz) {
+        return;
+    }
+    if (!X->slot || 2 * siz > X->mask) {
+        size_t newsize = X->slot ? 2 * (X->mask + 1) : 256;
+        while (2 * siz > newsize - 1) {
+            newsize *= 2;
+        }
+        free(X->slot);
+        X->slot = (size_t *)calloc(newsize, sizeof(size_t));
+        X->mask = newsize - 1;
+        X->count = 0;
+    }
+    for (i = X->count; i < siz; i++) {
+        h = AsmVarSlot(X, g[i].op->name);
+        while (X->slot[h]) {
+            h = (h + 1) & X->mask;
+        }
+        X->slot[h] = i + 1;
+    }
+    X->count = siz;
+}
+
+// find the variable called "name" (which must be interned), or NULL
+static AsmVariable *
+FindAsmVar(struct flexbuf *fb, const char *name)
+{
+    AsmVarIndex *X = AsmVarIndexFor(fb);
+    AsmVariable *g = (AsmVariable *)flexbuf_peek(fb);
+    size_t siz, i, h;
+
+    if (!X) {
+        siz = flexbuf_curlen(fb) / sizeof(AsmVariable);
+        for (i = 0; i < siz; i++) {
+            if (name == g[i].op->name) {
+                return &g[i];
+            }
+        }
+        return NULL;
+    }
+    UpdateAsmVarIndex(X);
+    h = AsmVarSlot(X, name);
+    while (X->slot[h]) {
+        i = X->slot[h] - 1;
+        if (name == g[i].op->name) {
+            return &g[i];
+        }
+        h = (h + 1) & X->mask;
+    }
+    return NULL;
+}
+
 static int sym_offset(Function *func, Symbol *s)
 {
     return s->offset;
@@ -420,37 +519,39 @@ static int IsMemRef(Operand *op)
 static Operand *
 GetSizedVarCond(struct flexbuf *fb, Operandkind kind, const char *name, intptr_t value, int count, bool allocateIfNeeded)
 {
-    size_t siz = flexbuf_curlen(fb) / sizeof(AsmVariable);
-    size_t i;
     AsmVariable tmp;
-    AsmVariable *g = (AsmVariable *)flexbuf_peek(fb);
-    for (i = 0; i < siz; i++) {
-        if (strcmp(name, g[i].op->name) == 0) {
-            if (g[i].val != value) {
-                if ( (kind == REG_HUBPTR || kind == REG_COGPTR)
-                        && kind == g[i].op->kind
-                        && !strcmp( ((Operand *)g[i].val)->name, ((Operand *)value)->name )
-                   )
-                {
-                    /* OK, pretend this is a match */
-                } else if (allocateIfNeeded) {
-                    ERROR(NULL, "Internal error, redefining value of %s", name);
-                }
-            }
-            if (g[i].count < count) {
-                g[i].count = count;
+    AsmVariable *g;
+    Operand *op = NULL;
+
+    // the optimizer may add globals from several threads at once
+    WorkPoolLock();
+    name = InternString(name);
+    g = FindAsmVar(fb, name);
+    if (g) {
+        if (g->val != value) {
+            if ( (kind == REG_HUBPTR || kind == REG_COGPTR)
+                    && kind == g->op->kind
+                    && ((Operand *)g->val)->name == ((Operand *)value)->name
+               )
+            {
+                /* OK, pretend this is a match */
+            } else if (allocateIfNeeded) {
+                ERROR(NULL, "Internal error, redefining value of %s", name);
             }
-            return g[i].op;
         }
-    }
-    if (allocateIfNeeded) {
+        if (g->count < count) {
+            g->count = count;
+        }
+        op = g->op;
+    } else if (allocateIfNeeded) {
         tmp.op = NewOperand(kind, name, value);
         tmp.val = value;
         tmp.count = count;
         flexbuf_addmem(fb, (const char *)&tmp, sizeof(tmp));
-        return tmp.op;
+        op = tmp.op;
     }
-    return NULL;
+    WorkPoolUnlock();
+    return op;
 }
 
 static Operand *
@@ -480,10 +581,12 @@ Operand *GetResultReg(int n)
         ERROR(NULL, "Too many return values from function");
         return NULL;
     }
+    WorkPoolLock();
     if (!resultreg[n]) {
         sprintf(rvalname, "result%d", n+1);
         resultreg[n] = GetOneGlobal(REG_RESULT, strdup(rvalname), n);
     }
+    WorkPoolUnlock();
     return resultreg[n];
 }
 
@@ -494,10 +597,12 @@ Operand *GetArgReg(int n)
         ERROR(NULL, "Internal error exceeded arg register limit; too many parameters to function");
         return NULL;
     }
+    WorkPoolLock();
     if (!argreg[n]) {
         sprintf(rvalname, "arg%02d", n+1);
         argreg[n] = GetOneGlobal(REG_ARG, strdup(rvalname), n);
     }
+    WorkPoolUnlock();
     return argreg[n];
 }
 
@@ -507,11 +612,13 @@ Operand *GetDebugReg(int n) {
         ERROR(NULL, "Internal error exceeded arg register limit; too many debug registers needed");
         return NULL;
     }
+    WorkPoolLock();
     if (!debugreg[n]) {
         sprintf(rvalname, "%d-0", n);
         debugreg[n] = GetOneGlobal(REG_HW, strdup(rvalname), 0);
         debugaddr[n] = n;
     }
+    WorkPoolUnlock();
     return debugreg[n];
 }
 
@@ -522,6 +629,7 @@ static Operand *GetGeneralLocalReg(int n)
         ERROR(NULL, "Internal error exceeded local register limit, possibly due to -O2 optimization needing additional registers or code being too complicated");
         return NULL;
     }
+    WorkPoolLock();
     if (!localreg[n]) {
         // tricky stuff to make sure local100 sorts after local99
         if (n < 99) {
@@ -533,6 +641,7 @@ static Operand *GetGeneralLocalReg(int n)
            functions */
         localreg[n] = GetOneGlobal(REG_ARG, strdup(rvalname), 0);
     }
+    WorkPoolUnlock();
     return localreg[n];
 }
 static Operand *GetLeafLocalReg(int n)
@@ -542,12 +651,14 @@ static Operand *GetLeafLocalReg(int n)
         ERROR(NULL, "Internal error exceeded local register limit");
         return NULL;
     }
+    WorkPoolLock();
     if (!leafreg[n]) {
         sprintf(rvalname, "_var%02d", n+1);
         /* do not use REG_LOCAL here, that will break optimization of recursive
            functions */
         leafreg[n] = GetOneGlobal(REG_ARG, strdup(rvalname), 0);
     }
+    WorkPoolUnlock();
     return leafreg[n];
 }
 
@@ -587,6 +698,7 @@ FindInstrForOpc(IROpcode kind)
 IR *NewIR(IROpcode kind)
 {
     IR *ir = (IR *)malloc(sizeof(*ir));
+    CountAlloc(sizeof(*ir));
     memset(ir, 0, sizeof(*ir));
     ir->opc = kind;
     ir->instr = FindInstrForOpc(kind);
@@ -741,9 +853,15 @@ void ReplaceIRWithInline(IRList *irl, IR *origir, Function *func)
 Operand *NewOperand(enum Operandkind k, const char *name, intptr_t value)
 {
     Operand *R = (Operand *)malloc(sizeof(*R));
+    CountAlloc(sizeof(*R));
     memset(R, 0, sizeof(*R));
     R->kind = k;
-    R->name = name;
+    if (name && OperandHasName(k)) {
+        // names are interned, so equal names have equal pointers
+        R->name = InternString(name);
+    } else {
+        R->name = name;
+    }
     R->val = value;
     if (k == IMM_COG_LABEL || k == IMM_HUB_LABEL) {
         R->used = 1;
@@ -825,6 +943,7 @@ InsertAfterIR(IRList *irl, IR *orig, IR *ir)
     IR *o_next;
 
     if (!ir) return;
+    IRNoteInsert(irl);
 
     if (!orig) {
         /* place at the beginning of the list */
@@ -951,10 +1070,21 @@ void EmitNamedCogLabel(IRList *irl, const char *name)
     }
 }
 
+// set while a worker is optimizing curfunc on its own
+static THREAD_LOCAL bool funcLocalLabels;
+
 // create a new temporary label name
+// labels made while optimizing functions in parallel are numbered
+// per function, so the names do not depend on thread scheduling
 char *
 NewTempLabelName()
 {
+    if (funcLocalLabels) {
+        IRFuncData *fdata = FuncData(curfunc);
+        char temp[64];
+        snprintf(temp, sizeof(temp), "L__%d_%04d", fdata->labelfunc, fdata->labelcount++);
+        return strdup(temp);
+    }
     return NewTemporaryVariable("L_", NULL);
 }
 
@@ -1779,6 +1909,56 @@ RenameSubregs(IRList *irl, Operand *base, int numlocals, int isLeaf)
     return num;
 }
 
+/*
+ * give the locals of irl the registers chosen by the register allocator,
+ * starting at local register numlocals; locals which are not live
+ * across calls may go in the leaf registers
+ * returns the number of local registers used, or -1 if the allocator
+ * could not handle the function
+ */
+static int
+AllocLocalRegs(IRList *irl, int numlocals, bool isLeaf)
+{
+    LocalRegAlloc A;
+    PtrMap map;
+    Operand *replace;
+    IR *ir, *next;
+    int i, x, y;
+
+    if (!AllocateLocalRegs(irl, !isLeaf, &A)) {
+        return -1;
+    }
+    // moves between locals which are to share a register are not needed
+    PtrMapInit(&map, A.nlocals);
+    for (i = 0; i < A.nlocals; i++) {
+        PtrMapPut(&map, A.locals[i], i);
+    }
+    for (ir = irl->head; ir; ir = next) {
+        next = ir->next;
+        if (ir->opc != OPC_MOV || !ir->dst || !ir->src || InstrSetsAnyFlags(ir) || InstrIsVolatile(ir)) {
+            continue;
+        }
+        x = PtrMapGet(&map, ir->dst);
+        y = PtrMapGet(&map, ir->src);
+        if (x >= 0 && y >= 0 && A.color[x] == A.color[y] && A.scratch[x] == A.scratch[y]) {
+            DeleteIR(irl, ir);
+        }
+    }
+    PtrMapFree(&map);
+    for (i = 0; i < A.nlocals; i++) {
+        if (A.scratch[i]) {
+            replace = GetLocalReg(A.color[i], true);
+        } else {
+            replace = GetLocalReg(numlocals + A.color[i], isLeaf);
+        }
+        if (!replace) break;
+        RenameOneReg(irl->head, A.locals[i], replace);
+    }
+    i = A.ncolors;
+    FreeLocalRegAlloc(&A);
+    return i;
+}
+
 /*
  * rename locals so that we can re-use registers
  * returns a count of how many unique local registers we needed
@@ -1803,6 +1983,12 @@ doRenameLocalRegs(Function *func, bool isLeaf)
             numlocals += RenameSubregs(irl, (Operand *)ir->src->name, numlocals, isLeaf);
         }
     }
+    if (func->optimize_flags & OPT_REG_ALLOC) {
+        int n = AllocLocalRegs(irl, numlocals, isLeaf);
+        if (n >= 0) {
+            return numlocals + n;
+        }
+    }
     for (ir = irl->head; ir; ir = ir->next) {
         if (IsDummy(ir)) continue;
         if (ir->dst && IsLocal(ir->dst)) {
@@ -1953,7 +2139,9 @@ static void EmitFunctionHeader(IRList *irl, Function *func)
     n = 0;
     needFrame = NeedFramePointer(func);
     if (needFrame == FRAME_YES || needFrame == FRAME_MAYBE) {
-        if (NeedToSaveLocals(func)) {
+        if (FuncData(func)->localsRenamed) {
+            n = FuncData(func)->numsavedregs;
+        } else if (NeedToSaveLocals(func)) {
             n = RenameLocalRegs(func, false);
         } else {
             MarkUsedAsmVars(FuncIRL(func));
@@ -3170,6 +3358,25 @@ IsDirectMemberVariable(IRList *irl, AST *objref, Operand **offsetPtr)
     return 0;
 }
 
+/*
+ * while CompileFunc_internal is running, calls found by the code
+ * generator are only logged, and OptimizeCompiledFuncs applies them
+ * in compilation order; this keeps the call counts seen by the
+ * inlining heuristics the same as when every function was fully
+ * processed before the next was compiled
+ */
+static Flexbuf *pendingCalls;
+
+static void
+MarkInternalCall(Function *func)
+{
+    if (pendingCalls) {
+        flexbuf_addmem(pendingCalls, (const char *)&func, sizeof(func));
+    } else {
+        func->callSites |= 1;
+    }
+}
+
 /*
  * get operands for:
  *  object pointer to use (NULL for the default one)
@@ -3262,7 +3469,7 @@ CompileGetFunctionInfo(IRList *irl, AST *expr, Operand **objptr, Operand **offse
     }
     func = (Function *)sym->v.ptr;
     if (func) {
-        func->callSites |= 1; // internal functions may not have been marked earlier
+        MarkInternalCall(func); // internal functions may not have been marked earlier
     }
     offset = NULL;
     objaddr = NULL;
@@ -5538,8 +5745,9 @@ static void CompileStatement(IRList *irl, IRList *cold_irl, AST *ast)
 /*
  * compile just the body of a function, and put it
  * in an IRL for that function
+ * returns false if there was no code to compile
  */
-static void
+static bool
 CompileFunctionBody(Function *f)
 {
     IRList *irl = FuncIRL(f);
@@ -5553,7 +5761,7 @@ CompileFunctionBody(Function *f)
 
     // check for __fromfile
     if (f->body && f->body->kind == AST_STRING) {
-        return;
+        return false;
     }
     EmitFunctionProlog(irl, f);
     // emit initializations if any required
@@ -5599,8 +5807,7 @@ CompileFunctionBody(Function *f)
         EmitLabel(irl,jumpover);
     }
     EmitFunctionEpilog(irl, f);
-    OptimizeIRLocal(irl, f);
-    HashFuncIRL(f);
+    return true;
 }
 
 /*
@@ -5608,10 +5815,101 @@ CompileFunctionBody(Function *f)
  * called late (after all optimizations have been finished)
  */
 
+/*
+ * code quality report (--quality-report=json): size and cycle
+ * estimates for each function, taken from its final IR
+ */
+typedef struct QualityEntry {
+    Function *f;
+    CodeQuality q;
+} QualityEntry;
+
+static Flexbuf qualityEntries;
+
+static void
+NoteFunctionQuality(Function *f, IR *first, IR *last)
+{
+    QualityEntry entry;
+
+    if (!first) return;
+    if (!flexbuf_curlen(&qualityEntries)) {
+        flexbuf_init(&qualityEntries, 1024);
+    }
+    entry.f = f;
+    AnalyzeCodeQuality(first, last, f->code_placement == CODE_PLACE_HUB, &entry.q);
+    flexbuf_addmem(&qualityEntries, (const char *)&entry, sizeof(entry));
+}
+
+static void
+PrintQualityCycles(FILE *f, int cycles)
+{
+    if (!gl_p2 || cycles == CYCLES_UNBOUNDED) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "%d", cycles);
+    }
+}
+
+static void
+WriteQualityReport(void)
+{
+    QualityEntry *list = (QualityEntry *)flexbuf_peek(&qualityEntries);
+    size_t count = flexbuf_curlen(&qualityEntries) / sizeof(QualityEntry);
+    size_t i;
+    int bytes[3] = { 0, 0, 0 };
+    int instrs = 0;
+    FILE *f;
+
+    f = gl_quality_file ? fopen(gl_quality_file, "w") : stdout;
+    if (!f) {
+        fprintf(stderr, "Unable to open quality report: ");
+        perror(gl_quality_file);
+        return;
+    }
+    fprintf(f, "{\n  \"target\": \"%s\",\n  \"functions\": [", gl_p2 ? "p2" : "p1");
+    for (i = 0; i < count; i++) {
+        Function *func = list[i].f;
+        CodeQuality *q = &list[i].q;
+        int place = func->code_placement;
+        int b[3] = { 0, 0, 0 };
+
+        b[place == CODE_PLACE_COG ? 0 : place == CODE_PLACE_LUT ? 2 : 1] = q->bytes;
+        fprintf(f, "%s\n    {\"name\": \"%s\", \"source\": \"%s.%s\", \"memory\": \"%s\", ",
+                i ? "," : "", FuncData(func)->asmname->name,
+                func->module ? func->module->classname : "", func->user_name ? func->user_name : func->name,
+                place == CODE_PLACE_COG ? "cog" : place == CODE_PLACE_LUT ? "lut" : "hub");
+        fprintf(f, "\"cog_bytes\": %d, \"hub_bytes\": %d, \"lut_bytes\": %d, \"instructions\": %d, ",
+                b[0], b[1], b[2], q->instrs);
+        fprintf(f, "\"augs\": %d, \"augd\": %d, \"hub_accesses\": %d, \"cordic_ops\": %d, \"calls\": %d, \"branches\": %d, ",
+                q->augs, q->augd, q->hubAccesses, q->cordicOps, q->calls, q->branches);
+        fprintf(f, "\"min_cycles\": ");
+        PrintQualityCycles(f, q->minCycles);
+        fprintf(f, ", \"max_cycles\": ");
+        PrintQualityCycles(f, q->maxCycles);
+        fprintf(f, ", \"wcet_cycles\": ");
+        PrintQualityCycles(f, gl_p2 ? FunctionWcet(func) : CYCLES_UNBOUNDED);
+        fprintf(f, "}");
+        bytes[0] += b[0];
+        bytes[1] += b[1];
+        bytes[2] += b[2];
+        instrs += q->instrs;
+    }
+    fprintf(f, "%s],\n", count ? "\n  " : "");
+    fprintf(f, "  \"totals\": {\"functions\": %u, \"cog_bytes\": %d, \"hub_bytes\": %d, \"lut_bytes\": %d, \"instructions\": %d}\n}\n",
+            (unsigned)count, bytes[0], bytes[1], bytes[2], instrs);
+    if (f != stdout) {
+        fclose(f);
+    } else {
+        fflush(f);
+    }
+    flexbuf_delete(&qualityEntries);
+}
+
 static void
 CompileWholeFunction(IRList *irl, Function *f)
 {
     IRList *firl = FuncIRL(f);
+    IR *before = irl->tail;
     if (FuncData(f)->firl_done) {
         //ERROR(NULL, "firl done");
         // nothing to do
@@ -5621,6 +5919,11 @@ CompileWholeFunction(IRList *irl, Function *f)
     AppendIRList(irl, firl);
     EmitFunctionFooter(irl, f);
     FuncData(f)->firl_done = 1;
+    FuncData(f)->codefirst = before ? before->next : irl->head;
+    FuncData(f)->codelast = irl->tail;
+    if (gl_quality_report) {
+        NoteFunctionQuality(f, FuncData(f)->codefirst, FuncData(f)->codelast);
+    }
 }
 
 static Operand *newlineOp;
@@ -5662,6 +5965,7 @@ static int EmitAsmVars(struct flexbuf *fb, IRList *datairl, IRList *bssirl, int
     /* sort the global variables */
     if (alphaSort) {
         qsort(g, siz, sizeof(*g), gcmpfunc);
+        InvalidateAsmVarIndex(fb);
     }
     for (i = 0; i < siz; i++) {
         if (g[i].op->kind == REG_LOCAL && !g[i].op->used) {
@@ -5917,10 +6221,79 @@ AssignFuncNames(void *vptr, Module *P)
     return 0;
 }
 
+typedef struct CompiledFunc {
+    Function *f;
+    bool hasBody;   /* false for __fromfile functions */
+    size_t callsEnd;  /* end of this function's entries in pendingCalls */
+} CompiledFunc;
+
+/* functions compiled but not yet optimized */
+static Flexbuf compiledFuncs;
+
+/* how many functions to queue up per optimizer thread */
+#define FUNCS_PER_JOB 16
+
+static void
+OptimizeOneFunction(void *arg, int n)
+{
+    CompiledFunc *entry = ((CompiledFunc *)arg) + n;
+    Function *f = entry->f;
+
+    if (entry->hasBody) {
+        curfunc = f;
+        funcLocalLabels = true;
+        OptimizeIRLocal(FuncIRL(f), f);
+        funcLocalLabels = false;
+    }
+}
+
+/*
+ * run the local optimizer over the queued up functions; with -j N
+ * this is split across N threads. Each function's IR is independent
+ * at this point, so the only shared state is the global tables
+ * (guarded by WorkPoolLock) and the temporary label names (numbered
+ * per function). Everything that looks at other functions is done
+ * afterwards, in the original order, so the output is the same no
+ * matter how many threads are used.
+ */
+static void
+OptimizeCompiledFuncs(void)
+{
+    static int labelfunc = 0;
+    Function *savecurf = curfunc;
+    CompiledFunc *list = (CompiledFunc *)flexbuf_peek(&compiledFuncs);
+    int count = flexbuf_curlen(&compiledFuncs) / sizeof(CompiledFunc);
+    Function **called = (Function **)flexbuf_peek(pendingCalls);
+    size_t ncall = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        FuncData(list[i].f)->labelfunc = ++labelfunc;
+    }
+    PassTimeStart("optimize");
+    WorkPoolRun(gl_jobs, count, OptimizeOneFunction, (void *)list);
+    PassTimeEnd("optimize");
+    for (i = 0; i < count; i++) {
+        Function *f = list[i].f;
+        for (; ncall < list[i].callsEnd / sizeof(Function *); ncall++) {
+            called[ncall]->callSites |= 1;
+        }
+        curfunc = f;
+        if (list[i].hasBody) {
+            HashFuncIRL(f);
+        }
+        AnalyzeInlineEligibility(f);
+    }
+    curfunc = savecurf;
+    flexbuf_clear(&compiledFuncs);
+    flexbuf_clear(pendingCalls);
+}
+
 static int
 CompileFunc_internal(void *vptr, Module *P)
 {
     Function *savecurf = curfunc;
+    CompiledFunc entry;
     Function *f;
 
     for(f = P->functions; f; f = f->next) {
@@ -5928,8 +6301,19 @@ CompileFunc_internal(void *vptr, Module *P)
             continue;
         curfunc = f;
         NormalizeVarOffsets(f);
-        CompileFunctionBody(f);
-        AnalyzeInlineEligibility(f);
+        entry.f = f;
+        if (gl_time_passes) {
+            double start = PassTimeNow();
+            entry.hasBody = CompileFunctionBody(f);
+            PassTimeAddFunction(FuncData(f)->asmname->name, PassTimeNow() - start, 0.0);
+        } else {
+            entry.hasBody = CompileFunctionBody(f);
+        }
+        entry.callsEnd = flexbuf_curlen(pendingCalls);
+        flexbuf_addmem(&compiledFuncs, (const char *)&entry, sizeof(entry));
+        if (flexbuf_curlen(&compiledFuncs) >= gl_jobs * FUNCS_PER_JOB * sizeof(entry)) {
+            OptimizeCompiledFuncs();
+        }
     }
     curfunc = savecurf;
     return 0;
@@ -5971,13 +6355,428 @@ void
 CompileIntermediate(Module *P)
 {
     int change;
+    Flexbuf calls;
+
+    PassTimeStart("compile to IR");
     InitAsmCode();
 
     VisitRecursive(NULL, P, AssignFuncNames, VISITFLAG_FUNCNAMES);
+    flexbuf_init(&compiledFuncs, 1024);
+    flexbuf_init(&calls, 1024);
+    pendingCalls = &calls;
     VisitRecursive(NULL, P, CompileFunc_internal, VISITFLAG_COMPILEFUNCS);
+    OptimizeCompiledFuncs();
+    pendingCalls = NULL;
+    flexbuf_delete(&calls);
+    flexbuf_delete(&compiledFuncs);
+    PassTimeStart("inline");
     do {
         change = VisitRecursive(NULL, P, ExpandInline_internal, VISITFLAG_EXPANDINLINE);
     } while (change);
+    PassTimeEnd("inline");
+    PassTimeEnd("compile to IR");
+}
+
+/*
+ * static register frames (-Ostatic-frames)
+ *
+ * Normally a function which needs local registers pushes the ones it
+ * uses on entry and pops them again on exit, so that it cannot clobber
+ * its callers. If a function can never be active twice at the same
+ * time, and we know every function which may be active when it is
+ * called, we can instead give it local registers that none of those
+ * callers use and skip the push and pop entirely.
+ *
+ * To find those functions we build the call graph of the whole
+ * program. Calls through pointers go to a node standing for "some
+ * function whose address was taken", and calls we cannot identify at
+ * all go to a node which may call anything. Functions which are part of
+ * a cycle (including recursion through those nodes) keep the usual
+ * frames. The others are visited callers first; each gets registers
+ * starting above the highest register in use by any of its callers.
+ *
+ * On P2 the return address of a function without a frame stays on the
+ * 8 level hardware stack, so we also check that this cannot overflow.
+ */
+#define HW_STACK_DEPTH       8
+#define HW_STACK_SLACK       2   /* fcache loader plus a helper */
+#define HW_STACK_UNBOUNDED   (HW_STACK_DEPTH + 1)
+#define MAX_STATIC_FRAME_TOP 64
+
+typedef struct CallNode {
+    Function *f;           /* NULL for the unknown nodes */
+    Flexbuf succ;          /* int: callees */
+    bool special;          /* uses setjmp or gosub */
+    bool addressTaken;
+    int index, lowlink;    /* for finding cycles */
+    bool onstack;
+    int comp;              /* strongly connected component */
+    int height;            /* hardware stack entries it and callees may use */
+    int inTop, inDepth;    /* highest register / stack depth of callers */
+    int outTop, outDepth;  /* what its callees see */
+} CallNode;
+
+typedef struct CallGraph {
+    int nnodes;
+    CallNode *node;
+    PtrMap names;          /* function labels -> node */
+    int ptrNode, anyNode;  /* the unknown nodes */
+    int counter;
+    Flexbuf stack;         /* int */
+    Flexbuf comps;         /* int: nodes, each component ending with -1 */
+} CallGraph;
+
+#define CG_SUCC(n)  ((int *)flexbuf_peek(&(n)->succ))
+#define CG_NSUCC(n) ((int)(flexbuf_curlen(&(n)->succ) / sizeof(int)))
+
+static int
+CollectCallGraphFuncs(void *vptr, Module *P)
+{
+    Flexbuf *fb = (Flexbuf *)vptr;
+    Function *f;
+
+    for (f = P->functions; f; f = f->next) {
+        if (ShouldSkipFunction(f) || !FuncData(f) || FuncData(f)->firl_done) {
+            continue;
+        }
+        if (RemoveIfInlined(f) && ActuallyInlined(f)) {
+            continue;
+        }
+        flexbuf_addmem(fb, (const char *)&f, sizeof(f));
+    }
+    return 0;
+}
+
+static void
+AddCallEdge(CallNode *from, int to)
+{
+    flexbuf_addmem(&from->succ, (const char *)&to, sizeof(to));
+}
+
+static bool
+IsHelperCall(Operand *dst)
+{
+    return dst == mulfunc || dst == unsmulfunc || dst == divfunc || dst == unsdivfunc
+        || dst == putcogreg || dst == longjmpfunc || dst == setjmpfunc
+        || !strcmp(dst->name, "gosub_");
+}
+
+static void
+AddCallEdges(CallGraph *G, int v)
+{
+    CallNode *N = &G->node[v];
+    IR *ir;
+    int t;
+
+    for (ir = FuncIRL(N->f)->head; ir; ir = ir->next) {
+        if (IsDummy(ir)) continue;
+        switch (ir->opc) {
+        case OPC_CALL:
+        case OPC_JUMP:
+        case OPC_GENERIC_BRANCH:
+        case OPC_GENERIC_BRCOND:
+            if (!ir->dst) break;
+            t = PtrMapGet(&G->names, ir->dst);
+            if (t >= 0) {
+                AddCallEdge(N, t);
+            } else if (ir->dst->kind != IMM_COG_LABEL && ir->dst->kind != IMM_HUB_LABEL) {
+                AddCallEdge(N, G->ptrNode);
+            } else if (ir->opc == OPC_JUMP) {
+                // an ordinary jump inside the function
+            } else if (ir->opc == OPC_CALL && IsHelperCall(ir->dst)) {
+                if (ir->dst == setjmpfunc || !strcmp(ir->dst->name, "gosub_")) {
+                    N->special = true;
+                }
+            } else {
+                AddCallEdge(N, G->anyNode);
+            }
+            break;
+        default:
+            // taking the address of a function
+            if (ir->src && (t = PtrMapGet(&G->names, ir->src)) >= 0) {
+                G->node[t].addressTaken = true;
+            }
+            if (ir->dst && (t = PtrMapGet(&G->names, ir->dst)) >= 0) {
+                G->node[t].addressTaken = true;
+            }
+            break;
+        }
+    }
+}
+
+static void
+FindCallCycles(CallGraph *G, int v)
+{
+    CallNode *N = &G->node[v];
+    int i, w;
+
+    N->index = N->lowlink = G->counter++;
+    flexbuf_addmem(&G->stack, (const char *)&v, sizeof(v));
+    N->onstack = true;
+    for (i = 0; i < CG_NSUCC(N); i++) {
+        w = CG_SUCC(N)[i];
+        if (G->node[w].index < 0) {
+            FindCallCycles(G, w);
+            if (G->node[w].lowlink < N->lowlink) N->lowlink = G->node[w].lowlink;
+        } else if (G->node[w].onstack && G->node[w].index < N->lowlink) {
+            N->lowlink = G->node[w].index;
+        }
+    }
+    if (N->lowlink == N->index) {
+        int comp = (int)(flexbuf_curlen(&G->comps) / sizeof(int));
+        do {
+            G->stack.len -= sizeof(int);
+            w = *(int *)(flexbuf_peek(&G->stack) + G->stack.len);
+            G->node[w].onstack = false;
+            G->node[w].comp = comp;
+            flexbuf_addmem(&G->comps, (const char *)&w, sizeof(w));
+        } while (w != v);
+        w = -1;
+        flexbuf_addmem(&G->comps, (const char *)&w, sizeof(w));
+    }
+}
+
+/* does component comp, whose nodes are members[0..n-1], contain a cycle? */
+static bool
+CallCompIsCycle(CallGraph *G, int *members, int n)
+{
+    CallNode *N = &G->node[members[0]];
+    int i;
+
+    if (n > 1) return true;
+    for (i = 0; i < CG_NSUCC(N); i++) {
+        if (CG_SUCC(N)[i] == members[0]) return true;
+    }
+    return false;
+}
+
+/* rename local register k to base+k in f */
+static void
+ShiftLocalRegs(Function *f, int n, int base)
+{
+    int k;
+
+    // go from the top so that a new name is never one still to be renamed
+    for (k = n-1; k >= 0; --k) {
+        RenameOneReg(FuncIRL(f)->head, GetLocalReg(k, 0), GetLocalReg(base+k, 0));
+    }
+}
+
+/*
+ * give f its local registers; if stat is set it gets them starting at
+ * base, otherwise it pushes them starting at local01 as usual
+ * returns the number of registers
+ */
+static int
+AssignFrame(CallNode *N, bool stat, bool *pushes)
+{
+    Function *f = N->f;
+    int n = 0;
+    int needFrame;
+
+    curfunc = f;
+    if (NeedToSaveLocals(f)) {
+        n = RenameLocalRegs(f, false);
+        FuncData(f)->localsRenamed = true;
+        FuncData(f)->numsavedregs = n;
+    }
+    needFrame = NeedFramePointer(f);
+    if (stat && n > 0 && needFrame == FRAME_MAYBE && N->inTop + n <= MAX_STATIC_FRAME_TOP) {
+        ShiftLocalRegs(f, n, N->inTop);
+        FuncData(f)->numsavedregs = 0;
+        FuncData(f)->staticFrame = true;
+        *pushes = false;
+        return N->inTop + n;
+    }
+    // pushregs_ takes the return address off the hardware stack
+    *pushes = HUB_CODE && ((needFrame == FRAME_YES) || (needFrame == FRAME_MAYBE && n > 0));
+    return n;
+}
+
+static bool
+CanHaveStaticFrame(CallNode *N)
+{
+    Function *f = N->f;
+
+    if (!(f->optimize_flags & OPT_STATIC_FRAMES) || N->special) {
+        return false;
+    }
+    if (!NeedToSaveLocals(f) || NeedFramePointer(f) != FRAME_MAYBE) {
+        return false;
+    }
+    if (gl_p2 && N->inDepth - 1 + N->height > HW_STACK_DEPTH) {
+        return false;
+    }
+    return true;
+}
+
+static void
+AssignStaticFrames(Module *P)
+{
+    Flexbuf funcs;
+    CallGraph G;
+    Function **fl;
+    Function *f, *save = curfunc;
+    FunctionList *dup;
+    CallNode *N;
+    int *comps, *members;
+    int nfuncs, ncomp, i, j, h, k, n, v, w;
+    bool want = false;
+    bool cycle, pushes;
+
+    if (gl_compress || (gl_features_used & FEATURE_TASKS_USED)) {
+        return;
+    }
+    flexbuf_init(&funcs, 1024);
+    VisitRecursive(&funcs, P, CollectCallGraphFuncs, VISITFLAG_CALLGRAPH);
+    VisitRecursive(&funcs, systemModule, CollectCallGraphFuncs, VISITFLAG_CALLGRAPH);
+    fl = (Function **)flexbuf_peek(&funcs);
+    nfuncs = (int)(flexbuf_curlen(&funcs) / sizeof(Function *));
+    for (i = 0; i < nfuncs; i++) {
+        want = want || (fl[i]->optimize_flags & OPT_STATIC_FRAMES);
+    }
+    if (!want) {
+        flexbuf_delete(&funcs);
+        return;
+    }
+
+    // build the graph
+    memset(&G, 0, sizeof(G));
+    G.nnodes = nfuncs + 2;
+    G.ptrNode = nfuncs;
+    G.anyNode = nfuncs + 1;
+    G.node = (CallNode *)calloc(G.nnodes, sizeof(CallNode));
+    PtrMapInit(&G.names, 2*nfuncs);
+    for (v = 0; v < G.nnodes; v++) {
+        N = &G.node[v];
+        N->f = (v < nfuncs) ? fl[v] : NULL;
+        N->index = -1;
+        flexbuf_init(&N->succ, 16*sizeof(int));
+        if (N->f) {
+            f = N->f;
+            PtrMapPut(&G.names, FuncData(f)->asmname, v);
+            if (FuncData(f)->asmentername) {
+                PtrMapPut(&G.names, FuncData(f)->asmentername, v);
+            }
+            if (FuncData(f)->asmaltname) {
+                PtrMapPut(&G.names, FuncData(f)->asmaltname, v);
+            }
+            for (dup = FuncData(f)->funcdups; dup; dup = dup->next) {
+                PtrMapPut(&G.names, FuncData(dup->func)->asmname, v);
+            }
+        }
+    }
+    for (v = 0; v < nfuncs; v++) {
+        AddCallEdges(&G, v);
+    }
+    for (v = 0; v < nfuncs; v++) {
+        f = fl[v];
+        if (f->used_as_ptr || f->cog_task || G.node[v].addressTaken) {
+            AddCallEdge(&G.node[G.ptrNode], v);
+        }
+        AddCallEdge(&G.node[G.anyNode], v);
+    }
+
+    // find the cycles; components come out callees first
+    flexbuf_init(&G.stack, 1024);
+    flexbuf_init(&G.comps, 1024);
+    for (v = 0; v < G.nnodes; v++) {
+        if (G.node[v].index < 0) {
+            FindCallCycles(&G, v);
+        }
+    }
+    comps = (int *)flexbuf_peek(&G.comps);
+    ncomp = (int)(flexbuf_curlen(&G.comps) / sizeof(int));
+
+    // hardware stack use, callees first
+    for (i = 0; i < ncomp; i = j + 1) {
+        members = &comps[i];
+        for (j = i; comps[j] >= 0; j++)
+            ;
+        n = j - i;
+        cycle = CallCompIsCycle(&G, members, n);
+        k = HW_STACK_SLACK;
+        for (v = 0; v < n; v++) {
+            N = &G.node[members[v]];
+            for (w = 0; w < CG_NSUCC(N); w++) {
+                CallNode *C = &G.node[CG_SUCC(N)[w]];
+                if (C->comp != N->comp && C->height > k) k = C->height;
+            }
+        }
+        // a function keeps its return address on the stack unless
+        // pushregs_ takes it off; inside a cycle that may happen any
+        // number of times
+        h = k;
+        for (v = 0; v < n; v++) {
+            N = &G.node[members[v]];
+            if (N->f && !(HUB_CODE && NeedFramePointer(N->f) == FRAME_YES)) {
+                h = (cycle || k >= HW_STACK_DEPTH) ? HW_STACK_UNBOUNDED : k + 1;
+            }
+        }
+        for (v = 0; v < n; v++) {
+            G.node[members[v]].height = h;
+        }
+    }
+
+    // frames, callers first
+    for (v = 0; v < G.nnodes; v++) {
+        G.node[v].inDepth = 1;
+    }
+    for (j = ncomp - 1; j >= 0; j = i - 1) {
+        for (i = j - 1; i >= 0 && comps[i] >= 0; --i)
+            ;
+        i++;
+        members = &comps[i];
+        n = j - i;
+        cycle = CallCompIsCycle(&G, members, n);
+        if (!cycle) {
+            N = &G.node[members[0]];
+            N->outTop = N->inTop;
+            N->outDepth = N->inDepth;
+            if (N->f) {
+                k = AssignFrame(N, CanHaveStaticFrame(N), &pushes);
+                if (k > N->outTop) N->outTop = k;
+                if (!pushes) N->outDepth++;
+            }
+        } else {
+            int top = 0, depth = 1;
+            for (v = 0; v < n; v++) {
+                N = &G.node[members[v]];
+                if (N->inTop > top) top = N->inTop;
+                if (N->inDepth > depth) depth = N->inDepth;
+            }
+            for (v = 0; v < n; v++) {
+                N = &G.node[members[v]];
+                N->outDepth = depth;
+                if (N->f) {
+                    k = AssignFrame(N, false, &pushes);
+                    if (k > top) top = k;
+                    if (!pushes) N->outDepth = HW_STACK_UNBOUNDED;
+                }
+            }
+            for (v = 0; v < n; v++) G.node[members[v]].outTop = top;
+        }
+        for (v = 0; v < n; v++) {
+            N = &G.node[members[v]];
+            for (w = 0; w < CG_NSUCC(N); w++) {
+                CallNode *C = &G.node[CG_SUCC(N)[w]];
+                if (C->comp == N->comp) continue;
+                if (N->outTop > C->inTop) C->inTop = N->outTop;
+                if (N->outDepth > C->inDepth) C->inDepth = N->outDepth;
+                if (C->inDepth > HW_STACK_UNBOUNDED) C->inDepth = HW_STACK_UNBOUNDED;
+            }
+        }
+    }
+
+    for (v = 0; v < G.nnodes; v++) {
+        flexbuf_delete(&G.node[v].succ);
+    }
+    free(G.node);
+    PtrMapFree(&G.names);
+    flexbuf_delete(&G.stack);
+    flexbuf_delete(&G.comps);
+    flexbuf_delete(&funcs);
+    curfunc = save;
 }
 
 static int
@@ -7124,10 +7923,9 @@ CompileSystemModule(IRList *where, Module *M, int flag)
     VisitRecursive(where, M, CompileToIR_internal, flag);
 }
 
-void
-OutputAsmCode(const char *fname, Module *P, int outputMain)
+static IRList *
+doCompileAsmCode(Module *P, int outputMain)
 {
-    FILE *f = NULL;
     Module *save;
     IR *orgh = NULL;
     Operand *entrylabel = NewOperand(IMM_COG_LABEL, ENTRYNAME, 0);
@@ -7135,7 +7933,6 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
     Operand *cog_bss_start = NewOperand(IMM_COG_LABEL, "COG_BSS_START", 0);
     bool emitSpinCode = true;
 
-    const char *asmcode;
     int maxargs = 2; // initialization code wants 2 arguments
     int maxrets = 1;  // assume 1 return value is default
 
@@ -7230,6 +8027,7 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
         }
     }
     if (emitSpinCode) {
+        ApplyAsmProfile();
         EmitOp1(&cogbss, OPC_ORG, cog_bss_start);
     }
     CompileConsts(&cogcode, P);
@@ -7263,12 +8061,16 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
         }
         // generate code for inlining
         CompileIntermediate(P);
+        // give registers to functions which need not push them
+        AssignStaticFrames(P);
         // compile COG functions
         if (!CompileToIR_cog(&cogcode, P)) {
-            return;
+            current = save;
+            return NULL;
         }
         if (!CompileToIR_lut(&lutcode, P)) {
-            return;
+            current = save;
+            return NULL;
         }
 
         if (HUB_CODE) {
@@ -7281,7 +8083,8 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
             EmitInfoLabel(&hubcode, NewOperand(IMM_HUB_LABEL, "__SIZE_CODE_START", 0));
             EmitLabel(&hubcode, NewOperand(IMM_HUB_LABEL, "hubentry", 0));
             if (!CompileToIR_hub(&hubcode, P)) {
-                return;
+                current = save;
+                return NULL;
             }
         }
         if (hubexit) {
@@ -7311,7 +8114,12 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
         AppendIR(&cogcode, hubcode.head);
 
         // we have to optimize all code before emitting any variables
+        PassTimeStart("global optimize");
         OptimizeIRGlobal(&cogcode);
+        PassTimeEnd("global optimize");
+        if (gl_p2) {
+            AnalyzeWcet();
+        }
 
         // mark used variables (only)
         ClearUseCounts(&cogGlobalVars);
@@ -7410,10 +8218,66 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
     // now the cog bss (which doesn't need any actual space
     AppendIR(&cogcode, cogbss.head);
 
-    // and assemble the result
-    asmcode = IRAssemble(&cogcode, P);
+    if (gl_verbosity) {
+        PrintOptimizerStats(stdout);
+    }
+    if (gl_quality_report) {
+        WriteQualityReport();
+    }
 
     current = save;
+    return &cogcode;
+}
+
+static char *
+doCompileAsmText(Module *P, int outputMain, Flexbuf *irlines)
+{
+    IRList *irl;
+    Module *save;
+    char *asmcode = NULL;
+
+    PassTimeStart("pasm backend");
+    irl = doCompileAsmCode(P, outputMain);
+    if (irl) {
+        save = current;
+        current = P;
+        PassTimeStart("assemble");
+        asmcode = IRAssembleLines(irl, P, irlines);
+        PassTimeEnd("assemble");
+        current = save;
+    }
+    PassTimeEnd("pasm backend");
+    return asmcode;
+}
+
+/*
+ * compile module P (and everything it uses) to assembly language
+ * returns a freshly allocated string holding the assembly text,
+ * or NULL if compilation stopped early because of errors
+ */
+char *
+CompileAsmCode(Module *P, int outputMain)
+{
+    return doCompileAsmText(P, outputMain, NULL);
+}
+
+/*
+ * like CompileAsmCode, but also record in irlines what IRBuildDat
+ * needs to build the DAT section for the text without parsing it
+ */
+char *
+CompileAsmCodeLines(Module *P, int outputMain, Flexbuf *irlines)
+{
+    return doCompileAsmText(P, outputMain, irlines);
+}
+
+/*
+ * write assembly text produced by CompileAsmCode to fname
+ */
+void
+WriteAsmFile(const char *fname, const char *asmcode)
+{
+    FILE *f = NULL;
 
     f = fopen(fname, "w");
     if (!f) {
@@ -7421,6 +8285,7 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
         perror(fname);
         exit(1);
     }
+    CacheNoteOutput(fname);
     // write a header if appropriate
     if (gl_output == OUTPUT_COGSPIN && gl_header1) {
         fprintf(f, "'' %s", gl_header1);
@@ -7429,3 +8294,15 @@ OutputAsmCode(const char *fname, Module *P, int outputMain)
     fwrite(asmcode, 1, strlen(asmcode), f);
     fclose(f);
 }
+
+void
+OutputAsmCode(const char *fname, Module *P, int outputMain)
+{
+    char *asmcode;
+
+    asmcode = CompileAsmCode(P, outputMain);
+    if (!asmcode) {
+        return;
+    }
+    WriteAsmFile(fname, asmcode);
+}
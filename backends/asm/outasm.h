@@ -57,6 +57,7 @@ IRCond InvertCond(IRCond v);
 // function to convert an IR list into a text representation of the
 // assembly
 char *IRAssemble(IRList *list, Module *P);
+char *IRAssembleLines(IRList *list, Module *P, Flexbuf *irlines);
 
 // do instruction compression
 void IRCompress(IRList *list, IRList *kernel);
@@ -69,6 +70,7 @@ IR *EmitMove(IRList *irl, Operand *dst, Operand *src, AST *linenum);
 
 // optimization functions
 void OptimizeIRLocal(IRList *irl, Function *f);
+void PrintOptimizerStats(FILE *f);
 void OptimizeIRGlobal(IRList *irl);
 void OptimizeFcache(IRList *irl);
 bool AnalyzeInlineEligibility(Function *f);
@@ -76,14 +78,66 @@ bool RemoveIfInlined(Function *f);
 int  ExpandInlines(IRList *irl);
 
 void ReplaceOpcode(IR *ir, IROpcode op);
+// tells the optimizer that instructions are being inserted into irl
+void IRNoteInsert(IRList *irl);
+
+// assignment of registers to the locals of a function (-Oregalloc)
+typedef struct LocalRegAlloc {
+    int nlocals;
+    Operand **locals;   // the locals, in order of first appearance
+    int *color;         // register number given to each local
+    bool *scratch;      // true if that number is for a scratch register
+    int ncolors;        // number of registers for the non-scratch locals
+    int nscratch;       // number of scratch registers
+} LocalRegAlloc;
+
+bool AllocateLocalRegs(IRList *irl, bool useScratch, LocalRegAlloc *A);
+void FreeLocalRegAlloc(LocalRegAlloc *A);
+
+// static size and speed estimates for a piece of code (--quality-report)
+// the cycle counts are only computed for P2
+#define CYCLES_UNBOUNDED (-1)
+
+// worst case hub timings from the P2 instruction table: the egg beater
+// window is the same in hub code, but there the FIFO competes for the hub
+#define HUB_READ_CYCLES(hubexec)  ((hubexec) ? 26 : 16)
+#define HUB_WRITE_CYCLES(hubexec) ((hubexec) ? 20 : 10)
+// a taken branch or return; one to hub code has to refill the FIFO
+#define BRANCH_CYCLES(hubexec)    ((hubexec) ? 20 : 4)
+
+typedef struct CodeQuality {
+    int instrs;         // machine instructions
+    int augs;           // AUGS prefixes needed for big source immediates
+    int augd;           // AUGD prefixes needed for big destination immediates
+    int bytes;          // size of the instructions and prefixes
+    int hubAccesses;    // hub memory reads and writes
+    int cordicOps;      // CORDIC commands
+    int calls;
+    int branches;
+    int minCycles;      // if every instruction runs once
+    int maxCycles;      // ditto, or CYCLES_UNBOUNDED
+} CodeQuality;
+
+int InstrMinCycles(IR *ir);
+int InstrMaxCycles(IR *ir, bool hubexec);
+void AnalyzeCodeQuality(IR *first, IR *last, bool hubexec, CodeQuality *Q);
+
+// use the --profile-use profile to mark hot and cold functions and pick LUT code
+void ApplyAsmProfile(void);
+
+// worst case cycles of each function (--wcet and cycle budgets); P2 only
+void AnalyzeWcet(void);
+int FunctionWcet(Function *f);
 
 bool IsDummy(IR *ir);
 bool IsBranch(IR *ir);
+bool IsJump(IR *ir);
 bool IsValidDstReg(Operand *reg);
 bool SrcOnlyHwReg(Operand *reg);
 bool IsLocal(Operand *reg);
 bool IsLocalOrArg(Operand *reg);
 bool IsHwReg(Operand *reg);
+bool NeedsImmAug(Operand *op);
 
 bool IsHubDest(Operand *dst);
 Operand *JumpDest(IR *ir);
@@ -130,6 +184,13 @@ typedef struct ir_bedata {
 
     /* number of local registers that need to be pushed */
     int numsavedregs;
+
+    /* set if the locals were already given registers by the whole
+       program pass (AssignStaticFrames); numsavedregs is then valid */
+    bool localsRenamed;
+    /* set if the locals live in registers reserved for this function
+       along every call path, so nothing needs to be pushed */
+    bool staticFrame;
     
     /* flags for whether we should inline the function */
     unsigned inliningFlags;
@@ -160,6 +221,18 @@ typedef struct ir_bedata {
     
     /* hash of the function's instructions */
     unsigned char firl_hash[SHA256_BLOCK_SIZE];
+
+    /* numbering for temporary labels created while optimizing this
+       function on its own (see NewTempLabelName) */
+    int labelfunc;
+    int labelcount;
+
+    /* first and last instructions of the function in the final
+       program, and its worst case cycles (see wcet_ir.c) */
+    IR *codefirst, *codelast;
+    int wcet;
+    int wcetState;
+    const char *wcetReason;
     
 } IRFuncData;
 
@@ -261,4 +334,72 @@ int OptimizePeephole2(IRList *irl);
 // Hashing functions
 void HashFuncIRL(Function *f);
 
+// map from pointers to small integers (cfg_ir.c)
+typedef struct PtrMap {
+    size_t mask;
+    size_t count;
+    const void **keys;
+    int *vals;
+} PtrMap;
+
+void PtrMapInit(PtrMap *m, size_t n);
+void PtrMapFree(PtrMap *m);
+int PtrMapGet(PtrMap *m, const void *p);    // -1 if not found
+void PtrMapPut(PtrMap *m, const void *p, int val);
+
+//
+// control flow graph (cfg_ir.c)
+//
+
+// special successors
+#define CFG_EXIT    (-1)   // leaves the function
+#define CFG_UNKNOWN (-2)   // jumps somewhere we cannot tell
+
+typedef struct IRBlock {
+    IR *first, *last;      // first and last instructions
+    int start, end;        // and their indexes (end is one past last)
+    int nsucc, npred;
+    int *succ;             // block numbers, CFG_EXIT or CFG_UNKNOWN
+    int *pred;             // block numbers
+    int rpo;               // position in reverse postorder, or -1 if unreachable
+    int idom;              // immediate dominator, or -1 for entry blocks
+    int ipdom;             // immediate post-dominator, or -1 if none
+    int loop;              // innermost loop containing the block, or -1
+    int dompre, dompost;   // numbering of the dominator tree
+    int pdompre, pdompost; // and of the post-dominator tree
+} IRBlock;
+
+typedef struct IRLoop {
+    int header;            // block every entry to the loop goes through
+    int parent;            // enclosing loop, or -1
+    int depth;             // 1 for outermost loops
+    int nblocks;
+    int *blocks;           // the header comes first
+} IRLoop;
+
+typedef struct IRCfg {
+    IRList *irl;
+    int ninstrs;
+    IR **instrs;           // all instructions, in order
+    int *blockOf;          // block number for each instruction
+    int *pos;              // number of real instructions before each one
+    PtrMap instrMap;       // IR -> instruction index
+    int nblocks;
+    IRBlock *blocks;
+    int nedges;
+    int *succs, *preds;    // storage for the block edge lists
+    int nloops;
+    IRLoop *loops;         // outer loops before the loops inside them
+    int *loopBlocks;
+} IRCfg;
+
+IRCfg *GetIRCfg(IRList *irl);
+void InvalidateIRCfg(void);
+int IRCfgInstrIndex(IRCfg *cfg, IR *ir);
+int IRCfgBlockOf(IRCfg *cfg, IR *ir);
+int IRCfgPosition(IRCfg *cfg, IR *ir);
+bool IRCfgDominates(IRCfg *cfg, int a, int b);
+bool IRCfgPostDominates(IRCfg *cfg, int a, int b);
+bool IRCfgInLoop(IRCfg *cfg, int b, int loop);
+
 #endif
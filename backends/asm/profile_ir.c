@@ -0,0 +1,248 @@
+/*
+ * Spin to Pasm converter
+ * Copyright 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * Profile guided optimization (--profile-use=FILE).
+ *
+ * The profile is the JSON written by "p2sim --json=FILE" for a run of
+ * an earlier build of the same program (compiled with -l, so that p2sim
+ * knows the function names). It gives the cycles used, the calls, and
+ * the hub size of each function, keyed by the function's assembly name.
+ * Before any code is generated, ApplyAsmProfile uses it to:
+ *
+ *   - mark short functions which are called often and use a noticeable
+ *     share of the time as hot; they are inlined at twice the usual size
+ *   - place the hot functions which use the most cycles per byte in LUT
+ *     memory, as if they had been declared {++lut}, while they fit
+ *   - mark functions which never ran as cold; they are only inlined if
+ *     that makes the code smaller, and are compiled with OPT_EXTRASMALL
+ *
+ * Functions missing from the profile (for example because they were
+ * inlined everywhere in the profiled build, or are new) are compiled
+ * as usual, so a stale profile makes the code slower, never wrong.
+ *
+ * Only function level data is used: there is no instrumented build
+ * (--profile-generate), so there are no branch counts, and profiles
+ * can only come from runs under p2sim, not from real hardware.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spinc.h"
+#include "outasm.h"
+
+/*
+ * a function is hot if it uses at least PROFILE_HOT_PERMILLE/1000 of the
+ * cycles, is called at least PROFILE_HOT_CALLS times, and takes at most
+ * PROFILE_HOT_CYCLES_PER_CALL cycles per call; longer calls (most often
+ * ones which wait for a pin or a timer) gain little from inlining or
+ * from the faster branches in LUT
+ */
+#define PROFILE_HOT_PERMILLE         10
+#define PROFILE_HOT_CALLS            64
+#define PROFILE_HOT_CYCLES_PER_CALL  400
+/* LUT space for hot functions; the LUT code area ($210-$2FF) holds 240 longs,
+   and the sizes in the profile are those of the hub code, so leave some slack */
+#define PROFILE_LUT_BYTES     (160*4)
+
+typedef struct ProfileEntry {
+    const char *name;
+    long long cycles;
+    long long calls;
+    long long bytes;
+} ProfileEntry;
+
+typedef struct LutCandidate {
+    Function *f;
+    ProfileEntry *prof;
+} LutCandidate;
+
+static Flexbuf profileEntries;
+static long long profileCycles;
+
+/* the number after "key": in line, or -1 if there is none */
+static long long
+ProfileField(const char *line, const char *key)
+{
+    char pattern[64];
+    const char *p;
+
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    p = strstr(line, pattern);
+    if (!p) {
+        return -1;
+    }
+    return strtoll(p + strlen(pattern), NULL, 10);
+}
+
+/*
+ * read a profile; p2sim writes each function on a line of its own,
+ * and the total cycles before any of them
+ */
+static bool
+ReadProfile(const char *fname)
+{
+    FILE *f = fopen(fname, "r");
+    char line[1024];
+    ProfileEntry entry;
+    char *name, *end;
+
+    if (!f) {
+        return false;
+    }
+    flexbuf_init(&profileEntries, 1024);
+    profileCycles = 0;
+    while (fgets(line, sizeof(line), f)) {
+        name = strstr(line, "\"name\": \"");
+        if (!name) {
+            if (!profileCycles && !strstr(line, "\"cog\":")) {
+                long long cycles = ProfileField(line, "cycles");
+                if (cycles > 0) {
+                    profileCycles = cycles;
+                }
+            }
+            continue;
+        }
+        name += 9;
+        end = strchr(name, '"');
+        if (!end) {
+            continue;
+        }
+        *end++ = 0;
+        entry.name = strdup(name);
+        entry.cycles = ProfileField(end, "cycles");
+        entry.calls = ProfileField(end, "calls");
+        entry.bytes = ProfileField(end, "bytes");
+        flexbuf_addmem(&profileEntries, (const char *)&entry, sizeof(entry));
+    }
+    fclose(f);
+    return true;
+}
+
+static ProfileEntry *
+FindProfile(const char *name)
+{
+    ProfileEntry *list = (ProfileEntry *)flexbuf_peek(&profileEntries);
+    size_t n = flexbuf_curlen(&profileEntries) / sizeof(ProfileEntry);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(list[i].name, name)) {
+            return &list[i];
+        }
+    }
+    return NULL;
+}
+
+static bool
+CanMoveToLut(Function *f, ProfileEntry *prof)
+{
+    if (f->module == systemModule) {
+        // library functions are only ever compiled into COG or HUB
+        return false;
+    }
+    if (f->code_placement != CODE_PLACE_DEFAULT) {
+        // the user already picked a place for it
+        return false;
+    }
+    if (f->cog_task || f->used_as_ptr) {
+        // may be started or called through its hub address
+        return false;
+    }
+    return prof->bytes > 0;
+}
+
+static void
+ProfileModule(Module *Q, Flexbuf *lutCandidates)
+{
+    Function *f;
+    ProfileEntry *prof;
+    LutCandidate cand;
+
+    for (f = Q->functions; f; f = f->next) {
+        prof = FindProfile(IdentifierModuleName(Q, f->name));
+        if (!prof) {
+            continue;
+        }
+        if (prof->cycles == 0) {
+            f->profile_cold = 1;
+            f->optimize_flags |= OPT_EXTRASMALL;
+            continue;
+        }
+        if (prof->calls < PROFILE_HOT_CALLS
+            || prof->cycles * 1000 < profileCycles * PROFILE_HOT_PERMILLE
+            || prof->cycles > prof->calls * PROFILE_HOT_CYCLES_PER_CALL) {
+            continue;
+        }
+        f->profile_hot = 1;
+        if (CanMoveToLut(f, prof)) {
+            cand.f = f;
+            cand.prof = prof;
+            flexbuf_addmem(lutCandidates, (const char *)&cand, sizeof(cand));
+        }
+    }
+}
+
+// sort by cycles per byte, highest first
+static int
+CompareLutCandidates(const void *a, const void *b)
+{
+    const LutCandidate *ca = (const LutCandidate *)a;
+    const LutCandidate *cb = (const LutCandidate *)b;
+    double da = (double)ca->prof->cycles / ca->prof->bytes;
+    double db = (double)cb->prof->cycles / cb->prof->bytes;
+
+    if (da != db) {
+        return da > db ? -1 : 1;
+    }
+    return strcmp(ca->prof->name, cb->prof->name);
+}
+
+void
+ApplyAsmProfile(void)
+{
+    Flexbuf lutCandidates;
+    LutCandidate *list;
+    size_t i, n;
+    long long lutBytes = 0;
+    bool useLut;
+    Module *Q;
+
+    if (!gl_profile_file) {
+        return;
+    }
+    if (!ReadProfile(gl_profile_file)) {
+        ERROR(NULL, "Unable to read profile %s", gl_profile_file);
+        return;
+    }
+    if (profileCycles == 0) {
+        WARNING(NULL, "profile %s has no cycle counts; ignoring it", gl_profile_file);
+        return;
+    }
+    flexbuf_init(&lutCandidates, 256);
+    for (Q = allparse; Q; Q = Q->next) {
+        ProfileModule(Q, &lutCandidates);
+    }
+    ProfileModule(systemModule, &lutCandidates);
+
+    // leave the LUT alone if the program already puts code (or the debugger) there
+    useLut = !(gl_outputflags & OUTFLAG_COG_CODE) && !gl_have_lut && !gl_brkdebug;
+    list = (LutCandidate *)flexbuf_peek(&lutCandidates);
+    n = flexbuf_curlen(&lutCandidates) / sizeof(LutCandidate);
+    qsort(list, n, sizeof(LutCandidate), CompareLutCandidates);
+    for (i = 0; useLut && i < n; i++) {
+        if (lutBytes + list[i].prof->bytes > PROFILE_LUT_BYTES) {
+            continue;
+        }
+        lutBytes += list[i].prof->bytes;
+        list[i].f->code_placement = CODE_PLACE_LUT;
+        gl_have_lut++;
+        if (gl_verbosity) {
+            printf("profile: placing %s in LUT (%lld cycles, %lld bytes)\n",
+                   list[i].prof->name, list[i].prof->cycles, list[i].prof->bytes);
+        }
+    }
+    flexbuf_delete(&lutCandidates);
+}
@@ -0,0 +1,555 @@
+/*
+ * Spin to Pasm converter
+ * Copyright 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * Worst case execution time of P2 functions (--wcet, and the cycle
+ * budgets given with {++cycles(N)}).
+ *
+ * This runs on the final code of each function, after the global
+ * optimizations (so FCACHE loads are included). Every instruction is
+ * charged InstrMaxCycles, so hub reads and writes always wait for the
+ * worst egg beater window, and branches in hub code always refill the
+ * FIFO. Code without loops is charged as if every instruction in it ran
+ * once, which is safe because all its branches go forward. A loop is
+ * charged for its trip count times its body, and so needs a constant
+ * trip count: that is the case for the loops CheckSimpleDecrementLoop
+ * and CheckSimpleIncrementLoop produce, which end in a DJNZ on a
+ * counter set with "mov reg, #N" just before the loop (or become a REP
+ * of that counter), and for REP loops in inline assembly with a
+ * constant count. Called functions are charged their own worst case.
+ *
+ * A function has no bound if it contains any other loop, waits for an
+ * event or for a number of cycles that is not constant, is recursive,
+ * or calls or jumps somewhere we cannot see (a method pointer, for
+ * example).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "spinc.h"
+#include "outasm.h"
+
+#define WCET_NEW    0
+#define WCET_BUSY   1
+#define WCET_DONE   2
+
+/*
+ * builtin helpers (builtin_pushregs_p2, builtin_div_p2 and
+ * builtin_fcache_p2 in outasm.c), charged instruction by instruction
+ * the way InstrMaxCycles would charge them in cog memory; each ends
+ * with a branch back to hub code. The largest times p2sim measured for
+ * them are given for comparison (the fmtnum function of the C library
+ * saves 11 registers).
+ *
+ * pushregs_: pop, pop, tjz (not taken), altd, setq, setq and mov, a
+ * write of the saved registers and one of 3 longs, then jmp pa.
+ * Measured: 60 cycles with 11 registers.
+ */
+#define PUSHREGS_CYCLES  (7*2 + HUB_WRITE_CYCLES(0) + HUB_WRITE_CYCLES(0)+3 + BRANCH_CYCLES(1))
+                              /* plus one per register saved */
+/*
+ * popregs_: pop, setq, djf (not taken), setq and push, a read of 3
+ * longs and one of the saved registers, then jmp pa.
+ * Measured: 68 cycles with 11 registers.
+ */
+#define POPREGS_CYCLES   (5*2 + HUB_READ_CYCLES(0)+3 + HUB_READ_CYCLES(0) + BRANCH_CYCLES(1))
+                              /* ditto */
+/*
+ * divide_: 7 ALU instructions, qdiv and getqx (9 and 58, as in
+ * InstrMaxCycles), getqy (2, since the result is already there), and
+ * the _ret_. multiply_ is expanded inline on P2.
+ * Measured: 91 cycles.
+ */
+#define MULDIV_CYCLES    (7*2 + 9 + 58 + 2 + BRANCH_CYCLES(1))
+/*
+ * an FCACHE load: the callpa to the loader from hub code (of which
+ * InstrMaxCycles already charges 2 for the instruction itself), mov,
+ * pop, altd, mov and setq, the block read, push and mov, the jump into
+ * the block, and the _ret_ after the block back to hub code.
+ * Measured: 44 cycles from the callpa to the block, 19 for the return.
+ */
+#define FCACHE_CYCLES    (BRANCH_CYCLES(1)-2 + 5*2 + HUB_READ_CYCLES(0) + 2*2 + BRANCH_CYCLES(0) + BRANCH_CYCLES(1))
+                              /* plus one per long loaded */
+
+static PtrMap wcetNames;       /* function labels -> index in wcetFuncs */
+static Flexbuf wcetFuncs;      /* Function * */
+
+static Function *
+WcetFunction(Operand *label)
+{
+    int i;
+
+    if (!label) return NULL;
+    i = PtrMapGet(&wcetNames, label);
+    return (i < 0) ? NULL : ((Function **)flexbuf_peek(&wcetFuncs))[i];
+}
+
+static void
+AddWcetName(Operand *label, int i)
+{
+    if (label) {
+        PtrMapPut(&wcetNames, label, i);
+    }
+}
+
+static void
+AddWcetModule(Module *Q)
+{
+    Function *f;
+
+    for (f = Q->functions; f; f = f->next) {
+        if (FuncData(f) && FuncData(f)->codefirst) {
+            flexbuf_addmem(&wcetFuncs, (const char *)&f, sizeof(f));
+        }
+    }
+}
+
+// the instruction before ir which actually does something
+static IR *
+PrevInstr(IR *ir)
+{
+    do {
+        ir = ir->prev;
+    } while (ir && (IsDummy(ir) || ir->opc == OPC_COMMENT || ir->opc == OPC_LITERAL));
+    return ir;
+}
+
+/*
+ * the constant value reg has when control falls into "at", looking
+ * back through straight line code for the "mov reg, #N" setting it;
+ * returns 0 if it cannot be found (for DJNZ and REP a count of 0
+ * means 2^32, so it is no use to us anyway)
+ */
+static unsigned
+ConstantBefore(IR *at, Operand *reg, IR *first)
+{
+    IR *ir;
+
+    if (reg->kind == IMM_INT) {
+        return (unsigned)reg->val;
+    }
+    for (ir = at ? PrevInstr(at) : NULL; ir; ir = PrevInstr(ir)) {
+        if (ir->opc == OPC_LABEL || ir->opc == OPC_CALL || ir->opc == OPC_RET) {
+            return 0;
+        }
+        if (ir->opc == OPC_JUMP && ir->cond == COND_TRUE) {
+            return 0;
+        }
+        if (InstrModifies(ir, reg)) {
+            if (ir->opc == OPC_MOV && ir->cond == COND_TRUE && ir->src && ir->src->kind == IMM_INT) {
+                return (unsigned)ir->src->val;
+            }
+            return 0;
+        }
+        if (ir == first) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * trip count of a natural loop, or 0 if it is not known; the loop
+ * must be entered only by falling into its header, and left only
+ * by the counter running out (or by forward jumps out of it)
+ */
+static unsigned
+LoopTripCount(IRCfg *cfg, IRLoop *lp, IR *first)
+{
+    IRBlock *hdr = &cfg->blocks[lp->header];
+    IR *label = hdr->first;
+    IR *latch = NULL;
+    IR *rep;
+    struct ir_lbljumps *jumps;
+    bool hasCall = false;
+    int i, j;
+
+    if (label->opc != OPC_LABEL || !label->aux) {
+        return 0;
+    }
+    // the only jump to the header must be the one closing the loop
+    for (jumps = (struct ir_lbljumps *)label->aux; jumps; jumps = jumps->next) {
+        if (latch || !IRCfgInLoop(cfg, IRCfgBlockOf(cfg, jumps->jump), lp - cfg->loops)) {
+            return 0;
+        }
+        latch = jumps->jump;
+    }
+    if (!latch) {
+        return 0;
+    }
+    if (latch->opc == OPC_REPEAT_END) {
+        // REP latches its count when it starts
+        rep = PrevInstr(label);
+        if (!rep || rep->opc != OPC_REPEAT || !rep->src) {
+            return 0;
+        }
+        return ConstantBefore(rep, rep->src, first);
+    }
+    if (latch->opc != OPC_DJNZ || !latch->dst) {
+        return 0;
+    }
+    // nothing else in the loop may change the counter
+    for (i = 0; i < lp->nblocks; i++) {
+        IRBlock *blk = &cfg->blocks[lp->blocks[i]];
+        for (j = blk->start; j < blk->end; j++) {
+            IR *ir = cfg->instrs[j];
+            if (IsDummy(ir) || ir == latch) continue;
+            if (ir->opc == OPC_CALL) hasCall = true;
+            if (InstrModifies(ir, latch->dst)) return 0;
+        }
+    }
+    // called functions save and restore the locals they use, but
+    // may change any other register
+    if (hasCall && !IsLocal(latch->dst)) {
+        return 0;
+    }
+    return ConstantBefore(label, latch->dst, first);
+}
+
+// does ir take up space (and time) in the final code?
+static bool
+IsRealInstr(IR *ir)
+{
+    return !IsDummy(ir) && ir->opc <= OPC_GENERIC_BRCOND && ir->opc != OPC_REPEAT_END;
+}
+
+/*
+ * the REP at instrs[i] repeats the instructions up to the index this
+ * returns; a REP the compiler made ends in a REPEAT_END jumping back,
+ * so the graph already has its loop, and then this returns 0. A REP
+ * from inline assembly gives the number of instructions ("rep #3, #N")
+ * or a label after the last one ("rep @.end, #N"); -1 if we cannot
+ * tell which it is
+ */
+static int
+InlineRepeatEnd(IRCfg *cfg, int i)
+{
+    IR *rep = cfg->instrs[i];
+    IR *ir;
+    int j, n;
+
+    if (!rep->dst) {
+        return -1;
+    }
+    if (rep->dst->kind == IMM_INT) {
+        n = rep->dst->val;
+        for (j = i+1; j < cfg->ninstrs && n > 0; j++) {
+            ir = cfg->instrs[j];
+            if (IsRealInstr(ir)) {
+                n -= 1 + NeedsImmAug(ir->src) + NeedsImmAug(ir->dst);
+            }
+        }
+        return (n == 0) ? j : -1;
+    }
+    for (j = i+1; j < cfg->ninstrs; j++) {
+        ir = cfg->instrs[j];
+        if (ir->opc == OPC_REPEAT_END) {
+            return 0;
+        }
+        if (ir->opc == OPC_LABEL && ir->dst && (ir->dst == rep->dst || !strcmp(ir->dst->name, rep->dst->name))) {
+            return j;
+        }
+    }
+    return -1;
+}
+
+// longs the FCACHE instruction ir loads
+static int
+FcacheLongs(IR *ir)
+{
+    IR *p;
+    int n = 0;
+
+    for (p = ir->next; p; p = p->next) {
+        if (p->opc == OPC_LABEL && p->dst == ir->dst) {
+            break;
+        }
+        if (IsRealInstr(p)) {
+            n += 1 + NeedsImmAug(p->src) + NeedsImmAug(p->dst);
+        }
+    }
+    return n;
+}
+
+// registers saved by the pushregs_ call ir (set in COUNT_ just before it)
+static int
+PushregsCount(IR *ir)
+{
+    IR *p = PrevInstr(ir);
+
+    if (p && p->opc == OPC_MOV && p->dst && !strcmp(p->dst->name, "COUNT_")
+        && p->src && p->src->kind == IMM_INT) {
+        return (int)p->src->val;
+    }
+    return -1;
+}
+
+/* cycles taken by code outside the function that ir calls or jumps to */
+static int
+CalleeCycles(Function *f, IR *ir, Operand *dst, const char **reason)
+{
+    Function *callee;
+    int n;
+
+    if (!dst) {
+        return 0;
+    }
+    if (dst->kind != IMM_COG_LABEL && dst->kind != IMM_HUB_LABEL) {
+        *reason = "calls through a pointer";
+        return CYCLES_UNBOUNDED;
+    }
+    callee = WcetFunction(dst);
+    if (callee) {
+        n = FunctionWcet(callee);
+        if (n == CYCLES_UNBOUNDED) {
+            *reason = callee == f ? "is recursive" : auto_printf(128, "calls %s", dst->name);
+        }
+        return n;
+    }
+    if (!strcmp(dst->name, "pushregs_")) {
+        n = PushregsCount(ir);
+        if (n >= 0) {
+            return PUSHREGS_CYCLES + n;
+        }
+    } else if (!strcmp(dst->name, "popregs_")) {
+        return POPREGS_CYCLES + FuncData(f)->numsavedregs;
+    } else if (!strcmp(dst->name, "multiply_") || !strcmp(dst->name, "unsmultiply_")
+               || !strcmp(dst->name, "divide_") || !strcmp(dst->name, "unsdivide_")) {
+        return MULDIV_CYCLES;
+    }
+    *reason = auto_printf(128, "calls %s", dst->name);
+    return CYCLES_UNBOUNDED;
+}
+
+static int
+AnalyzeFunctionWcet(Function *f, const char **reason)
+{
+    IRList irl;
+    IRCfg *cfg;
+    IR *first = FuncData(f)->codefirst;
+    IR *last = FuncData(f)->codelast;
+    IR *after = last->next;
+    IR *ir;
+    long long *trips, *reps;
+    long long total = 0, weight, cyc;
+    bool hubexec = f->code_placement == CODE_PLACE_HUB;
+    int i, j, l;
+
+    /* find the callees' times first, since that needs their own graphs */
+    for (ir = first; ir != after; ir = ir->next) {
+        if (ir->opc == OPC_CALL || ir->opc == OPC_JUMP) {
+            Function *callee = WcetFunction(JumpDest(ir));
+            if (callee && callee != f) {
+                FunctionWcet(callee);
+            }
+        }
+    }
+    /* look at the function on its own */
+    InvalidateIRCfg();
+    irl.head = first;
+    irl.tail = last;
+    last->next = NULL;
+    cfg = GetIRCfg(&irl);
+
+    trips = (long long *)calloc(cfg->nloops + 1, sizeof(long long));
+    reps = (long long *)malloc((cfg->ninstrs + 1) * sizeof(long long));
+    for (l = 0; l < cfg->nloops; l++) {
+        trips[l] = LoopTripCount(cfg, &cfg->loops[l], first);
+        if (!trips[l]) {
+            *reason = "has a loop without a constant trip count";
+            total = CYCLES_UNBOUNDED;
+            goto done;
+        }
+    }
+    for (i = 0; i < cfg->ninstrs; i++) {
+        reps[i] = 1;
+    }
+    for (i = 0; i < cfg->ninstrs; i++) {
+        ir = cfg->instrs[i];
+        if (ir->opc == OPC_REPEAT) {
+            int end = InlineRepeatEnd(cfg, i);
+            unsigned count;
+            if (end == 0) {
+                continue;
+            }
+            count = (end < 0) ? 0 : ConstantBefore(ir, ir->src, first);
+            if (!count) {
+                *reason = "has a loop without a constant trip count";
+                total = CYCLES_UNBOUNDED;
+                goto done;
+            }
+            for (j = i+1; j < end; j++) {
+                reps[j] *= count;
+            }
+        }
+    }
+    for (i = 0; i < cfg->ninstrs; i++) {
+        ir = cfg->instrs[i];
+        if (!IsRealInstr(ir) && ir->opc != OPC_FCACHE) {
+            continue;
+        }
+        if (ir->opc == OPC_RET) {
+            // the caller may be in hub memory even if we are not
+            cyc = InstrMaxCycles(ir, true);
+        } else {
+            cyc = InstrMaxCycles(ir, hubexec && !ir->fcache);
+        }
+        if (cyc == CYCLES_UNBOUNDED) {
+            if (ir->opc >= OPC_GENERIC && ir->instr && strncmp(ir->instr->name, "wait", 4) != 0) {
+                *reason = auto_printf(128, "uses %s, whose time is not known", ir->instr->name);
+            } else {
+                *reason = "waits for an event or a variable time";
+            }
+            total = CYCLES_UNBOUNDED;
+            goto done;
+        }
+        if (ir->opc == OPC_CALL) {
+            cyc += CalleeCycles(f, ir, ir->dst, reason);
+        } else if (ir->opc == OPC_FCACHE) {
+            cyc += FCACHE_CYCLES + FcacheLongs(ir);
+        } else if (IsJump(ir) && ir->opc != OPC_REPEAT && ir->opc != OPC_JMPREL) {
+            int to = ir->aux ? IRCfgInstrIndex(cfg, (IR *)ir->aux) : -1;
+            if (to >= 0 && to <= i) {
+                // every cycle has a jump back to somewhere earlier, so a
+                // backward jump which does not close a loop we know about
+                // is a loop we cannot bound
+                int b = cfg->blockOf[to];
+                l = cfg->blocks[b].loop;
+                if (l < 0 || cfg->loops[l].header != b || !IRCfgInLoop(cfg, cfg->blockOf[i], l)) {
+                    *reason = "has a loop without a constant trip count";
+                    total = CYCLES_UNBOUNDED;
+                    goto done;
+                }
+            } else if (to < 0) {
+                // a jump out of the function is a return, or a tail call
+                Operand *dst = JumpDest(ir);
+                if (dst != FuncData(f)->asmretname && dst != FuncData(f)->asmreturnlabel) {
+                    cyc += CalleeCycles(f, ir, dst, reason);
+                }
+            }
+        }
+        if (cyc < 0) {
+            total = CYCLES_UNBOUNDED;
+            goto done;
+        }
+        weight = reps[i];
+        for (l = cfg->blocks[cfg->blockOf[i]].loop; l >= 0 && weight <= INT_MAX; l = cfg->loops[l].parent) {
+            weight *= trips[l];
+        }
+        if (weight > INT_MAX || (total += weight * cyc) > INT_MAX) {
+            *reason = "may take more than 2^31 cycles";
+            total = CYCLES_UNBOUNDED;
+            goto done;
+        }
+    }
+done:
+    free(reps);
+    free(trips);
+    InvalidateIRCfg();
+    last->next = after;
+    return (int)total;
+}
+
+/*
+ * worst case cycles of a call to f, including everything it calls, or
+ * CYCLES_UNBOUNDED; AnalyzeWcet must have been called first
+ */
+int
+FunctionWcet(Function *f)
+{
+    IRFuncData *fd = FuncData(f);
+    Function *save = curfunc;
+
+    if (!fd || !fd->codefirst) {
+        return CYCLES_UNBOUNDED;
+    }
+    if (fd->wcetState == WCET_DONE) {
+        return fd->wcet;
+    }
+    if (fd->wcetState == WCET_BUSY) {
+        fd->wcetReason = "is recursive";
+        return CYCLES_UNBOUNDED;
+    }
+    fd->wcetState = WCET_BUSY;
+    fd->wcetReason = NULL;
+    curfunc = f;
+    fd->wcet = AnalyzeFunctionWcet(f, &fd->wcetReason);
+    curfunc = save;
+    fd->wcetState = WCET_DONE;
+    return fd->wcet;
+}
+
+static void
+CheckCycleBudget(Function *f)
+{
+    int cycles = FunctionWcet(f);
+    const char *name = f->user_name ? f->user_name : f->name;
+
+    if (cycles == CYCLES_UNBOUNDED) {
+        WARNING(f->decl, "cannot check the cycle budget of %s: it %s", name, FuncData(f)->wcetReason);
+    } else if (cycles > f->cycle_budget) {
+        WARNING(f->decl, "%s may take up to %d cycles, more than its budget of %d", name, cycles, f->cycle_budget);
+    }
+}
+
+static void
+PrintWcetReport(Function **list, int n)
+{
+    int i, cycles;
+
+    printf("worst case cycles of each function, including the functions it calls:\n");
+    for (i = 0; i < n; i++) {
+        cycles = FunctionWcet(list[i]);
+        if (cycles == CYCLES_UNBOUNDED) {
+            printf("  %10s  %s: %s\n", "unbounded", FuncData(list[i])->asmname->name, FuncData(list[i])->wcetReason);
+        } else {
+            printf("  %10d  %s", cycles, FuncData(list[i])->asmname->name);
+            if (list[i]->cycle_budget) {
+                printf(" (budget %d)", list[i]->cycle_budget);
+            }
+            printf("\n");
+        }
+    }
+}
+
+void
+AnalyzeWcet(void)
+{
+    Function **list;
+    FunctionList *dup;
+    Module *Q;
+    int i, n;
+
+    if (wcetNames.keys) {
+        PtrMapFree(&wcetNames);
+        flexbuf_delete(&wcetFuncs);
+    }
+    flexbuf_init(&wcetFuncs, 256);
+    for (Q = allparse; Q; Q = Q->next) {
+        if (Q != systemModule) {
+            AddWcetModule(Q);
+        }
+    }
+    AddWcetModule(systemModule);
+    list = (Function **)flexbuf_peek(&wcetFuncs);
+    n = flexbuf_curlen(&wcetFuncs) / sizeof(Function *);
+    PtrMapInit(&wcetNames, 2*n);
+    for (i = 0; i < n; i++) {
+        AddWcetName(FuncData(list[i])->asmname, i);
+        AddWcetName(FuncData(list[i])->asmentername, i);
+        for (dup = FuncData(list[i])->funcdups; dup; dup = dup->next) {
+            AddWcetName(FuncData(dup->func)->asmname, i);
+        }
+    }
+    for (i = 0; i < n; i++) {
+        if (list[i]->cycle_budget) {
+            CheckCycleBudget(list[i]);
+        }
+    }
+    if (gl_wcet_report) {
+        PrintWcetReport(list, n);
+    }
+}
@@ -12,6 +12,7 @@ void OutputDataBlob(Flexbuf *fb, Flexbuf *databuf, Flexbuf *relocbuf, const char
 void NormalizeVarOffsets(Function *f);
 
 void CompileAsmToBinary(const char *binname, const char *asmname); // in cmdline.c
+void CompileAsmTextToBinary(const char *binname, const char *asmname, const char *asmtext, Flexbuf *irlines); // in cmdline.c
 
 // evaluate any constant expressions inside a string
 // and return an AST representing the whole string
@@ -155,6 +156,7 @@ int VisitRecursive(void *irl, Module *P, VisitorFunc func, unsigned visitval);
 #define VISITFLAG_EXPANDINLINE  0x00200000
 #define VISITFLAG_EMITDAT       0x00400000
 #define VISITFLAG_BC_OPTIMIZE   0x00800000
+#define VISITFLAG_CALLGRAPH     0x01000000
 
 // interpreter ability functions
 bool interp_can_unsigned();
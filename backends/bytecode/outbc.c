@@ -9,6 +9,7 @@
 #include "outbc.h"
 #include "bcbuffers.h"
 #include "bcir.h"
+#include "compcache.h"
 #include <stdlib.h>
 #include "becommon.h"
 #include <inttypes.h>
@@ -3507,7 +3508,12 @@ void OutputByteCode(const char *fname, Module *P) {
     }
 
     bin_file = fopen(fname,"wb");
-    if (gl_listing) lst_file = fopen(ReplaceExtension(fname,".lst"),"w"); // FIXME: Get list file name from cmdline
+    if (gl_listing) {
+        const char *lstname = ReplaceExtension(fname,".lst"); // FIXME: Get list file name from cmdline
+        lst_file = fopen(lstname,"w");
+        CacheNoteOutput(lstname);
+    }
+    CacheNoteOutput(fname);
 
     // Walk through buffer and emit the stuff
     int outPosition = 0;
@@ -12,6 +12,7 @@
 #include <errno.h>
 #include "spinc.h"
 #include "becommon.h"
+#include "compcache.h"
 
 bool IsRelativeHubAddress(AST *);
 
@@ -145,6 +146,7 @@ OutputDatFile(const char *fname, Module *P, int prefixBin)
         perror(fname);
         exit(1);
     }
+    CacheNoteOutput(fname);
 
     flexbuf_init(&fb, BUFSIZ);
     if (prefixBin && !gl_p2) {
@@ -9,6 +9,7 @@
 #include <ctype.h>
 #include "spinc.h"
 #include "becommon.h"
+#include "compcache.h"
 
 int gl_list_options = 0;
 
@@ -459,6 +460,7 @@ OutputLstFile(const char *fname, Module *P)
         perror(fname);
         exit(1);
     }
+    CacheNoteOutput(fname);
     current = P;
     flexbuf_init(&fb, BUFSIZ);
     initLstOutput(P);
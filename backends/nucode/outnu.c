@@ -6,6 +6,8 @@
 //
 #include "outnu.h"
 #include "becommon.h"
+#include "compcache.h"
+#include "passtime.h"
 #include <stdlib.h>
 
 /* some utility functions */
@@ -2636,15 +2638,21 @@ void OutputNuCode(const char *asmFileName, Module *P)
         return;
     }
     // convert functions to IR
+    PassTimeStart("nucode convert");
     VisitRecursive(NULL, P, NuConvertFunctions, VISITFLAG_COMPILEFUNCS);
     VisitRecursive(NULL, systemModule, NuConvertFunctions, VISITFLAG_COMPILEFUNCS);
+    PassTimeEnd("nucode convert");
 
     // optimize and prepare for bytecode assignment
+    PassTimeStart("nucode optimize");
     VisitRecursive(&globalList, P, NuRevisitFunctions, VISITFLAG_BC_OPTIMIZE);
     VisitRecursive(&globalList, systemModule, NuRevisitFunctions, VISITFLAG_BC_OPTIMIZE);
+    PassTimeEnd("nucode optimize");
 
     // create bytecodes
+    PassTimeStart("nucode bytecodes");
     NuCreateBytecodes(globalList);
+    PassTimeEnd("nucode bytecodes");
 
     flexbuf_init(&asmFb, 512);
 
@@ -2690,6 +2698,7 @@ void OutputNuCode(const char *asmFileName, Module *P)
         ERROR(NULL, "Unable to open output file %s", asmFileName);
         return;
     }
+    CacheNoteOutput(asmFileName);
     // emit PASM code
     flexbuf_addchar(&asmFb, 0);
     char *asmcode = flexbuf_get(&asmFb);
@@ -35,7 +35,11 @@
 #include "spinc.h"
 #include "preprocess.h"
 #include "version.h"
+#include "util/arena.h"
 #include "cmdline.h"
+#include "compcache.h"
+#include "watch.h"
+#include "passtime.h"
 #include "becommon.h"
 
 static int TrivialSpinFunction(Module *P);
@@ -99,10 +103,41 @@ PrintFileSize(const char *fname)
     }
 }
 
-void
-CompileAsmToBinary(const char *binname, const char *asmname)
+/*
+ * AST memory for the program being compiled; it is released only on
+ * P2, by BuildAsmModule. On P1 the assembly may have a Spin wrapper,
+ * and then the system module goes through FixupCode again, but the
+ * first pass left it pointing into this arena; so P1 keeps the arena
+ * until the end
+ */
+static Arena progArena;
+
+/*
+ * build the module for the final assembly (P2 only) from the IR that
+ * printed asmtext, as recorded in irlines, instead of parsing the text;
+ * the program's own ASTs are released once it is built
+ */
+static Module *
+BuildAsmModule(const char *asmname, const char *asmtext, Flexbuf *irlines)
+{
+    static Arena asmArena;
+    Module *Q;
+
+    if (!asmArena.chunksize) {
+        ArenaInit(&asmArena, 0);
+    }
+    SetASTArena(&asmArena);
+    Q = NewTopAsmModule(asmname);
+    IRBuildDat(irlines, asmtext, Q);
+    ArenaFree(&progArena);
+    return FinishTopAsmModule(Q, 1);
+}
+
+static void
+doCompileAsmToBinary(const char *binname, const char *asmname, const char *asmtext, Flexbuf *irlines)
 {
     const char *listFile = gl_listing ? ReplaceExtension(binname, ".lst") : NULL;
+    Module *Q;
     if (gl_errors > 0) {
         // no point in going all the way to compiling
         // the final assembly, it isn't valid anyway
@@ -115,8 +150,14 @@ CompileAsmToBinary(const char *binname, const char *asmname)
     gl_output = OUTPUT_DAT;
     gl_dat_offset = (gl_p2 ? 0 : DEFAULT_P1_DAT_OFFSET);
     gl_interp_kind = 0;
-    
-    Module *Q = ParseTopFiles(&asmname, 1, 1);
+
+    if (asmtext && irlines) {
+        Q = BuildAsmModule(asmname, asmtext, irlines);
+    } else if (asmtext) {
+        Q = ParseTopBuffer(asmname, asmtext, strlen(asmtext), 1);
+    } else {
+        Q = ParseTopFiles(&asmname, 1, 1);
+    }
     if (gl_errors == 0) {
         if (listFile) {
             OutputLstFile(listFile, Q);
@@ -125,6 +166,43 @@ CompileAsmToBinary(const char *binname, const char *asmname)
     }
 }
 
+void
+CompileAsmToBinary(const char *binname, const char *asmname)
+{
+    doCompileAsmToBinary(binname, asmname, NULL, NULL);
+}
+
+/*
+ * like CompileAsmToBinary, but the assembly comes from a string
+ * in memory rather than a file; asmname is used only in error messages
+ * if irlines is non-NULL, the DAT section is built from the IR that
+ * asmtext was printed from (see CompileAsmCodeLines) instead of by
+ * parsing asmtext
+ */
+void
+CompileAsmTextToBinary(const char *binname, const char *asmname, const char *asmtext, Flexbuf *irlines)
+{
+    doCompileAsmToBinary(binname, asmname, asmtext, irlines);
+}
+
+/*
+ * can the compile cache handle this kind of output? It only knows
+ * about the files written by the binary, listing and assembly outputs,
+ * and does not hash extra inputs such as a --profile-use profile
+ */
+static int
+CacheableOutput(CmdLineOptions *cmd)
+{
+    if (cmd->outputFiles || cmd->outputDependencies || cmd->printSizes || gl_quality_report || gl_profile_file || gl_wcet_report) {
+        return 0;
+    }
+    if (cmd->outputDat && gl_gas_dat) {
+        return 0;
+    }
+    return gl_output == OUTPUT_ASM || gl_output == OUTPUT_COGSPIN
+        || gl_output == OUTPUT_BYTECODE || gl_output == OUTPUT_DAT;
+}
+
 int ProcessCommandLine(CmdLineOptions *cmd)
 {
     Module *P;
@@ -277,10 +355,38 @@ int ProcessCommandLine(CmdLineOptions *cmd)
         gl_srccomments = 1;
     }
     
+    if (gl_quality_report && gl_output != OUTPUT_ASM) {
+        WARNING(NULL, "--quality-report only covers PASM output; no report will be written");
+        gl_quality_report = 0;
+    }
+    if (gl_profile_file && !(gl_output == OUTPUT_ASM && gl_p2)) {
+        WARNING(NULL, "--profile-use only applies to P2 PASM output; the profile will be ignored");
+        gl_profile_file = NULL;
+    }
+    if (gl_wcet_report && !(gl_output == OUTPUT_ASM && gl_p2)) {
+        WARNING(NULL, "--wcet only covers P2 PASM output; no report will be printed");
+        gl_wcet_report = 0;
+    }
+
+    /* see if we have compiled exactly this before; not when timing
+       the compile, since then it is the compile we want */
+    if (gl_cache_dir && !gl_watch && !gl_time_passes && CacheableOutput(cmd) && CacheLookup()) {
+        if (!cmd->quiet && cmd->outputAsm && cmd->compile) {
+            printf("Done.\n");
+            PrintFileSize(CacheMainOutput());
+        }
+        return 0;
+    }
+
     /* initialize the parser; we do that after command line processing
        so that command line options can influence it */
     Init();
 
+    /* in watch mode the compile runs (repeatedly) in child processes */
+    if (gl_watch) {
+        WatchStart();
+    }
+
     /* now actually parse the file */
     if (!cmd->quiet) {
         gl_printprogress = 1;
@@ -288,7 +394,17 @@ int ProcessCommandLine(CmdLineOptions *cmd)
     if (cmd->printSizes) {
         gl_print_sizes = true;
     }
+    ArenaInit(&progArena, 0);
+    SetASTArena(&progArena);
     P = ParseTopFiles(cmd->file_argv, cmd->file_argc, cmd->outputBin);
+    if (gl_time_passes) {
+        unsigned long lines = 0;
+        Module *Q;
+        for (Q = allparse; Q; Q = Q->next) {
+            if (Q->Lptr) lines += Q->Lptr->lineCounter;
+        }
+        PassTimeSetLines(lines);
+    }
 
     if (cmd->outputFiles) {
         PrintSourceFiles();
@@ -383,6 +499,8 @@ int ProcessCommandLine(CmdLineOptions *cmd)
         } else if (cmd->outputAsm || (cmd->outputBytecode && gl_interp_kind == INTERP_KIND_NUCODE) ) {
             const char *binname = NULL;
             const char *asmname = NULL;
+            char *asmtext = NULL;
+            Flexbuf asmlines;
             if (cmd->compile) {
                 binname = gl_outname;
                 if (binname) {
@@ -421,7 +539,25 @@ int ProcessCommandLine(CmdLineOptions *cmd)
                 if (!gl_p2) {
                     ERROR(NULL, "Nucode only supported on P2");
                 }
+                PassTimeStart("nucode");
                 OutputNuCode(asmname, P);
+                PassTimeEnd("nucode");
+            } else if (cmd->compile && gl_output != OUTPUT_COGSPIN) {
+                // hand the assembly straight to the assembler, rather
+                // than reading it back from the file and preprocessing it;
+                // on P2 the generated assembly is pure DAT, so the
+                // assembler's DAT section can be built from the IR
+                // without parsing the text, while on P1 it may contain
+                // a Spin wrapper and the text is parsed
+                flexbuf_init(&asmlines, 4096);
+                asmtext = CompileAsmCodeLines(P, cmd->outputMain, gl_p2 ? &asmlines : NULL);
+                if (!asmtext) {
+                    remove(binname);
+                    return 1;
+                }
+                if (!cmd->noAsmFile) {
+                    WriteAsmFile(asmname, asmtext);
+                }
             } else {
                 OutputAsmCode(asmname, P, cmd->outputMain);
             }
@@ -430,12 +566,20 @@ int ProcessCommandLine(CmdLineOptions *cmd)
                 gl_warn_flags &= ~(WARN_ASM_FIRST_PASS|WARN_ASM_USAGE|WARN_ASM_LABEL_TYPES); // already issued warnings
                 gl_optimize_flags = 0; // no need to re-optimize
                 gl_cenv_flags = 0;     // already handled C startup code
-                CompileAsmToBinary(binname, asmname);
+                PassTimeStart("binary");
+                if (asmtext) {
+                    CompileAsmTextToBinary(binname, asmname, asmtext, gl_p2 ? &asmlines : NULL);
+                    flexbuf_delete(&asmlines);
+                    free(asmtext);
+                } else {
+                    CompileAsmToBinary(binname, asmname);
+                }
                 if (gl_errors == 0) {
                     DoPropellerPostprocess(binname, cmd->useEeprom ? cmd->eepromSize : 0);
                 } else {
                     remove(binname);
                 }
+                PassTimeEnd("binary");
                 if (!cmd->quiet) {
                     printf("Done.\n");
                     if (gl_errors == 0) {
@@ -459,8 +603,10 @@ int ProcessCommandLine(CmdLineOptions *cmd)
             if (gl_interp_kind == INTERP_KIND_NUCODE) {
                 ERROR(NULL, "How did we get here?");
             } else {
+                PassTimeStart("bytecode");
                 OutputByteCode(cmd->outname,P);
                 DoPropellerPostprocess(cmd->outname,cmd->useEeprom ? cmd->eepromSize : 0);
+                PassTimeEnd("bytecode");
             }
         } else {
             fprintf(stderr, "This front end cannot convert to C\n");
@@ -470,6 +616,7 @@ int ProcessCommandLine(CmdLineOptions *cmd)
         return 1;
     }
 
+    CacheStore();
     return 0;
 }
 
@@ -543,6 +690,9 @@ static FlagTable optflag[] = {
     { "spin-relax-memory", OPT_SPIN_RELAXMEM},
     { "fast-inline-asm", OPT_FASTASM },
     { "peek-args", OPT_PEEK_ARGS },
+    { "regalloc", OPT_REG_ALLOC },
+    { "static-frames", OPT_STATIC_FRAMES },
+    { "gvn", OPT_GVN },
     { "experimental", OPT_EXPERIMENTAL },
     { "all", OPT_FLAGS_ALL },
 };
@@ -852,6 +1002,8 @@ void AddSourceFile(const char *shortName, const char *fullName)
 {
     SourceFile *f;
     int i;
+
+    CacheNoteSource(shortName, fullName);
     // check for duplicate
     for (i = 0; i < numSourceFiles; i++) {
         f = &sourceData[i];
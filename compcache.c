@@ -0,0 +1,897 @@
+/*
+ * Persistent compilation cache
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * With --cache-dir=DIR each compile is looked up in DIR under a key
+ * made from the compiler executable, the command line (so the
+ * defines, optimization flags and target), the working directory,
+ * and the include path environment variables. The entry for a key is
+ * a manifest giving the SHA-256 of every source file the compile read
+ * (including library files and FILE data) and of every file it wrote,
+ * and listing every place an include or OBJ search looked without
+ * finding anything. If all the sources still match and none of the
+ * missing files has appeared (which would change what a search finds),
+ * the outputs are copied back out of DIR and the compile is skipped
+ * entirely.
+ *
+ * The optimizer works on the whole program (inlining, unused method
+ * removal, register allocation) so these entries are per program, not
+ * per module. When one file of a program changes, the only per module
+ * work that is saved is lexing and parsing: see CacheParseLookup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "spinc.h"
+#include "preprocess.h"
+#include "version.h"
+#include "compcache.h"
+#include "watch.h"
+#include "util/sha256.h"
+
+#ifdef WIN32
+#include <direct.h>
+#define MKDIR(d) _mkdir(d)
+#include <process.h>
+#define GETPID() _getpid()
+#else
+#include <unistd.h>
+#define MKDIR(d) mkdir(d, 0777)
+#define GETPID() getpid()
+#endif
+
+#define CACHE_MAGIC "flexspin-cache 1"
+#define HEXLEN (2*SHA256_BLOCK_SIZE)
+#define MAX_CACHE_LINE 4200
+
+extern int getProgramPath(const char **argv, char *path, int size);
+
+static int cache_argc;
+static const char **cache_argv;
+static int cacheActive;
+static char cacheKey[HEXLEN+1];
+static Flexbuf cacheInputs;   /* holds const char * */
+static Flexbuf cacheOutputs;  /* holds const char * */
+static Flexbuf cacheMissing;  /* holds const char * */
+static const char *mainOutput;
+
+/* state for the preprocessor output cache */
+static int ppRecording;
+static char ppKey[HEXLEN+1];
+static const char *ppSource;
+static Flexbuf ppIncludes;    /* "sys FULL", "src FULL\tSHORT" and "mis FULL" lines */
+
+void
+CacheInit(int argc, const char **argv)
+{
+    cache_argc = argc;
+    cache_argv = argv;
+    flexbuf_init(&cacheInputs, 256);
+    flexbuf_init(&cacheOutputs, 64);
+    flexbuf_init(&cacheMissing, 256);
+    flexbuf_init(&ppIncludes, 256);
+}
+
+static void
+HexDigest(char *hex, const BYTE *hash)
+{
+    int i;
+    for (i = 0; i < SHA256_BLOCK_SIZE; i++) {
+        sprintf(hex + 2*i, "%02x", hash[i]);
+    }
+    hex[HEXLEN] = 0;
+}
+
+static void
+HashString(SHA256_CTX *ctx, const char *str)
+{
+    if (!str) str = "";
+    /* include the trailing 0 so adjacent strings cannot run together */
+    sha256_update(ctx, (const BYTE *)str, strlen(str) + 1);
+}
+
+/*
+ * compute the SHA-256 of a file's contents into hex; returns 0 if
+ * the file cannot be read. If uses is non-NULL, *uses gets USES_TIME
+ * if the file refers to __DATE__ or __TIME__ (whose values change
+ * from one compile to the next) and USES_PROGNAME if it refers to
+ * __FLEXSPIN_PROGRAM__ (the output file name)
+ */
+#define USES_TIME     0x1
+#define USES_PROGNAME 0x2
+
+static int
+HashFile(const char *name, char *hex, int *uses)
+{
+    FILE *f = fopen(name, "rb");
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    char *buf;
+    long len;
+
+    if (!f) {
+        return 0;
+    }
+    fseek(f, 0L, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    if (len < 0) {
+        fclose(f);
+        return 0;
+    }
+    buf = (char *)malloc(len + 1);
+    if (!buf || fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        fclose(f);
+        return 0;
+    }
+    fclose(f);
+    buf[len] = 0;
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const BYTE *)buf, len);
+    sha256_final(&ctx, hash);
+    HexDigest(hex, hash);
+    if (uses) {
+        /* files may contain 0 bytes, but this is only a heuristic */
+        *uses = 0;
+        if (strstr(buf, "__DATE__") || strstr(buf, "__TIME__")) {
+            *uses |= USES_TIME;
+        }
+        if (strstr(buf, "__FLEXSPIN_PROGRAM__")) {
+            *uses |= USES_PROGNAME;
+        }
+    }
+    free(buf);
+    return 1;
+}
+
+/* does a search for the file name now find something? */
+static int
+FileExists(const char *name)
+{
+    struct stat st;
+
+    return stat(name, &st) == 0 && !S_ISDIR(st.st_mode);
+}
+
+static int
+CopyCacheFile(const char *src, const char *dst)
+{
+    FILE *in, *out;
+    char buf[BUFSIZ];
+    size_t n;
+    int ok = 1;
+
+    in = fopen(src, "rb");
+    if (!in) {
+        return 0;
+    }
+    out = fopen(dst, "wb");
+    if (!out) {
+        fclose(in);
+        return 0;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), in)) > 0) {
+        if (fwrite(buf, 1, n, out) != n) {
+            ok = 0;
+            break;
+        }
+    }
+    fclose(in);
+    if (fclose(out) != 0) {
+        ok = 0;
+    }
+    return ok;
+}
+
+static char *
+CachePath(const char *name, const char *ext)
+{
+    size_t len = strlen(gl_cache_dir) + strlen(name) + strlen(ext) + 2;
+    char *path = (char *)malloc(len);
+    sprintf(path, "%s/%s%s", gl_cache_dir, name, ext);
+    return path;
+}
+
+/*
+ * command line options that cannot change the output files
+ */
+static int
+IgnoredArg(const char *arg)
+{
+    if (!strcmp(arg, "-q") || !strcmp(arg, "--verbose")
+        || !strcmp(arg, "--color") || !strcmp(arg, "--nocolor"))
+    {
+        return 1;
+    }
+    /* -j N, -jN, --cache-dir=DIR, and the compile statistics */
+    return !strncmp(arg, "-j", 2) || !strncmp(arg, "--cache-dir=", 12)
+        || !strncmp(arg, "--time-passes", 13) || !strncmp(arg, "--stats=", 8);
+}
+
+/*
+ * start a key with the compiler and the directory it is run in
+ */
+static void
+HashCompiler(SHA256_CTX *ctx)
+{
+    char buf[1024];
+    struct stat st;
+
+    sha256_init(ctx);
+    HashString(ctx, CACHE_MAGIC);
+    HashString(ctx, version_string);
+    /* a rebuilt compiler may generate different code, and the
+       standard library is found relative to the executable */
+    if (getProgramPath(cache_argv, buf, sizeof(buf)) == 0 && stat(buf, &st) == 0) {
+        HashString(ctx, buf);
+        sprintf(buf, "%lu %lu", (unsigned long)st.st_size, (unsigned long)st.st_mtime);
+    } else {
+        strcpy(buf, __DATE__ " " __TIME__);
+    }
+    HashString(ctx, buf);
+    if (!getcwd(buf, sizeof(buf))) {
+        buf[0] = 0;
+    }
+    HashString(ctx, buf);
+}
+
+/*
+ * the key covers everything other than source file contents that
+ * can affect the output
+ */
+static void
+ComputeKey(void)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    int i;
+
+    HashCompiler(&ctx);
+    HashString(&ctx, getenv("FLEXCC_INCLUDE_PATH"));
+    HashString(&ctx, getenv("FLEXSPIN_INCLUDE_PATH"));
+    HashString(&ctx, getenv("FASTSPIN_INCLUDE_PATH"));
+    for (i = 1; i < cache_argc; i++) {
+        if (IgnoredArg(cache_argv[i])) {
+            if (!strcmp(cache_argv[i], "-j")) {
+                i++;  /* skip the thread count too */
+            }
+            continue;
+        }
+        HashString(&ctx, cache_argv[i]);
+    }
+    sha256_final(&ctx, hash);
+    HexDigest(cacheKey, hash);
+}
+
+/*
+ * update the hit/miss totals kept in the cache directory, and
+ * report on this compile if --verbose was given
+ */
+static void
+CacheReport(int hit, const char *why)
+{
+    char *statname = CachePath("stats", "");
+    char *tmpname;
+    char suffix[32];
+    unsigned hits = 0, misses = 0;
+    FILE *f;
+
+    f = fopen(statname, "r");
+    if (f) {
+        if (fscanf(f, "hits %u misses %u", &hits, &misses) != 2) {
+            hits = misses = 0;
+        }
+        fclose(f);
+    }
+    if (hit) hits++; else misses++;
+    /* other compiles may be using the cache at the same time, so
+       write a file of our own and rename it into place; that way the
+       stats file is always complete, although a count may be lost
+       if two compiles update it at once */
+    sprintf(suffix, ".%lu", (unsigned long)GETPID());
+    tmpname = CachePath("stats", suffix);
+    f = fopen(tmpname, "w");
+    if (f) {
+        fprintf(f, "hits %u misses %u\n", hits, misses);
+        if (fclose(f) == 0) {
+#ifdef WIN32
+            remove(statname);
+#endif
+            rename(tmpname, statname);
+        }
+        remove(tmpname);
+    }
+    free(tmpname);
+    free(statname);
+    if (gl_verbosity) {
+        printf("cache: %s (%s); %u hits, %u misses in %s\n",
+               hit ? "hit" : "miss", why, hits, misses, gl_cache_dir);
+    }
+}
+
+int
+CacheLookup(void)
+{
+    char line[MAX_CACHE_LINE];
+    char hex[HEXLEN+1];
+    char why[MAX_CACHE_LINE + 32];
+    char *manifest;
+    char *data;
+    char *name;
+    FILE *f;
+    int ok = 1;
+    int nsrc = 0, nout = 0;
+
+    if (!gl_cache_dir) {
+        return 0;
+    }
+    cacheActive = 1;
+    MKDIR(gl_cache_dir);
+    ComputeKey();
+    manifest = CachePath(cacheKey, ".manifest");
+    f = fopen(manifest, "r");
+    free(manifest);
+    if (!f) {
+        CacheReport(0, "no entry");
+        return 0;
+    }
+    if (!fgets(line, sizeof(line), f) || strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0) {
+        fclose(f);
+        CacheReport(0, "bad entry");
+        return 0;
+    }
+    /* first make sure all the sources are unchanged */
+    while (ok && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (strncmp(line, "in ", 3) != 0 || strlen(line) < 4 + HEXLEN) {
+            continue;
+        }
+        name = line + 4 + HEXLEN;
+        if (!HashFile(name, hex, NULL) || strncmp(hex, line + 3, HEXLEN) != 0) {
+            sprintf(why, "%s changed", name);
+            ok = 0;
+        }
+        nsrc++;
+    }
+    /* a file appearing where a search found nothing before may be
+       found instead of the one we used */
+    rewind(f);
+    while (ok && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (strncmp(line, "miss ", 5) != 0) {
+            continue;
+        }
+        if (FileExists(line + 5)) {
+            sprintf(why, "%s now exists", line + 5);
+            ok = 0;
+        }
+    }
+    /* now restore the outputs */
+    rewind(f);
+    while (ok && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\r\n")] = 0;
+        if (strncmp(line, "out ", 4) != 0 || strlen(line) < 5 + HEXLEN) {
+            continue;
+        }
+        name = line + 5 + HEXLEN;
+        line[4 + HEXLEN] = 0;
+        data = CachePath(line + 4, ".data");
+        if (!CopyCacheFile(data, name)) {
+            sprintf(why, "cannot restore %s", name);
+            ok = 0;
+        } else {
+            mainOutput = strdup(name);
+            nout++;
+        }
+        free(data);
+    }
+    fclose(f);
+    if (ok && nout == 0) {
+        strcpy(why, "no outputs");
+        ok = 0;
+    }
+    if (ok) {
+        sprintf(why, "%d source files unchanged", nsrc);
+    }
+    CacheReport(ok, why);
+    return ok;
+}
+
+const char *
+CacheMainOutput(void)
+{
+    return mainOutput;
+}
+
+static void
+AddName(Flexbuf *fb, const char *name)
+{
+    const char **list = (const char **)flexbuf_peek(fb);
+    size_t n = flexbuf_curlen(fb) / sizeof(*list);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(list[i], name)) {
+            return;
+        }
+    }
+    name = strdup(name);
+    flexbuf_addmem(fb, (const char *)&name, sizeof(name));
+}
+
+void
+CacheNoteInput(const char *fullName)
+{
+    WatchNoteInput(fullName);
+    if (cacheActive) {
+        AddName(&cacheInputs, fullName);
+        if (ppRecording) {
+            flexbuf_printf(&ppIncludes, "sys %s\n", fullName);
+        }
+    }
+}
+
+void
+CacheNoteSource(const char *shortName, const char *fullName)
+{
+    WatchNoteInput(fullName);
+    if (cacheActive) {
+        AddName(&cacheInputs, fullName);
+        if (ppRecording) {
+            flexbuf_printf(&ppIncludes, "src %s\t%s\n", fullName, shortName);
+        }
+    }
+}
+
+void
+CacheNoteMissing(const char *fullName)
+{
+    if (cacheActive) {
+        AddName(&cacheMissing, fullName);
+        if (ppRecording) {
+            flexbuf_printf(&ppIncludes, "mis %s\n", fullName);
+        }
+    }
+}
+
+void
+CacheNoteOutput(const char *fname)
+{
+    if (cacheActive) {
+        AddName(&cacheOutputs, fname);
+    }
+}
+
+static int
+IsOutput(const char *name)
+{
+    const char **list = (const char **)flexbuf_peek(&cacheOutputs);
+    size_t n = flexbuf_curlen(&cacheOutputs) / sizeof(*list);
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(list[i], name)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void
+CacheStore(void)
+{
+    const char **ins = (const char **)flexbuf_peek(&cacheInputs);
+    const char **outs = (const char **)flexbuf_peek(&cacheOutputs);
+    const char **missing = (const char **)flexbuf_peek(&cacheMissing);
+    size_t nins = flexbuf_curlen(&cacheInputs) / sizeof(*ins);
+    size_t nouts = flexbuf_curlen(&cacheOutputs) / sizeof(*outs);
+    size_t nmissing = flexbuf_curlen(&cacheMissing) / sizeof(*missing);
+    Flexbuf text;
+    char hex[HEXLEN+1];
+    char *manifest, *tmpname, *data;
+    const char *why = NULL;
+    int usesTime = 0;
+    unsigned nsrc = 0;
+    size_t i;
+    FILE *f;
+
+    if (!cacheActive) {
+        return;
+    }
+    if (gl_errors || gl_warning_count || gl_pp.numwarnings) {
+        /* a cache hit would not repeat the messages */
+        why = "messages were printed";
+    } else if (nouts == 0) {
+        why = "no outputs";
+    }
+    flexbuf_init(&text, 1024);
+    flexbuf_printf(&text, "%s\n", CACHE_MAGIC);
+    for (i = 0; !why && i < nins; i++) {
+        if (IsOutput(ins[i])) {
+            /* e.g. a .p2asm file we wrote and then assembled */
+            continue;
+        }
+        if (!HashFile(ins[i], hex, &usesTime)) {
+            why = "cannot read sources";
+        } else if (usesTime & USES_TIME) {
+            why = "program uses __DATE__ or __TIME__";
+        } else {
+            flexbuf_printf(&text, "in %s %s\n", hex, ins[i]);
+            nsrc++;
+        }
+    }
+    for (i = 0; !why && i < nmissing; i++) {
+        /* skip files the compile itself wrote (or found on a later try) */
+        if (!FileExists(missing[i])) {
+            flexbuf_printf(&text, "miss %s\n", missing[i]);
+        }
+    }
+    for (i = 0; !why && i < nouts; i++) {
+        if (!HashFile(outs[i], hex, NULL)) {
+            why = "cannot read outputs";
+            break;
+        }
+        data = CachePath(hex, ".data");
+        if (!CopyCacheFile(outs[i], data)) {
+            why = "cannot write to cache";
+        }
+        free(data);
+        flexbuf_printf(&text, "out %s %s\n", hex, outs[i]);
+    }
+    if (!why) {
+        /* write the manifest last, so a partial entry is never seen */
+        manifest = CachePath(cacheKey, ".manifest");
+        tmpname = CachePath(cacheKey, ".tmp");
+        f = fopen(tmpname, "w");
+        if (f) {
+            fwrite(flexbuf_peek(&text), 1, flexbuf_curlen(&text), f);
+            fclose(f);
+            remove(manifest);
+            if (rename(tmpname, manifest) != 0) {
+                why = "cannot write to cache";
+            }
+        } else {
+            why = "cannot write to cache";
+        }
+        free(tmpname);
+        free(manifest);
+    }
+    flexbuf_delete(&text);
+    if (gl_verbosity) {
+        if (why) {
+            printf("cache: not stored (%s)\n", why);
+        } else {
+            printf("cache: stored %u source files, %u outputs\n", nsrc, (unsigned)nouts);
+        }
+    }
+}
+
+/*
+ * Cache of preprocessor output
+ *
+ * A compile that misses in the cache above still runs mcpp over every
+ * C file, including library files (the __fromfile implementations of
+ * printf and friends) that are the same from one program to the next,
+ * and all of the headers they include. The preprocessed text of a file
+ * depends only on the preprocessor arguments (defines and include
+ * directories) and on the files read, so it is kept under a key made
+ * from the arguments and the file name, with a manifest giving the
+ * SHA-256 of the file and of every header it included. This extends
+ * the in-memory header cache in mcpp across compiles.
+ */
+
+/*
+ * read a whole file into memory; returns NULL if it cannot be read,
+ * and the length in *lenp if lenp is not NULL
+ */
+static char *
+ReadCacheFile(const char *name, size_t *lenp)
+{
+    FILE *f = fopen(name, "rb");
+    char *buf;
+    long len;
+
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0L, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0L, SEEK_SET);
+    buf = (len < 0) ? NULL : (char *)malloc(len + 1);
+    if (buf && fread(buf, 1, len, f) != (size_t)len) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    if (buf) {
+        buf[len] = 0;
+        if (lenp) *lenp = (size_t)len;
+    }
+    return buf;
+}
+
+/* check one "KIND HEX NAME" manifest line; returns the name or NULL */
+static char *
+CheckManifestLine(char *line, size_t kindlen)
+{
+    char hex[HEXLEN+1];
+    char *name;
+
+    if (strlen(line) < kindlen + 2 + HEXLEN) {
+        return NULL;
+    }
+    name = line + kindlen + 2 + HEXLEN;
+    if (!HashFile(name, hex, NULL) || strncmp(hex, line + kindlen + 1, HEXLEN) != 0) {
+        return NULL;
+    }
+    return name;
+}
+
+char *
+CachePreprocessLookup(const char *fullName, int argc, char **argv)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    char line[MAX_CACHE_LINE];
+    char *manifest, *data, *name, *tab;
+    char *text = NULL;
+    int ok = 1;
+    int i;
+    FILE *f;
+
+    ppRecording = 0;
+    if (!cacheActive) {
+        return NULL;
+    }
+    HashCompiler(&ctx);
+    HashString(&ctx, "preprocess");
+    for (i = 1; i < argc; i++) {
+        /* these change from one compile to the next, so files using
+           them are not stored */
+        if (!strncmp(argv[i], "-D__DATE__=", 11) || !strncmp(argv[i], "-D__TIME__=", 11)
+            || !strncmp(argv[i], "-D__FLEXSPIN_PROGRAM__=", 23))
+        {
+            continue;
+        }
+        HashString(&ctx, argv[i]);
+    }
+    HashString(&ctx, fullName);
+    sha256_final(&ctx, hash);
+    HexDigest(ppKey, hash);
+
+    manifest = CachePath(ppKey, ".pp");
+    f = fopen(manifest, "r");
+    free(manifest);
+    if (f) {
+        if (!fgets(line, sizeof(line), f) || strncmp(line, CACHE_MAGIC, strlen(CACHE_MAGIC)) != 0) {
+            ok = 0;
+        }
+        /* all the files must be unchanged */
+        while (ok && fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = 0;
+            tab = strchr(line, '\t');
+            if (tab) *tab = 0;
+            if (!strncmp(line, "in ", 3) || !strncmp(line, "sys ", 4) || !strncmp(line, "src ", 4)) {
+                ok = CheckManifestLine(line, strcspn(line, " ")) != NULL;
+            } else if (!strncmp(line, "miss ", 5)) {
+                ok = !FileExists(line + 5);
+            }
+        }
+        /* then fetch the text and replay the includes */
+        rewind(f);
+        while (ok && fgets(line, sizeof(line), f)) {
+            line[strcspn(line, "\r\n")] = 0;
+            if (!strncmp(line, "text ", 5) && strlen(line) == 5 + HEXLEN) {
+                data = CachePath(line + 5, ".data");
+                text = ReadCacheFile(data, NULL);
+                free(data);
+                ok = text != NULL;
+            } else if (!strncmp(line, "sys ", 4)) {
+                CacheNoteInput(line + 5 + HEXLEN);
+            } else if (!strncmp(line, "miss ", 5)) {
+                CacheNoteMissing(line + 5);
+            } else if (!strncmp(line, "src ", 4)) {
+                name = line + 5 + HEXLEN;
+                tab = strchr(name, '\t');
+                if (tab) {
+                    *tab++ = 0;
+                    AddSourceFile(strdup(tab), strdup(name));
+                }
+            }
+        }
+        fclose(f);
+        if (ok && text) {
+            if (gl_verbosity) {
+                printf("cache: preprocessed %s reused\n", fullName);
+            }
+            return text;
+        }
+        free(text);
+    }
+    /* record the headers the preprocessor reads for CachePreprocessStore */
+    flexbuf_clear(&ppIncludes);
+    ppSource = fullName;
+    ppRecording = 1;
+    return NULL;
+}
+
+void
+CachePreprocessStore(const char *text, int warnings)
+{
+    Flexbuf manifestText;
+    char hex[HEXLEN+1];
+    char *line, *next, *name, *tab;
+    char *manifest, *tmpname, *data;
+    int uses = 0;
+    int ok = 1;
+    FILE *f;
+
+    if (!ppRecording) {
+        return;
+    }
+    ppRecording = 0;
+    if (warnings) {
+        /* reusing the text would hide the warnings */
+        return;
+    }
+    flexbuf_init(&manifestText, 1024);
+    flexbuf_printf(&manifestText, "%s\n", CACHE_MAGIC);
+    if (!HashFile(ppSource, hex, &uses) || uses) {
+        ok = 0;
+    } else {
+        flexbuf_printf(&manifestText, "in %s %s\n", hex, ppSource);
+    }
+    flexbuf_addchar(&ppIncludes, 0);
+    for (line = flexbuf_peek(&ppIncludes); ok && *line; line = next) {
+        next = strchr(line, '\n');
+        *next++ = 0;
+        name = line + 4;
+        if (!strncmp(line, "mis ", 4)) {
+            if (!FileExists(name)) {
+                flexbuf_printf(&manifestText, "miss %s\n", name);
+            }
+            continue;
+        }
+        tab = strchr(name, '\t');
+        if (tab) *tab = 0;
+        if (!HashFile(name, hex, &uses) || uses) {
+            ok = 0;
+            break;
+        }
+        if (tab) *tab = '\t';
+        flexbuf_printf(&manifestText, "%.3s %s %s\n", line, hex, name);
+    }
+    if (ok) {
+        SHA256_CTX ctx;
+        BYTE hash[SHA256_BLOCK_SIZE];
+
+        sha256_init(&ctx);
+        sha256_update(&ctx, (const BYTE *)text, strlen(text));
+        sha256_final(&ctx, hash);
+        HexDigest(hex, hash);
+        data = CachePath(hex, ".data");
+        f = fopen(data, "wb");
+        if (!f || fwrite(text, 1, strlen(text), f) != strlen(text)) {
+            ok = 0;
+        }
+        if (f && fclose(f) != 0) {
+            ok = 0;
+        }
+        free(data);
+        flexbuf_printf(&manifestText, "text %s\n", hex);
+    }
+    if (ok) {
+        manifest = CachePath(ppKey, ".pp");
+        tmpname = CachePath(ppKey, ".pptmp");
+        f = fopen(tmpname, "w");
+        if (f) {
+            fwrite(flexbuf_peek(&manifestText), 1, flexbuf_curlen(&manifestText), f);
+            fclose(f);
+            remove(manifest);
+            rename(tmpname, manifest);
+        }
+        free(tmpname);
+        free(manifest);
+    }
+    flexbuf_delete(&manifestText);
+    flexbuf_clear(&ppIncludes);
+}
+
+/*
+ * Cache of Spin parses
+ *
+ * The parse of a Spin object depends on its preprocessed text, on
+ * the options, and (through "child.name" and OBJ declarations) on its
+ * OBJ children; sysimage.c records the last in the image and checks it
+ * when loading. So an image is kept under a key made from the program
+ * key (which covers the options), the file name and the text. Images
+ * are only saved and used by compiles that missed in the whole
+ * program cache above; they save the lexing and parsing of unchanged
+ * objects, but all of the later passes still run.
+ */
+
+unsigned char *
+CacheParseLookup(const char *fullName, const char *text, char *key)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    char *name;
+    unsigned char *image;
+    size_t len = 0;
+
+    key[0] = 0;
+    if (!cacheActive) {
+        return NULL;
+    }
+    sha256_init(&ctx);
+    HashString(&ctx, cacheKey);
+    HashString(&ctx, "parse");
+    HashString(&ctx, fullName);
+    sha256_update(&ctx, (const BYTE *)text, strlen(text));
+    sha256_final(&ctx, hash);
+    HexDigest(key, hash);
+
+    name = CachePath(key, ".parse");
+    image = (unsigned char *)ReadCacheFile(name, &len);
+    free(name);
+    if (!image) {
+        return NULL;
+    }
+    /* the image is followed by its SHA-256, to catch damaged files */
+    if (len >= SHA256_BLOCK_SIZE) {
+        len -= SHA256_BLOCK_SIZE;
+        sha256_init(&ctx);
+        sha256_update(&ctx, image, len);
+        sha256_final(&ctx, hash);
+        if (!memcmp(hash, image + len, SHA256_BLOCK_SIZE)) {
+            if (gl_verbosity) {
+                printf("cache: parse of %s reused\n", fullName);
+            }
+            return image;
+        }
+    }
+    free(image);
+    return NULL;
+}
+
+void
+CacheParseStore(const char *key, const char *fullName, const unsigned char *image, size_t len, const char *why)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    char suffix[32];
+    char *name, *tmpname;
+    FILE *f;
+    int ok;
+
+    if (!image) {
+        if (gl_verbosity) {
+            printf("cache: parse of %s not stored (%s)\n", fullName, why);
+        }
+        return;
+    }
+    sha256_init(&ctx);
+    sha256_update(&ctx, image, len);
+    sha256_final(&ctx, hash);
+    name = CachePath(key, ".parse");
+    sprintf(suffix, ".parse.%lu", (unsigned long)GETPID());
+    tmpname = CachePath(key, suffix);
+    f = fopen(tmpname, "wb");
+    ok = f && fwrite(image, 1, len, f) == len && fwrite(hash, 1, SHA256_BLOCK_SIZE, f) == SHA256_BLOCK_SIZE;
+    if (f && fclose(f) != 0) {
+        ok = 0;
+    }
+    if (ok) {
+#ifdef WIN32
+        remove(name);
+#endif
+        rename(tmpname, name);
+    }
+    remove(tmpname);
+    free(tmpname);
+    free(name);
+}
@@ -0,0 +1,61 @@
+/*
+ * Persistent compilation cache
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ */
+
+#ifndef COMPCACHE_H_
+#define COMPCACHE_H_
+
+/*
+ * remember the command line (and other things that affect the
+ * output) for the cache key; must be called before argv is consumed
+ */
+void CacheInit(int argc, const char **argv);
+
+/*
+ * look for a previous compile with the same key whose source files
+ * have not changed; if there is one, copy its outputs into place
+ * and return 1, otherwise return 0
+ */
+int CacheLookup(void);
+
+/*
+ * save the outputs of a successful compile in the cache
+ */
+void CacheStore(void);
+
+/*
+ * record files read and written by the compile
+ */
+void CacheNoteInput(const char *fullName);
+void CacheNoteSource(const char *shortName, const char *fullName);
+void CacheNoteOutput(const char *fname);
+/* a search for an include or OBJ file looked for fullName, but it did not exist */
+void CacheNoteMissing(const char *fullName);
+
+/*
+ * name of the last output restored by CacheLookup (the program image)
+ */
+const char *CacheMainOutput(void);
+
+/*
+ * look for saved preprocessor output for the C file fullName
+ * run with the preprocessor arguments argv; returns the text (to be
+ * freed by the caller) or NULL, in which case the preprocessor should
+ * be run and its output passed to CachePreprocessStore
+ */
+char *CachePreprocessLookup(const char *fullName, int argc, char **argv);
+void CachePreprocessStore(const char *text, int warnings);
+
+/*
+ * look for a saved parse of the Spin file fullName whose preprocessed
+ * text is text; returns the image (to be freed by the caller) or NULL.
+ * key is set for CacheParseStore, or to "" if parses are not being
+ * kept (no --cache-dir, or the compile was found in the cache)
+ */
+#define CACHE_KEY_SIZE 65
+unsigned char *CacheParseLookup(const char *fullName, const char *text, char *key);
+void CacheParseStore(const char *key, const char *fullName, const unsigned char *image, size_t len, const char *why);
+
+#endif
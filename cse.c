@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "spinc.h"
+#include "passtime.h"
 
 #define CSE_HASH_SIZE 32  /* make this a power of two */
 
@@ -757,7 +758,9 @@ PerformCSE(Module *Q)
     curfunc = savefunc;
     current = savecur;
 
+    PassTimeStart("loop optimize");
     PerformLoopOptimization(Q);
+    PassTimeEnd("loop optimize");
 }
 
 //
@@ -37,6 +37,8 @@
 #include "preprocess.h"
 #include "version.h"
 #include "cmdline.h"
+#include "compcache.h"
+#include "passtime.h"
 
 //#define DEBUG_YACC
 
@@ -60,6 +62,13 @@ Usage(FILE *f)
     fprintf(f, "  [ -D <define> ]    add a define\n");
     fprintf(f, "  [ -g ]             include debug info in output\n");
     fprintf(f, "  [ -L or -I <path> ] add a directory to the include path\n");
+    fprintf(f, "  [ -j N ]           use N threads for the PASM optimizer, N processes for parsing\n");
+    fprintf(f, "  [ --opt-budget=N ] run at most N rounds of the PASM optimizer per function (0 for no limit)\n");
+    fprintf(f, "  [ --time-passes[=N] ] print time and memory used by each compiler phase, and the N slowest functions\n");
+    fprintf(f, "  [ --stats=json[:FILE] ] write compile statistics as JSON to stdout (or FILE)\n");
+    fprintf(f, "  [ --quality-report=json[:FILE] ] write size and cycle estimates for each function as JSON\n");
+    fprintf(f, "  [ --profile-use=FILE ] optimize using the function profile written by p2sim --json=FILE\n");
+    fprintf(f, "  [ --wcet ]         print the worst case cycles of each function (P2 only)\n");
     fprintf(f, "  [ -MMD ]           generate Make dependency file\n");
     fprintf(f, "  [ -o <name> ]      set output filename to <name>\n");
     fprintf(f, "  [ -O# ]            set optimization level:\n");
@@ -72,6 +81,9 @@ Usage(FILE *f)
     fprintf(f, "  [ -Wmax-errors=N ] allow at most N errors in a pass before stopping\n");
     fprintf(f, "  [ -x ]             capture program exit code (for testing)\n");
     //fprintf(f, "  [ -z ]             compress code\n");
+    fprintf(f, "  [ --no-asm-file ]  do not write the intermediate .pasm/.p2asm file\n");
+    fprintf(f, "  [ --cache-dir=DIR ] reuse the output of earlier identical compiles saved in DIR\n");
+    fprintf(f, "  [ --watch ]        compile again whenever a source file changes\n");
     fprintf(f, "  [ --code=cog ]     compile for COG mode instead of LMM\n");
     fprintf(f, "  [ --fcache=N ]     set FCACHE size to N (0 to disable)\n");
     fprintf(f, "  [ --fixedreal ]    use 16.16 fixed point in place of floats\n");
@@ -101,6 +113,7 @@ main(int argc, const char **argv)
     int i;
     
     InitializeSystem(cmd, argv);
+    CacheInit(argc, argv);
     
     /* save our command line arguments and comments describing
        how we were run
@@ -186,6 +199,21 @@ main(int argc, const char **argv)
         if (!strcmp(argv[0], "-y")) {
             spinyydebug = 1;
             argv++; --argc;
+        } else if (!strncmp(argv[0], "-j", 2)) {
+            // number of threads for the optimizer, and of parse workers
+            const char *num;
+            if (argv[0][2] != 0) {
+                num = &argv[0][2];
+            } else {
+                argv++; --argc;
+                num = argv[0];
+            }
+            gl_jobs = num ? atoi(num) : 0;
+            if (gl_jobs < 1) {
+                fprintf(stderr, "-j needs a thread count of at least 1\n");
+                Usage(stderr);
+            }
+            argv++; --argc;
         } else if (!strcmp(argv[0], "-x")) {
             gl_cenv_flags = 0xff;  // explicitly asked for testing & exit status
             argv++; --argc;
@@ -262,12 +290,74 @@ main(int argc, const char **argv)
         } else if (!strcmp(argv[0], "--nostdlib")) {
             gl_nostdlib = 1;
             argv++; --argc;
+        } else if (!strncmp(argv[0], "--cache-dir=", 12)) {
+            gl_cache_dir = argv[0] + 12;
+            if (!*gl_cache_dir) {
+                fprintf(stderr, "--cache-dir needs a directory name\n");
+                Usage(stderr);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--watch")) {
+            gl_watch = 1;
+            argv++; --argc;
+        } else if (!strncmp(argv[0], "--opt-budget=", 13)) {
+            char *end;
+            gl_opt_budget = strtol(argv[0] + 13, &end, 10);
+            if (*end || end == argv[0] + 13 || gl_opt_budget < 0) {
+                fprintf(stderr, "--opt-budget needs a number of rounds\n");
+                Usage(stderr);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--time-passes") || !strncmp(argv[0], "--time-passes=", 14)) {
+            if (argv[0][13] == '=') {
+                char *end;
+                gl_time_passes_funcs = strtol(argv[0] + 14, &end, 10);
+                if (*end || end == argv[0] + 14 || gl_time_passes_funcs < 0) {
+                    fprintf(stderr, "--time-passes needs a number of functions\n");
+                    Usage(stderr);
+                }
+            }
+            PassTimeInit(PASSTIME_TEXT);
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--stats=json") || !strncmp(argv[0], "--stats=json:", 13)) {
+            if (argv[0][12] == ':') {
+                gl_stats_file = argv[0] + 13;
+                if (!*gl_stats_file) {
+                    fprintf(stderr, "--stats=json: needs a file name\n");
+                    Usage(stderr);
+                }
+            }
+            PassTimeInit(PASSTIME_JSON);
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--quality-report=json") || !strncmp(argv[0], "--quality-report=json:", 22)) {
+            if (argv[0][21] == ':') {
+                gl_quality_file = argv[0] + 22;
+                if (!*gl_quality_file) {
+                    fprintf(stderr, "--quality-report=json: needs a file name\n");
+                    Usage(stderr);
+                }
+            }
+            gl_quality_report = 1;
+            argv++; --argc;
+        } else if (!strncmp(argv[0], "--profile-use=", 14)) {
+            gl_profile_file = argv[0] + 14;
+            if (!*gl_profile_file) {
+                fprintf(stderr, "--profile-use= needs a file name\n");
+                Usage(stderr);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--wcet")) {
+            gl_wcet_report = 1;
+            argv++; --argc;
         } else if (!strcmp(argv[0], "--verbose")) {
             gl_verbosity = 1;
             argv++; --argc;
         } else if (!strcmp(argv[0], "--sizes")) {
             cmd->printSizes = 1;
             argv++; --argc;
+        } else if (!strcmp(argv[0], "--no-asm-file")) {
+            cmd->noAsmFile = 1;
+            argv++; --argc;
         } else if (!strcmp(argv[0], "-v")) {
             cmd->quiet = 0;
             argv++; --argc;
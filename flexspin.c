@@ -36,6 +36,8 @@
 #include "preprocess.h"
 #include "version.h"
 #include "cmdline.h"
+#include "compcache.h"
+#include "passtime.h"
 
 //#define DEBUG_YACC
 
@@ -85,6 +87,13 @@ Usage(FILE *f, int bstcMode)
     fprintf(f, "          -O1 = basic optimization\n");
     fprintf(f, "          -O2 = all optimization\n");
     fprintf(f, "  [ -H nnnn ]        set starting hub address\n");
+    fprintf(f, "  [ -j N ]           use N threads for the PASM optimizer, N processes for parsing\n");
+    fprintf(f, "  [ --opt-budget=N ] run at most N rounds of the PASM optimizer per function (0 for no limit)\n");
+    fprintf(f, "  [ --time-passes[=N] ] print time and memory used by each compiler phase, and the N slowest functions\n");
+    fprintf(f, "  [ --stats=json[:FILE] ] write compile statistics as JSON to stdout (or FILE)\n");
+    fprintf(f, "  [ --quality-report=json[:FILE] ] write size and cycle estimates for each function as JSON\n");
+    fprintf(f, "  [ --profile-use=FILE ] optimize using the function profile written by p2sim --json=FILE\n");
+    fprintf(f, "  [ --wcet ]         print the worst case cycles of each function (P2 only)\n");
     fprintf(f, "  [ -E ]             skip initial coginit code (usually used with -H)\n");
     fprintf(f, "  [ -w ]             compile for COG with Spin wrappers\n");
     fprintf(f, "  [ -Wall ]          enable warnings for language extensions and other features\n");
@@ -94,6 +103,9 @@ Usage(FILE *f, int bstcMode)
     fprintf(f, "  [ -C ]             enable case sensitive mode\n");
     fprintf(f, "  [ -x ]             capture program exit code (for testing)\n");
     //fprintf(f, "  [ -z ]             compress code\n");
+    fprintf(f, "  [ --no-asm-file ]  do not write the intermediate .pasm/.p2asm file\n");
+    fprintf(f, "  [ --cache-dir=DIR ] reuse the output of earlier identical compiles saved in DIR\n");
+    fprintf(f, "  [ --watch ]        compile again whenever a source file changes\n");
     fprintf(f, "  [ --charset=xxx ]  set character set for runtime\n");
     fprintf(f, "           xxx is one of utf8, latin1, shiftjis, or parallax\n");
     fprintf(f, "  [ --code=cog ]     compile for COG mode instead of LMM\n");
@@ -140,6 +152,7 @@ main(int argc, const char **argv)
     gl_start_time = getCurTime();
 
     InitializeSystem(cmd, argv);
+    CacheInit(argc, argv);
     
     /* save our command line arguments and comments describing
        how we were run
@@ -307,12 +320,74 @@ main(int argc, const char **argv)
         } else if (!strcmp(argv[0], "--nostdlib")) {
             gl_nostdlib = 1;
             argv++; --argc;
+        } else if (!strncmp(argv[0], "--cache-dir=", 12)) {
+            gl_cache_dir = argv[0] + 12;
+            if (!*gl_cache_dir) {
+                fprintf(stderr, "--cache-dir needs a directory name\n");
+                Usage(stderr, cmd->bstcMode);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--watch")) {
+            gl_watch = 1;
+            argv++; --argc;
+        } else if (!strncmp(argv[0], "--opt-budget=", 13)) {
+            char *end;
+            gl_opt_budget = strtol(argv[0] + 13, &end, 10);
+            if (*end || end == argv[0] + 13 || gl_opt_budget < 0) {
+                fprintf(stderr, "--opt-budget needs a number of rounds\n");
+                Usage(stderr, cmd->bstcMode);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--time-passes") || !strncmp(argv[0], "--time-passes=", 14)) {
+            if (argv[0][13] == '=') {
+                char *end;
+                gl_time_passes_funcs = strtol(argv[0] + 14, &end, 10);
+                if (*end || end == argv[0] + 14 || gl_time_passes_funcs < 0) {
+                    fprintf(stderr, "--time-passes needs a number of functions\n");
+                    Usage(stderr, cmd->bstcMode);
+                }
+            }
+            PassTimeInit(PASSTIME_TEXT);
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--stats=json") || !strncmp(argv[0], "--stats=json:", 13)) {
+            if (argv[0][12] == ':') {
+                gl_stats_file = argv[0] + 13;
+                if (!*gl_stats_file) {
+                    fprintf(stderr, "--stats=json: needs a file name\n");
+                    Usage(stderr, cmd->bstcMode);
+                }
+            }
+            PassTimeInit(PASSTIME_JSON);
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--quality-report=json") || !strncmp(argv[0], "--quality-report=json:", 22)) {
+            if (argv[0][21] == ':') {
+                gl_quality_file = argv[0] + 22;
+                if (!*gl_quality_file) {
+                    fprintf(stderr, "--quality-report=json: needs a file name\n");
+                    Usage(stderr, cmd->bstcMode);
+                }
+            }
+            gl_quality_report = 1;
+            argv++; --argc;
+        } else if (!strncmp(argv[0], "--profile-use=", 14)) {
+            gl_profile_file = argv[0] + 14;
+            if (!*gl_profile_file) {
+                fprintf(stderr, "--profile-use= needs a file name\n");
+                Usage(stderr, cmd->bstcMode);
+            }
+            argv++; --argc;
+        } else if (!strcmp(argv[0], "--wcet")) {
+            gl_wcet_report = 1;
+            argv++; --argc;
         } else if (!strcmp(argv[0], "--verbose")) {
             gl_verbosity = 1;
             argv++; --argc;
         } else if (!strcmp(argv[0], "--sizes")) {
             cmd->printSizes = 1;
             argv++; --argc;
+        } else if (!strcmp(argv[0], "--no-asm-file")) {
+            cmd->noAsmFile = 1;
+            argv++; --argc;
         } else if (!strcmp(argv[0], "-w")) {
             gl_output = OUTPUT_COGSPIN;
             gl_debug = 1;
@@ -518,6 +593,21 @@ main(int argc, const char **argv)
                 Usage(stderr, cmd->bstcMode);
             }
             argv++; --argc;
+        } else if (!strncmp(argv[0], "-j", 2)) {
+            // number of threads for the optimizer, and of parse workers
+            const char *num;
+            if (argv[0][2] != 0) {
+                num = &argv[0][2];
+            } else {
+                argv++; --argc;
+                num = argv[0];
+            }
+            gl_jobs = num ? atoi(num) : 0;
+            if (gl_jobs < 1) {
+                fprintf(stderr, "-j needs a thread count of at least 1\n");
+                Usage(stderr, cmd->bstcMode);
+            }
+            argv++; --argc;
         } else if (!strncmp(argv[0], "-H", 2)) {
             // set ub address
             const char *addr;
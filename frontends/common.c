@@ -43,6 +43,7 @@
 #include "compress/compress.h"
 #include "preprocess.h"
 #include "version.h"
+#include "sysimage.h"
 
 /* declarations common to all front ends */
 
@@ -56,9 +57,18 @@ int gl_src_charset = CHARSET_UTF8;
 int gl_run_charset = CHARSET_UTF8;
 int gl_have_lut;
 int gl_errors;
+int gl_warning_count;
 int gl_warnings_are_errors;
 int gl_verbosity;
 int gl_max_errors;
+int gl_jobs = 1;
+int gl_opt_budget = DEFAULT_OPT_BUDGET;
+const char *gl_cache_dir;
+int gl_watch;
+int gl_quality_report;
+const char *gl_quality_file;
+const char *gl_profile_file;
+int gl_wcet_report;
 int gl_colorize_output;
 int gl_output;
 int gl_outputflags;
@@ -824,7 +834,8 @@ NewObjectWithParams(AST *identifier, AST *string, int fromUsing, AST *paramlist)
 
     ast = NewAST(AST_OBJECT, identifier, NULL);
     if (filename) {
-        Module *P = ParseFile(filename, paramlist);
+        /* ParseFile, but noted for the compile cache */
+        Module *P = ParseImageChild(filename, paramlist);
         P->fromUsing = fromUsing;
         ast->d.ptr = (void *)P;
     }
@@ -989,6 +1000,7 @@ LANGUAGE_WARNING(int language, AST *ast, const char *msg, ...)
     } else {
         banner = "warning";
         SETCOLOR(PRINT_WARNING);
+        gl_warning_count++;
     }
     if (ast) {
         ERRORHEADER_AST(ast, banner);
@@ -1017,6 +1029,7 @@ WARNING(AST *instr, const char *msg, ...)
     } else {
         banner = "warning";
         SETCOLOR(PRINT_WARNING);
+        gl_warning_count++;
     }
     ERRORHEADER_AST(instr, banner);
 
@@ -1033,6 +1046,7 @@ NOTE(AST *instr, const char *msg, ...)
     va_list args;
 
     SETCOLOR(PRINT_NOTE);
+    gl_warning_count++;
 
     ERRORHEADER_AST(instr, "note");
 
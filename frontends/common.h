@@ -12,6 +12,7 @@ typedef struct modulestate Module;
 #include "expr.h"
 #include "util/util.h"
 #include "util/flexbuf.h"
+#include "util/workpool.h"
 #include "instr.h"
 
 #include "optokens.h"
@@ -196,6 +197,9 @@ extern int gl_optimize_flags; /* flags for optimization */
 #define OPT_SPIN_RELAXMEM       0x01000000  /* relax strict memory semantics for Spin */
 #define OPT_FASTASM             0x02000000  /* optimize inline assembly invocation */
 #define OPT_PEEK_ARGS           0x04000000  /* peek into functions to see if arg registers can be reused */
+#define OPT_REG_ALLOC           0x08000000  /* share local registers by coloring their live ranges */
+#define OPT_STATIC_FRAMES       0x10000000  /* give non-recursive functions fixed registers instead of pushing them */
+#define OPT_GVN                 0x20000000  /* global value numbering across basic blocks */
 #define OPT_EXPERIMENTAL        0x80000000  /* gate new or experimental optimizations */
 #define OPT_FLAGS_ALL           0xffffffff
 
@@ -213,6 +217,9 @@ extern int gl_optimize_flags; /* flags for optimization */
 // default optimization (-O1) for bytecode output; defaults to much less optimization than asm
 #define DEFAULT_BYTECODE_OPTS   (OPT_REMOVE_UNUSED_FUNCS|OPT_REMOVE_FEATURES|OPT_DEADCODE|OPT_MAKE_MACROS|OPT_SPECIAL_FUNCS|OPT_PEEPHOLE|OPT_LOOP_BASIC)
 
+/* default limit on PASM optimizer rounds per function (--opt-budget); 0 for no limit */
+#define DEFAULT_OPT_BUDGET      0
+
 extern int gl_warn_flags;     /* flags for warnings */
 #define WARN_LANG_EXTENSIONS    0x000001
 #define WARN_HIDE_MEMBERS       0x000002
@@ -235,6 +242,14 @@ extern int gl_list_options;   /* options for listing files */
 
 extern int gl_printprogress;  /* print files as we process them */
 extern int gl_fcache_size;   /* size of fcache for LMM mode */
+extern int gl_jobs;          /* number of threads for the PASM optimizer */
+extern int gl_opt_budget;    /* max. PASM optimizer rounds per function (0 for no limit) */
+extern const char *gl_cache_dir; /* directory for cached compiles, or NULL */
+extern int gl_watch;         /* recompile when the sources change */
+extern int gl_quality_report; /* write per function size and cycle estimates */
+extern const char *gl_quality_file; /* file for them, or NULL for stdout */
+extern const char *gl_profile_file; /* p2sim profile for --profile-use, or NULL */
+extern int gl_wcet_report;  /* print the worst case cycles of each function */
 extern const char *gl_cc; /* C compiler to use; NULL means default (PropGCC) */
 extern const char *gl_intstring; /* int string to use */
 
@@ -454,6 +469,7 @@ typedef struct funcdef {
     /* various flags */
     int optimize_flags;   // optimizations to be applied
     int warn_flags;       // warnings enabled for this function
+    int cycle_budget;     // most cycles the function may take (0 for no limit)
     unsigned is_public:1;
     unsigned code_placement:2;
 #define CODE_PLACE_DEFAULT 0
@@ -478,6 +494,8 @@ typedef struct funcdef {
     unsigned toplevel:1;     // 1 if function is top level
     unsigned sets_send:1;    // 1 if function sets SEND function
     unsigned sets_recv:1;    // 1 if function sets RECV function
+    unsigned profile_hot:1;  // 1 if the --profile-use profile says it is called often
+    unsigned profile_cold:1; // 1 if the --profile-use profile says it never ran
 
     unsigned attributes;     // various other attributes
 #define FUNC_ATTR_CONSTRUCTOR 0x0001  /* does not actually work yet */
@@ -658,7 +676,7 @@ struct modulestate {
 
 /* the current parser state */
 extern Module *current;
-extern Function *curfunc;
+extern THREAD_LOCAL Function *curfunc;
 extern SymbolTable *currentTypes;
 
 /* defines given on the command line */
@@ -776,6 +794,7 @@ void CheckRecursive(Function *f);
 
 /* code for printing errors */
 extern int gl_errors;
+extern int gl_warning_count;  /* warnings and notes printed so far */
 extern int gl_warnings_are_errors;
 extern int gl_verbosity;
 extern int gl_max_errors;
@@ -822,6 +841,10 @@ void OutputDatFile(const char *name, Module *P, int prefixBin);
 void OutputGasFile(const char *name, Module *P);
 void OutputLstFile(const char *name, Module *P);
 void OutputAsmCode(const char *name, Module *P, int printMain);
+char *CompileAsmCode(Module *P, int printMain);
+char *CompileAsmCodeLines(Module *P, int printMain, Flexbuf *irlines);
+void IRBuildDat(Flexbuf *irlines, const char *asmcode, Module *Q);
+void WriteAsmFile(const char *name, const char *asmcode);
 void OutputObjFile(const char *name, Module *P);
 void OutputByteCode(const char *name, Module *P);
 void OutputNuCode(const char *name, Module *P);
@@ -15,6 +15,7 @@
 #include "spinc.h"
 #include "lexer.h"
 #include "preprocess.h"
+#include "sysimage.h"
 #ifdef WIN32
 #include <direct.h>
 #else
@@ -165,6 +166,22 @@ void strToLex(LexStream *L, const char *s, size_t maxBytes, const char *name, in
     flexbuf_init(&L->lineInfo, 1024);
 }
 
+/*
+ * release the lines a stream has read so far, before it is opened
+ * again; ASTs that refer to them by index will see the new lines
+ */
+void freeLexLines(LexStream *L)
+{
+    LineInfo *info = (LineInfo *)flexbuf_peek(&L->lineInfo);
+    size_t i, n = flexbuf_curlen(&L->lineInfo) / sizeof(*info);
+
+    for (i = 0; i < n; i++) {
+        free(info[i].linedata);
+    }
+    flexbuf_delete(&L->lineInfo);
+    flexbuf_delete(&L->curLine);
+}
+
 /* functions for handling FILE streams */
 /* filegetc is for ASCII streams;
    filegetwc is for UCS-16LE streams
@@ -709,8 +726,109 @@ getTranslatedString(struct flexbuf *fb)
     return flexbuf_get(fb);
 }
 
+/*
+ * fetch the canonical (interned) copy of an identifier out of a flexbuf;
+ * identical spellings share one string, so they may be compared
+ * by pointer
+ */
+static char *
+getIdentifierString(struct flexbuf *fb)
+{
+    char *idstr = (char *)InternString(flexbuf_peek(fb));
+
+    flexbuf_delete(fb);
+    return idstr;
+}
+
 static Module *open_obj = NULL;
 
+/*
+ * find the AST parseSpinIdentifier would produce for a word in a DAT
+ * section of the current module: an instruction (only looked for if
+ * "instr" is set, as at the start of a line), a modifier, a hardware
+ * register or an identifier; used when building DAT sections without
+ * parsing them
+ * returns NULL if the word would be read as anything else (a keyword,
+ * a type name, a number, or more than one token)
+ */
+AST *
+PasmWordAST(const char *name, int instr)
+{
+    Symbol *sym = NULL;
+    AST *ast;
+    const char *s;
+    char *idstr;
+
+    for (s = name; *s; s++) {
+        // these are quoted with ` when printed
+        if (isIdentifierChar(*s) || *s == ':' || strchr("!$%#", *s)) {
+            continue;
+        }
+        return NULL;
+    }
+    if (!*name || safe_isdigit(*name) || *name == ':') {
+        return NULL;
+    }
+    if (instr) {
+        sym = FindSymbol(&pasmInstrWords, name);
+    }
+    if (!sym) {
+        sym = FindSymbol(&pasmWords, name);
+    }
+    if (sym) {
+        switch (sym->kind) {
+        case SYM_INSTR:
+            ast = NewAST(AST_INSTR, NULL, NULL);
+            break;
+        case SYM_INSTRMODIFIER:
+            ast = NewAST(AST_INSTRMODIFIER, NULL, NULL);
+            break;
+        case SYM_HWREG:
+            ast = NewAST(AST_HWREG, NULL, NULL);
+            break;
+        default:
+            return NULL;
+        }
+        ast->d.ptr = sym->v.ptr;
+        return ast;
+    }
+    if (current && current->curLanguage == LANG_SPIN_SPIN2) {
+        sym = FindSymbol(&spin2ReservedWords, name);
+    } else {
+        sym = FindSymbol(&spin1ReservedWords, name);
+    }
+    if (!sym) {
+        sym = FindSymbol(&spinCommonReservedWords, name);
+    }
+    if (sym) {
+        // builtins and constants are read as identifiers, but the
+        // lexer runs a builtin's parse hook, so leave those to it
+        if (sym->kind == SYM_CONSTANT || sym->kind == SYM_FLOAT_CONSTANT) {
+            sym = NULL;
+        } else if (sym->kind == SYM_BUILTIN && !(sym->v.ptr && ((Builtin *)sym->v.ptr)->parsehook)) {
+            sym = NULL;
+        }
+    }
+    if (!sym && current && currentTypes) {
+        sym = LookupSymbolInTable(currentTypes, name);
+        if (sym && sym->kind != SYM_TYPEDEF && sym->kind != SYM_VARIABLE) {
+            sym = NULL;
+        }
+    }
+    if (sym) {
+        return NULL;
+    }
+    idstr = (char *)InternString(name);
+    if (gl_normalizeIdents) {
+        idstr = AstStrdup(idstr);
+        NormalizeIdentifier(idstr);
+        idstr = (char *)InternString(idstr);
+    }
+    ast = NewAST(AST_IDENTIFIER, NULL, NULL);
+    ast->d.string = idstr;
+    return ast;
+}
+
 /* parse an identifier */
 static int
 parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
@@ -747,11 +865,9 @@ parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
         flexbuf_addchar(&fb, c);
         c = lexgetc(L);
     }
-    // add a trailing 0, and make sure there is room for an extra
-    // character in case the name mangling needs it
+    // add a trailing 0
     flexbuf_addchar(&fb, '\0');
-    flexbuf_addchar(&fb, '\0');
-    idstr = flexbuf_get(&fb);
+    idstr = getIdentifierString(&fb);
     lexungetc(L, c);
 
     sym = NULL;
@@ -764,7 +880,6 @@ parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
             sym = FindSymbol(&pasmWords, idstr);
         }
         if (sym) {
-            free(idstr);
             if (sym->kind == SYM_INSTR) {
                 ast = NewAST(AST_INSTR, NULL, NULL);
                 ast->d.ptr = sym->v.ptr;
@@ -984,7 +1099,6 @@ parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
                 // if gl_debug is off, we want to ignore the whole debug statement
                 // do this by just skipping the rest of the line
                 if (!gl_debug) {
-                    free(idstr);
                     do {
                         c = lexgetc(L);
                     } while ( (c > 0) && (c != 10) && (c != 13) );
@@ -1005,14 +1119,12 @@ parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
                     ast = GetComments();
                 }
             }
-            free(idstr);
             *ast_ptr = ast;
             return c;
         }
         if (sym->kind == SYM_HWREG) {
             ast = NewAST(AST_HWREG, NULL, NULL);
             ast->d.ptr = sym->v.ptr;
-            free(idstr);
             *ast_ptr = ast;
             return SP_HWREG;
         }
@@ -1022,6 +1134,7 @@ parseSpinIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
     if (current) {
         if (open_obj) {
             sym = LookupSymbolInTable(&open_obj->objsyms, idstr);
+            ParseImageLookup(open_obj, idstr, sym);
         } else {
             sym = NULL;
         }
@@ -1068,7 +1181,10 @@ is_identifier:
         ast = NewAST(AST_IDENTIFIER, NULL, NULL);
     }
     if (gl_normalizeIdents) {
+        // interned strings are shared, so normalize a copy
+        idstr = AstStrdup(idstr);
         NormalizeIdentifier(idstr);
+        idstr = (char *)InternString(idstr);
     }
 
     /* peek ahead to handle foo.bar as foo#bar */
@@ -1258,7 +1374,6 @@ parseBacktickString(LexStream *L, AST **ast_ptr, int first)
     ast->d.string = getTranslatedString(&fb);
     if (ast->d.string[0] == 0) {
         c = lexgetc(L);
-        free(ast);
         ast = NULL;
     } else {
         c = SP_BACKTICK_STRING;
@@ -4482,11 +4597,9 @@ parseBasicIdentifier(LexStream *L, AST **ast_ptr)
         flexbuf_addchar(&fb, c);
         c = lexgetc(L);
     }
-    // add a trailing 0, and make sure there is room for an extra
-    // character in case the name mangling needs it
-    flexbuf_addchar(&fb, '\0');
+    // add a trailing 0
     flexbuf_addchar(&fb, '\0');
-    idstr = flexbuf_get(&fb);
+    idstr = getIdentifierString(&fb);
     lexungetc(L, c);
 
     // check for ASM
@@ -4501,7 +4614,6 @@ parseBasicIdentifier(LexStream *L, AST **ast_ptr)
             sym = FindSymbol(&pasmWords, idstr);
         }
         if (sym) {
-            free(idstr);
             if (sym->kind == SYM_INSTR) {
                 ast = NewAST(AST_INSTR, NULL, NULL);
                 ast->d.ptr = sym->v.ptr;
@@ -4857,11 +4969,9 @@ parseCIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
         flexbuf_addchar(&fb, c);
         c = lexgetc(L);
     }
-    // add a trailing 0, and make sure there is room for an extra
-    // character in case the name mangling needs it
-    flexbuf_addchar(&fb, '\0');
+    // add a trailing 0
     flexbuf_addchar(&fb, '\0');
-    idstr = flexbuf_get(&fb);
+    idstr = getIdentifierString(&fb);
     lexungetc(L, c);
 
     // check for ASM
@@ -4872,7 +4982,6 @@ parseCIdentifier(LexStream *L, AST **ast_ptr, const char *prefix)
             sym = FindSymbol(&pasmWords, idstr);
         }
         if (sym) {
-            free(idstr);
             if (sym->kind == SYM_INSTR) {
                 ast = NewAST(AST_INSTR, NULL, NULL);
                 ast->d.ptr = sym->v.ptr;
@@ -24,6 +24,11 @@ extern void resetLineState(LexStream *L);
  */
 void strToLex(LexStream *lex, const char *s, size_t maxBytes, const char *name, int language);
 
+/*
+ * function to free the lines a stream has read, before re-opening it
+ */
+void freeLexLines(LexStream *lex);
+
 /*
  * function to open a lexer stream from a FILE
  */
@@ -47,6 +52,13 @@ bool Is_C_Reserved(const char *);
  */
 void NormalizeIdentifier(char *name);
 
+/*
+ * function to find the AST a DAT section word becomes: an instruction
+ * (only looked for if "instr" is set), a modifier, a hardware register
+ * or an identifier; returns NULL for anything else
+ */
+AST *PasmWordAST(const char *name, int instr);
+
 /*
  * function to retrieve pending comments
  */
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include "spinc.h"
+#include "sysimage.h"
 
 #define SPINYYSTYPE AST*
 #undef  YYSTYPE
@@ -67,10 +68,22 @@ SpinAddDatList(AST *datlist)
 
 // add a constant definition immediately (if we know the
 // values) or later (if we do not)
+static int
+RefersToObject(AST *ast)
+{
+    if (!ast) return 0;
+    if (ast->kind == AST_CONSTREF || ast->kind == AST_METHODREF) return 1;
+    return RefersToObject(ast->left) || RefersToObject(ast->right);
+}
+
 static AST *
 SpinAddConstant(AST *id, AST *val)
 {
     int op = K_ASSIGN;
+    if (RefersToObject(val)) {
+        // whether this is constant depends on the other object
+        ParseImageBlock("it uses constants from another object");
+    }
     if (IsConstExpr(val)) {
         const char *name = GetIdentifierName(id);
         if (!LookupSymbolInTable(&current->objsyms, name)) {
@@ -778,7 +791,11 @@ funcdef:
 
 funcdef_end:
   {
+      // the function's scope only told the lexer about its locals
+      SymbolTable *scope = currentTypes;
       PopCurrentTypes();
+      FreeSymbolTable(scope);
+      free(scope);
   }
 ;
 
@@ -13,6 +13,7 @@
 #include <inttypes.h>
 #include "spinc.h"
 #include "preprocess.h"
+#include "sysimage.h"
 
 // marked in MarkUsed(); checks for things like try()/catch() that
 // may affect global code generation
@@ -56,7 +57,7 @@ NumExprItemsOnStack(AST *expr)
     return ((siz+3) & ~3) / LONG_SIZE;
 }
 
-Function *curfunc;
+THREAD_LOCAL Function *curfunc;
 static int visitPass = 1;
 
 static void ReinitFunction(Function *f, int language)
@@ -1000,6 +1001,23 @@ doDeclareFunction(AST *funcblock)
     if (FindAnnotation(annotation, "noinline") != 0) {
         fdef->no_inline = 1;
     }
+    {
+        const char *budget = FindAnnotation(annotation, "cycles");
+        if (budget) {
+            char *end;
+            long n = 0;
+            if (budget[0] == '(') {
+                n = strtol(budget+1, &end, 0);
+            }
+            if (n <= 0 || *end != ')') {
+                ERROR(annotation, "cycle budget must be a positive number in parentheses");
+            } else {
+                // the budget is checked on the function's own code, so keep it
+                fdef->cycle_budget = n;
+                fdef->no_inline = 1;
+            }
+        }
+    }
     {
         const char *spfunc = FindAnnotation(annotation, "specialfunc");
         if (spfunc) {
@@ -1707,6 +1725,9 @@ DeclareToplevelAnnotation(AST *anno)
     Function *f;
     const char *str;
 
+    /* these change the options or the function list */
+    ParseImageBlock("it has a top level annotation");
+
     /* check the annotation string; some of them are special */
     str = anno->d.string;
     if (*str == '!') {
@@ -353,6 +353,11 @@ enum Operandkind {
 
 typedef enum Operandkind Operandkind;
 
+// operand kinds whose "name" really is a name (rather than a pointer to
+// some other data); these names are interned, so two such operands
+// have the same name exactly when the name pointers are equal
+#define OperandHasName(kind) ((kind) <= IMM_STRING || ((kind) >= REG_HW && (kind) <= REG_RESULT))
+
 enum OperandEffect {
     OPEFFECT_NONE = 0,
     OPEFFECT_PREDEC = 1,
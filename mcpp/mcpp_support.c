@@ -1037,7 +1037,8 @@ int     get_ch( void)
     if (file->fp) {                         /* Source file included */
         free( file->filename);              /* Free filename        */
         free( file->src_dir);               /* Free src_dir         */
-        fclose( file->fp);                  /* Close finished file  */
+        if (file->fp != MEM_FP)
+            fclose( file->fp);              /* Close finished file  */
         /* Do not free file->real_fname and file->full_fname        */
         cur_fullname = infile->full_fname;
         cur_fname = infile->real_fname;     /* Restore current fname*/
@@ -1499,13 +1500,30 @@ static char *   parse_line( void)
     return r;
 }
 
-static char *   mcpp_fgets(
+char *  mcpp_fgets(
     char *  s,
     int     size,
-    FILE *  stream
+    FILEINFO *  file
 )
+/*
+ * fgets() from the source file, or the next line of its cached text.
+ */
 {
-    return fgets( s, size, stream);
+    const char *    end;
+    size_t  len;
+
+    if (file->fp != MEM_FP)
+        return fgets( s, size, file->fp);
+    if (*file->mptr == EOS)
+        return  NULL;
+    end = strchr( file->mptr, '\n');
+    len = end ? (size_t) (end - file->mptr) + 1 : strlen( file->mptr);
+    if (len > (size_t) size - 1)
+        len = size - 1;
+    memcpy( s, file->mptr, len);
+    s[ len] = EOS;
+    file->mptr += len;
+    return  s;
 }
 
 static char *   get_line(
@@ -1530,7 +1548,7 @@ static char *   get_line(
     if ((mcpp_debug & MACRO_CALL) && src_line == 0) /* Initialize   */
         com_cat_line.last_line = bsl_cat_line.last_line = 0L;
 
-    while (mcpp_fgets( ptr, (int) (infile->buffer + NBUFF - ptr), infile->fp)
+    while (mcpp_fgets( ptr, (int) (infile->buffer + NBUFF - ptr), infile)
             != NULL) {
         /* Translation phase 1  */
         src_line++;                 /* Gotten next physical line    */
@@ -1603,7 +1621,7 @@ static char *   get_line(
     }
 
     /* End of a (possibly included) source file */
-    if (ferror( infile->fp))
+    if (infile->fp != MEM_FP && ferror( infile->fp))
         cfatal( "File read error", NULL, 0L, NULL);         /* _F_  */
     if ((ptr = at_eof( in_comment)) != NULL)        /* Check at end of file */
         return  ptr;                        /* Partial line supplemented    */
@@ -1761,6 +1779,7 @@ FILEINFO *  get_file(
     file->buffer[ 0] = EOS;                 /* Force first read     */
     file->line = 0L;                        /* (Not used just yet)  */
     file->fp = NULL;                        /* No file yet          */
+    file->mptr = NULL;                      /* No cached text       */
     file->pos = 0L;                         /* No pos to remember   */
     file->parent = infile;                  /* Chain files together */
     file->initif = ifptr;                   /* Initial ifstack      */
@@ -104,6 +104,13 @@ ssize_t readlink(const char *pathname, char *buf, size_t bufsiz);
 #endif
 #endif
 
+typedef struct hdr_cache {      /* Header read by open_file()       */
+    struct hdr_cache *  next;   /* Next header in the same bucket   */
+    char *      fullname;       /* Full path list                   */
+    char *      text;           /* Contents of the file             */
+    char *      guard;          /* Macro guarding the file or NULL  */
+} HDR_CACHE;
+
 static void     version( void);
                 /* Print version message            */
 static void     usage( int opt);
@@ -179,6 +186,16 @@ static void     do_once( const char * fullname);
                 /* Process #pragma once             */
 static int      included( const char * fullname);
                 /* The file has been once included? */
+static HDR_CACHE *  cached_header( const char * fullname);
+                /* Get the text of a header         */
+static char *   find_guard( const char * text);
+                /* Get the include guard of a header*/
+static const char *     skip_blanks( const char * cp, int newline);
+                /* Skip spaces and comments         */
+static const char *     skip_rest( const char * cp);
+                /* Skip to the next line            */
+static const char *     get_word( const char * cp, char * word, size_t size);
+                /* Get an identifier                */
 static void     push_or_pop( int direction);
                 /* Push or pop a macro definition   */
 static void     do_preprocessed( void);
@@ -226,6 +243,19 @@ static INC_LIST *   once_list;          /* Once opened file         */
 static INC_LIST *   once_end;           /* -> active end of once_list   */
 static int          max_once;           /* Number of once_list[]    */
 
+/*
+ * hdr_cache[] keeps the text of every header read, for the rest of the
+ * compile, so that a header included by several C files (mcpp is run once
+ * for each of them) is read only once.  The entry also remembers the macro
+ * guarding the whole file, if any, so that the file is skipped without
+ * being read again while that macro is defined.
+ */
+#define HDR_CACHE_SIZE      128         /* Number of hash buckets       */
+static HDR_CACHE *  hdr_cache[ HDR_CACHE_SIZE];
+
+/* Full path of the file last opened (or skipped) by open_file()   */
+static const char *     opened_fullname;
+
 #define INIT_NUM_INCLUDE    32          /* Initial number of incdir[]   */
 #define INIT_NUM_FNAMELIST  256         /* Initial number of fnamelist[]    */
 #define INIT_NUM_ONCE       64          /* Initial number of once_list[]    */
@@ -1558,8 +1588,13 @@ found_name:
         /*      real_fname and has been registered into fnamelist[]     */
         if (!sys_header) {
             extern void AddSourceFile(const char *, const char *);            
-            // open_include sets cur_fullname to the full path
-            AddSourceFile(filename, cur_fullname);
+            // open_file sets opened_fullname to the full path, even if
+            // the file was skipped (#pragma once or include guard)
+            AddSourceFile(filename, opened_fullname);
+        } else {
+            // not a dependency, but the compile cache must still check it
+            extern void CacheNoteInput(const char *);
+            CacheNoteInput(opened_fullname);
         }
         return  TRUE;
     }
@@ -1720,21 +1755,16 @@ static int  open_file(
     int         sys_frame           /* System framework header (for SYS_MAC)*/
 )
 /*
- * Open a file, add it to the linked list of open files, close the includer
- * if nessesary and truncate the includer's buffer.
+ * Open a file, add it to the linked list of open files and truncate the
+ * includer's buffer.  The file is skipped if it has been marked by #pragma
+ * once, or if its include guard is defined.
  * This is called from open_include() and at_start().
  */
 {
     char        dir_fname[ PATHMAX] = { EOS, };
-#if HOST_COMPILER == BORLANDC
-    /* Borland's fopen() does not set errno.    */
-    static int  max_open = FOPEN_MAX - 5;
-#else
-    static int  max_open;
-#endif
     int         len;
     FILEINFO *  file = infile;
-    FILE *      fp;
+    HDR_CACHE * hdr;
     char *      fullname;
     const char *    fname;
 
@@ -1756,42 +1786,34 @@ static int  open_file(
 
     fullname = norm_path( *dirp, fname, TRUE, FALSE);
                                     /* Convert to absolute path     */
-    if (! fullname)                 /* Non-existent or directory    */
+    if (! fullname) {               /* Non-existent or directory    */
+        /* the compile cache must notice if it appears later        */
+        extern void CacheNoteMissing(const char *);
+        char    probe[ PATHMAX * 2 + 2];
+        strcpy( probe, *dirp);
+        if (*probe && probe[ strlen( probe) - 1] != PATH_DELIM)
+            strcat( probe, "/");
+        strcat( probe, fname);
+        CacheNoteMissing( probe);
         return  FALSE;
+    }
+    opened_fullname = fullname;
     if (included( fullname))        /* Once included    */
         goto  true_case;
 
-    if ((max_open != 0 && max_open <= include_nest)
-                            /* Exceed the known limit of open files */
-            || ((fp = mcpp_fopen( fullname, "r")) == NULL && errno == EMFILE)) {
-                            /* Reached the limit for the first time */
-        if (mcpp_debug & PATH) {
-#if HOST_COMPILER == BORLANDC
-            if (include_nest == FOPEN_MAX - 5)
-#else
-            if (max_open == 0)
-#endif
-                mcpp_fprintf( DBG,
-    "#include nest reached at the maximum of system: %d, returned errno: %d\n"
-                    , include_nest, errno);
-        }
-        /*
-         * Table of open files is full.
-         * Remember the file position and close the includer.
-         * The state will be restored by get_line() on end of the included.
-         */
-        file->pos = ftell( file->fp);
-        fclose( file->fp);
-        /* In case of failure, re-open the includer */
-        if ((fp = mcpp_fopen( fullname, "r")) == NULL) {
-            file->fp = mcpp_fopen( cur_fullname, "r");
-            fseek( file->fp, file->pos, SEEK_SET);
-            goto  false_case;
-        }
-        if (max_open == 0)      /* Remember the limit of the system */
-            max_open = include_nest;
-    } else if (fp == NULL)                  /* No read permission   */
-        goto  false_case;
+    /*
+     * Headers are read whole and kept in hdr_cache[], so no file is left
+     * open while its includes are processed.
+     */
+    if ((hdr = cached_header( fullname)) == NULL)
+        goto  false_case;           /* Cannot read          */
+    if (hdr->guard && look_id( hdr->guard) != NULL) {
+        /* The whole file would be skipped by its include guard    */
+        if (mcpp_debug & PATH)
+            mcpp_fprintf( DBG, "Guarded by %s \"%s\"\n", hdr->guard
+                    , fullname);
+        goto  true_case;
+    }
     /* Truncate buffer of the includer to save memory   */
     len = (int) (file->bptr - file->buffer);
     if (len) {
@@ -1801,8 +1823,9 @@ static int  open_file(
 
     if (! include_opt)
         sharp( NULL, 0);    /* Print includer's line num and fname  */
-    add_file( fp, src_dir, filename, fullname, include_opt);
+    add_file( MEM_FP, src_dir, filename, fullname, include_opt);
     /* Add file-info to the linked list.  'infile' has been just renewed    */
+    infile->mptr = hdr->text;
     /*
      * Remember the directory for #include_next.
      * Note: inc_dirp is restored to the parent includer's directory
@@ -1851,7 +1874,7 @@ void    add_file(
     //
     // When encoding is UTF-8, skip BOM if present.
     //
-    if(fp != NULL && ftell(fp) == 0)
+    if(fp != NULL && fp != MEM_FP && ftell(fp) == 0)
     {
         const unsigned char UTF8_BOM[3] = {0xEF, 0xBB, 0xBF};
         unsigned char FILE_HEAD[3] = {0, 0, 0};
@@ -2310,6 +2333,233 @@ static int  included(
     return  FALSE;                          /* Not yet included     */
 }
 
+static HDR_CACHE *  cached_header(
+    const char *    fullname
+)
+/*
+ * Get the hdr_cache[] entry of the file, reading the file if this is the
+ * first time it is included in this compile.
+ * Returns NULL if the file cannot be read.
+ * This routine is only called from open_file().
+ */
+{
+    HDR_CACHE *     hdr;
+    FILE *      fp;
+    char *      text;
+    size_t      len, size;
+    unsigned    hash = 0;
+    const char *    cp;
+
+    for (cp = fullname; *cp; cp++)
+        hash = hash * 31 + tolower( *cp & UCHARMAX);
+    hash %= HDR_CACHE_SIZE;
+    for (hdr = hdr_cache[ hash]; hdr != NULL; hdr = hdr->next) {
+        if (str_case_eq( hdr->fullname, fullname))
+            return  hdr;
+    }
+
+    if ((fp = mcpp_fopen( fullname, "r")) == NULL)
+        return  NULL;
+    size = NBUFF;
+    text = xmalloc( size);
+    len = 0;
+    while ((len += fread( text + len, 1, size - len - 1, fp)) == size - 1) {
+        size *= 2;
+        text = xrealloc( text, size);
+    }
+    if (ferror( fp)) {
+        fclose( fp);
+        free( text);
+        return  NULL;
+    }
+    fclose( fp);
+    text[ len] = EOS;
+    /* When encoding is UTF-8, skip BOM if present  */
+    if (memcmp( text, "\xEF\xBB\xBF", 3) == 0)
+        memmove( text, text + 3, len - 2);
+
+    hdr = (HDR_CACHE *) xmalloc( sizeof (HDR_CACHE));
+    hdr->fullname = save_string( fullname);
+    hdr->text = text;
+    hdr->guard = find_guard( text);
+    if (hdr->guard && (mcpp_debug & PATH))
+        mcpp_fprintf( DBG, "Include guard %s \"%s\"\n", hdr->guard, fullname);
+    hdr->next = hdr_cache[ hash];
+    hdr_cache[ hash] = hdr;
+    return  hdr;
+}
+
+static const char *     skip_blanks(
+    const char *    cp,
+    int     newline                 /* Skip newlines too            */
+)
+/*
+ * Skip white spaces and comments in the text of a header.
+ */
+{
+    for (;;) {
+        if (*cp == ' ' || *cp == '\t' || *cp == '\f' || *cp == '\v'
+                || *cp == '\r' || (newline && *cp == '\n')) {
+            cp++;
+        } else if (cp[ 0] == '/' && cp[ 1] == '*') {
+            if ((cp = strstr( cp + 2, "*/")) == NULL)
+                return  "";         /* Unterminated comment */
+            cp += 2;
+        } else if (cp[ 0] == '/' && cp[ 1] == '/') {
+            while (*cp != EOS && *cp != '\n')
+                cp++;
+        } else {
+            return  cp;
+        }
+    }
+}
+
+static const char *     skip_rest(
+    const char *    cp
+)
+/*
+ * Skip to the beginning of the next line of a header, skipping string and
+ * character literals and comments (which may span lines).
+ */
+{
+    int     delim;
+
+    while (*cp != EOS && *cp != '\n') {
+        if (*cp == '"' || *cp == '\'') {
+            delim = *cp++;
+            while (*cp != EOS && *cp != '\n' && *cp != delim) {
+                if (*cp == '\\' && cp[ 1] != EOS)
+                    cp++;
+                cp++;
+            }
+            if (*cp == delim)
+                cp++;
+        } else if (cp[ 0] == '/' && (cp[ 1] == '*' || cp[ 1] == '/')) {
+            cp = skip_blanks( cp, FALSE);
+        } else {
+            cp++;
+        }
+    }
+    return  *cp == '\n' ? cp + 1 : cp;
+}
+
+static const char *     get_word(
+    const char *    cp,
+    char *  word,
+    size_t  size
+)
+/*
+ * Copy the identifier at cp (if any) to word, and return the end of it.
+ */
+{
+    size_t  len = 0;
+
+    while ((isalnum( *cp & UCHARMAX) || *cp == '_') && len < size - 1)
+        word[ len++] = *cp++;
+    word[ len] = EOS;
+    return  cp;
+}
+
+static char *   find_guard(
+    const char *    text
+)
+/*
+ * Find the macro guarding the whole of a header, that is the name NAME if
+ * the header is, apart from white spaces and comments,
+ *      #ifndef NAME    (or #if ! defined NAME, or #if ! defined( NAME))
+ *      ...
+ *      #endif
+ * with no #else or #elif for the outer group.  While NAME is defined such
+ * a header produces nothing, and need not be read again.
+ * Returns NULL if the header is not of this form.  This errs on the side
+ * of NULL for anything unusual.
+ */
+{
+    char    guard[ IDMAX + 1];
+    char    word[ IDMAX + 1];
+    char *  buf;
+    char *  dp;
+    const char *    cp;
+    int     depth = 0;
+    int     ok = TRUE;
+    enum { BEFORE, INSIDE, AFTER } state = BEFORE;
+
+    guard[ 0] = EOS;
+    /* Splice the lines and give up on trigraphs and digraphs  */
+    buf = xmalloc( strlen( text) + 1);
+    for (cp = text, dp = buf; *cp; ) {
+        if (cp[ 0] == '\\' && cp[ 1] == '\n')
+            cp += 2;
+        else if (cp[ 0] == '\\' && cp[ 1] == '\r' && cp[ 2] == '\n')
+            cp += 3;
+        else
+            *dp++ = *cp++;
+    }
+    *dp = EOS;
+    if (strstr( buf, "?\?=") || strstr( buf, "%:"))
+        ok = FALSE;
+
+    cp = buf;
+    while (ok && *(cp = skip_blanks( cp, TRUE)) != EOS) {
+        if (*cp != '#') {                   /* Text line            */
+            if (state != INSIDE)
+                ok = FALSE;
+            cp = skip_rest( cp);
+            continue;
+        }
+        cp = get_word( skip_blanks( cp + 1, FALSE), word, sizeof word);
+        switch (state) {
+        case BEFORE:                        /* Must be the guard    */
+            cp = skip_blanks( cp, FALSE);
+            if (str_eq( word, "if") && *cp == '!') {
+                cp = get_word( skip_blanks( cp + 1, FALSE), word, sizeof word);
+                cp = skip_blanks( cp, FALSE);
+                if (! str_eq( word, "defined")) {
+                    ok = FALSE;
+                } else if (*cp == '(') {
+                    cp = get_word( skip_blanks( cp + 1, FALSE), guard
+                            , sizeof guard);
+                    cp = skip_blanks( cp, FALSE);
+                    if (*cp++ != ')')
+                        ok = FALSE;
+                } else {
+                    cp = get_word( cp, guard, sizeof guard);
+                }
+            } else if (str_eq( word, "ifndef")) {
+                cp = get_word( cp, guard, sizeof guard);
+            } else {
+                ok = FALSE;
+            }
+            cp = skip_blanks( cp, FALSE);
+            if (guard[ 0] == EOS || isdigit( guard[ 0] & UCHARMAX)
+                    || (*cp != '\n' && *cp != EOS))
+                ok = FALSE;
+            state = INSIDE;
+            depth = 1;
+            break;
+        case INSIDE:
+            if (str_eq( word, "if") || str_eq( word, "ifdef")
+                    || str_eq( word, "ifndef")) {
+                depth++;
+            } else if (str_eq( word, "endif")) {
+                if (--depth == 0)
+                    state = AFTER;
+            } else if (memcmp( word, "el", 2) == 0 && depth == 1) {
+                ok = FALSE;                 /* #else of the guard   */
+            }
+            break;
+        case AFTER:
+            ok = FALSE;                     /* Directive after guard*/
+            break;
+        }
+        cp = skip_rest( cp);
+    }
+    free( buf);
+    if (! ok || state != AFTER)
+        return  NULL;
+    return  save_string( guard);
+}
+
 static void push_or_pop(
     int     direction
 )
@@ -2444,7 +2694,7 @@ static void do_preprocessed( void)
     lbuf = file->bptr = file->buffer;           /* Reset file->bptr */
 
     /* Copy the input to output until a comment line appears.       */
-    while (fgets( lbuf, NBUFF, file->fp) != NULL
+    while (mcpp_fgets( lbuf, NBUFF, file) != NULL
             && memcmp( lbuf, "/*", 2) != 0) {
 #if STD_LINE_PREFIX == FALSE
         if (memcmp( lbuf, "#line ", 6) == 0) {
@@ -2461,7 +2711,7 @@ static void do_preprocessed( void)
                 , NULL, 0L, NULL);
 
     /* Define macros according to the #define lines.    */
-    while (fgets( lbuf, NWORK, file->fp) != NULL) {
+    while (mcpp_fgets( lbuf, NWORK, file) != NULL) {
         if (memcmp( lbuf, "/*", 2) == 0) {
                                     /* Standard predefined macro    */
             continue;
@@ -0,0 +1,379 @@
+//
+// Generator for the large synthetic programs used by "make bench"
+// (see Test/bench.sh) to measure how fast the compiler is.
+//
+// usage: mkbench [-s scale] dir
+//
+// writes into dir:
+//   bench_spin.spin2  plus bench_obj1.spin2 ... : a deep tree of OBJs
+//   bench_many.spin2  plus bench_mid1.spin2 ... : a wide tree of 60 OBJs
+//   bench_c.c         : one big C file
+//   bench_bas.bas     : one big BASIC file
+//   bench_fatfs.c     : a small program using the FAT file system
+//   bench_lfs.c       : a small program using littlefs on flash
+//
+// Each program has many small methods calling one another, a long
+// case/switch statement, and a big data table. The output depends
+// only on the scale (default 1), so timings can be compared between
+// compiler versions.
+//
+// This runs on the build machine, so it uses only the C library.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TABLE_MASK 255
+
+static int scale = 1;
+static const char *outdir;
+
+// sizes, for scale 1
+static int spinDepth = 8;       // OBJ nesting depth
+static int spinMethods = 100;   // methods per object
+static int manyMids = 12;       // objects used by bench_many
+static int manyLeaves = 4;      // objects used by each of those
+static int manyMethods = 20;    // methods per object in bench_many
+static int cFuncs = 1500;
+static int basFuncs = 1000;
+static int caseBranches = 400;  // in each case/switch statement
+static int tableWords = 2048;   // in each data table
+
+static FILE *
+OpenOutput(const char *name)
+{
+    char path[1024];
+    FILE *f;
+
+    snprintf(path, sizeof(path), "%s/%s", outdir, name);
+    f = fopen(path, "w");
+    if (!f) {
+        perror(path);
+        exit(1);
+    }
+    return f;
+}
+
+// a repeatable pseudo random table entry
+static unsigned
+TableValue(int i)
+{
+    unsigned x = (unsigned)i * 2654435761u;
+    return (x >> 7) & 0xffff;
+}
+
+//
+// Spin2: bench_spin.spin2 uses bench_obj1, which uses bench_obj2, ...
+//
+static void
+SpinObject(int level)
+{
+    char name[64];
+    FILE *f;
+    int i;
+
+    if (level == 0) {
+        strcpy(name, "bench_spin.spin2");
+    } else {
+        snprintf(name, sizeof(name), "bench_obj%d.spin2", level);
+    }
+    f = OpenOutput(name);
+    fprintf(f, "' generated by mkbench; do not edit\n");
+    fprintf(f, "CON\n  _clkfreq = 180_000_000\n  MASK = %d\n\n", TABLE_MASK);
+    if (level < spinDepth) {
+        fprintf(f, "OBJ\n  sub : \"bench_obj%d\"\n\n", level+1);
+    }
+    fprintf(f, "VAR\n  long total\n  long hist[16]\n\n");
+    if (level == 0) {
+        fprintf(f, "PUB main() | i\n");
+        fprintf(f, "  repeat i from 0 to 9\n");
+        fprintf(f, "    total += entry(i)\n");
+        fprintf(f, "  repeat\n\n");
+    }
+    fprintf(f, "PUB entry(x) : r\n");
+    fprintf(f, "  r := f%d(x, 3) + dispatch(x)\n", spinMethods-1);
+    if (level < spinDepth) {
+        fprintf(f, "  r += sub.entry(r & 15)\n");
+    }
+    fprintf(f, "\n");
+    for (i = 0; i < spinMethods; i++) {
+        fprintf(f, "PUB f%d(a, b) : r | t, k\n", i);
+        fprintf(f, "  t := a * %d + b\n", i + 1);
+        fprintf(f, "  repeat while t > 100\n");
+        fprintf(f, "    t := (t >> 1) + table[t & MASK]\n");
+        fprintf(f, "  repeat k from 0 to 3\n");
+        fprintf(f, "    hist[(t + k) & 15]++\n");
+        if (i > 0) {
+            fprintf(f, "  if t & 1\n");
+            fprintf(f, "    r := f%d(t, a) + f%d(b, t)\n", i-1, i/2);
+            fprintf(f, "  else\n");
+            fprintf(f, "    r := t ^ b\n");
+        } else {
+            fprintf(f, "  r := t ^ b\n");
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "PUB dispatch(x) : r\n");
+    fprintf(f, "  case x\n");
+    for (i = 0; i < caseBranches; i++) {
+        fprintf(f, "    %d: r := x * %d + %d\n", i * 3, i + 1, (int)TableValue(i));
+    }
+    fprintf(f, "    other: r := -1\n\n");
+    fprintf(f, "DAT\n  orgh\ntable\n");
+    for (i = 0; i < tableWords; i++) {
+        fprintf(f, "%s%u", (i % 16) ? ", " : (i ? "\n  long " : "  long "), TableValue(i));
+    }
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+static void
+SpinProgram(void)
+{
+    int level;
+    for (level = 0; level <= spinDepth; level++) {
+        SpinObject(level);
+    }
+}
+
+//
+// Spin2: bench_many.spin2 uses bench_mid1 ... bench_mid12, each of
+// which uses four objects of its own (bench_leaf1 ...); this is the
+// shape of a real project built from many small drivers
+//
+static void
+SpinMethods(FILE *f, const char *prefix)
+{
+    int i;
+
+    for (i = 0; i < manyMethods; i++) {
+        fprintf(f, "PUB %s%d(a, b) : r | t\n", prefix, i);
+        fprintf(f, "  t := a * %d + b\n", i + 1);
+        fprintf(f, "  repeat while t > 100\n");
+        fprintf(f, "    t := (t >> 1) + table[t & MASK]\n");
+        if (i > 0) {
+            fprintf(f, "  if t & 1\n");
+            fprintf(f, "    r := %s%d(t, a)\n", prefix, i-1);
+            fprintf(f, "  else\n");
+            fprintf(f, "    r := t ^ b\n");
+        } else {
+            fprintf(f, "  r := t ^ b\n");
+        }
+        fprintf(f, "\n");
+    }
+    fprintf(f, "DAT\n  orgh\ntable\n");
+    for (i = 0; i <= TABLE_MASK; i++) {
+        fprintf(f, "%s%u", (i % 16) ? ", " : (i ? "\n  long " : "  long "), TableValue(i));
+    }
+    fprintf(f, "\n");
+}
+
+static void
+ManyObjectsProgram(void)
+{
+    char name[64];
+    FILE *f;
+    int m, k, leaf;
+
+    f = OpenOutput("bench_many.spin2");
+    fprintf(f, "' generated by mkbench; do not edit\n");
+    fprintf(f, "CON\n  _clkfreq = 180_000_000\n  MASK = %d\n\nOBJ\n", TABLE_MASK);
+    for (m = 1; m <= manyMids; m++) {
+        fprintf(f, "  m%d : \"bench_mid%d\"\n", m, m);
+    }
+    fprintf(f, "\nVAR\n  long total\n\nPUB main() | i\n");
+    fprintf(f, "  repeat i from 0 to 9\n");
+    for (m = 1; m <= manyMids; m++) {
+        fprintf(f, "    total += m%d.entry(i)\n", m);
+    }
+    fprintf(f, "  repeat\n\n");
+    SpinMethods(f, "g");
+    fclose(f);
+
+    for (m = 1; m <= manyMids; m++) {
+        snprintf(name, sizeof(name), "bench_mid%d.spin2", m);
+        f = OpenOutput(name);
+        fprintf(f, "' generated by mkbench; do not edit\n");
+        fprintf(f, "CON\n  MASK = %d\n\nOBJ\n", TABLE_MASK);
+        for (k = 0; k < manyLeaves; k++) {
+            leaf = (m-1) * manyLeaves + k + 1;
+            fprintf(f, "  l%d : \"bench_leaf%d\"\n", k, leaf);
+        }
+        fprintf(f, "\nPUB entry(x) : r\n  r := m%d(x, %d)\n", manyMethods-1, m);
+        for (k = 0; k < manyLeaves; k++) {
+            fprintf(f, "  r += l%d.entry(r & 15)\n", k);
+        }
+        fprintf(f, "\n");
+        SpinMethods(f, "m");
+        fclose(f);
+
+        for (k = 0; k < manyLeaves; k++) {
+            leaf = (m-1) * manyLeaves + k + 1;
+            snprintf(name, sizeof(name), "bench_leaf%d.spin2", leaf);
+            f = OpenOutput(name);
+            fprintf(f, "' generated by mkbench; do not edit\n");
+            fprintf(f, "CON\n  MASK = %d\n\n", TABLE_MASK);
+            fprintf(f, "PUB entry(x) : r\n  r := l%d(x, %d)\n\n", manyMethods-1, leaf);
+            SpinMethods(f, "l");
+            fclose(f);
+        }
+    }
+}
+
+//
+// C
+//
+static void
+CProgram(void)
+{
+    FILE *f = OpenOutput("bench_c.c");
+    int i;
+
+    fprintf(f, "// generated by mkbench; do not edit\n");
+    fprintf(f, "#include <stdio.h>\n#include <string.h>\n\n");
+    fprintf(f, "#define MASK %d\n\n", TABLE_MASK);
+    fprintf(f, "static const int table[] = {");
+    for (i = 0; i < tableWords; i++) {
+        fprintf(f, "%s%u,", (i % 16) ? " " : "\n    ", TableValue(i));
+    }
+    fprintf(f, "\n};\n\n");
+    fprintf(f, "struct point { int x, y; };\n");
+    fprintf(f, "static int hist[16];\n\n");
+    for (i = 0; i < cFuncs; i++) {
+        fprintf(f, "int f%d(int a, int b);\n", i);
+    }
+    fprintf(f, "\n");
+    for (i = 0; i < cFuncs; i++) {
+        fprintf(f, "int f%d(int a, int b)\n{\n", i);
+        fprintf(f, "    struct point p;\n    int t = a * %d + b;\n    int k;\n", i + 1);
+        fprintf(f, "    while (t > 100) {\n        t = (t >> 1) + table[t & MASK];\n    }\n");
+        fprintf(f, "    for (k = 0; k < 4; k++) {\n        hist[(t + k) & 15]++;\n    }\n");
+        fprintf(f, "    p.x = t; p.y = b;\n");
+        if (i > 0) {
+            fprintf(f, "    if (t & 1) {\n");
+            fprintf(f, "        return f%d(p.x, a) + f%d(b, p.y);\n", i-1, i/2);
+            fprintf(f, "    }\n");
+        }
+        fprintf(f, "    return p.x ^ p.y;\n}\n\n");
+    }
+    fprintf(f, "int dispatch(int x)\n{\n    switch (x) {\n");
+    for (i = 0; i < caseBranches; i++) {
+        fprintf(f, "    case %d: return x * %d + %d;\n", i * 3, i + 1, (int)TableValue(i));
+    }
+    fprintf(f, "    default: return -1;\n    }\n}\n\n");
+    fprintf(f, "int main()\n{\n    int i, r = 0;\n");
+    fprintf(f, "    for (i = 0; i < 10; i++) {\n");
+    fprintf(f, "        r += f%d(i, 3) + dispatch(i);\n    }\n", cFuncs-1);
+    fprintf(f, "    printf(\"%%d\\n\", r);\n    return 0;\n}\n");
+    fclose(f);
+}
+
+//
+// BASIC
+//
+static void
+BasicProgram(void)
+{
+    FILE *f = OpenOutput("bench_bas.bas");
+    int i;
+
+    fprintf(f, "' generated by mkbench; do not edit\n");
+    fprintf(f, "const MASK = %d\n", TABLE_MASK);
+    fprintf(f, "dim shared as integer table(%d)\n", tableWords - 1);
+    fprintf(f, "dim shared as integer hist(15)\n");
+    fprintf(f, "dim as integer i, r\n\n");
+    fprintf(f, "for i = 0 to %d\n  read table(i)\nnext i\n", tableWords - 1);
+    fprintf(f, "for i = 0 to 9\n  r = r + f%d(i, 3) + dispatch(i)\nnext i\n", basFuncs-1);
+    fprintf(f, "print r\n\n");
+    for (i = 0; i < basFuncs; i++) {
+        fprintf(f, "function f%d(a as integer, b as integer) as integer\n", i);
+        fprintf(f, "  dim as integer t, k\n");
+        fprintf(f, "  t = a * %d + b\n", i + 1);
+        fprintf(f, "  while t > 100\n    t = (t shr 1) + table(t and MASK)\n  wend\n");
+        fprintf(f, "  for k = 0 to 3\n    hist((t + k) and 15) += 1\n  next k\n");
+        if (i > 0) {
+            fprintf(f, "  if t and 1 then\n");
+            fprintf(f, "    return f%d(t, a) + f%d(b, t)\n", i-1, i/2);
+            fprintf(f, "  end if\n");
+        }
+        fprintf(f, "  return t xor b\nend function\n\n");
+    }
+    fprintf(f, "function dispatch(x as integer) as integer\n  select case x\n");
+    for (i = 0; i < caseBranches; i++) {
+        fprintf(f, "  case %d\n    return x * %d + %d\n", i * 3, i + 1, (int)TableValue(i));
+    }
+    fprintf(f, "  case else\n    return -1\n  end select\nend function\n\n");
+    for (i = 0; i < tableWords; i++) {
+        fprintf(f, "%s%u", (i % 16) ? ", " : (i ? "\ndata " : "data "), TableValue(i));
+    }
+    fprintf(f, "\n");
+    fclose(f);
+}
+
+//
+// small programs which pull in the file system drivers from include/filesys
+//
+static void
+FileSystemPrograms(void)
+{
+    FILE *f;
+
+    f = OpenOutput("bench_fatfs.c");
+    fprintf(f, "// generated by mkbench; do not edit\n");
+    fprintf(f, "#include <stdio.h>\n#include <sys/vfs.h>\n\n");
+    fprintf(f, "int main()\n{\n    FILE *f;\n");
+    fprintf(f, "    mount(\"/sd\", _vfs_open_sdcard());\n");
+    fprintf(f, "    f = fopen(\"/sd/bench.txt\", \"w\");\n");
+    fprintf(f, "    fprintf(f, \"hello\\n\");\n    fclose(f);\n");
+    fprintf(f, "    return 0;\n}\n");
+    fclose(f);
+
+    f = OpenOutput("bench_lfs.c");
+    fprintf(f, "// generated by mkbench; do not edit\n");
+    fprintf(f, "#include <stdio.h>\n#include <sys/vfs.h>\n\n");
+    fprintf(f, "int main()\n{\n    FILE *f;\n");
+    fprintf(f, "    mount(\"/pfs\", _vfs_open_littlefs_flash(1, 0));\n");
+    fprintf(f, "    f = fopen(\"/pfs/bench.txt\", \"w\");\n");
+    fprintf(f, "    fprintf(f, \"hello\\n\");\n    fclose(f);\n");
+    fprintf(f, "    return 0;\n}\n");
+    fclose(f);
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "usage: mkbench [-s scale] dir\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    while (argc > 1 && argv[1][0] == '-') {
+        if (!strcmp(argv[1], "-s") && argc > 2) {
+            scale = atoi(argv[2]);
+            if (scale < 1) Usage();
+            argv += 2; argc -= 2;
+        } else {
+            Usage();
+        }
+    }
+    if (argc != 2) {
+        Usage();
+    }
+    outdir = argv[1];
+
+    spinMethods *= scale;
+    manyMethods *= scale;
+    cFuncs *= scale;
+    basFuncs *= scale;
+    caseBranches *= scale;
+    tableWords *= scale;
+
+    SpinProgram();
+    ManyObjectsProgram();
+    CProgram();
+    BasicProgram();
+    FileSystemPrograms();
+    return 0;
+}
@@ -0,0 +1,491 @@
+//
+// Build time generator for the asm peephole patterns (see asm_peep.c)
+// Reads the pattern file and prints the PeepholePattern tables, the
+// peep2[] list, and a Peep2Candidates() function which picks out the
+// patterns worth trying at an instruction by looking at its opcode
+// and the opcode of the instruction after it.
+//
+// usage: mkpeep asm_peep.pat > asm_peep_pat.h
+//
+// This runs on the build machine, so it uses only the C library.
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#define MAX_PATTERNS 512
+#define MAX_LINES    16
+#define MAX_OPERANDS 16   /* MAX_OPERANDS_IN_PATTERN in asm_peep.c */
+#define MAX_WORD     64
+
+typedef struct PatLine {
+    char cond[MAX_WORD];
+    char opc[MAX_WORD];
+    char dst[MAX_WORD*2];
+    char src[MAX_WORD*2];
+    char flags[MAX_WORD*2];
+    int p2;
+} PatLine;
+
+typedef struct Pattern {
+    char name[MAX_WORD];
+    char replace[MAX_WORD];
+    char arg[MAX_WORD];
+    int nlines;
+    int p2;        /* some line only matches on P2 */
+    PatLine line[MAX_LINES];
+} Pattern;
+
+static Pattern pats[MAX_PATTERNS];
+static int npats;
+
+static const char *filename;
+static int lineno;
+
+static void
+Fail(const char *msg, const char *arg)
+{
+    fprintf(stderr, "%s:%d: error: %s", filename, lineno, msg);
+    if (arg) {
+        fprintf(stderr, " `%s'", arg);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+static char *
+SkipSpace(char *s)
+{
+    while (*s && isspace((unsigned char)*s)) s++;
+    return s;
+}
+
+// copy the next word (up to white space or a comma) into buf
+static char *
+GetWord(char *s, char *buf, int size)
+{
+    int n = 0;
+    s = SkipSpace(s);
+    while (*s && !isspace((unsigned char)*s) && *s != ',') {
+        // keep parenthesized expressions together
+        if (*s == '(') {
+            int depth = 0;
+            do {
+                if (*s == '(') depth++;
+                else if (*s == ')') depth--;
+                if (n < size-1) buf[n++] = *s;
+                s++;
+            } while (*s && depth > 0);
+            continue;
+        }
+        if (n < size-1) buf[n++] = *s;
+        s++;
+    }
+    buf[n] = 0;
+    return s;
+}
+
+static void
+Upcase(char *dst, const char *prefix, const char *word, int size)
+{
+    int n = strlen(prefix);
+    strcpy(dst, prefix);
+    while (*word && n < size-1) {
+        dst[n++] = toupper((unsigned char)*word++);
+    }
+    dst[n] = 0;
+}
+
+static int
+IsName(const char *s)
+{
+    if (!*s || (!isalpha((unsigned char)*s) && *s != '_')) return 0;
+    while (*s) {
+        if (!isalnum((unsigned char)*s) && *s != '_') return 0;
+        s++;
+    }
+    return 1;
+}
+
+// parse an operand number after a '%'
+static int
+OperandNum(const char **sp)
+{
+    const char *s = *sp;
+    int n = 0;
+    if (!isdigit((unsigned char)*s)) {
+        Fail("expected an operand number after %", NULL);
+    }
+    while (isdigit((unsigned char)*s)) {
+        n = 10*n + (*s++ - '0');
+    }
+    if (n >= MAX_OPERANDS) {
+        Fail("operand number too large", NULL);
+    }
+    *sp = s;
+    return n;
+}
+
+//
+// translate an operand into its PEEP_OP_xxx form
+//   *          any operand
+//   %n         operand n; the first use records it, later uses must match
+//   %n!        operand n, which must also be dead after this instruction
+//   %n-1s      immediate one less than operand n (signed)
+//   %n-1u      immediate one less than operand n (unsigned)
+//   #%n        like %n, but it must be an immediate
+//   #k         the immediate k (a number or a parenthesized C expression)
+//   clrmask(b,s) the immediate with b bits starting at bit s clear
+//
+static void
+Operand(const char *s, char *out, int size, int *bound)
+{
+    int n;
+    int imm = 0;
+
+    if (!strcmp(s, "*")) {
+        snprintf(out, size, "OPERAND_ANY");
+        return;
+    }
+    if (!strncmp(s, "clrmask(", 8)) {
+        snprintf(out, size, "PEEP_OP_CLRMASK%s", s+7);
+        return;
+    }
+    if (s[0] == '#' && s[1] != '%') {
+        if (!s[1]) Fail("missing immediate value", NULL);
+        snprintf(out, size, "PEEP_OP_IMM|%s", s+1);
+        return;
+    }
+    if (s[0] == '#') {
+        imm = 1;
+        s++;
+    }
+    if (s[0] != '%') {
+        Fail("bad operand", s);
+    }
+    s++;
+    n = OperandNum(&s);
+    if (!bound[n]) {
+        if (*s) Fail("first use of an operand cannot have a suffix", s);
+        bound[n] = 1;
+        snprintf(out, size, "%s|%d", imm ? "PEEP_OP_SET_IMM" : "PEEP_OP_SET", n);
+        return;
+    }
+    if (imm) {
+        Fail("#%n may only be used for the first use of an operand", NULL);
+    }
+    if (!*s) {
+        snprintf(out, size, "PEEP_OP_MATCH|%d", n);
+    } else if (!strcmp(s, "!")) {
+        snprintf(out, size, "PEEP_OP_MATCH_DEAD|%d", n);
+    } else if (!strcmp(s, "-1s")) {
+        snprintf(out, size, "PEEP_OP_MATCH_M1S|%d", n);
+    } else if (!strcmp(s, "-1u")) {
+        snprintf(out, size, "PEEP_OP_MATCH_M1U|%d", n);
+    } else {
+        Fail("unknown operand suffix", s);
+    }
+}
+
+static void
+ParseLine(Pattern *P, char *s, int *bound)
+{
+    PatLine *L;
+    char word[MAX_WORD*2];
+    char flags[MAX_WORD*2];
+
+    if (P->nlines == MAX_LINES) {
+        Fail("too many instructions in pattern", P->name);
+    }
+    L = &P->line[P->nlines++];
+
+    // condition
+    s = GetWord(s, word, sizeof(word));
+    if (!IsName(word)) Fail("bad condition", word);
+    Upcase(L->cond, "COND_", word, sizeof(L->cond));
+
+    // opcode
+    s = GetWord(s, word, sizeof(word));
+    if (!strcmp(word, "*")) {
+        strcpy(L->opc, "OPC_ANY");
+    } else if (IsName(word)) {
+        Upcase(L->opc, "OPC_", word, sizeof(L->opc));
+    } else {
+        Fail("bad opcode", word);
+    }
+
+    // operands
+    s = GetWord(s, word, sizeof(word));
+    Operand(word, L->dst, sizeof(L->dst), bound);
+    s = SkipSpace(s);
+    if (*s != ',') Fail("expected two operands", NULL);
+    s = GetWord(s+1, word, sizeof(word));
+    Operand(word, L->src, sizeof(L->src), bound);
+
+    // flags
+    flags[0] = 0;
+    for (;;) {
+        s = GetWord(s, word, sizeof(word));
+        if (!word[0]) break;
+        if (!strcmp(word, "p2")) {
+            L->p2 = P->p2 = 1;
+        } else if (strcmp(word, "wcz_ok") && strcmp(word, "must_wz") && strcmp(word, "must_wc")) {
+            Fail("unknown flag", word);
+        }
+        if (flags[0]) strcat(flags, "|");
+        Upcase(flags + strlen(flags), "PEEP_FLAGS_", word, sizeof(flags) - strlen(flags));
+    }
+    strcpy(L->flags, flags[0] ? flags : "PEEP_FLAGS_NONE");
+}
+
+static void
+ReadPatterns(FILE *f)
+{
+    char buf[512];
+    char word[MAX_WORD];
+    Pattern *P = NULL;
+    int bound[MAX_OPERANDS];
+    char *s, *c;
+    int i;
+
+    while (fgets(buf, sizeof(buf), f)) {
+        lineno++;
+        c = strstr(buf, "//");
+        if (c) *c = 0;
+        s = SkipSpace(buf);
+        if (!*s) continue;
+        if (!P) {
+            s = GetWord(s, word, sizeof(word));
+            if (strcmp(word, "pattern") != 0) Fail("expected pattern", word);
+            if (npats == MAX_PATTERNS) Fail("too many patterns", NULL);
+            P = &pats[npats++];
+            s = GetWord(s, P->name, sizeof(P->name));
+            s = GetWord(s, P->replace, sizeof(P->replace));
+            s = GetWord(s, P->arg, sizeof(P->arg));
+            if (!IsName(P->name) || !IsName(P->replace) || !P->arg[0]) {
+                Fail("expected pattern NAME REPLACE ARG", NULL);
+            }
+            if (*SkipSpace(s)) Fail("junk after pattern", s);
+            for (i = 0; i < npats-1; i++) {
+                if (!strcmp(pats[i].name, P->name)) Fail("duplicate pattern", P->name);
+            }
+            memset(bound, 0, sizeof(bound));
+            continue;
+        }
+        if (!strncmp(s, "end", 3) && !*SkipSpace(s+3)) {
+            if (P->nlines == 0) Fail("empty pattern", P->name);
+            P = NULL;
+            continue;
+        }
+        ParseLine(P, s, bound);
+    }
+    if (P) Fail("missing end for pattern", P->name);
+}
+
+//
+// candidate lists
+//
+
+#define MAX_LISTS 1024
+
+static short *lists[MAX_LISTS];
+static int listlen[MAX_LISTS];
+static int nlists;
+
+// find or create a list holding the patterns in sel[]
+static int
+FindList(short *sel, int n)
+{
+    int i;
+    if (n == 0) return -1;
+    for (i = 0; i < nlists; i++) {
+        if (listlen[i] == n && !memcmp(lists[i], sel, n * sizeof(short))) {
+            return i;
+        }
+    }
+    if (nlists == MAX_LISTS) Fail("too many candidate lists", NULL);
+    lists[nlists] = (short *)malloc(n * sizeof(short));
+    memcpy(lists[nlists], sel, n * sizeof(short));
+    listlen[nlists] = n;
+    return nlists++;
+}
+
+// can pattern i start at an instruction with opcode opc1, followed by opc2?
+// NULL means "some other opcode"
+static int
+Candidate(Pattern *P, const char *opc1, const char *opc2)
+{
+    const char *p1 = P->line[0].opc;
+    const char *p2 = P->nlines > 1 ? P->line[1].opc : "OPC_ANY";
+    if (strcmp(p1, "OPC_ANY") != 0) {
+        if (!opc1 || strcmp(p1, opc1) != 0) return 0;
+    }
+    if (strcmp(p2, "OPC_ANY") != 0) {
+        if (!opc2 || strcmp(p2, opc2) != 0) return 0;
+    }
+    return 1;
+}
+
+static void
+PrintReturn(FILE *out, const char *indent, const char *opc1, const char *opc2)
+{
+    short all[MAX_PATTERNS], p1[MAX_PATTERNS];
+    int nall = 0, np1 = 0;
+    int i, la, l1;
+
+    for (i = 0; i < npats; i++) {
+        if (Candidate(&pats[i], opc1, opc2)) {
+            all[nall++] = i;
+            if (!pats[i].p2) p1[np1++] = i;
+        }
+    }
+    la = FindList(all, nall);
+    l1 = FindList(p1, np1);
+    if (la == l1) {
+        if (la < 0) fprintf(out, "%sreturn NULL;\n", indent);
+        else fprintf(out, "%sreturn peep2_list%d;\n", indent, la);
+    } else if (l1 < 0) {
+        fprintf(out, "%sreturn gl_p2 ? peep2_list%d : NULL;\n", indent, la);
+    } else {
+        fprintf(out, "%sreturn gl_p2 ? peep2_list%d : peep2_list%d;\n", indent, la, l1);
+    }
+}
+
+// the opcode of the second instruction of pattern i, if it is
+// worth a case of its own after opc1
+static const char *
+SecondOpc(int i, const char *opc1)
+{
+    const char *opc2;
+    int j;
+
+    if (pats[i].nlines < 2) return NULL;
+    opc2 = pats[i].line[1].opc;
+    if (!strcmp(opc2, "OPC_ANY") || !Candidate(&pats[i], opc1, opc2)) return NULL;
+    for (j = 0; j < i; j++) {
+        if (pats[j].nlines > 1 && !strcmp(pats[j].line[1].opc, opc2)
+            && Candidate(&pats[j], opc1, opc2)) {
+            return NULL;
+        }
+    }
+    return opc2;
+}
+
+static void
+PrintCase(FILE *out, const char *opc1)
+{
+    const char *opc2;
+    int i;
+    int any = 0;
+
+    for (i = 0; i < npats; i++) {
+        opc2 = SecondOpc(i, opc1);
+        if (!opc2) continue;
+        if (!any) {
+            fprintf(out, "        switch (Peep2NextOpc(ir)) {\n");
+            any = 1;
+        }
+        fprintf(out, "        case %s:\n", opc2);
+        PrintReturn(out, "            ", opc1, opc2);
+    }
+    if (any) {
+        fprintf(out, "        default:\n");
+        PrintReturn(out, "            ", opc1, NULL);
+        fprintf(out, "        }\n");
+    } else {
+        PrintReturn(out, "        ", opc1, NULL);
+    }
+}
+
+// the dispatch function refers to the candidate lists, which are only
+// known once it has been generated, so it is built in a temporary file
+static void
+PrintCandidates(FILE *out)
+{
+    const char *opc1;
+    FILE *fn;
+    int i, j, c;
+
+    fn = tmpfile();
+    if (!fn) {
+        perror("mkpeep: tmpfile");
+        exit(1);
+    }
+    fprintf(fn, "static const short *\nPeep2Candidates(IR *ir)\n{\n");
+    fprintf(fn, "    switch (ir->opc) {\n");
+    for (i = 0; i < npats; i++) {
+        opc1 = pats[i].line[0].opc;
+        if (!strcmp(opc1, "OPC_ANY")) continue;
+        for (j = 0; j < i; j++) {
+            if (!strcmp(pats[j].line[0].opc, opc1)) break;
+        }
+        if (j < i) continue;
+        fprintf(fn, "    case %s:\n", opc1);
+        PrintCase(fn, opc1);
+    }
+    fprintf(fn, "    default:\n");
+    PrintCase(fn, NULL);
+    fprintf(fn, "    }\n}\n");
+
+    for (i = 0; i < nlists; i++) {
+        fprintf(out, "static const short peep2_list%d[] = {", i);
+        for (j = 0; j < listlen[i]; j++) {
+            fprintf(out, " %d,", lists[i][j]);
+        }
+        fprintf(out, " -1 };\n");
+    }
+    fprintf(out, "\n");
+    rewind(fn);
+    while ((c = getc(fn)) != EOF) {
+        putc(c, out);
+    }
+    fclose(fn);
+}
+
+static void
+PrintTables(FILE *out)
+{
+    Pattern *P;
+    PatLine *L;
+    int i, j;
+
+    fprintf(out, "/* generated by mkpeep from %s; do not edit */\n\n", filename);
+    for (i = 0; i < npats; i++) {
+        P = &pats[i];
+        fprintf(out, "static PeepholePattern pat_%s[] = {\n", P->name);
+        for (j = 0; j < P->nlines; j++) {
+            L = &P->line[j];
+            fprintf(out, "    { %s, %s, %s, %s, %s },\n", L->cond, L->opc, L->dst, L->src, L->flags);
+        }
+        fprintf(out, "    { 0, 0, 0, 0, PEEP_FLAGS_DONE }\n};\n");
+    }
+    fprintf(out, "\nstatic struct Peepholes peep2[] = {\n");
+    for (i = 0; i < npats; i++) {
+        P = &pats[i];
+        fprintf(out, "    { pat_%s, %s, %s },\n", P->name, P->arg, P->replace);
+    }
+    fprintf(out, "};\n\n");
+    PrintCandidates(out);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *f;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: mkpeep file.pat\n");
+        return 2;
+    }
+    filename = argv[1];
+    f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        return 1;
+    }
+    ReadPatterns(f);
+    fclose(f);
+    PrintTables(stdout);
+    return 0;
+}
@@ -0,0 +1,55 @@
+//
+// Build time generator for the system module images (see sysimage.c)
+// Parses the system code for one target and prints the image as a
+// C array named sysimage_<target>.
+//
+// usage: mksysimage p1|p2|p1rom|p2nu
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "spinc.h"
+#include "cmdline.h"
+#include "sysimage.h"
+
+static struct {
+    const char *name;
+    int p2;
+    int output;
+    int interp_kind;
+} targets[] = {
+    { "p1",    0,                  OUTPUT_ASM,      INTERP_KIND_NONE },
+    { "p2",    DEFAULT_P2_VERSION, OUTPUT_ASM,      INTERP_KIND_NONE },
+    { "p1rom", 0,                  OUTPUT_BYTECODE, INTERP_KIND_P1ROM },
+    { "p2nu",  DEFAULT_P2_VERSION, OUTPUT_BYTECODE, INTERP_KIND_NUCODE },
+};
+
+int
+main(int argc, const char **argv)
+{
+    static CmdLineOptions cmd;
+    static char name[64];
+    unsigned i;
+
+    InitializeSystem(&cmd, argv);
+    if (argc != 2) {
+        fprintf(stderr, "usage: mksysimage p1|p2|p1rom|p2nu\n");
+        return 2;
+    }
+    for (i = 0; i < sizeof(targets)/sizeof(targets[0]); i++) {
+        if (!strcmp(argv[1], targets[i].name)) break;
+    }
+    if (i == sizeof(targets)/sizeof(targets[0])) {
+        fprintf(stderr, "mksysimage: unknown target %s\n", argv[1]);
+        return 2;
+    }
+    gl_p2 = targets[i].p2;
+    gl_output = targets[i].output;
+    gl_interp_kind = targets[i].interp_kind;
+    gl_outputflags = OUTFLAGS_DEFAULT;
+
+    snprintf(name, sizeof(name), "sysimage_%s", targets[i].name);
+    CaptureSystemImage(stdout, name);
+    Init();
+    return gl_errors ? 1 : 0;
+}
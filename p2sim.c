@@ -0,0 +1,2458 @@
+/*
+ * P2 simulator: runs flexspin P2 binaries on the host
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * usage: p2sim [options] file.binary
+ *
+ * The binary is loaded at hub address 0 and started in cog 0, as the
+ * boot ROM would do. Output sent by the async serial smartpin on the
+ * console pin (62) is written to stdout. The run ends when every cog
+ * has stopped, when the program sends the exit sequence $FF $00 status
+ * (as loadp2 -t -q expects), or when the cycle limit is reached.
+ *
+ * Every cog is simulated clock by clock, using the instruction timings
+ * from the P2 documentation:
+ *   - most instructions take 2 clocks, taken branches 4 in cog/LUT
+ *     memory and 13..20 when the target is in hub (FIFO reload)
+ *   - hub reads take 9..16 clocks and writes 3..10, depending on
+ *     where the egg beater is when the access starts; a SETQ block
+ *     transfer adds one clock per extra long
+ *   - a CORDIC command waits for the cog's slot (up to 7 clocks), and
+ *     its results are ready 56 clocks later; GETQX/GETQY wait for them
+ *   - WAITX, WAITCT1-3 and the async serial pins advance the clock
+ *     exactly as the hardware would
+ * Stalls of the hub exec FIFO caused by data accesses to hub memory are
+ * not modelled, so hub exec code with many hub accesses may run a few
+ * percent faster here than on a real chip.
+ *
+ * If the listing made by "flexspin -l" is available, cycles are also
+ * counted per function (the labels in the listing), both for hub code
+ * and for code loaded into cog or LUT memory (such as FCACHE loops).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include "util/softcordic.h"
+
+#define HUB_SIZE        (512*1024)
+#define HUB_MASK        (HUB_SIZE-1)
+#define NUM_COGS        8
+#define NUM_PINS        64
+#define NUM_LOCKS       16
+#define STACK_DEPTH     8
+#define COG_LOAD_LONGS  0x1f0
+#define CORDIC_DEPTH    8
+#define CORDIC_LATENCY  56
+
+#define CONSOLE_TX_PIN  62
+
+#define REG_PA          0x1f6
+#define REG_PB          0x1f7
+#define REG_PTRA        0x1f8
+#define REG_PTRB        0x1f9
+#define REG_DIRA        0x1fa
+#define REG_DIRB        0x1fb
+#define REG_OUTA        0x1fc
+#define REG_OUTB        0x1fd
+#define REG_INA         0x1fe
+#define REG_INB         0x1ff
+
+/* smartpin modes (WRPIN D[5:1]) that are modelled */
+#define SP_ASYNC_TX     0x1e
+#define SP_ASYNC_RX     0x1f
+
+/* events, numbered as in POLLxxx/WAITxxx/Jxxx */
+#define EV_CT1          1
+#define EV_CT3          3
+#define EV_ATN          14
+#define EV_QMT          15
+
+#define FOREVER         UINT64_MAX
+
+/* exit status for problems in the simulation itself */
+#define STATUS_TIMEOUT  124
+#define STATUS_ERROR    125
+
+typedef struct CordicResult {
+    uint64_t ready;
+    uint32_t x, y;
+} CordicResult;
+
+typedef struct Cog {
+    int id;
+    int running;
+    int blocked;            /* waiting for an ATN event */
+    uint64_t time;          /* clock at which the next instruction starts */
+    uint32_t pc;
+    int c, z;
+    uint32_t reg[512];
+    uint32_t lut[512];
+    int32_t loadAddr[1024]; /* hub address each cog/LUT long was loaded from */
+    uint32_t stack[STACK_DEPTH];
+
+    /* state left by prefix instructions for the next one */
+    int augsValid, augdValid;
+    uint32_t augs, augd;
+    int setq;               /* 1 after SETQ, 2 after SETQ2 */
+    uint32_t q;
+    int altValid;
+    uint32_t altMask, altBits;
+    int altrValid;
+    uint32_t altr;
+    int srcValid;           /* SCA/SCAS/XORO32 supply the next S value */
+    uint32_t srcValue;
+
+    /* REP */
+    int repActive;
+    uint32_t repStart, repEnd, repCount;
+
+    /* SKIP/SKIPF */
+    uint32_t skipPattern;
+    int skipFast;
+
+    /* CORDIC results in flight, and the last one to arrive */
+    CordicResult cordic[CORDIC_DEPTH];
+    int cordicHead, cordicCount;
+    uint32_t qx, qy;
+    int qxRead, qyRead;
+
+    /* events */
+    uint32_t ct[3];
+    uint64_t ctFire[3];
+    int atn;
+
+    /* hub RAM FIFO (RDFAST/WRFAST) */
+    uint32_t fifoAddr, fifoStart, fifoEnd;
+
+    /* statistics */
+    uint64_t cycles;
+    uint64_t instrs;
+    int func;
+} Cog;
+
+typedef struct Pin {
+    uint32_t mode, x, y, z;
+    uint64_t inTime;        /* IN goes high at this clock */
+    uint64_t busyUntil;     /* transmitter is shifting until this clock */
+} Pin;
+
+typedef struct Func {
+    uint32_t addr;
+    char *name;
+    uint64_t cycles;
+    uint64_t instrs;
+    uint64_t calls;
+    uint32_t bytes;         /* distance to the next label, 0 for the last one */
+} Func;
+
+static uint8_t hub[HUB_SIZE];
+static Cog cogs[NUM_COGS];
+static Pin pins[NUM_PINS];
+static uint64_t pinDir, pinOut;
+static int lockOwner[NUM_LOCKS];
+static int lockAllocated[NUM_LOCKS];
+static uint32_t rndState = 0x12345678;
+
+static Func *funcs;
+static int numFuncs;
+
+static int exitRequested;
+static int exitStatus;
+static uint64_t maxCycles = 20000000000ULL;
+static uint64_t endTime;
+static uint64_t traceLimit;
+static int txState;         /* for spotting the $FF $00 status exit sequence */
+
+static const char *progname = "p2sim";
+
+static void
+Fatal(Cog *c, const char *msg, uint32_t instr)
+{
+    fflush(stdout);
+    if (c) {
+        fprintf(stderr, "%s: cog %d at $%05x: %s (instruction $%08x)\n", progname, c->id, c->pc, msg, instr);
+    } else {
+        fprintf(stderr, "%s: %s\n", progname, msg);
+    }
+    exit(STATUS_ERROR);
+}
+
+/*
+ * hub memory
+ */
+static uint32_t
+HubRead(uint32_t addr, int size)
+{
+    uint32_t v = 0;
+    int i;
+
+    for (i = size-1; i >= 0; i--) {
+        v = (v << 8) | hub[(addr + i) & HUB_MASK];
+    }
+    return v;
+}
+
+static void
+HubWrite(uint32_t addr, uint32_t v, int size)
+{
+    int i;
+
+    for (i = 0; i < size; i++) {
+        hub[(addr + i) & HUB_MASK] = v & 0xff;
+        v >>= 8;
+    }
+}
+
+/* clocks a cog must wait before the egg beater reaches addr */
+static int
+HubWait(Cog *c, uint32_t addr)
+{
+    return (int)(((addr >> 2) - (c->time + c->id)) & 7);
+}
+
+/* clocks taken by a branch to target */
+static int
+BranchCycles(Cog *c, uint32_t target)
+{
+    if (target < 0x400) {
+        return 4;
+    }
+    return 13 + HubWait(c, target);
+}
+
+static uint32_t
+Random(void)
+{
+    /* xorshift32 keeps runs repeatable */
+    rndState ^= rndState << 13;
+    rndState ^= rndState >> 17;
+    rndState ^= rndState << 5;
+    return rndState;
+}
+
+static int
+Parity(uint32_t v)
+{
+    v ^= v >> 16;
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+}
+
+static int
+Ones(uint32_t v)
+{
+    int n = 0;
+    while (v) {
+        v &= v - 1;
+        n++;
+    }
+    return n;
+}
+
+static int32_t
+SignExtend(uint32_t v, int bits)
+{
+    int sh = 32 - bits;
+    return (int32_t)(v << sh) >> sh;
+}
+
+/*
+ * serial output; the exit sequence is $FF $00 status
+ */
+static void
+SerialOut(int ch)
+{
+    switch (txState) {
+    case 0:
+        if (ch == 0xff) {
+            txState = 1;
+            return;
+        }
+        break;
+    case 1:
+        if (ch == 0) {
+            txState = 2;
+            return;
+        }
+        putchar(0xff);
+        txState = 0;
+        if (ch == 0xff) {
+            txState = 1;
+            return;
+        }
+        break;
+    case 2:
+        exitStatus = ch;
+        exitRequested = 1;
+        return;
+    }
+    putchar(ch);
+}
+
+/*
+ * pins
+ */
+static void
+PinReset(int p)
+{
+    pins[p].inTime = FOREVER;
+    pins[p].busyUntil = 0;
+    pins[p].z = 0;
+}
+
+/* recompute the pin outputs from all the cogs, resetting smartpins whose DIR changed */
+static void
+UpdatePins(void)
+{
+    uint64_t dir = 0, out = 0, changed;
+    int i;
+
+    for (i = 0; i < NUM_COGS; i++) {
+        Cog *c = &cogs[i];
+        if (!c->running) continue;
+        dir |= ((uint64_t)c->reg[REG_DIRB] << 32) | c->reg[REG_DIRA];
+        out |= ((uint64_t)c->reg[REG_OUTB] << 32) | c->reg[REG_OUTA];
+    }
+    changed = dir ^ pinDir;
+    pinDir = dir;
+    pinOut = out;
+    for (i = 0; changed; i++, changed >>= 1) {
+        if (changed & 1) {
+            PinReset(i);
+        }
+    }
+}
+
+static int
+SmartMode(int p)
+{
+    return (pins[p].mode >> 1) & 0x1f;
+}
+
+static int
+PinIn(int p, uint64_t now)
+{
+    if (SmartMode(p)) {
+        return ((pinDir >> p) & 1) && now >= pins[p].inTime;
+    }
+    return (pinDir & pinOut) >> p & 1;
+}
+
+static uint32_t
+ReadInputs(int port, uint64_t now)
+{
+    uint32_t v = 0;
+    int i;
+
+    for (i = 31; i >= 0; i--) {
+        v = (v << 1) | PinIn(port*32 + i, now);
+    }
+    return v;
+}
+
+static void
+PinWriteY(Cog *c, int p, uint32_t v)
+{
+    Pin *pin = &pins[p];
+
+    pin->y = v;
+    if (SmartMode(p) == SP_ASYNC_TX && ((pinDir >> p) & 1)) {
+        uint64_t now = c->time;
+        uint64_t bitTime = pin->x >> 16;
+        int bits = (pin->x & 0x1f) + 1;
+        uint64_t start;
+
+        if (bitTime == 0) bitTime = 1;
+        start = (pin->busyUntil > now) ? pin->busyUntil : now + 1;
+        /* IN rises when the byte moves from the buffer to the shifter */
+        pin->inTime = start + 1;
+        pin->busyUntil = start + bitTime * (bits + 2);
+        if (p == CONSOLE_TX_PIN) {
+            SerialOut(v & 0xff);
+        }
+    }
+}
+
+/* pin numbers selected by D[5:0] plus D[10:6] more, wrapping within the port */
+static int
+PinCount(uint32_t d)
+{
+    return ((d >> 6) & 0x1f) + 1;
+}
+
+static int
+PinNumber(uint32_t d, int i)
+{
+    return (d & 0x20) | ((d + i) & 0x1f);
+}
+
+/*
+ * cog registers
+ */
+static uint32_t
+ReadReg(Cog *c, uint32_t a)
+{
+    if (a >= REG_INA) {
+        return ReadInputs(a - REG_INA, c->time);
+    }
+    return c->reg[a];
+}
+
+static void
+WriteReg(Cog *c, uint32_t a, uint32_t v)
+{
+    a &= 0x1ff;
+    c->reg[a] = v;
+    c->loadAddr[a] = -1;
+    if (a >= REG_DIRA && a <= REG_OUTB) {
+        UpdatePins();
+    }
+}
+
+static void
+Push(Cog *c, uint32_t v)
+{
+    memmove(&c->stack[1], &c->stack[0], (STACK_DEPTH-1) * sizeof(c->stack[0]));
+    c->stack[0] = v;
+}
+
+static uint32_t
+Pop(Cog *c)
+{
+    uint32_t v = c->stack[0];
+    memmove(&c->stack[0], &c->stack[1], (STACK_DEPTH-1) * sizeof(c->stack[0]));
+    return v;
+}
+
+/*
+ * cog start and stop
+ */
+static void
+StopCog(Cog *c)
+{
+    int i;
+
+    c->running = 0;
+    c->blocked = 0;
+    for (i = 0; i < NUM_LOCKS; i++) {
+        /* locks owned by a stopped cog are released */
+        if (lockOwner[i] == c->id) lockOwner[i] = -1;
+    }
+    if (c->time > endTime) endTime = c->time;
+    UpdatePins();
+}
+
+static void
+StartCog(Cog *c, uint64_t when, uint32_t addr, uint32_t ptra, int hubexec)
+{
+    int i;
+
+    c->running = 1;
+    c->blocked = 0;
+    c->c = c->z = 0;
+    memset(c->stack, 0, sizeof(c->stack));
+    c->augsValid = c->augdValid = c->setq = 0;
+    c->altValid = c->altrValid = c->srcValid = 0;
+    c->repActive = 0;
+    c->skipPattern = 0;
+    c->cordicCount = 0;
+    c->qxRead = c->qyRead = 1;
+    c->atn = 0;
+    for (i = 0; i < 3; i++) c->ctFire[i] = FOREVER;
+    for (i = 0; i < 1024; i++) c->loadAddr[i] = -1;
+    addr &= 0xfffff;
+    if (hubexec) {
+        c->pc = addr;
+        when += 2 + BranchCycles(c, addr);
+    } else {
+        for (i = 0; i < COG_LOAD_LONGS; i++) {
+            c->reg[i] = HubRead(addr + 4*i, 4);
+            c->loadAddr[i] = (addr + 4*i) & HUB_MASK;
+        }
+        c->pc = 0;
+        when += 2 + COG_LOAD_LONGS + 8;
+    }
+    for (i = COG_LOAD_LONGS; i < 0x200; i++) c->reg[i] = 0;
+    c->reg[REG_PTRA] = ptra;
+    c->reg[REG_PTRB] = addr;
+    c->time = when;
+    UpdatePins();
+}
+
+/*
+ * functions from the listing
+ */
+static int
+FindFunc(uint32_t addr)
+{
+    int lo = 0, hi = numFuncs - 1, mid;
+
+    if (numFuncs == 0 || addr < funcs[0].addr) return -1;
+    while (lo < hi) {
+        mid = (lo + hi + 1) / 2;
+        if (funcs[mid].addr <= addr) {
+            lo = mid;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return lo;
+}
+
+static int
+CompareFuncAddr(const void *a, const void *b)
+{
+    const Func *fa = (const Func *)a;
+    const Func *fb = (const Func *)b;
+    if (fa->addr != fb->addr) return fa->addr < fb->addr ? -1 : 1;
+    return 0;
+}
+
+static int
+IsFunctionLabel(const char *name)
+{
+    static const char *sections[] = { "con", "dat", "obj", "var", "pub", "pri", NULL };
+    size_t len = strlen(name);
+    int i;
+
+    if (!strncmp(name, "LR__", 4)) return 0;
+    if (len > 4 && !strcmp(name + len - 4, "_ret")) return 0;
+    for (i = 0; sections[i]; i++) {
+        if (!strcmp(name, sections[i])) return 0;
+    }
+    return 1;
+}
+
+/*
+ * read labels from a flexspin listing; lines look like
+ *   00924                 | _demo
+ *   00804 100             | skip_clock_set_
+ */
+static int
+ReadListing(const char *fname)
+{
+    FILE *f = fopen(fname, "r");
+    char line[1024];
+    int maxFuncs = 0;
+    int i;
+
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        char *bar = strstr(line, "| ");
+        char *name, *p;
+        unsigned addr;
+
+        if (!bar || sscanf(line, "%x", &addr) != 1) continue;
+        name = bar + 2;
+        p = name;
+        if (!(*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z'))) continue;
+        while (*p == '_' || (*p >= 'a' && *p <= 'z') || (*p >= 'A' && *p <= 'Z') || (*p >= '0' && *p <= '9')) p++;
+        if (*p != '\n' && *p != '\r' && *p != 0) continue;
+        *p = 0;
+        if (!IsFunctionLabel(name)) continue;
+        if (numFuncs == maxFuncs) {
+            maxFuncs = maxFuncs ? 2*maxFuncs : 256;
+            funcs = (Func *)realloc(funcs, maxFuncs * sizeof(Func));
+            if (!funcs) Fatal(NULL, "out of memory", 0);
+        }
+        memset(&funcs[numFuncs], 0, sizeof(Func));
+        funcs[numFuncs].addr = addr;
+        funcs[numFuncs].name = strdup(name);
+        numFuncs++;
+    }
+    fclose(f);
+    qsort(funcs, numFuncs, sizeof(Func), CompareFuncAddr);
+    for (i = 0; i + 1 < numFuncs; i++) {
+        funcs[i].bytes = funcs[i+1].addr - funcs[i].addr;
+    }
+    return 1;
+}
+
+/*
+ * CORDIC
+ */
+static uint32_t
+Isqrt64(uint64_t n)
+{
+    uint64_t r = (uint64_t)sqrt((double)n);
+    while (r * r > n) r--;
+    while ((r + 1) * (r + 1) <= n && r < 0xffffffffULL) r++;
+    return (uint32_t)r;
+}
+
+static void
+Divide(uint64_t n, uint32_t d, uint32_t *x, uint32_t *y)
+{
+    if (d == 0) {
+        *x = 0xffffffff;
+        *y = (uint32_t)n;
+        return;
+    }
+    if (n / d > 0xffffffffULL) {
+        *x = 0xffffffff;
+    } else {
+        *x = (uint32_t)(n / d);
+    }
+    *y = (uint32_t)(n % d);
+}
+
+static int
+CordicCommand(Cog *c, uint32_t x, uint32_t y)
+{
+    int wait = (int)((c->id - c->time) & 7);
+    int slot;
+
+    if (c->cordicCount == CORDIC_DEPTH) {
+        c->cordicHead = (c->cordicHead + 1) % CORDIC_DEPTH;
+        c->cordicCount--;
+    }
+    slot = (c->cordicHead + c->cordicCount) % CORDIC_DEPTH;
+    c->cordic[slot].ready = c->time + 2 + wait + CORDIC_LATENCY;
+    c->cordic[slot].x = x;
+    c->cordic[slot].y = y;
+    c->cordicCount++;
+    /* a result already read will not be read again once a new command is issued */
+    if (c->cordicCount == 1) {
+        c->qxRead = c->qyRead = 1;
+    }
+    return 2 + wait;
+}
+
+/* move results that have arrived by now into QX/QY */
+static void
+CordicArrive(Cog *c, uint64_t now, int waitForOne)
+{
+    while (c->cordicCount > 0) {
+        CordicResult *r = &c->cordic[c->cordicHead];
+        if (r->ready > now && !waitForOne) break;
+        c->qx = r->x;
+        c->qy = r->y;
+        c->qxRead = c->qyRead = 0;
+        c->cordicHead = (c->cordicHead + 1) % CORDIC_DEPTH;
+        c->cordicCount--;
+        if (waitForOne) break;
+    }
+}
+
+/* GETQX/GETQY; returns the clocks taken */
+static int
+CordicGet(Cog *c, int wantY, uint32_t *result)
+{
+    int cycles = 2;
+    int *readFlag = wantY ? &c->qyRead : &c->qxRead;
+
+    CordicArrive(c, c->time, 0);
+    if (*readFlag && c->cordicCount > 0) {
+        CordicResult *r = &c->cordic[c->cordicHead];
+        if (r->ready > c->time) {
+            cycles += (int)(r->ready - c->time);
+        }
+        CordicArrive(c, r->ready, 1);
+    }
+    *readFlag = 1;
+    *result = wantY ? c->qy : c->qx;
+    return cycles;
+}
+
+static uint32_t
+CordicAngle(double a)
+{
+    return (uint32_t)(int64_t)llround(a * 4294967296.0 / (2.0 * M_PI));
+}
+
+/*
+ * hub addresses for RDxxxx/WRxxxx: a register, an immediate $00..$FF,
+ * or a PTRA/PTRB expression; scale is the size of the data
+ */
+static uint32_t
+MemAddress(Cog *c, uint32_t instr, uint32_t sval, int scale, int count)
+{
+    uint32_t sfield = instr & 0x1ff;
+    uint32_t v;
+    int sel, update, post;
+    int32_t index;
+    uint32_t base, addr, ptrReg;
+
+    if (!((instr >> 18) & 1)) {
+        return sval;
+    }
+    if (c->augsValid) {
+        v = c->augs | sfield;
+        c->augsValid = 0;
+        if ((v >> 23) != 1) {
+            return v;
+        }
+        sel = (v >> 22) & 1;
+        update = (v >> 21) & 1;
+        post = (v >> 20) & 1;
+        index = SignExtend(v & 0xfffff, 20);
+    } else {
+        if (!(sfield & 0x100)) {
+            return sfield;
+        }
+        sel = (sfield >> 7) & 1;
+        update = (sfield >> 6) & 1;
+        post = (sfield >> 5) & 1;
+        if (update) {
+            index = SignExtend(sfield & 0x1f, 5);
+            if (index == 0) index = 16;
+        } else {
+            index = SignExtend(sfield & 0x3f, 6);
+        }
+        index *= scale;
+    }
+    ptrReg = sel ? REG_PTRB : REG_PTRA;
+    base = c->reg[ptrReg];
+    if (!update) {
+        return base + index;
+    }
+    /* a SETQ block transfer moves the pointer past the whole block */
+    if (post) {
+        addr = base;
+        WriteReg(c, ptrReg, base + index * count);
+    } else {
+        addr = base + index * count;
+        WriteReg(c, ptrReg, addr);
+    }
+    return addr;
+}
+
+/*
+ * branches
+ */
+static uint32_t
+RelativeTarget(uint32_t pcNext, int32_t instrs)
+{
+    if (pcNext < 0x400) {
+        return (pcNext + instrs) & 0xfffff;
+    }
+    return (pcNext + 4*instrs) & 0xfffff;
+}
+
+/* target of a branch to {#}S: relative if immediate, absolute from a register */
+static uint32_t
+SourceTarget(uint32_t instr, uint32_t sval, int augmented, uint32_t pcNext)
+{
+    if ((instr >> 18) & 1) {
+        return RelativeTarget(pcNext, SignExtend(sval & 0xfffff, augmented ? 20 : 9));
+    }
+    return sval & 0xfffff;
+}
+
+/* K, the value pushed by calls */
+static uint32_t
+ReturnValue(Cog *c, uint32_t pcNext)
+{
+    return ((uint32_t)c->c << 31) | ((uint32_t)c->z << 30) | pcNext;
+}
+
+/*
+ * events
+ */
+static void
+ClearEvent(Cog *c, int ev)
+{
+    if (ev >= EV_CT1 && ev <= EV_CT3) {
+        c->ctFire[ev - EV_CT1] = FOREVER;
+    } else if (ev == EV_ATN) {
+        c->atn = 0;
+    }
+}
+
+static int
+EventFlag(Cog *c, int ev)
+{
+    if (ev >= EV_CT1 && ev <= EV_CT3) {
+        return c->time >= c->ctFire[ev - EV_CT1];
+    }
+    if (ev == EV_ATN) {
+        return c->atn;
+    }
+    if (ev == EV_QMT) {
+        return c->cordicCount == 0;
+    }
+    return 0;
+}
+
+static void
+SetCounterEvent(Cog *c, int n, uint32_t target)
+{
+    uint64_t delta = (uint32_t)(target - (uint32_t)c->time);
+
+    if (delta == 0) delta = 0x100000000ULL;
+    c->ct[n] = target;
+    c->ctFire[n] = c->time + delta;
+}
+
+/*
+ * true for instructions whose immediate S is a hub or LUT address; these
+ * apply AUGS themselves (in MemAddress), as do the D-only instructions
+ */
+static int
+HubAddressOperand(uint32_t op, int wc, int wz)
+{
+    if (op >= 0x55 && op <= 0x58) return 1;     /* RDLUT, RDBYTE, RDWORD, RDLONG */
+    if (op == 0x53 && wc && wz) return 1;       /* WMLONG */
+    if (op == 0x61 && wc) return 1;             /* WRLUT */
+    if (op == 0x62) return 1;                   /* WRBYTE, WRWORD */
+    if (op == 0x63 && !wc) return 1;            /* WRLONG */
+    return op >= 0x6b;
+}
+
+/*
+ * execute one instruction on cog c
+ */
+static void
+Step(Cog *c)
+{
+    uint32_t pc = c->pc;
+    uint32_t pcNext;
+    uint32_t instr;
+    uint32_t cond, op, dfield, sfield, rfield;
+    uint32_t d, s, r;
+    int wc, wz, imm, cycles = 2;
+    int nc, nz;
+    int writeResult = 0;
+    int branched = 0;
+    int isAug = 0;
+    int keepSetq = 0;
+    int hubAddr;
+    int startCalls;
+    int sAug = 0;
+
+    /* fetch */
+    if (pc < 0x200) {
+        instr = c->reg[pc];
+        hubAddr = c->loadAddr[pc];
+        pcNext = pc + 1;
+    } else if (pc < 0x400) {
+        instr = c->lut[pc - 0x200];
+        hubAddr = c->loadAddr[pc - 0x200 + 0x200];
+        pcNext = pc + 1;
+    } else {
+        instr = HubRead(pc, 4);
+        hubAddr = pc;
+        pcNext = (pc + 4) & 0xfffff;
+    }
+
+    /* attribute the clocks to a function */
+    startCalls = 0;
+    if (numFuncs && hubAddr >= 0) {
+        int f = FindFunc((uint32_t)hubAddr);
+        if (f >= 0) {
+            /* count entries from other functions as calls, but not loops back to the start */
+            if (funcs[f].addr == (uint32_t)hubAddr && c->func != f) startCalls = 1;
+            c->func = f;
+        }
+    }
+
+    if (traceLimit) {
+        traceLimit--;
+        fprintf(stderr, "%llu cog %d $%05x: %08x c=%d z=%d\n", (unsigned long long)c->time, c->id, pc, instr, c->c, c->z);
+    }
+    c->pc = pcNext;
+    if (c->skipPattern) {
+        int skip = c->skipPattern & 1;
+        c->skipPattern >>= 1;
+        if (skip) {
+            cycles = (c->skipFast && pc < 0x400) ? 0 : 2;
+            goto done;
+        }
+    }
+    if (c->altValid) {
+        instr = (instr & ~c->altMask) | c->altBits;
+    }
+
+    cond = instr >> 28;
+    op = (instr >> 21) & 0x7f;
+    wc = (instr >> 20) & 1;
+    wz = (instr >> 19) & 1;
+    imm = (instr >> 18) & 1;
+    dfield = (instr >> 9) & 0x1ff;
+    sfield = instr & 0x1ff;
+    rfield = c->altrValid ? c->altr : dfield;
+    nc = c->c;
+    nz = c->z;
+
+    if (instr == 0) {
+        /* NOP */
+        goto done;
+    }
+    if (cond != 0 && !((cond >> ((c->c << 1) | c->z)) & 1)) {
+        /* condition false: the instruction is cancelled */
+        goto done;
+    }
+
+    /* source operand */
+    if (c->srcValid) {
+        s = c->srcValue;
+    } else if (imm) {
+        s = sfield;
+        if (c->augsValid && !HubAddressOperand(op, wc, wz)) {
+            s |= c->augs;
+            sAug = 1;
+            c->augsValid = 0;
+        }
+    } else {
+        s = ReadReg(c, sfield);
+    }
+    d = ReadReg(c, dfield);
+    r = d;
+
+    switch (op) {
+    case 0x00: /* ROR */
+    case 0x01: /* ROL */
+    case 0x02: /* SHR */
+    case 0x03: /* SHL */
+    case 0x04: /* RCR */
+    case 0x05: /* RCL */
+    case 0x06: /* SAR */
+    case 0x07: /* SAL */
+    {
+        int sh = s & 31;
+        int left = op & 1;
+        if (sh == 0) {
+            r = d;
+            nc = left ? d >> 31 : d & 1;
+        } else if (left) {
+            nc = (d >> (32 - sh)) & 1;
+            r = d << sh;
+            if (op == 0x01) r |= d >> (32 - sh);
+            else if (op == 0x05 && c->c) r |= (1u << sh) - 1;
+            else if (op == 0x07 && (d & 1)) r |= (1u << sh) - 1;
+        } else {
+            nc = (d >> (sh - 1)) & 1;
+            r = d >> sh;
+            if (op == 0x00) r |= d << (32 - sh);
+            else if (op == 0x04 && c->c) r |= ~0u << (32 - sh);
+            else if (op == 0x06) r = (uint32_t)((int32_t)d >> sh);
+        }
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x08: /* ADD */
+        r = d + s;
+        nc = r < d;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x09: /* ADDX */
+    {
+        uint64_t t = (uint64_t)d + s + c->c;
+        r = (uint32_t)t;
+        nc = (int)(t >> 32);
+        nz = c->z && (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x0a: /* ADDS */
+    case 0x0b: /* ADDSX */
+    {
+        int64_t t = (int64_t)(int32_t)d + (int32_t)s + (op == 0x0b ? c->c : 0);
+        r = (uint32_t)t;
+        nc = t < 0;
+        nz = (op == 0x0b) ? (c->z && r == 0) : (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x0c: /* SUB */
+        r = d - s;
+        nc = d < s;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x0d: /* SUBX */
+    case 0x11: /* CMPX */
+    {
+        uint64_t t = (uint64_t)s + c->c;
+        r = d - (uint32_t)t;
+        nc = (uint64_t)d < t;
+        nz = c->z && (r == 0);
+        writeResult = (op == 0x0d);
+        break;
+    }
+    case 0x0e: /* SUBS */
+    case 0x0f: /* SUBSX */
+    case 0x13: /* CMPSX */
+    {
+        int carry = (op == 0x0e) ? 0 : c->c;
+        int64_t t = (int64_t)(int32_t)d - (int32_t)s - carry;
+        r = (uint32_t)t;
+        nc = t < 0;
+        nz = (op == 0x0e) ? (r == 0) : (c->z && r == 0);
+        writeResult = (op != 0x13);
+        break;
+    }
+    case 0x10: /* CMP */
+        nc = d < s;
+        nz = (d == s);
+        break;
+    case 0x12: /* CMPS */
+        nc = (int32_t)d < (int32_t)s;
+        nz = (d == s);
+        break;
+    case 0x14: /* CMPR */
+        nc = s < d;
+        nz = (d == s);
+        break;
+    case 0x15: /* CMPM */
+        nc = ((d - s) >> 31) & 1;
+        nz = (d == s);
+        break;
+    case 0x16: /* SUBR */
+        r = s - d;
+        nc = s < d;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x17: /* CMPSUB */
+        if (d >= s) {
+            r = d - s;
+            nc = 1;
+        } else {
+            nc = 0;
+        }
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x18: /* FGE */
+        nc = d < s;
+        if (nc) r = s;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x19: /* FLE */
+        nc = d > s;
+        if (nc) r = s;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x1a: /* FGES */
+        nc = (int32_t)d < (int32_t)s;
+        if (nc) r = s;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x1b: /* FLES */
+        nc = (int32_t)d > (int32_t)s;
+        if (nc) r = s;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x1c: /* SUMC */
+    case 0x1d: /* SUMNC */
+    case 0x1e: /* SUMZ */
+    case 0x1f: /* SUMNZ */
+    {
+        int flag = (op < 0x1e) ? c->c : c->z;
+        int sub = (op & 1) ? !flag : flag;
+        int64_t t = sub ? (int64_t)(int32_t)d - (int32_t)s : (int64_t)(int32_t)d + (int32_t)s;
+        r = (uint32_t)t;
+        nc = t < 0;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x20: case 0x21: case 0x22: case 0x23:
+    case 0x24: case 0x25: case 0x26: case 0x27:
+        if (wc != wz) {
+            /* TESTB/TESTBN, with AND/OR/XOR variants */
+            int bit = (d >> (s & 31)) & 1;
+            int flag = wc ? c->c : c->z;
+            if (op & 1) bit = !bit;
+            switch ((op - 0x20) >> 1) {
+            case 0: flag = bit; break;
+            case 1: flag &= bit; break;
+            case 2: flag |= bit; break;
+            default: flag ^= bit; break;
+            }
+            if (wc) nc = flag; else nz = flag;
+        } else {
+            /* BITL .. BITNOT on S[9:5]+1 bits starting at S[4:0] */
+            int first = s & 31;
+            int count = ((s >> 5) & 31) + 1;
+            int i, val;
+            nc = nz = (d >> first) & 1;
+            for (i = 0; i < count; i++) {
+                int b = (first + i) & 31;
+                switch (op) {
+                case 0x20: val = 0; break;
+                case 0x21: val = 1; break;
+                case 0x22: val = c->c; break;
+                case 0x23: val = !c->c; break;
+                case 0x24: val = c->z; break;
+                case 0x25: val = !c->z; break;
+                case 0x26: val = Random() & 1; break;
+                default: val = !((r >> b) & 1); break;
+                }
+                r = (r & ~(1u << b)) | ((uint32_t)val << b);
+            }
+            writeResult = 1;
+        }
+        break;
+    case 0x28: /* AND */
+        r = d & s;
+        goto logic;
+    case 0x29: /* ANDN */
+        r = d & ~s;
+        goto logic;
+    case 0x2a: /* OR */
+        r = d | s;
+        goto logic;
+    case 0x2b: /* XOR */
+        r = d ^ s;
+        goto logic;
+    case 0x2c: /* MUXC */
+    case 0x2d: /* MUXNC */
+    case 0x2e: /* MUXZ */
+    case 0x2f: /* MUXNZ */
+    {
+        int flag = (op < 0x2e) ? c->c : c->z;
+        if (op & 1) flag = !flag;
+        r = (d & ~s) | (flag ? s : 0);
+    }
+    logic:
+        nc = Parity(r);
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x30: /* MOV */
+        r = s;
+        nc = s >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x31: /* NOT */
+        r = ~s;
+        nc = r >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x32: /* ABS */
+        r = ((int32_t)s < 0) ? -s : s;
+        nc = s >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x33: /* NEG */
+    case 0x34: /* NEGC */
+    case 0x35: /* NEGNC */
+    case 0x36: /* NEGZ */
+    case 0x37: /* NEGNZ */
+    {
+        int neg = 1;
+        if (op == 0x34) neg = c->c;
+        else if (op == 0x35) neg = !c->c;
+        else if (op == 0x36) neg = c->z;
+        else if (op == 0x37) neg = !c->z;
+        r = neg ? -s : s;
+        nc = r >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x38: /* INCMOD */
+        nc = (d == s);
+        r = nc ? 0 : d + 1;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x39: /* DECMOD */
+        nc = (d == 0);
+        r = nc ? s : d - 1;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x3a: /* ZEROX */
+        r = d & ((2u << (s & 31)) - 1);
+        nc = r >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x3b: /* SIGNX */
+    {
+        int sh = 31 - (s & 31);
+        r = (uint32_t)((int32_t)(d << sh) >> sh);
+        nc = r >> 31;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x3c: /* ENCOD */
+        r = 0;
+        if (s) {
+            r = 31;
+            while (!((s >> r) & 1)) r--;
+        }
+        nc = (s != 0);
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x3d: /* ONES */
+        r = Ones(s);
+        nc = r & 1;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    case 0x3e: /* TEST */
+    case 0x3f: /* TESTN */
+    {
+        uint32_t t = (op == 0x3e) ? (d & s) : (d & ~s);
+        nc = Parity(t);
+        nz = (t == 0);
+        break;
+    }
+    case 0x40: case 0x41: case 0x42: case 0x43:
+    case 0x44: case 0x45: case 0x46: case 0x47:
+    case 0x48: case 0x49: case 0x4a: case 0x4b:
+    case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+    {
+        uint32_t op9 = (instr >> 19) & 0x1ff;
+        uint32_t n, sh;
+        int32_t inc;
+
+        if (op9 < 0x118) {
+            /* SETNIB/GETNIB/ROLNIB */
+            n = op9 & 7;
+            sh = 4*n;
+            if (op9 < 0x108) r = (d & ~(0xfu << sh)) | ((s & 0xf) << sh);
+            else if (op9 < 0x110) r = (s >> sh) & 0xf;
+            else r = (d << 4) | ((s >> sh) & 0xf);
+            writeResult = 1;
+            break;
+        }
+        if (op9 < 0x124) {
+            /* SETBYTE/GETBYTE/ROLBYTE */
+            n = op9 & 3;
+            sh = 8*n;
+            if (op9 < 0x11c) r = (d & ~(0xffu << sh)) | ((s & 0xff) << sh);
+            else if (op9 < 0x120) r = (s >> sh) & 0xff;
+            else r = (d << 8) | ((s >> sh) & 0xff);
+            writeResult = 1;
+            break;
+        }
+        if (op9 < 0x12a) {
+            /* SETWORD/GETWORD/ROLWORD */
+            n = op9 & 1;
+            sh = 16*n;
+            if (op9 < 0x126) r = (d & ~(0xffffu << sh)) | ((s & 0xffff) << sh);
+            else if (op9 < 0x128) r = (s >> sh) & 0xffff;
+            else r = (d << 16) | ((s >> sh) & 0xffff);
+            writeResult = 1;
+            break;
+        }
+        inc = SignExtend((s >> 9) & 0x1ff, 9);
+        switch (op9) {
+        case 0x12a: /* ALTSN: next D field and nibble number */
+        case 0x12b: /* ALTGN: next S field and nibble number */
+            c->altMask = (op9 == 0x12a ? 0x1ff << 9 : 0x1ff) | (7u << 19);
+            c->altBits = ((((d >> 3) + s) & 0x1ff) << (op9 == 0x12a ? 9 : 0)) | ((d & 7) << 19);
+            goto alter;
+        case 0x12c: /* ALTSB */
+        case 0x12d: /* ALTGB */
+            c->altMask = (op9 == 0x12c ? 0x1ff << 9 : 0x1ff) | (3u << 19);
+            c->altBits = ((((d >> 2) + s) & 0x1ff) << (op9 == 0x12c ? 9 : 0)) | ((d & 3) << 19);
+            goto alter;
+        case 0x12e: /* ALTSW */
+        case 0x12f: /* ALTGW */
+            c->altMask = (op9 == 0x12e ? 0x1ff << 9 : 0x1ff) | (1u << 19);
+            c->altBits = ((((d >> 1) + s) & 0x1ff) << (op9 == 0x12e ? 9 : 0)) | ((d & 1) << 19);
+            goto alter;
+        case 0x130: /* ALTR */
+            c->altrValid = 2;
+            c->altr = (d + s) & 0x1ff;
+            c->altMask = c->altBits = 0;
+            goto alter;
+        case 0x131: /* ALTD */
+            c->altMask = 0x1ff << 9;
+            c->altBits = ((d + s) & 0x1ff) << 9;
+            goto alter;
+        case 0x132: /* ALTS */
+            c->altMask = 0x1ff;
+            c->altBits = (d + s) & 0x1ff;
+            goto alter;
+        case 0x133: /* ALTB */
+            c->altMask = 0x1ff << 9;
+            c->altBits = (((d >> 5) + s) & 0x1ff) << 9;
+        alter:
+            if (op9 != 0x130) c->altValid = 2;
+            if (inc && !imm) {
+                r = d + inc;
+                writeResult = 1;
+            }
+            break;
+        case 0x135: /* SETR */
+            r = (d & ~(0x1ffu << 19)) | ((s & 0x1ff) << 19);
+            writeResult = 1;
+            break;
+        case 0x136: /* SETD */
+            r = (d & ~(0x1ffu << 9)) | ((s & 0x1ff) << 9);
+            writeResult = 1;
+            break;
+        case 0x137: /* SETS */
+            r = (d & ~0x1ffu) | (s & 0x1ff);
+            writeResult = 1;
+            break;
+        case 0x138: /* DECOD */
+            r = 1u << (s & 31);
+            writeResult = 1;
+            break;
+        case 0x139: /* BMASK */
+            r = (2u << (s & 31)) - 1;
+            writeResult = 1;
+            break;
+        case 0x13a: /* CRCBIT */
+            r = ((c->c ^ d) & 1) ? (d >> 1) ^ s : d >> 1;
+            writeResult = 1;
+            break;
+        case 0x13b: /* CRCNIB */
+        {
+            int i;
+            for (i = 0; i < 4; i++) {
+                int bit = c->q >> 31;
+                c->q <<= 1;
+                r = ((bit ^ r) & 1) ? (r >> 1) ^ s : r >> 1;
+            }
+            writeResult = 1;
+            break;
+        }
+        case 0x13c: /* MUXNITS */
+        case 0x13d: /* MUXNIBS */
+        {
+            int width = (op9 == 0x13c) ? 2 : 4;
+            uint32_t m = (1u << width) - 1;
+            int i;
+            for (i = 0; i < 32; i += width) {
+                if ((s >> i) & m) r = (r & ~(m << i)) | (s & (m << i));
+            }
+            writeResult = 1;
+            break;
+        }
+        case 0x13e: /* MUXQ */
+            r = (d & ~c->q) | (s & c->q);
+            writeResult = 1;
+            break;
+        case 0x13f: /* MOVBYTS */
+            r = ((d >> (8*(s & 3))) & 0xff)
+                | (((d >> (8*((s >> 2) & 3))) & 0xff) << 8)
+                | (((d >> (8*((s >> 4) & 3))) & 0xff) << 16)
+                | (((d >> (8*((s >> 6) & 3))) & 0xff) << 24);
+            writeResult = 1;
+            break;
+        default: /* ALTI */
+            Fatal(c, "unsupported instruction ALTI", instr);
+        }
+        break;
+    }
+    case 0x50: /* MUL/MULS */
+        if (wc) {
+            r = (uint32_t)((int32_t)(int16_t)d * (int32_t)(int16_t)s);
+        } else {
+            r = (d & 0xffff) * (s & 0xffff);
+        }
+        nz = (r == 0);
+        wc = 0;
+        writeResult = 1;
+        break;
+    case 0x51: /* SCA/SCAS */
+        if (wc) {
+            c->srcValue = (uint32_t)(((int32_t)(int16_t)d * (int32_t)(int16_t)s) >> 14);
+        } else {
+            c->srcValue = ((d & 0xffff) * (s & 0xffff)) >> 16;
+        }
+        c->srcValid = 2;
+        nz = (c->srcValue == 0);
+        wc = 0;
+        break;
+    case 0x52: /* ADDPIX etc. */
+        Fatal(c, "unsupported pixel instruction", instr);
+        break;
+    case 0x53: /* ADDCT1..3, WMLONG */
+    {
+        int n = (int)((instr >> 19) & 3);
+        if (n == 3) {
+            /* WMLONG: write the non-zero bytes of D */
+            uint32_t addr = MemAddress(c, instr, s, 4, 1);
+            int i;
+            for (i = 0; i < 4; i++) {
+                if ((d >> (8*i)) & 0xff) HubWrite(addr + i, d >> (8*i), 1);
+            }
+            cycles = 3 + HubWait(c, addr);
+            wc = wz = 0;
+            break;
+        }
+        r = d + s;
+        SetCounterEvent(c, n, r);
+        wc = wz = 0;
+        writeResult = 1;
+        break;
+    }
+    case 0x54: /* RQPIN/RDPIN */
+    {
+        int p = s & 0x3f;
+        Pin *pin = &pins[p];
+        if (SmartMode(p) == SP_ASYNC_TX) {
+            nc = c->time < pin->busyUntil;
+        } else {
+            nc = 0;
+        }
+        r = pin->z;
+        if (wz) {
+            /* RDPIN acknowledges the smartpin */
+            pin->inTime = FOREVER;
+        }
+        wz = 0;
+        writeResult = 1;
+        break;
+    }
+    case 0x55: /* RDLUT */
+    {
+        uint32_t addr = MemAddress(c, instr, s, 1, 1);
+        r = c->lut[addr & 0x1ff];
+        nc = r >> 31;
+        nz = (r == 0);
+        cycles = 3;
+        writeResult = 1;
+        break;
+    }
+    case 0x56: /* RDBYTE */
+    case 0x57: /* RDWORD */
+    case 0x58: /* RDLONG */
+    {
+        int size = (op == 0x56) ? 1 : (op == 0x57) ? 2 : 4;
+        int count = 1;
+        uint32_t addr;
+        if (op == 0x58 && c->setq) {
+            count = (c->q & 0x1ff) + 1;
+        }
+        addr = MemAddress(c, instr, s, size, count) & 0xfffff;
+        cycles = 9 + HubWait(c, addr) + count - 1;
+        if (count > 1 || (op == 0x58 && c->setq)) {
+            /* block read into cog or LUT memory */
+            int i;
+            for (i = 0; i < count; i++) {
+                uint32_t v = HubRead(addr + 4*i, 4);
+                if (c->setq == 2) {
+                    c->lut[(dfield + i) & 0x1ff] = v;
+                    c->loadAddr[0x200 + ((dfield + i) & 0x1ff)] = (addr + 4*i) & HUB_MASK;
+                } else {
+                    WriteReg(c, dfield + i, v);
+                    c->loadAddr[(dfield + i) & 0x1ff] = (addr + 4*i) & HUB_MASK;
+                }
+            }
+            wc = wz = 0;
+            break;
+        }
+        r = HubRead(addr, size);
+        nc = (r >> (8*size - 1)) & 1;
+        nz = (r == 0);
+        writeResult = 1;
+        break;
+    }
+    case 0x59: /* CALLD D,S */
+    {
+        uint32_t target = SourceTarget(instr, s, sAug, pcNext);
+        WriteReg(c, rfield, ReturnValue(c, pcNext));
+        if (!imm) {
+            nc = s >> 31;
+            nz = (s >> 30) & 1;
+        }
+        c->pc = target;
+        branched = 1;
+        break;
+    }
+    case 0x5a: /* CALLPA/CALLPB */
+    {
+        uint32_t target = SourceTarget(instr, s, sAug, pcNext);
+        uint32_t dval = wz ? (c->augdValid ? c->augd | dfield : dfield) : d;
+        c->augdValid = wz ? 0 : c->augdValid;
+        WriteReg(c, wc ? REG_PB : REG_PA, dval);
+        Push(c, ReturnValue(c, pcNext));
+        c->pc = target;
+        branched = 1;
+        wc = wz = 0;
+        break;
+    }
+    case 0x5b: /* DJZ/DJNZ/DJF/DJNF */
+    case 0x5c: /* IJZ/IJNZ/TJZ/TJNZ */
+    case 0x5d: /* TJF/TJNF/TJS/TJNS */
+    case 0x5e: /* TJV, JINT.. */
+    {
+        int kind = (int)((instr >> 19) & 3);
+        int take = 0;
+        if (op == 0x5e && kind == 1) {
+            /* Jxxx/JNxxx on an event */
+            int ev = dfield & 15;
+            int flag = EventFlag(c, ev);
+            take = (dfield & 16) ? !flag : flag;
+            ClearEvent(c, ev);
+        } else if (op == 0x5e) {
+            if (kind != 0) Fatal(c, "unknown instruction", instr);
+            take = (d >> 31) != (uint32_t)c->c;   /* TJV */
+        } else if (op == 0x5b) {
+            r = d - 1;
+            writeResult = 1;
+            switch (kind) {
+            case 0: take = (r == 0); break;
+            case 1: take = (r != 0); break;
+            case 2: take = (r == 0xffffffff); break;
+            default: take = (r != 0xffffffff); break;
+            }
+        } else if (op == 0x5c) {
+            switch (kind) {
+            case 0: r = d + 1; writeResult = 1; take = (r == 0); break;
+            case 1: r = d + 1; writeResult = 1; take = (r != 0); break;
+            case 2: take = (d == 0); break;
+            default: take = (d != 0); break;
+            }
+        } else {
+            switch (kind) {
+            case 0: take = (d == 0xffffffff); break;
+            case 1: take = (d != 0xffffffff); break;
+            case 2: take = (d >> 31); break;
+            default: take = !(d >> 31); break;
+            }
+        }
+        if (take) {
+            c->pc = SourceTarget(instr, s, sAug, pcNext);
+            branched = 1;
+        }
+        wc = wz = 0;
+        break;
+    }
+    case 0x5f: /* SETPAT */
+        wc = wz = 0;
+        break;
+    case 0x60: /* WRPIN/WXPIN */
+    case 0x61: /* WYPIN/WRLUT */
+    case 0x62: /* WRBYTE/WRWORD */
+    case 0x63: /* WRLONG/RDFAST */
+    case 0x64: /* WRFAST/FBLOCK */
+    case 0x65: /* XINIT/XZERO */
+    case 0x66: /* XCONT/REP */
+    case 0x67: /* COGINIT */
+    {
+        int sub = wc;
+        uint32_t dval = d;
+        if (wz) {
+            /* L bit: D is an immediate */
+            dval = dfield;
+            if (c->augdValid) {
+                dval |= c->augd;
+                c->augdValid = 0;
+            }
+        }
+        if (op == 0x67) {
+            /* COGINIT */
+            int id = -1, i;
+            uint32_t ptra = c->setq ? c->q : 0;
+            if (dval & 0x10) {
+                for (i = 0; i < NUM_COGS; i++) {
+                    if (!cogs[i].running) { id = i; break; }
+                }
+            } else {
+                id = dval & 7;
+            }
+            cycles = 2 + HubWait(c, 0);
+            nc = (id < 0);
+            if (id >= 0) {
+                Cog *nw = &cogs[id];
+                if (nw == c) {
+                    StartCog(c, c->time + cycles, s, ptra, (dval >> 5) & 1);
+                    c->instrs++;
+                    return;
+                }
+                StartCog(nw, c->time + cycles, s, ptra, (dval >> 5) & 1);
+                if (!wz) {
+                    r = id;
+                    writeResult = 1;
+                }
+            }
+            wz = 0;
+            break;
+        }
+        switch (op*2 + sub) {
+        case 0x60*2: /* WRPIN */
+        case 0x60*2+1: /* WXPIN */
+        case 0x61*2: /* WYPIN */
+        {
+            int i, n = PinCount(s);
+            for (i = 0; i < n; i++) {
+                int p = PinNumber(s, i);
+                if (op == 0x61) {
+                    PinWriteY(c, p, dval);
+                } else if (sub) {
+                    pins[p].x = dval;
+                } else {
+                    if (((pins[p].mode ^ dval) >> 1) & 0x1f) PinReset(p);
+                    pins[p].mode = dval;
+                }
+            }
+            break;
+        }
+        case 0x61*2+1: /* WRLUT */
+        {
+            uint32_t addr = MemAddress(c, instr, s, 1, 1);
+            c->lut[addr & 0x1ff] = dval;
+            c->loadAddr[0x200 + (addr & 0x1ff)] = -1;
+            break;
+        }
+        case 0x62*2: /* WRBYTE */
+        case 0x62*2+1: /* WRWORD */
+        case 0x63*2: /* WRLONG */
+        {
+            int size = (op == 0x63) ? 4 : sub ? 2 : 1;
+            int count = 1, i;
+            uint32_t addr;
+            if (op == 0x63 && c->setq) {
+                count = (c->q & 0x1ff) + 1;
+            }
+            addr = MemAddress(c, instr, s, size, count) & 0xfffff;
+            cycles = 3 + HubWait(c, addr) + count - 1;
+            if (count > 1 || (op == 0x63 && c->setq)) {
+                for (i = 0; i < count; i++) {
+                    uint32_t v;
+                    if (wz) v = dval;   /* fill with the immediate */
+                    else if (c->setq == 2) v = c->lut[(dfield + i) & 0x1ff];
+                    else v = ReadReg(c, (dfield + i) & 0x1ff);
+                    HubWrite(addr + 4*i, v, 4);
+                }
+            } else {
+                HubWrite(addr, dval, size);
+            }
+            break;
+        }
+        case 0x63*2+1: /* RDFAST */
+        case 0x64*2: /* WRFAST */
+        case 0x64*2+1: /* FBLOCK */
+        {
+            uint32_t blocks = dval & 0x3fff;
+            if (op*2 + sub != 0x64*2+1) {
+                c->fifoAddr = s & 0xfffff;
+                cycles = (dval >> 31) ? 2 : 10 + HubWait(c, s);
+            }
+            c->fifoStart = s & 0xfffff;
+            c->fifoEnd = blocks ? c->fifoStart + 64*blocks : 0;
+            break;
+        }
+        case 0x66*2+1: /* REP */
+            if (dval & 0x1ff) {
+                c->repActive = 1;
+                c->repStart = pcNext;
+                c->repEnd = RelativeTarget(pcNext, dval & 0x1ff);
+                c->repCount = s;
+            }
+            break;
+        default: /* streamer */
+            Fatal(c, "unsupported streamer instruction", instr);
+        }
+        wc = wz = 0;
+        break;
+    }
+    case 0x68: /* QMUL/QDIV */
+    case 0x69: /* QFRAC/QSQRT */
+    case 0x6a: /* QROTATE/QVECTOR */
+    {
+        uint32_t dval = d, x = 0, y = 0;
+        uint32_t q = c->setq ? c->q : 0;
+        if (wz) {
+            dval = dfield;
+            if (c->augdValid) {
+                dval |= c->augd;
+                c->augdValid = 0;
+            }
+        }
+        switch (op*2 + wc) {
+        case 0x68*2: /* QMUL */
+        {
+            uint64_t t = (uint64_t)dval * s;
+            x = (uint32_t)t;
+            y = (uint32_t)(t >> 32);
+            break;
+        }
+        case 0x68*2+1: /* QDIV */
+            Divide(((uint64_t)q << 32) | dval, s, &x, &y);
+            break;
+        case 0x69*2: /* QFRAC */
+            Divide(((uint64_t)dval << 32) | q, s, &x, &y);
+            break;
+        case 0x69*2+1: /* QSQRT */
+            x = Isqrt64(((uint64_t)s << 32) | dval);
+            break;
+        case 0x6a*2: /* QROTATE */
+        {
+            double a = (double)s * 2.0 * M_PI / 4294967296.0;
+            double x0 = (int32_t)dval, y0 = (int32_t)q;
+            x = (uint32_t)(int64_t)llround(x0 * cos(a) - y0 * sin(a));
+            y = (uint32_t)(int64_t)llround(x0 * sin(a) + y0 * cos(a));
+            break;
+        }
+        default: /* QVECTOR */
+        {
+            double x0 = (int32_t)dval, y0 = (int32_t)s;
+            x = (uint32_t)llround(sqrt(x0*x0 + y0*y0));
+            y = CordicAngle(atan2(y0, x0));
+            break;
+        }
+        }
+        cycles = CordicCommand(c, x, y);
+        wc = wz = 0;
+        break;
+    }
+    case 0x6b:
+    {
+        /* instructions with only a D operand; S selects the operation */
+        uint32_t dval = d;
+        if (imm) {
+            dval = dfield;
+            if (c->augdValid) {
+                dval |= c->augd;
+                c->augdValid = 0;
+            }
+        }
+        switch (sfield) {
+        case 0x00: /* HUBSET */
+            if ((dval >> 28) == 1) {
+                fflush(stdout);
+                fprintf(stderr, "%s: reboot requested\n", progname);
+                exitRequested = 1;
+            }
+            cycles = 2 + HubWait(c, 0);
+            break;
+        case 0x01: /* COGID */
+            if (wc) {
+                nc = cogs[dval & 7].running;
+            } else {
+                r = c->id;
+                writeResult = 1;
+            }
+            cycles = 2 + HubWait(c, 0);
+            break;
+        case 0x03: /* COGSTOP */
+            cycles = 2 + HubWait(c, 0);
+            if (&cogs[dval & 7] == c) {
+                c->time += cycles;
+                c->cycles += cycles;
+                c->instrs++;
+                if (c->func >= 0 && numFuncs) {
+                    funcs[c->func].cycles += cycles;
+                    funcs[c->func].instrs++;
+                }
+                StopCog(c);
+                return;
+            }
+            if (cogs[dval & 7].running) StopCog(&cogs[dval & 7]);
+            break;
+        case 0x04: /* LOCKNEW */
+        {
+            int i;
+            nc = 1;
+            for (i = 0; i < NUM_LOCKS; i++) {
+                if (!lockAllocated[i]) {
+                    lockAllocated[i] = 1;
+                    r = i;
+                    nc = 0;
+                    writeResult = 1;
+                    break;
+                }
+            }
+            cycles = 2 + HubWait(c, 0);
+            break;
+        }
+        case 0x05: /* LOCKRET */
+            lockAllocated[dval & 15] = 0;
+            cycles = 2 + HubWait(c, 0);
+            break;
+        case 0x06: /* LOCKTRY */
+        {
+            int id = dval & 15;
+            if (lockOwner[id] < 0 || lockOwner[id] == c->id) {
+                lockOwner[id] = c->id;
+                nc = 1;
+            } else {
+                nc = 0;
+            }
+            cycles = 2 + HubWait(c, 0);
+            break;
+        }
+        case 0x07: /* LOCKREL */
+        {
+            int id = dval & 15;
+            nc = (lockOwner[id] >= 0);
+            if (wc && !imm) {
+                r = lockOwner[id] >= 0 ? lockOwner[id] : 0;
+                writeResult = 1;
+            }
+            if (lockOwner[id] == c->id) lockOwner[id] = -1;
+            cycles = 2 + HubWait(c, 0);
+            break;
+        }
+        case 0x0e: /* QLOG */
+            cycles = CordicCommand(c, qlog(dval), 0);
+            break;
+        case 0x0f: /* QEXP */
+            cycles = CordicCommand(c, qexp(dval), 0);
+            break;
+        case 0x10: /* RFBYTE */
+        case 0x11: /* RFWORD */
+        case 0x12: /* RFLONG */
+        {
+            int size = 1 << (sfield - 0x10);
+            r = HubRead(c->fifoAddr, size);
+            c->fifoAddr += size;
+            if (c->fifoEnd && c->fifoAddr >= c->fifoEnd) c->fifoAddr = c->fifoStart;
+            nc = (r >> (8*size - 1)) & 1;
+            nz = (r == 0);
+            writeResult = 1;
+            break;
+        }
+        case 0x13: /* RFVAR */
+        case 0x14: /* RFVARS */
+        {
+            int i, bits = 0;
+            r = 0;
+            for (i = 0; i < 4; i++) {
+                uint32_t b = hub[c->fifoAddr++ & HUB_MASK];
+                if (i == 3) {
+                    r |= b << bits;
+                    bits += 8;
+                    break;
+                }
+                r |= (b & 0x7f) << bits;
+                bits += 7;
+                if (!(b & 0x80)) break;
+            }
+            if (sfield == 0x14 && bits < 32) r = (uint32_t)SignExtend(r, bits);
+            nc = r >> 31;
+            nz = (r == 0);
+            writeResult = 1;
+            break;
+        }
+        case 0x15: /* WFBYTE */
+        case 0x16: /* WFWORD */
+        case 0x17: /* WFLONG */
+        {
+            int size = 1 << (sfield - 0x15);
+            HubWrite(c->fifoAddr, dval, size);
+            c->fifoAddr += size;
+            if (c->fifoEnd && c->fifoAddr >= c->fifoEnd) c->fifoAddr = c->fifoStart;
+            break;
+        }
+        case 0x18: /* GETQX */
+        case 0x19: /* GETQY */
+            cycles = CordicGet(c, sfield == 0x19, &r);
+            nc = r >> 31;
+            nz = (r == 0);
+            writeResult = 1;
+            break;
+        case 0x1a: /* GETCT */
+            r = wc ? (uint32_t)(c->time >> 32) : (uint32_t)c->time;
+            nc = 0;
+            writeResult = 1;
+            break;
+        case 0x1b: /* GETRND */
+            r = Random();
+            nc = r >> 31;
+            nz = (r >> 30) & 1;
+            writeResult = !imm;
+            break;
+        case 0x1c: /* SETDACS */
+        case 0x1d: /* SETXFRQ */
+        case 0x20: case 0x21: case 0x22: case 0x23: /* SETSE1..4 */
+        case 0x37: /* SETLUTS */
+        case 0x38: case 0x39: case 0x3a: case 0x3b: /* SETCY.. */
+        case 0x3c: case 0x3d: case 0x3e:
+        case 0x70: /* SETSCP */
+            break;
+        case 0x1e: /* GETXACC */
+        case 0x71: /* GETSCP */
+            r = 0;
+            writeResult = 1;
+            break;
+        case 0x1f: /* WAITX */
+            cycles = 2 + dval;
+            break;
+        case 0x24: /* POLLxxx/WAITxxx, interrupt control */
+        {
+            int ev = dfield & 15;
+            if (dfield < 16) {
+                nc = nz = EventFlag(c, ev);
+                ClearEvent(c, ev);
+            } else if (dfield < 32) {
+                if (ev >= EV_CT1 && ev <= EV_CT3) {
+                    uint64_t fire = c->ctFire[ev - EV_CT1];
+                    if (fire > c->time) cycles += (int)(fire - c->time);
+                } else if (ev == EV_ATN) {
+                    if (!c->atn) {
+                        /* come back to this instruction when another cog sends ATN */
+                        c->blocked = 1;
+                        c->pc = pc;
+                        return;
+                    }
+                } else if (!EventFlag(c, ev)) {
+                    Fatal(c, "waiting for an event which is not simulated", instr);
+                }
+                ClearEvent(c, ev);
+                nc = nz = 0;
+            } else if (dfield == 32 || dfield == 33 || (dfield >= 37 && dfield <= 39)) {
+                /* ALLOWI, STALLI, NIXINTx */
+            } else {
+                Fatal(c, "interrupts are not simulated", instr);
+            }
+            break;
+        }
+        case 0x25: case 0x26: case 0x27: /* SETINT1..3 */
+            if (dval & 15) Fatal(c, "interrupts are not simulated", instr);
+            break;
+        case 0x28: /* SETQ */
+        case 0x29: /* SETQ2 */
+            c->q = dval;
+            c->setq = (sfield == 0x28) ? 1 : 2;
+            keepSetq = 1;
+            break;
+        case 0x2a: /* PUSH */
+            Push(c, dval);
+            break;
+        case 0x2b: /* POP */
+            r = Pop(c);
+            nc = r >> 31;
+            nz = (r >> 30) & 1;
+            writeResult = 1;
+            break;
+        case 0x2c: /* JMP D */
+            if (imm) Fatal(c, "unknown instruction", instr);
+            nc = dval >> 31;
+            nz = (dval >> 30) & 1;
+            c->pc = dval & 0xfffff;
+            branched = 1;
+            break;
+        case 0x2d: /* CALL D/RET */
+        case 0x2e: /* CALLA D/RETA */
+        case 0x2f: /* CALLB D/RETB */
+        {
+            uint32_t ptrReg = (sfield == 0x2e) ? REG_PTRA : REG_PTRB;
+            uint32_t k;
+            if (imm) {
+                /* return */
+                if (sfield == 0x2d) {
+                    k = Pop(c);
+                } else {
+                    uint32_t addr = c->reg[ptrReg] - 4;
+                    WriteReg(c, ptrReg, addr);
+                    k = HubRead(addr, 4);
+                    cycles += 7 + HubWait(c, addr);
+                }
+                nc = k >> 31;
+                nz = (k >> 30) & 1;
+                c->pc = k & 0xfffff;
+            } else {
+                k = ReturnValue(c, pcNext);
+                if (sfield == 0x2d) {
+                    Push(c, k);
+                } else {
+                    uint32_t addr = c->reg[ptrReg];
+                    HubWrite(addr, k, 4);
+                    WriteReg(c, ptrReg, addr + 4);
+                    cycles += 1 + HubWait(c, addr);
+                }
+                nc = dval >> 31;
+                nz = (dval >> 30) & 1;
+                c->pc = dval & 0xfffff;
+            }
+            branched = 1;
+            break;
+        }
+        case 0x30: /* JMPREL */
+            c->pc = RelativeTarget(pcNext, (int32_t)dval);
+            branched = 1;
+            break;
+        case 0x31: /* SKIP */
+        case 0x32: /* SKIPF */
+            c->skipPattern = dval;
+            c->skipFast = (sfield == 0x32);
+            break;
+        case 0x33: /* EXECF */
+            c->pc = dval & 0x3ff;
+            c->skipPattern = dval >> 10;
+            c->skipFast = 1;
+            branched = 1;
+            break;
+        case 0x34: /* GETPTR */
+            r = c->fifoAddr;
+            writeResult = 1;
+            break;
+        case 0x3f: /* COGATN */
+        {
+            int i;
+            for (i = 0; i < NUM_COGS; i++) {
+                if ((dval >> i) & 1 && cogs[i].running) {
+                    cogs[i].atn = 1;
+                    if (cogs[i].blocked) {
+                        cogs[i].blocked = 0;
+                        if (cogs[i].time < c->time + 2) cogs[i].time = c->time + 2;
+                    }
+                }
+            }
+            break;
+        }
+        case 0x40: case 0x41: case 0x42: case 0x43:
+        case 0x44: case 0x45: case 0x46: case 0x47:
+            if (wc != wz) {
+                /* TESTP/TESTPN, with AND/OR/XOR variants */
+                int bit = PinIn(dval & 0x3f, c->time);
+                int flag = wc ? c->c : c->z;
+                if (sfield & 1) bit = !bit;
+                switch ((sfield - 0x40) >> 1) {
+                case 0: flag = bit; break;
+                case 1: flag &= bit; break;
+                case 2: flag |= bit; break;
+                default: flag ^= bit; break;
+                }
+                if (wc) nc = flag; else nz = flag;
+                break;
+            }
+            /* fall through */
+        case 0x48: case 0x49: case 0x4a: case 0x4b:
+        case 0x4c: case 0x4d: case 0x4e: case 0x4f:
+        case 0x50: case 0x51: case 0x52: case 0x53:
+        case 0x54: case 0x55: case 0x56: case 0x57:
+        case 0x58: case 0x59: case 0x5a: case 0x5b:
+        case 0x5c: case 0x5d: case 0x5e: case 0x5f:
+        {
+            /* DIRx, OUTx, FLTx, DRVx */
+            int group = (sfield - 0x40) >> 3;
+            int kind = sfield & 7;
+            int i, n = PinCount(dval);
+            for (i = 0; i < n; i++) {
+                int p = PinNumber(dval, i);
+                uint32_t bit = 1u << (p & 31);
+                uint32_t dirReg = REG_DIRA + (p >> 5);
+                uint32_t outReg = REG_OUTA + (p >> 5);
+                uint32_t reg = (group == 0) ? dirReg : outReg;
+                int val;
+                switch (kind) {
+                case 0: val = 0; break;
+                case 1: val = 1; break;
+                case 2: val = c->c; break;
+                case 3: val = !c->c; break;
+                case 4: val = c->z; break;
+                case 5: val = !c->z; break;
+                case 6: val = Random() & 1; break;
+                default: val = !(c->reg[reg] & bit); break;
+                }
+                c->reg[reg] = val ? (c->reg[reg] | bit) : (c->reg[reg] & ~bit);
+                if (group == 2) c->reg[dirReg] &= ~bit;
+                if (group == 3) c->reg[dirReg] |= bit;
+                if (i == 0) nc = nz = val;
+            }
+            UpdatePins();
+            break;
+        }
+        case 0x60: /* SPLITB */
+        case 0x61: /* MERGEB */
+        case 0x62: /* SPLITW */
+        case 0x63: /* MERGEW */
+        {
+            int i;
+            r = 0;
+            for (i = 0; i < 32; i++) {
+                int from, to;
+                if (sfield < 0x62) {
+                    /* bit b of byte k <-> bit 4*b + k */
+                    int a = (i & 7) * 4 + (i >> 3);
+                    from = (sfield == 0x60) ? a : i;
+                    to = (sfield == 0x60) ? i : a;
+                } else {
+                    /* bit b of word k <-> bit 2*b + k */
+                    int a = (i & 15) * 2 + (i >> 4);
+                    from = (sfield == 0x62) ? a : i;
+                    to = (sfield == 0x62) ? i : a;
+                }
+                r |= ((d >> from) & 1) << to;
+            }
+            writeResult = 1;
+            break;
+        }
+        case 0x68: /* XORO32 */
+        {
+            uint32_t result = 0;
+            int i;
+            r = d;
+            for (i = 0; i < 2; i++) {
+                uint16_t s0 = r & 0xffff, s1 = r >> 16;
+                uint16_t sum = s0 + s1;
+                uint16_t out = (uint16_t)(((sum << 9) | (sum >> 7)) + s0);
+                s1 ^= s0;
+                s0 = (uint16_t)(((s0 << 13) | (s0 >> 3)) ^ s1 ^ (s1 << 5));
+                s1 = (uint16_t)((s1 << 10) | (s1 >> 6));
+                r = ((uint32_t)s1 << 16) | s0;
+                result = (result >> 16) | ((uint32_t)out << 16);
+            }
+            c->srcValue = result;
+            c->srcValid = 2;
+            writeResult = 1;
+            break;
+        }
+        case 0x69: /* REV */
+        {
+            int i;
+            r = 0;
+            for (i = 0; i < 32; i++) r |= ((d >> i) & 1) << (31 - i);
+            writeResult = 1;
+            break;
+        }
+        case 0x6a: /* RCZR */
+            r = ((uint32_t)c->c << 31) | ((uint32_t)c->z << 30) | (d >> 2);
+            nc = (d >> 1) & 1;
+            nz = d & 1;
+            writeResult = 1;
+            break;
+        case 0x6b: /* RCZL */
+            r = (d << 2) | ((uint32_t)c->c << 1) | (uint32_t)c->z;
+            nc = d >> 31;
+            nz = (d >> 30) & 1;
+            writeResult = 1;
+            break;
+        case 0x6c: /* WRC */
+            r = c->c;
+            writeResult = 1;
+            break;
+        case 0x6d: /* WRNC */
+            r = !c->c;
+            writeResult = 1;
+            break;
+        case 0x6e: /* WRZ */
+            r = c->z;
+            writeResult = 1;
+            break;
+        case 0x6f: /* WRNZ/MODCZ */
+            if (imm) {
+                int state = (c->c << 1) | c->z;
+                nc = ((dfield >> 4) >> state) & 1;
+                nz = ((dfield & 15) >> state) & 1;
+            } else {
+                r = !c->z;
+                writeResult = 1;
+            }
+            break;
+        default:
+            Fatal(c, "unsupported instruction", instr);
+        }
+        break;
+    }
+    case 0x6c: /* JMP #A */
+    case 0x6d: /* CALL #A */
+    case 0x6e: /* CALLA #A */
+    case 0x6f: /* CALLB #A */
+    case 0x70: case 0x71: case 0x72: case 0x73: /* CALLD PA/PB/PTRA/PTRB,#A */
+    {
+        uint32_t a = instr & 0xfffff;
+        uint32_t target;
+        uint32_t k = ReturnValue(c, pcNext);
+        if (wc) {
+            int32_t off = SignExtend(a, 20);
+            target = (pc < 0x400) ? pcNext + (off >> 2) : pcNext + off;
+            target &= 0xfffff;
+        } else {
+            target = a;
+        }
+        if (op == 0x6d) {
+            Push(c, k);
+        } else if (op == 0x6e || op == 0x6f) {
+            uint32_t ptrReg = (op == 0x6e) ? REG_PTRA : REG_PTRB;
+            uint32_t addr = c->reg[ptrReg];
+            HubWrite(addr, k, 4);
+            WriteReg(c, ptrReg, addr + 4);
+            cycles += 1 + HubWait(c, addr);
+        } else if (op >= 0x70) {
+            WriteReg(c, REG_PA + (op & 3), k);
+        }
+        c->pc = target;
+        branched = 1;
+        wc = wz = 0;
+        break;
+    }
+    case 0x74: case 0x75: case 0x76: case 0x77: /* LOC */
+    {
+        uint32_t a = instr & 0xfffff;
+        if (wc) {
+            int32_t off = SignExtend(a, 20);
+            a = (pc < 0x400) ? pcNext + off : pcNext + off;
+            a &= 0xfffff;
+        }
+        WriteReg(c, REG_PA + (op & 3), a);
+        wc = wz = 0;
+        break;
+    }
+    case 0x78: case 0x79: case 0x7a: case 0x7b: /* AUGS */
+        c->augs = (instr & 0x7fffff) << 9;
+        c->augsValid = 1;
+        isAug = 1;
+        wc = wz = 0;
+        break;
+    default: /* AUGD */
+        c->augd = (instr & 0x7fffff) << 9;
+        c->augdValid = 1;
+        isAug = 1;
+        wc = wz = 0;
+        break;
+    }
+
+    if (writeResult) {
+        WriteReg(c, rfield, r);
+    }
+    if (wc) c->c = nc;
+    if (wz) c->z = nz;
+
+    if (branched) {
+        c->repActive = 0;
+        cycles += BranchCycles(c, c->pc) - 2;
+    } else if (cond == 0) {
+        /* _ret_ */
+        uint32_t k = Pop(c);
+        c->pc = k & 0xfffff;
+        branched = 1;
+        c->repActive = 0;
+        cycles += BranchCycles(c, c->pc) - 2;
+    }
+
+done:
+    /* prefixes (ALTx, SETQ, SCA...) last for one more instruction */
+    if (!isAug) {
+        if (c->altValid) c->altValid--;
+        if (c->altrValid) c->altrValid--;
+        if (c->srcValid) c->srcValid--;
+        if (!keepSetq) c->setq = 0;
+    }
+    if (!branched && c->repActive && c->pc == c->repEnd) {
+        if (c->repCount == 0 || --c->repCount > 0) {
+            c->pc = c->repStart;
+            if (c->repStart >= 0x400) cycles += BranchCycles(c, c->repStart) - 2;
+        } else {
+            c->repActive = 0;
+        }
+    }
+
+    c->time += cycles;
+    c->cycles += cycles;
+    c->instrs++;
+    if (numFuncs && c->func >= 0) {
+        Func *f = &funcs[c->func];
+        f->cycles += cycles;
+        f->instrs++;
+        if (startCalls) f->calls++;
+    }
+}
+
+/*
+ * reporting
+ */
+static int
+CompareFuncCycles(const void *a, const void *b)
+{
+    const Func *fa = (const Func *)a;
+    const Func *fb = (const Func *)b;
+    if (fa->cycles != fb->cycles) return fa->cycles > fb->cycles ? -1 : 1;
+    return strcmp(fa->name, fb->name);
+}
+
+static void
+JsonString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fputc('\\', f);
+        fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+static void
+Report(FILE *text, const char *jsonFile, const char *binary, int showProfile, int limitHit)
+{
+    uint64_t totalInstrs = 0;
+    uint32_t clkfreq = HubRead(0x14, 4);
+    int i;
+
+    for (i = 0; i < NUM_COGS; i++) {
+        totalInstrs += cogs[i].instrs;
+    }
+    if (!clkfreq) clkfreq = 80000000;
+    qsort(funcs, numFuncs, sizeof(Func), CompareFuncCycles);
+    if (text) {
+        fprintf(text, "%s: %llu cycles (%.3f ms at %.1f MHz), %llu instructions\n", progname,
+                (unsigned long long)endTime, endTime * 1000.0 / clkfreq, clkfreq / 1e6,
+                (unsigned long long)totalInstrs);
+    }
+    if (text && showProfile && numFuncs) {
+        fprintf(text, "%12s %7s %10s %12s  %s\n", "cycles", "%", "calls", "instructions", "function");
+        for (i = 0; i < numFuncs; i++) {
+            Func *fn = &funcs[i];
+            if (!fn->instrs) continue;
+            fprintf(text, "%12llu %6.2f%% %10llu %12llu  %s\n", (unsigned long long)fn->cycles,
+                    endTime ? 100.0 * fn->cycles / endTime : 0.0,
+                    (unsigned long long)fn->calls, (unsigned long long)fn->instrs, fn->name);
+        }
+    }
+    if (jsonFile) {
+        FILE *f = fopen(jsonFile, "w");
+        int first = 1;
+        if (!f) {
+            perror(jsonFile);
+            return;
+        }
+        fprintf(f, "{\n  \"binary\": ");
+        JsonString(f, binary);
+        fprintf(f, ",\n  \"exit_status\": %d,\n  \"cycle_limit_reached\": %s,\n", exitStatus, limitHit ? "true" : "false");
+        fprintf(f, "  \"clkfreq\": %u,\n  \"cycles\": %llu,\n  \"instructions\": %llu,\n", clkfreq,
+                (unsigned long long)endTime, (unsigned long long)totalInstrs);
+        fprintf(f, "  \"cogs\": [");
+        for (i = 0; i < NUM_COGS; i++) {
+            if (!cogs[i].instrs) continue;
+            fprintf(f, "%s\n    {\"cog\": %d, \"cycles\": %llu, \"instructions\": %llu}", first ? "" : ",", i,
+                    (unsigned long long)cogs[i].cycles, (unsigned long long)cogs[i].instrs);
+            first = 0;
+        }
+        fprintf(f, "\n  ],\n  \"functions\": [");
+        first = 1;
+        /* functions which never ran are listed too, so a profile can tell them from unknown ones */
+        for (i = 0; i < numFuncs; i++) {
+            Func *fn = &funcs[i];
+            fprintf(f, "%s\n    {\"name\": ", first ? "" : ",");
+            JsonString(f, fn->name);
+            fprintf(f, ", \"cycles\": %llu, \"instructions\": %llu, \"calls\": %llu, \"bytes\": %u}",
+                    (unsigned long long)fn->cycles, (unsigned long long)fn->instrs, (unsigned long long)fn->calls,
+                    fn->bytes);
+            first = 0;
+        }
+        fprintf(f, "\n  ]\n}\n");
+        fclose(f);
+    }
+}
+
+static void
+Usage(void)
+{
+    fprintf(stderr, "usage: %s [options] file.binary\n", progname);
+    fprintf(stderr, "  -l FILE           read function labels from listing FILE (default: file.lst, if it exists)\n");
+    fprintf(stderr, "  -c                print the total cycle count to stderr\n");
+    fprintf(stderr, "  -p                print the cycles used by each function to stderr\n");
+    fprintf(stderr, "  --json=FILE       write the cycle counts as JSON to FILE\n");
+    fprintf(stderr, "  --trace=N         print the first N instructions executed to stderr\n");
+    fprintf(stderr, "  --max-cycles=N    stop after N clock cycles (default %llu)\n", (unsigned long long)maxCycles);
+    fprintf(stderr, "The exit status is the one sent by the program, %d if the cycle limit was\n", STATUS_TIMEOUT);
+    fprintf(stderr, "reached, or %d if the program did something that is not simulated.\n", STATUS_ERROR);
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *binary = NULL;
+    const char *listing = NULL;
+    const char *jsonFile = NULL;
+    int showCycles = 0, showProfile = 0;
+    int limitHit = 0;
+    char *defaultListing = NULL;
+    FILE *f;
+    size_t len;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        if (!strcmp(arg, "-l") && i + 1 < argc) {
+            listing = argv[++i];
+        } else if (!strcmp(arg, "-c")) {
+            showCycles = 1;
+        } else if (!strncmp(arg, "--trace=", 8)) {
+            traceLimit = strtoull(arg + 8, NULL, 0);
+        } else if (!strcmp(arg, "-p")) {
+            showProfile = 1;
+        } else if (!strncmp(arg, "--json=", 7) && arg[7]) {
+            jsonFile = arg + 7;
+        } else if (!strncmp(arg, "--max-cycles=", 13)) {
+            char *end;
+            maxCycles = strtoull(arg + 13, &end, 0);
+            if (*end || maxCycles == 0) Usage();
+        } else if (arg[0] == '-' || binary) {
+            Usage();
+        } else {
+            binary = arg;
+        }
+    }
+    if (!binary) Usage();
+
+    f = fopen(binary, "rb");
+    if (!f) {
+        perror(binary);
+        return 2;
+    }
+    len = fread(hub, 1, HUB_SIZE, f);
+    fclose(f);
+    if (len == 0) {
+        fprintf(stderr, "%s: %s is empty\n", progname, binary);
+        return 2;
+    }
+
+    if (!listing) {
+        const char *dot = strrchr(binary, '.');
+        size_t base = dot ? (size_t)(dot - binary) : strlen(binary);
+        defaultListing = (char *)malloc(base + 5);
+        memcpy(defaultListing, binary, base);
+        strcpy(defaultListing + base, ".lst");
+        ReadListing(defaultListing);
+    } else if (!ReadListing(listing)) {
+        perror(listing);
+        return 2;
+    }
+
+    for (i = 0; i < NUM_LOCKS; i++) lockOwner[i] = -1;
+    for (i = 0; i < NUM_PINS; i++) PinReset(i);
+    for (i = 0; i < NUM_COGS; i++) {
+        cogs[i].id = i;
+        cogs[i].func = -1;
+    }
+    StartCog(&cogs[0], 0, 0, 0, 0);
+
+    while (!exitRequested) {
+        Cog *next = NULL;
+        int blocked = 0;
+        for (i = 0; i < NUM_COGS; i++) {
+            Cog *c = &cogs[i];
+            if (!c->running) continue;
+            if (c->blocked) {
+                blocked++;
+                continue;
+            }
+            if (!next || c->time < next->time) next = c;
+        }
+        if (!next) {
+            if (blocked) {
+                fflush(stdout);
+                fprintf(stderr, "%s: all cogs are waiting for an event which will never happen\n", progname);
+                exitStatus = STATUS_ERROR;
+            }
+            break;
+        }
+        if (next->time > maxCycles) {
+            fflush(stdout);
+            fprintf(stderr, "%s: stopped after %llu cycles\n", progname, (unsigned long long)maxCycles);
+            exitStatus = STATUS_TIMEOUT;
+            limitHit = 1;
+            endTime = maxCycles;
+            break;
+        }
+        Step(next);
+        if (exitRequested && next->time > endTime) endTime = next->time;
+    }
+    fflush(stdout);
+    Report((showCycles || showProfile) ? stderr : NULL, jsonFile, binary, showProfile, limitHit);
+    return exitStatus;
+}
@@ -0,0 +1,550 @@
+/*
+ * Parsing Spin objects ahead of time in worker processes
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * The lexers and parsers keep their state in globals (the current
+ * module, the preprocessor, the symbol tables and the error counts),
+ * so they cannot run on several threads at once. With -j N the
+ * compile instead forks N worker processes just before it parses the
+ * top level files. Each worker parses its share of the Spin objects
+ * the program uses and sends the compile an image of each parse (see
+ * sysimage.c) over a pipe.
+ *
+ * The compile still parses the files in its usual order. When it
+ * comes to an object a worker was given, it waits for that worker to
+ * finish the object, and loads the image instead of parsing, if the
+ * worker saw the same preprocessed text. Loading an image gives the
+ * same module as the parse (the compile cache relies on this too), so
+ * the output does not depend on N or on timing. An object a worker
+ * could not make an image of (see FinishParseImage) is simply parsed.
+ *
+ * The objects are found by scanning the OBJ sections of the sources,
+ * before preprocessing, for file names. That is only a guess: an
+ * object it misses is parsed by the compile as usual, and one the
+ * program does not use only costs a worker some time.
+ *
+ * A worker sends a sequence of records:
+ *   'I', the file name, the SHA-256 of its text, the length, the image
+ *   'D', the file name (the worker is done with that object)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "spinc.h"
+#include "parsejobs.h"
+#include "passtime.h"
+#include "util/sha256.h"
+
+#ifdef WIN32
+
+void ParseJobsStart(const char **names, int count) {}
+unsigned char *ParseJobsLookup(const char *fullName, const char *text, size_t *lenp) { return NULL; }
+int ParseJobsWorker(void) { return 0; }
+void ParseJobsSave(const char *fullName, const char *text, const unsigned char *image, size_t len) {}
+void ParseJobsFinish(void) {}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#define MAX_WORKERS 64
+
+typedef struct ParseJob {
+    const char *name;       /* the name in the OBJ section */
+    const char *from;       /* name of the module it is in */
+    int fromLanguage;       /* and that module's language */
+    const char *fullName;   /* absolute path of the object */
+    int worker;             /* worker parsing it, or -1 for a top level file */
+    int done;               /* the worker has finished it */
+} ParseJob;
+
+typedef struct ParsedImage {
+    const char *fullName;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    unsigned char *image;   /* NULL once used */
+    size_t len;
+} ParsedImage;
+
+typedef struct ParseWorker {
+    pid_t pid;
+    int fd;                 /* read end of its pipe, or -1 */
+} ParseWorker;
+
+static Flexbuf jobs;        /* ParseJob */
+static Flexbuf images;      /* ParsedImage */
+static ParseWorker workers[MAX_WORKERS];
+static int numWorkers;
+static int numJobs;
+static int numUsed;
+static int workerFd = -1;   /* in a worker, the write end of its pipe */
+
+static ParseJob *
+FindJob(const char *fullName)
+{
+    ParseJob *job = (ParseJob *)flexbuf_peek(&jobs);
+    size_t i, n = flexbuf_curlen(&jobs) / sizeof(ParseJob);
+
+    for (i = 0; i < n; i++) {
+        if (!strcmp(job[i].fullName, fullName)) {
+            return &job[i];
+        }
+    }
+    return NULL;
+}
+
+static char *
+ReadSource(const char *fname)
+{
+    Flexbuf fb;
+    char buf[4096];
+    size_t n;
+    FILE *f = fopen(fname, "rb");
+
+    if (!f) {
+        return NULL;
+    }
+    flexbuf_init(&fb, 4096);
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        flexbuf_addmem(&fb, buf, n);
+    }
+    fclose(f);
+    flexbuf_addchar(&fb, 0);
+    return flexbuf_get(&fb);
+}
+
+static void ScanObjects(const char *text, Module *from);
+
+/*
+ * add a job for the object "name" in module from (or for a top level
+ * file, if from is NULL) unless it is not a Spin file we can read or
+ * already has one, and then for the objects it uses; so the jobs are
+ * in the order the compile needs them
+ */
+static void
+AddJob(const char *name, Module *from)
+{
+    ParseJob job;
+    Module stub;
+    char *fname, *shortName, *text;
+    const char *fullName;
+    int language;
+
+    /* looking for the language of a .o file may print a warning */
+    fname = strrchr(name, '.');
+    if (fname && !strcmp(fname, ".o")) {
+        return;
+    }
+    fname = FindSourceFile(name, from, &language, &shortName);
+    free(shortName);
+    if (!fname || !IsSpinLang(language)) {
+        return;
+    }
+    fullName = MakeAbsolutePath(fname);
+    if (FindJob(fullName)) {
+        return;
+    }
+    text = ReadSource(fname);
+    if (!text) {
+        return;
+    }
+    memset(&job, 0, sizeof(job));
+    job.name = strdup(name);
+    job.from = from ? from->fullname : NULL;
+    job.fromLanguage = from ? from->mainLanguage : 0;
+    job.fullName = fullName;
+    job.worker = from ? 0 : -1;
+    flexbuf_addmem(&jobs, (const char *)&job, sizeof(job));
+    if (from) {
+        numJobs++;
+    }
+
+    /* the objects it uses are looked up relative to it, as doParseFile would */
+    memset(&stub, 0, sizeof(stub));
+    stub.fullname = gl_useFullPaths ? fullName : fname;
+    stub.mainLanguage = language;
+    ScanObjects(text, &stub);
+    free(text);
+}
+
+/* is the word at s the section name kw? */
+static int
+IsSection(const char *s, const char *kw)
+{
+    size_t n = strlen(kw);
+
+    return !strncasecmp(s, kw, n) && !isalnum((unsigned char)s[n]) && s[n] != '_';
+}
+
+/* add jobs for the file names in the OBJ sections of text */
+static void
+ScanObjects(const char *text, Module *from)
+{
+    const char *s = text;
+    const char *start;
+    char *name;
+    int inObj = 0;
+    int comment = 0;
+    int lineStart = 1;
+
+    while (*s) {
+        if (comment) {
+            if (*s == '{') {
+                comment++;
+            } else if (*s == '}') {
+                comment--;
+            }
+            s++;
+            continue;
+        }
+        if (lineStart) {
+            lineStart = 0;
+            while (*s == ' ' || *s == '\t') {
+                s++;
+            }
+            if (*s == '#') {
+                /* a preprocessor directive */
+                while (*s && *s != '\n') {
+                    s++;
+                }
+            } else if (IsSection(s, "obj")) {
+                inObj = 1;
+                s += 3;
+            } else if (IsSection(s, "con") || IsSection(s, "var") || IsSection(s, "dat")
+                       || IsSection(s, "pub") || IsSection(s, "pri"))
+            {
+                inObj = 0;
+            }
+            continue;
+        }
+        switch (*s) {
+        case '\n':
+            lineStart = 1;
+            s++;
+            break;
+        case '\'':
+            while (*s && *s != '\n') {
+                s++;
+            }
+            break;
+        case '{':
+            comment = 1;
+            s++;
+            break;
+        case '"':
+            start = ++s;
+            while (*s && *s != '"' && *s != '\n') {
+                s++;
+            }
+            if (*s == '"') {
+                if (inObj && s > start) {
+                    name = strndup(start, s - start);
+                    AddJob(name, from);
+                    free(name);
+                }
+                s++;
+            }
+            break;
+        default:
+            s++;
+            break;
+        }
+    }
+}
+
+static void
+SendBytes(const void *data, size_t len)
+{
+    const char *p = (const char *)data;
+    ssize_t r;
+
+    while (len > 0) {
+        r = write(workerFd, p, len);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            /* the compile does not want any more */
+            _exit(0);
+        }
+        p += r;
+        len -= r;
+    }
+}
+
+static void
+SendRecord(char type, const char *fullName)
+{
+    SendBytes(&type, 1);
+    SendBytes(fullName, strlen(fullName) + 1);
+}
+
+static void
+RunWorker(int w)
+{
+    ParseJob *job = (ParseJob *)flexbuf_peek(&jobs);
+    size_t i, n = flexbuf_curlen(&jobs) / sizeof(ParseJob);
+    int fd;
+
+    /* anything the parses print is the compile's business */
+    fd = open("/dev/null", O_WRONLY);
+    if (fd >= 0) {
+        dup2(fd, 1);
+        dup2(fd, 2);
+        close(fd);
+    }
+    gl_printprogress = 0;
+    gl_verbosity = 0;
+    /* a worker parses the objects its own objects use itself; the
+       other workers' pipes are not ours to read */
+    numWorkers = 0;
+    for (i = 0; i < n; i++) {
+        if (job[i].worker == w) {
+            ParseJobFile(job[i].name, NewModule(job[i].from, job[i].fromLanguage));
+            SendRecord('D', job[i].fullName);
+        }
+    }
+    _exit(0);
+}
+
+int
+ParseJobsWorker(void)
+{
+    return workerFd >= 0;
+}
+
+void
+ParseJobsSave(const char *fullName, const char *text, const unsigned char *image, size_t len)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+
+    if (workerFd < 0 || !image) {
+        return;
+    }
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const BYTE *)text, strlen(text));
+    sha256_final(&ctx, hash);
+    SendRecord('I', fullName);
+    SendBytes(hash, sizeof(hash));
+    SendBytes(&len, sizeof(len));
+    SendBytes(image, len);
+}
+
+void
+ParseJobsStart(const char **names, int count)
+{
+    ParseJob *job;
+    size_t i, n;
+    int fds[2];
+    int w;
+    pid_t pid;
+
+    if (gl_jobs <= 1 || gl_watch) {
+        return;
+    }
+    PassTimeStart("start parse jobs");
+    flexbuf_init(&jobs, 64*sizeof(ParseJob));
+    flexbuf_init(&images, 64*sizeof(ParsedImage));
+    for (i = 0; i < (size_t)count; i++) {
+        AddJob(names[i], NULL);
+    }
+    if (numJobs == 0) {
+        PassTimeEnd("start parse jobs");
+        return;
+    }
+    numWorkers = gl_jobs;
+    if (numWorkers > numJobs) {
+        numWorkers = numJobs;
+    }
+    if (numWorkers > MAX_WORKERS) {
+        numWorkers = MAX_WORKERS;
+    }
+    /* deal the jobs out in turn, so the workers finish them in about
+       the order the compile needs them */
+    job = (ParseJob *)flexbuf_peek(&jobs);
+    n = flexbuf_curlen(&jobs) / sizeof(ParseJob);
+    for (i = 0, w = 0; i < n; i++) {
+        if (job[i].worker >= 0) {
+            job[i].worker = w++ % numWorkers;
+        }
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    for (w = 0; w < numWorkers; w++) {
+        workers[w].pid = 0;
+        workers[w].fd = -1;
+    }
+    for (w = 0; w < numWorkers; w++) {
+        if (pipe(fds) < 0) {
+            continue;
+        }
+        pid = fork();
+        if (pid == 0) {
+            int k;
+            for (k = 0; k < w; k++) {
+                if (workers[k].fd >= 0) {
+                    close(workers[k].fd);
+                    workers[k].fd = -1;
+                }
+            }
+            close(fds[0]);
+            workerFd = fds[1];
+            RunWorker(w);
+        }
+        close(fds[1]);
+        if (pid < 0) {
+            close(fds[0]);
+            continue;
+        }
+        workers[w].pid = pid;
+        workers[w].fd = fds[0];
+    }
+    PassTimeEnd("start parse jobs");
+}
+
+/* read len bytes from worker w; returns 0 at the end of its output */
+static int
+ReadBytes(int w, void *data, size_t len)
+{
+    char *p = (char *)data;
+    ssize_t r;
+
+    while (len > 0) {
+        r = read(workers[w].fd, p, len);
+        if (r < 0 && errno == EINTR) {
+            continue;
+        }
+        if (r <= 0) {
+            close(workers[w].fd);
+            workers[w].fd = -1;
+            return 0;
+        }
+        p += r;
+        len -= r;
+    }
+    return 1;
+}
+
+/* read a record from worker w; returns 0 at the end of its output */
+static int
+ReadRecord(int w)
+{
+    Flexbuf name;
+    ParsedImage rec;
+    ParseJob *job;
+    char type, c;
+
+    if (workers[w].fd < 0 || !ReadBytes(w, &type, 1)) {
+        return 0;
+    }
+    flexbuf_init(&name, 256);
+    do {
+        if (!ReadBytes(w, &c, 1)) {
+            flexbuf_delete(&name);
+            return 0;
+        }
+        flexbuf_addchar(&name, c);
+    } while (c);
+    if (type == 'D') {
+        job = FindJob(flexbuf_peek(&name));
+        if (job) {
+            job->done = 1;
+        }
+        flexbuf_delete(&name);
+        return 1;
+    }
+    rec.fullName = flexbuf_get(&name);
+    if (!ReadBytes(w, rec.hash, sizeof(rec.hash)) || !ReadBytes(w, &rec.len, sizeof(rec.len))) {
+        return 0;
+    }
+    rec.image = (unsigned char *)malloc(rec.len);
+    if (!ReadBytes(w, rec.image, rec.len)) {
+        free(rec.image);
+        return 0;
+    }
+    flexbuf_addmem(&images, (const char *)&rec, sizeof(rec));
+    return 1;
+}
+
+unsigned char *
+ParseJobsLookup(const char *fullName, const char *text, size_t *lenp)
+{
+    SHA256_CTX ctx;
+    BYTE hash[SHA256_BLOCK_SIZE];
+    ParseJob *job;
+    ParsedImage *rec;
+    unsigned char *image;
+    size_t i, n;
+
+    if (numWorkers == 0 || workerFd >= 0) {
+        return NULL;
+    }
+    job = FindJob(fullName);
+    if (job && job->worker >= 0 && !job->done) {
+        PassTimeStart("wait for parse jobs");
+        while (!job->done && ReadRecord(job->worker)) {
+            /* the job table does not move, so job stays valid */
+        }
+        PassTimeEnd("wait for parse jobs");
+    }
+
+    sha256_init(&ctx);
+    sha256_update(&ctx, (const BYTE *)text, strlen(text));
+    sha256_final(&ctx, hash);
+    rec = (ParsedImage *)flexbuf_peek(&images);
+    n = flexbuf_curlen(&images) / sizeof(ParsedImage);
+    for (i = 0; i < n; i++) {
+        if (rec[i].image && !strcmp(rec[i].fullName, fullName)
+            && !memcmp(rec[i].hash, hash, sizeof(hash)))
+        {
+            image = rec[i].image;
+            *lenp = rec[i].len;
+            rec[i].image = NULL;
+            numUsed++;
+            return image;
+        }
+    }
+    return NULL;
+}
+
+void
+ParseJobsFinish(void)
+{
+    ParsedImage *rec;
+    size_t i, n;
+    int w;
+
+    if (numWorkers == 0) {
+        return;
+    }
+    for (w = 0; w < numWorkers; w++) {
+        if (workers[w].fd >= 0) {
+            close(workers[w].fd);
+        }
+        if (workers[w].pid > 0) {
+            kill(workers[w].pid, SIGKILL);
+            waitpid(workers[w].pid, NULL, 0);
+        }
+    }
+    if (gl_verbosity) {
+        printf("parse: %d of %d objects parsed by %d workers\n", numUsed, numJobs, numWorkers);
+    }
+    rec = (ParsedImage *)flexbuf_peek(&images);
+    n = flexbuf_curlen(&images) / sizeof(ParsedImage);
+    for (i = 0; i < n; i++) {
+        free(rec[i].image);
+    }
+    flexbuf_delete(&images);
+    numWorkers = 0;
+}
+
+#endif
@@ -0,0 +1,35 @@
+/*
+ * Parsing Spin objects ahead of time in worker processes
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ */
+
+#ifndef PARSEJOBS_H_
+#define PARSEJOBS_H_
+
+#include <stddef.h>
+
+/*
+ * with -j N, start N worker processes to parse the Spin objects the
+ * top level files names[0..count-1] use; called before those files
+ * are parsed
+ */
+void ParseJobsStart(const char **names, int count);
+
+/*
+ * look for a parse of the Spin file fullName, with preprocessed text
+ * text, made by a worker; returns the image (to be freed by the
+ * caller) and sets *lenp, or returns NULL if there is none
+ */
+unsigned char *ParseJobsLookup(const char *fullName, const char *text, size_t *lenp);
+
+/* nonzero in a worker process, where parses should be captured */
+int ParseJobsWorker(void);
+
+/* in a worker, hand the image of a parse (or NULL) back to the compile */
+void ParseJobsSave(const char *fullName, const char *text, const unsigned char *image, size_t len);
+
+/* stop the workers; called once the top level files are parsed */
+void ParseJobsFinish(void);
+
+#endif
@@ -35,16 +35,14 @@
 #define NEED_ALIGNMENT (!gl_p2 && !gl_compress)
 #endif
 
-static char *
+static const char *
 NewOrgName()
 {
     static int counter;
-    char *buf;
+    char buf[32];
     ++counter;
-    buf = (char *)calloc(1, 32);
-    if (!buf) return buf;
     sprintf(buf, "..org%04x", counter);
-    return buf;
+    return InternString(buf);
 }
 
 unsigned
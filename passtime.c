@@ -0,0 +1,461 @@
+/*
+ * Compile time and memory statistics (--time-passes, --stats=json)
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * Three kinds of statistics are kept:
+ *
+ * phases: the main steps of the compile (preprocessing, parsing,
+ * type inference, code generation, ...). Phases nest; each one has a
+ * "total" time, from its outermost start to its end, and a "self"
+ * time, during which it was the innermost phase running. Self times
+ * add up to the wall time, so they are the ones to look at for where
+ * the time goes. The same goes for allocation volume.
+ *
+ * passes: the PASM optimizer passes. These run on the worker threads
+ * with -j, so their times are summed over all threads and may add up
+ * to more than the wall time.
+ *
+ * functions: compile and optimize time for each function compiled by
+ * the PASM back end; only the slowest few are reported.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "passtime.h"
+#include "util/workpool.h"
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+int gl_time_passes;
+int gl_time_passes_funcs = 10;
+const char *gl_stats_file;
+
+#define MAX_PHASES 32
+#define MAX_PHASE_DEPTH 64
+#define MAX_PASSES 64
+
+typedef struct PhaseStats {
+    const char *name;
+    unsigned calls;
+    unsigned active;        /* activations not yet ended */
+    double self;
+    double total;
+    double started;         /* start of the outermost activation */
+    size_t selfAlloc;
+    size_t totalAlloc;
+    size_t startAlloc;
+} PhaseStats;
+
+typedef struct PassStats {
+    const char *name;
+    unsigned runs;
+    unsigned changes;
+    unsigned skipped;
+    double secs;
+    size_t alloc;
+} PassStats;
+
+typedef struct FuncStats {
+    const char *name;
+    double compile;
+    double optimize;
+    struct FuncStats *next;
+} FuncStats;
+
+static double startTime;
+static unsigned long sourceLines;
+static size_t allocTotal;
+static THREAD_LOCAL size_t threadAlloc;
+
+static PhaseStats phases[MAX_PHASES];
+static int numPhases;
+static PhaseStats *phaseStack[MAX_PHASE_DEPTH];
+static int phaseDepth;
+static PhaseStats otherPhase = { "(other)" };
+static double markTime;     /* when the innermost phase last changed */
+static size_t markAlloc;
+
+static PassStats passes[MAX_PASSES];
+static int numPasses;
+
+#define FUNC_HASH_SIZE 1024
+static FuncStats *funcHash[FUNC_HASH_SIZE];
+static int numFuncs;
+
+double
+PassTimeNow(void)
+{
+#ifdef WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) {
+        QueryPerformanceFrequency(&freq);
+    }
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart / (double)freq.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/* peak resident set size in kilobytes, or 0 if unknown */
+static long
+PeakRSS(void)
+{
+#ifdef WIN32
+    return 0;
+#else
+    struct rusage ru;
+    if (getrusage(RUSAGE_SELF, &ru) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return ru.ru_maxrss / 1024;  /* bytes on MacOS */
+#else
+    return ru.ru_maxrss;
+#endif
+#endif
+}
+
+void
+PassTimeCountAlloc(size_t n)
+{
+    threadAlloc += n;
+#ifdef FLEXSPIN_THREADS
+    __atomic_fetch_add(&allocTotal, n, __ATOMIC_RELAXED);
+#else
+    allocTotal += n;
+#endif
+}
+
+size_t
+PassTimeThreadAlloc(void)
+{
+    return threadAlloc;
+}
+
+static size_t
+AllocTotal(void)
+{
+#ifdef FLEXSPIN_THREADS
+    return __atomic_load_n(&allocTotal, __ATOMIC_RELAXED);
+#else
+    return allocTotal;
+#endif
+}
+
+/*
+ * charge the time and memory since the last change of phase to the
+ * innermost phase
+ */
+static void
+ChargeInnermost(double now, size_t alloc)
+{
+    PhaseStats *P = phaseDepth ? phaseStack[phaseDepth-1] : &otherPhase;
+    P->self += now - markTime;
+    P->selfAlloc += alloc - markAlloc;
+    markTime = now;
+    markAlloc = alloc;
+}
+
+void
+PassTimeStart(const char *name)
+{
+    PhaseStats *P = NULL;
+    double now;
+    size_t alloc;
+    int i;
+
+    if (!gl_time_passes) return;
+    for (i = 0; i < numPhases; i++) {
+        if (!strcmp(phases[i].name, name)) {
+            P = &phases[i];
+            break;
+        }
+    }
+    if (!P) {
+        if (numPhases == MAX_PHASES || phaseDepth == MAX_PHASE_DEPTH) {
+            return;
+        }
+        P = &phases[numPhases++];
+        P->name = name;
+    }
+    if (phaseDepth == MAX_PHASE_DEPTH) {
+        return;
+    }
+    now = PassTimeNow();
+    alloc = AllocTotal();
+    ChargeInnermost(now, alloc);
+    P->calls++;
+    if (P->active++ == 0) {
+        P->started = now;
+        P->startAlloc = alloc;
+    }
+    phaseStack[phaseDepth++] = P;
+}
+
+static void
+EndInnermost(double now, size_t alloc)
+{
+    PhaseStats *P = phaseStack[--phaseDepth];
+    if (--P->active == 0) {
+        P->total += now - P->started;
+        P->totalAlloc += alloc - P->startAlloc;
+    }
+}
+
+void
+PassTimeEnd(const char *name)
+{
+    double now;
+    size_t alloc;
+
+    if (!gl_time_passes) return;
+    if (phaseDepth == 0 || strcmp(phaseStack[phaseDepth-1]->name, name) != 0) {
+        /* unbalanced, or the start was dropped because a table was full */
+        return;
+    }
+    now = PassTimeNow();
+    alloc = AllocTotal();
+    ChargeInnermost(now, alloc);
+    EndInnermost(now, alloc);
+}
+
+void
+PassTimeAddPass(const char *name, unsigned runs, unsigned changes, unsigned skipped, double secs, size_t alloc)
+{
+    PassStats *S = NULL;
+    int i;
+
+    WorkPoolLock();
+    for (i = 0; i < numPasses; i++) {
+        if (passes[i].name == name || !strcmp(passes[i].name, name)) {
+            S = &passes[i];
+            break;
+        }
+    }
+    if (!S && numPasses < MAX_PASSES) {
+        S = &passes[numPasses++];
+        S->name = name;
+    }
+    if (S) {
+        S->runs += runs;
+        S->changes += changes;
+        S->skipped += skipped;
+        S->secs += secs;
+        S->alloc += alloc;
+    }
+    WorkPoolUnlock();
+}
+
+void
+PassTimeAddFunction(const char *name, double compileSecs, double optimizeSecs)
+{
+    unsigned hash = 0;
+    const char *s;
+    FuncStats *F;
+
+    for (s = name; *s; s++) {
+        hash = hash * 31 + (unsigned char)*s;
+    }
+    hash &= (FUNC_HASH_SIZE-1);
+    WorkPoolLock();
+    for (F = funcHash[hash]; F; F = F->next) {
+        if (!strcmp(F->name, name)) break;
+    }
+    if (!F) {
+        F = (FuncStats *)calloc(1, sizeof(*F));
+        F->name = strdup(name);
+        F->next = funcHash[hash];
+        funcHash[hash] = F;
+        numFuncs++;
+    }
+    F->compile += compileSecs;
+    F->optimize += optimizeSecs;
+    WorkPoolUnlock();
+}
+
+void
+PassTimeSetLines(unsigned long lines)
+{
+    sourceLines = lines;
+}
+
+static int
+CompareFuncs(const void *a, const void *b)
+{
+    const FuncStats *A = *(const FuncStats **)a;
+    const FuncStats *B = *(const FuncStats **)b;
+    double ta = A->compile + A->optimize;
+    double tb = B->compile + B->optimize;
+    if (ta > tb) return -1;
+    if (ta < tb) return 1;
+    return strcmp(A->name, B->name);
+}
+
+/* returns the slowest functions, slowest first; *countp is set to how many */
+static FuncStats **
+SlowestFunctions(int *countp)
+{
+    FuncStats **list;
+    FuncStats *F;
+    int i, n = 0;
+
+    list = (FuncStats **)malloc((numFuncs + 1) * sizeof(*list));
+    for (i = 0; i < FUNC_HASH_SIZE; i++) {
+        for (F = funcHash[i]; F; F = F->next) {
+            list[n++] = F;
+        }
+    }
+    qsort(list, n, sizeof(*list), CompareFuncs);
+    if (n > gl_time_passes_funcs) {
+        n = gl_time_passes_funcs;
+    }
+    *countp = n;
+    return list;
+}
+
+static void
+PrintText(FILE *f, double wall)
+{
+    FuncStats **list;
+    int i, n;
+
+    fprintf(f, "\n%-28s %7s %10s %10s %12s\n", "phase", "calls", "self(s)", "total(s)", "self alloc(KB)");
+    for (i = 0; i < numPhases; i++) {
+        fprintf(f, "  %-26s %7u %10.4f %10.4f %12lu\n", phases[i].name, phases[i].calls,
+                phases[i].self, phases[i].total, (unsigned long)(phases[i].selfAlloc / 1024));
+    }
+    fprintf(f, "  %-26s %7s %10.4f %10s %12lu\n", otherPhase.name, "",
+            otherPhase.self, "", (unsigned long)(otherPhase.selfAlloc / 1024));
+    fprintf(f, "wall time %.4f s, allocated %lu KB, peak RSS %ld KB\n",
+            wall, (unsigned long)(AllocTotal() / 1024), PeakRSS());
+    if (sourceLines && wall > 0) {
+        fprintf(f, "%lu source lines, %.0f lines/s\n", sourceLines, sourceLines / wall);
+    }
+
+    if (numPasses) {
+        fprintf(f, "\n%-28s %8s %8s %8s %10s %10s\n", "optimizer pass", "runs", "changes", "skipped", "time(s)", "alloc(KB)");
+        for (i = 0; i < numPasses; i++) {
+            fprintf(f, "  %-26s %8u %8u %8u %10.4f %10lu\n", passes[i].name, passes[i].runs,
+                    passes[i].changes, passes[i].skipped, passes[i].secs,
+                    (unsigned long)(passes[i].alloc / 1024));
+        }
+    }
+    list = SlowestFunctions(&n);
+    if (n) {
+        fprintf(f, "\n%-40s %10s %11s\n", "slowest functions", "compile(s)", "optimize(s)");
+        for (i = 0; i < n; i++) {
+            fprintf(f, "  %-38s %10.4f %11.4f\n", list[i]->name, list[i]->compile, list[i]->optimize);
+        }
+    }
+    free(list);
+}
+
+static void
+PrintJsonString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < ' ') {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+static void
+PrintJson(FILE *f, double wall)
+{
+    FuncStats **list;
+    int i, n;
+
+    fprintf(f, "{\n  \"wall_seconds\": %.6f,\n", wall);
+    fprintf(f, "  \"source_lines\": %lu,\n", sourceLines);
+    fprintf(f, "  \"alloc_bytes\": %lu,\n", (unsigned long)AllocTotal());
+    fprintf(f, "  \"peak_rss_kb\": %ld,\n", PeakRSS());
+    fprintf(f, "  \"phases\": [");
+    for (i = 0; i <= numPhases; i++) {
+        PhaseStats *P = (i < numPhases) ? &phases[i] : &otherPhase;
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        PrintJsonString(f, P->name);
+        fprintf(f, ", \"calls\": %u, \"self_seconds\": %.6f, \"total_seconds\": %.6f, "
+                "\"self_alloc_bytes\": %lu, \"total_alloc_bytes\": %lu}",
+                P->calls, P->self, P->total,
+                (unsigned long)P->selfAlloc, (unsigned long)P->totalAlloc);
+    }
+    fprintf(f, "\n  ],\n  \"passes\": [");
+    for (i = 0; i < numPasses; i++) {
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        PrintJsonString(f, passes[i].name);
+        fprintf(f, ", \"runs\": %u, \"changes\": %u, \"skipped\": %u, \"seconds\": %.6f, \"alloc_bytes\": %lu}",
+                passes[i].runs, passes[i].changes, passes[i].skipped, passes[i].secs,
+                (unsigned long)passes[i].alloc);
+    }
+    fprintf(f, "%s],\n  \"functions\": [", numPasses ? "\n  " : "");
+    list = SlowestFunctions(&n);
+    for (i = 0; i < n; i++) {
+        fprintf(f, "%s\n    {\"name\": ", i ? "," : "");
+        PrintJsonString(f, list[i]->name);
+        fprintf(f, ", \"compile_seconds\": %.6f, \"optimize_seconds\": %.6f}",
+                list[i]->compile, list[i]->optimize);
+    }
+    free(list);
+    fprintf(f, "%s]\n}\n", n ? "\n  " : "");
+}
+
+static void
+PassTimeReport(void)
+{
+    double now = PassTimeNow();
+    size_t alloc = AllocTotal();
+    double wall = now - startTime;
+    FILE *f;
+
+    /* close any phases left open by an early exit */
+    ChargeInnermost(now, alloc);
+    while (phaseDepth > 0) {
+        EndInnermost(now, alloc);
+    }
+    fflush(stdout);
+    if (gl_time_passes & PASSTIME_TEXT) {
+        PrintText(stdout, wall);
+    }
+    if (gl_time_passes & PASSTIME_JSON) {
+        f = gl_stats_file ? fopen(gl_stats_file, "w") : stdout;
+        if (!f) {
+            fprintf(stderr, "Unable to open statistics file: ");
+            perror(gl_stats_file);
+            return;
+        }
+        PrintJson(f, wall);
+        if (f != stdout) {
+            fclose(f);
+        }
+    }
+    fflush(stdout);
+}
+
+void
+PassTimeInit(int flags)
+{
+    if (!gl_time_passes) {
+        startTime = markTime = PassTimeNow();
+        atexit(PassTimeReport);
+    }
+    gl_time_passes |= flags;
+}
@@ -0,0 +1,58 @@
+/*
+ * Compile time and memory statistics (--time-passes, --stats=json)
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ */
+
+#ifndef PASSTIME_H_
+#define PASSTIME_H_
+
+#include <stddef.h>
+
+/* bits for gl_time_passes */
+#define PASSTIME_TEXT 0x01  /* print a table to stdout */
+#define PASSTIME_JSON 0x02  /* write JSON to stdout or gl_stats_file */
+
+extern int gl_time_passes;
+extern int gl_time_passes_funcs;    /* how many of the slowest functions to list */
+extern const char *gl_stats_file;   /* file for the JSON report, or NULL for stdout */
+
+/*
+ * turn on statistics gathering; the report is printed when the
+ * program exits, so it covers compiles that stop early with errors
+ */
+void PassTimeInit(int flags);
+
+/* seconds since some fixed point in the past */
+double PassTimeNow(void);
+
+/*
+ * mark the start and end of a compiler phase; phases may nest, and
+ * time spent in an inner phase is not counted as "self" time of the
+ * outer one. Only the main thread should call these.
+ */
+void PassTimeStart(const char *name);
+void PassTimeEnd(const char *name);
+
+/*
+ * count n bytes allocated for compiler data structures; the
+ * allocations counted are AST nodes, identifier strings, and IR
+ * instructions and operands
+ */
+void PassTimeCountAlloc(size_t n);
+#define CountAlloc(n) do { if (gl_time_passes) PassTimeCountAlloc(n); } while (0)
+
+/* bytes counted by PassTimeCountAlloc on the calling thread */
+size_t PassTimeThreadAlloc(void);
+
+/*
+ * add statistics for one optimizer pass, or for one function;
+ * these may be called from any thread
+ */
+void PassTimeAddPass(const char *name, unsigned runs, unsigned changes, unsigned skipped, double secs, size_t alloc);
+void PassTimeAddFunction(const char *name, double compileSecs, double optimizeSecs);
+
+/* record the number of source lines compiled, for lines per second */
+void PassTimeSetLines(unsigned long lines);
+
+#endif
@@ -58,6 +58,8 @@
 
 // hook for keeping track of source files
 extern void AddSourceFile(const char *shortName, const char *fullName);
+// and of places we looked for a file but did not find it
+extern void CacheNoteMissing(const char *fullName);
 
 #ifdef _MSC_VER
 # ifndef strdup
@@ -1069,12 +1071,14 @@ find_file_relative(struct preprocess *pp, const char *name, const char *ext, con
   strcat(ret, name);
   f = fopen_fileonly(ret, "r");
   if (!f && ext) {
+    CacheNoteMissing(ret);
     strcat(ret, ext);
     f = fopen_fileonly(ret, "r");
   }
   //printf("... trying %s\n", ret);
   if (!f) {
     /* give up */
+    CacheNoteMissing(ret);
     free(ret);
     ret = NULL;
   }
@@ -1369,9 +1373,11 @@ int gl_errors;
 
 struct preprocess gl_pp;
 
-/* dummy stub */
+/* dummy stubs */
 void AddSourceFile(const char *, const char *) {
 }
+void CacheNoteMissing(const char *) {
+}
 
 /* test code */
 char *
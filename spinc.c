@@ -34,6 +34,11 @@
 #include "spinc.h"
 #include "preprocess.h"
 #include "version.h"
+#include "sysimage.h"
+#include "compcache.h"
+#include "watch.h"
+#include "parsejobs.h"
+#include "passtime.h"
 #include "mcpp/mcpp_lib.h"
 
 //#define DEBUG_YACC
@@ -100,6 +105,15 @@ makeClassNameSafe(Module *P)
 #include "sys/gc_pasm.spin.h"
 #include "sys/gc_bytecode.spin.h"
 
+/* parse one part of the system code; the parts share a stream */
+static void
+parseSystemCode(const char *code, size_t len, const char *name)
+{
+    freeLexLines(systemModule->Lptr);
+    strToLex(systemModule->Lptr, code, len, name, LANG_SPIN_SPIN1);
+    spinyyparse();
+}
+
 void
 InitGlobalModule(void)
 {
@@ -198,55 +212,54 @@ InitGlobalModule(void)
         saveyydebug = spinyydebug;  // do not show parser debug output for system
         spinyydebug = 0;
 
-        // add in processor specific code
-        if (gl_output == OUTPUT_BYTECODE) {
-            switch (gl_interp_kind) {
-            case INTERP_KIND_P1ROM:
-                syscode = (const char *)sys_bytecode_rom_spin;
-                syscode_len = sys_bytecode_rom_spin_len;
-                break;
-            case INTERP_KIND_NUCODE:
-                syscode = (const char *)sys_nucode_util_spin;
-                syscode_len = sys_nucode_util_spin_len;
-                break;
-            default:
-                ERROR(NULL, "No internal code for bytecode type\n");
-                break;
-            }
-        } else {
-            if (gl_p2) {
-                syscode = (const char *)sys_p2_code_spin;
-                syscode_len = sys_p2_code_spin_len;
-            } else {
-                syscode = (const char *)sys_p1_code_spin;
-                syscode_len = sys_p1_code_spin_len;
-            }
-        }
         gl_normalizeIdents = 0;
         systemModule->Lptr = (LexStream *)calloc(sizeof(*systemModule->Lptr), 1);
         systemModule->Lptr->flags |= LEXSTREAM_FLAG_NOSRC;
-        strToLex(systemModule->Lptr, syscode, syscode_len, "_system_", LANG_SPIN_SPIN1);
-        spinyyparse();
+        // use the parse done at build time if there is one for our options
+        PassTimeStart("system module");
+        if (!LoadSystemImage(systemModule)) {
+            // add in processor specific code
+            if (gl_output == OUTPUT_BYTECODE) {
+                switch (gl_interp_kind) {
+                case INTERP_KIND_P1ROM:
+                    syscode = (const char *)sys_bytecode_rom_spin;
+                    syscode_len = sys_bytecode_rom_spin_len;
+                    break;
+                case INTERP_KIND_NUCODE:
+                    syscode = (const char *)sys_nucode_util_spin;
+                    syscode_len = sys_nucode_util_spin_len;
+                    break;
+                default:
+                    ERROR(NULL, "No internal code for bytecode type\n");
+                    break;
+                }
+            } else {
+                if (gl_p2) {
+                    syscode = (const char *)sys_p2_code_spin;
+                    syscode_len = sys_p2_code_spin_len;
+                } else {
+                    syscode = (const char *)sys_p1_code_spin;
+                    syscode_len = sys_p1_code_spin_len;
+                }
+            }
+            parseSystemCode(syscode, syscode_len, "_system_");
 
-        // add common PASM code
-        if (gl_output != OUTPUT_BYTECODE) {
-            strToLex(systemModule->Lptr, (const char *)sys_common_pasm_spin, sys_common_pasm_spin_len, "_common_pasm_", LANG_SPIN_SPIN1);
-            spinyyparse();
-        }
-        strToLex(systemModule->Lptr, (const char *)sys_common_spin, sys_common_spin_len, "_common_", LANG_SPIN_SPIN1);
-        spinyyparse();
-        strToLex(systemModule->Lptr, (const char *)sys_float_spin, sys_float_spin_len, "_float_", LANG_SPIN_SPIN1);
-        spinyyparse();
-        strToLex(systemModule->Lptr, (const char *)sys_gcalloc_spin, sys_gcalloc_spin_len, "_gc_", LANG_SPIN_SPIN1);
-        spinyyparse();
-        if (gl_output == OUTPUT_BYTECODE) {
-            strToLex(systemModule->Lptr, (const char *)sys_gc_bytecode_spin, sys_gc_bytecode_spin_len, "_platform_", LANG_SPIN_SPIN1);
-            spinyyparse();
-        } else {
-            strToLex(systemModule->Lptr, (const char *)sys_gc_pasm_spin, sys_gc_pasm_spin_len, "_platform_", LANG_SPIN_SPIN1);
-            spinyyparse();
+            // add common PASM code
+            if (gl_output != OUTPUT_BYTECODE) {
+                parseSystemCode((const char *)sys_common_pasm_spin, sys_common_pasm_spin_len, "_common_pasm_");
+            }
+            parseSystemCode((const char *)sys_common_spin, sys_common_spin_len, "_common_");
+            parseSystemCode((const char *)sys_float_spin, sys_float_spin_len, "_float_");
+            parseSystemCode((const char *)sys_gcalloc_spin, sys_gcalloc_spin_len, "_gc_");
+            if (gl_output == OUTPUT_BYTECODE) {
+                parseSystemCode((const char *)sys_gc_bytecode_spin, sys_gc_bytecode_spin_len, "_platform_");
+            } else {
+                parseSystemCode((const char *)sys_gc_pasm_spin, sys_gc_pasm_spin_len, "_platform_");
+            }
+            SaveSystemImage(systemModule);
         }
         ProcessModule(systemModule);
+        PassTimeEnd("system module");
 
         curfunc = NULL;
         /* restore temp variable base */
@@ -352,6 +365,8 @@ GetFullFileName(AST *baseString)
     if (!newname) {
         newname = strdup(basename);
     }
+    /* the file is not covered by the cache key for the parse */
+    ParseImageBlock("it uses FILE");
     AddSourceFile(basename, newname);
     ret = NewAST(AST_STRING, NULL, NULL);
     ret->d.string = newname;
@@ -515,19 +530,19 @@ getObjFileExtension(const char *fname)
     return ext;
 }
 
-static Module *
-doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
+/*
+ * find the source file "name", as a reference to it from module
+ * "from" (or from the command line, if from is NULL) would; returns
+ * the name to open, and sets *languagep to its language and
+ * *shortNamep to the name with any default extension added
+ */
+char *
+FindSourceFile(const char *name, Module *from, int *languagep, char **shortNamep)
 {
-    FILE *f = NULL;
-    Module *save, *Q, *LastQ;
     char *fname = NULL;
-    char *parseString = NULL;
+    char *shortName = NULL;
     char *langptr;
     int language = LANG_SPIN_SPIN1;
-    SymbolTable *saveCurrentTypes = NULL;
-    int new_module = 0;
-    const char *fullName = NULL;
-    char *shortName = NULL;
     bool needExtension = false;
 
     // check language to process
@@ -600,10 +615,10 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
         // if currently compiling a Spin1 program assume Spin1
         // as the default
         needExtension = true;
-        if (current && current->mainLanguage == LANG_SPIN_SPIN1) {
+        if (from && from->mainLanguage == LANG_SPIN_SPIN1) {
             langptr = ".spin";
             language = LANG_SPIN_SPIN1;
-        } else if (current && current->mainLanguage == LANG_SPIN_SPIN2) {
+        } else if (from && from->mainLanguage == LANG_SPIN_SPIN2) {
             langptr = ".spin2";
             language = LANG_SPIN_SPIN2;
         } else if (gl_p2) {
@@ -614,17 +629,17 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
             language = LANG_SPIN_SPIN1;
         }
     }
-    if (current) {
-        fname = find_file_on_path(&gl_pp, name, langptr, current->fullname);
+    if (from) {
+        fname = find_file_on_path(&gl_pp, name, langptr, from->fullname);
         if (!fname) {
             if (!strcasecmp(langptr, ".spin2")) {
-                fname = find_file_on_path(&gl_pp, name, ".spin", current->fullname);
+                fname = find_file_on_path(&gl_pp, name, ".spin", from->fullname);
                 if (fname) {
                     language = LANG_SPIN_SPIN1;
                     langptr = ".spin";
                 }
             } else if (!strcasecmp(langptr, ".spin")) {
-                fname = find_file_on_path(&gl_pp, name, ".spin2", current->fullname);
+                fname = find_file_on_path(&gl_pp, name, ".spin2", from->fullname);
                 if (fname) {
                     language = LANG_SPIN_SPIN2;
                     langptr = ".spin2";
@@ -648,6 +663,28 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
     } else {
         shortName = strdup(name);
     }
+    *languagep = language;
+    *shortNamep = shortName;
+    return fname;
+}
+
+static Module *
+doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
+{
+    FILE *f = NULL;
+    Module *save, *Q, *LastQ;
+    char *fname = NULL;
+    char *parseString = NULL;
+    int language;
+    SymbolTable *saveCurrentTypes = NULL;
+    int new_module = 0;
+    const char *fullName = NULL;
+    char *shortName = NULL;
+
+    // a rebuild in watch mode may start here
+    WatchSnapshot();
+
+    fname = FindSourceFile(name, current, &language, &shortName);
     fullName = MakeAbsolutePath(fname);
     if (gl_useFullPaths) {
         fname = (char *)fullName;
@@ -741,6 +778,7 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
     if (gl_preprocess) {
         void *defineState;
 
+        PassTimeStart("preprocess");
 #define MAX_MCPP_ARGC 255
         if (IsCLang(language)) {
             /* use mcpp */
@@ -756,19 +794,26 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
             argv[argc++] = fname;
             argv[argc] = NULL;
 
-            mcpp_use_mem_buffers(1);
-            r = mcpp_lib_main(argc, argv);
-            errString = mcpp_get_mem_buffer(ERR);
-            parseString = mcpp_get_mem_buffer(OUT);
-            if (r != 0) {
-                if (errString) {
-                    ERROR(NULL, "Preprocessor errors:\n%s", errString);
-                } else {
-                    ERROR(NULL, "Preprocessor failed!\n");
+            /* with --cache-dir, reuse the output of an earlier run */
+            parseString = CachePreprocessLookup(fullName, argc, argv);
+            if (!parseString) {
+                mcpp_use_mem_buffers(1);
+                r = mcpp_lib_main(argc, argv);
+                errString = mcpp_get_mem_buffer(ERR);
+                parseString = mcpp_get_mem_buffer(OUT);
+                if (r != 0) {
+                    if (errString) {
+                        ERROR(NULL, "Preprocessor errors:\n%s", errString);
+                    } else {
+                        ERROR(NULL, "Preprocessor failed!\n");
+                    }
+                    exit(1);
+                } else if (errString && strlen(errString)) {
+                    WARNING(NULL, "Preprocessor warnings:\n%s", errString);
+                }
+                if (parseString) {
+                    CachePreprocessStore(parseString, errString && strlen(errString));
                 }
-                exit(1);
-            } else if (errString && strlen(errString)) {
-                WARNING(NULL, "Preprocessor warnings:\n%s", errString);
             }
         } else if (IsBasicLang(language) || IsSpinLang(language)) {
             SetPreprocessorLanguage(language);
@@ -786,16 +831,56 @@ doParseFile(const char *name, Module *P, int *is_dup, AST *paramlist)
             parseString = pp_finish(&gl_pp);
             pp_restore_define_state(&gl_pp, defineState);
         }
+        PassTimeEnd("preprocess");
     }
 
+    PassTimeStart("parse");
     if (parseString) {
-        strToLex(NULL, parseString, strlen(parseString), fname, language);
-        doparse(language);
+        char imageKey[CACHE_KEY_SIZE];
+        unsigned char *image = NULL;
+        size_t imageLen = 0;
+        int capture = 0;
+        ParseImageCapture cap;
+
+        /* reuse the parse of an unchanged Spin object from --cache-dir,
+           or one made by a -j worker; not one with OBJ parameters,
+           which the parse depends on */
+        imageKey[0] = 0;
+        if (new_module && !P->objparams && IsSpinLang(language)) {
+            image = CacheParseLookup(fullName, parseString, imageKey);
+            if (!image) {
+                image = ParseJobsLookup(fullName, parseString, &imageLen);
+            }
+            capture = image || imageKey[0] || ParseJobsWorker();
+        }
+        if (capture) {
+            StartParseImage(&cap, P);
+        }
+        if (!image || !LoadParseImage(&cap, image)) {
+            strToLex(NULL, parseString, strlen(parseString), fname, language);
+            doparse(language);
+            if (capture) {
+                const char *why;
+                size_t len = 0;
+                unsigned char *data = FinishParseImage(&cap, &len, &why);
+                if (ParseJobsWorker()) {
+                    ParseJobsSave(fullName, parseString, data, len);
+                } else if (imageKey[0]) {
+                    CacheParseStore(imageKey, fullName, data, len, why);
+                }
+                free(data);
+            }
+        } else if (imageLen && imageKey[0]) {
+            /* keep a worker's parse in the cache too */
+            CacheParseStore(imageKey, fullName, image, imageLen, NULL);
+        }
+        free(image);
         free(parseString);
     } else {
         fileToLex(NULL, f, fname, language);
         doparse(language);
     }
+    PassTimeEnd("parse");
     fclose(f);
 
     if (gl_errors >= gl_max_errors) {
@@ -848,6 +933,21 @@ ParseFile(const char *name, AST *params)
     return LoadFileIntoModule(name, NULL, params);
 }
 
+/*
+ * parse the file "name" as an OBJ declaration in module "from" would,
+ * but without processing it; for the workers in parsejobs.c
+ */
+void
+ParseJobFile(const char *name, Module *from)
+{
+    Module *save = current;
+    int is_dup = 0;
+
+    current = from;
+    doParseFile(name, NULL, &is_dup, NULL);
+    current = save;
+}
+
 //
 // now that we've figured out what's reachable, remove
 // uncalled methods from modules
@@ -1326,27 +1426,38 @@ FixupCode(Module *P, int isBinary)
         return;
     }
 
+    PassTimeStart("high level optimize");
     for (Q = allparse; Q; Q = Q->next) {
         if (Q->functions) {
             DoHighLevelOptimize(Q);
         }
-        if (gl_errors) return;
+        if (gl_errors) {
+            PassTimeEnd("high level optimize");
+            return;
+        }
     }
+    PassTimeEnd("high level optimize");
 
+    PassTimeStart("resolve symbols");
     do {
         CheckUnusedMethods(isBinary);
         changes = ResolveSymbols();
     } while (changes && gl_errors == 0);
+    PassTimeEnd("resolve symbols");
 
     if (gl_errors >= gl_max_errors) {
         return;
     }
     RemoveUnusedMethods(isBinary);
+    PassTimeStart("type inference");
     doTypeInference();
+    PassTimeEnd("type inference");
 
+    PassTimeStart("cse");
     for (Q = allparse; Q; Q = Q->next) {
         PerformCSE(Q);
     }
+    PassTimeEnd("cse");
 
     // fix up any internal array references (e.g. for LOOKUP/LOOKDOWN)
     for (Q = allparse; Q; Q = Q->next) {
@@ -1623,6 +1734,8 @@ ParseTopFiles(const char *argv[], int argc, int outputBin)
     Module *P = NULL;
     current = allparse = NULL;
 
+    // with -j, start parsing the objects the files use in the background
+    ParseJobsStart(argv, argc);
     while (argc > 0) {
         name = *argv++;
         currentTypes = NULL;
@@ -1646,6 +1759,7 @@ ParseTopFiles(const char *argv[], int argc, int outputBin)
             P = doParseFile(startupName, P, &is_dup, NULL);
         }
     }
+    ParseJobsFinish();
     ProcessModule(P);
     if (P && gl_errors < gl_max_errors) {
         FixupCode(P, outputBin);
@@ -1653,6 +1767,88 @@ ParseTopFiles(const char *argv[], int argc, int outputBin)
     return P;
 }
 
+/*
+ * like ParseTopFiles, but parses text that is already in memory
+ * (typically assembly generated by the PASM back end); the text
+ * is assumed to be fully preprocessed already, so the preprocessor
+ * is skipped. "name" is used for the module name and for error messages.
+ */
+Module *
+ParseTopBuffer(const char *name, const char *text, size_t len, int outputBin)
+{
+    Module *P;
+
+    P = NewTopAsmModule(name);
+    strToLex(NULL, text, len, name, P->curLanguage);
+    doparse(P->curLanguage);
+    return FinishTopAsmModule(P, outputBin);
+}
+
+/*
+ * start an empty top level module (resetting the global state, as
+ * ParseTopFiles does) to hold generated assembly; it becomes the
+ * current module, so its DAT section may be filled in either by
+ * ParseAsmFragment or directly
+ */
+Module *
+NewTopAsmModule(const char *name)
+{
+    Module *P;
+    int language = gl_p2 ? LANG_SPIN_SPIN2 : LANG_SPIN_SPIN1;
+
+    current = allparse = NULL;
+    currentTypes = NULL;
+    P = allparse = NewModule(name, language);
+    P->fromUsing = 1;
+    P->curLanguage = language;
+    P->parent = NULL;
+    current = P;
+    currentTypes = (SymbolTable *)calloc(1, sizeof(*currentTypes));
+    currentTypes->next = &P->objsyms;
+    currentTypes->flags = SYMTAB_FLAG_NOCASE;
+    AddSymbol(&P->objsyms, name, SYM_FILE, (void *)0, NULL);
+    return P;
+}
+
+/*
+ * parse a piece of generated assembly into the current module (which
+ * must come from NewTopAsmModule); "lastGlobal" is the label that
+ * local labels at the start of the text belong to, if any
+ * returns the stream the text was read from
+ */
+LexStream *
+ParseAsmFragment(const char *text, size_t len, const char *lastGlobal)
+{
+    LexStream *L;
+
+    strToLex(NULL, text, len, current->fullname, current->curLanguage);
+    L = current->Lptr;
+    L->lastGlobal = lastGlobal;
+    doparse(current->curLanguage);
+    return L;
+}
+
+/*
+ * finish a module started with NewTopAsmModule: resolve its
+ * symbols and lay out its code
+ */
+Module *
+FinishTopAsmModule(Module *P, int outputBin)
+{
+    if (gl_errors >= gl_max_errors) {
+        return NULL;
+    }
+    makeClassNameSafe(P);
+    P->datname = "dat";
+    current = NULL;
+    currentTypes = NULL;
+    ProcessModule(P);
+    if (gl_errors < gl_max_errors) {
+        FixupCode(P, outputBin);
+    }
+    return P;
+}
+
 Function *
 GetMainFunction(Module *P)
 {
@@ -55,10 +55,24 @@ void ProcessModule(Module *P);
 // parse a spin file; params is optional list of overriden constants
 Module *ParseFile(const char *name, AST *params);
 
+// find the source file name, as a reference to it from module from would
+char *FindSourceFile(const char *name, Module *from, int *languagep, char **shortNamep);
+
+// parse name as an OBJ child of from, without processing it
+void ParseJobFile(const char *name, Module *from);
+
 // parse top level spin files (resets global state)
 // outputBin is nonzero if we are outputting binary code
 Module *ParseTopFiles(const char *argv[], int argc, int outputBin);
 
+// like ParseTopFiles, but parses already preprocessed text held in memory
+Module *ParseTopBuffer(const char *name, const char *text, size_t len, int outputBin);
+
+// pieces of ParseTopBuffer, for building the module out of generated code
+Module *NewTopAsmModule(const char *name);
+LexStream *ParseAsmFragment(const char *text, size_t len, const char *lastGlobal);
+Module *FinishTopAsmModule(Module *P, int outputBin);
+
 // calculate number of expression items that may be placed on the stack
 int NumExprItemsOnStack(AST *param);
 
@@ -0,0 +1,94 @@
+//
+// Micro-benchmark for symbol table lookups
+// Times LookupSymbolInTable over every symbol in the system module,
+// plus upper cased variants (case insensitive hits) and misses.
+//
+// usage: symbench [-2] [iterations]
+//
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include "spinc.h"
+#include "cmdline.h"
+
+static double
+getCurTime(void)
+{
+    return (double)clock() / (double)CLOCKS_PER_SEC;
+}
+
+static const char **names;
+static int numnames;
+
+static int
+collectName(Symbol *sym, void *arg)
+{
+    const char *s = sym->our_name;
+    size_t len = strlen(s);
+    char *up = (char *)malloc(len + 1);
+    char *miss = (char *)malloc(len + 3);
+    size_t i;
+
+    for (i = 0; i <= len; i++) {
+        up[i] = toupper((unsigned char)s[i]);
+    }
+    strcpy(miss, s);
+    strcat(miss, "_q");
+    names[numnames++] = s;
+    names[numnames++] = up;
+    names[numnames++] = miss;
+    return 1;
+}
+
+static int
+countSymbol(Symbol *sym, void *arg)
+{
+    (*(int *)arg)++;
+    return 1;
+}
+
+int
+main(int argc, const char **argv)
+{
+    static CmdLineOptions cmd;
+    SymbolTable *table;
+    long iterations = 2000;
+    long i;
+    int j, count = 0, found = 0;
+    double start, elapsed;
+
+    InitializeSystem(&cmd, argv);
+    argv++; --argc;
+    if (argc > 0 && !strcmp(argv[0], "-2")) {
+        gl_p2 = DEFAULT_P2_VERSION;
+        argv++; --argc;
+    }
+    if (argc > 0) {
+        iterations = atol(argv[0]);
+    }
+    gl_output = OUTPUT_ASM;
+    Init();
+
+    table = &systemModule->objsyms;
+    IterateOverSymbols(table, countSymbol, &count);
+    names = (const char **)calloc(3 * count, sizeof(*names));
+    IterateOverSymbols(table, collectName, NULL);
+
+    start = getCurTime();
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < numnames; j++) {
+            if (LookupSymbolInTable(table, names[j])) {
+                found++;
+            }
+        }
+    }
+    elapsed = getCurTime() - start;
+
+    printf("%d symbols in system module, %ld x %d lookups (%d found)\n",
+           count, iterations, numnames, found);
+    printf("%.3f s total, %.1f ns per lookup\n", elapsed,
+           1e9 * elapsed / ((double)iterations * numnames));
+    return 0;
+}
@@ -4,6 +4,9 @@
 #include <stdio.h>
 #include "symbol.h"
 #include "util/util.h"
+#include "util/arena.h"
+#include "util/workpool.h"
+#include "passtime.h"
 
 extern int gl_caseSensitive;
 
@@ -24,46 +27,170 @@ RawSymbolHash(const char *str)
     return hash;
 }
 
+/*
+ * the hash used to pick buckets in tables indexed by masking off the
+ * low bits; the low bits of RawSymbolHash are just the xor of the
+ * characters (so e.g. anagrams always collide), so mix the high bits
+ * back down first
+ */
 unsigned
-SymbolHash(const char *str)
+TableHash(const char *str)
 {
     unsigned hash = RawSymbolHash(str);
-    return hash % SYMTABLE_HASH_SIZE;
+
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6b;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35;
+    hash ^= hash >> 16;
+    return hash;
 }
 
-/* find a symbol in the table */
-//extern inline Symbol *FindSymbol(SymbolTable *table, const char *name);
+/*
+ * a small hash value, for callers (like CSE) that just want
+ * to spread names over a few buckets
+ */
+unsigned
+SymbolHash(const char *str)
+{
+    unsigned hash = RawSymbolHash(str);
+    return hash % 128;
+}
 
-Symbol *
-FindSymbolEx(SymbolTable *table, const char *name,int forceCaseSens)
+/*
+ * find a symbol with the given name and (full) hash in the table
+ * the hash ignores case, so we only have to compare the strings
+ * of symbols whose hash matches
+ */
+static Symbol *
+FindSymbolHashed(SymbolTable *table, const char *name, unsigned hash, int nocase)
 {
-    unsigned hash;
     Symbol *sym;
-    int nocase = ((table->flags & SYMTAB_FLAG_NOCASE) != 0) && !gl_caseSensitive;
-    if (forceCaseSens) nocase = forceCaseSens < 0; // 1 forces case sensitive, -1 forces case insensitive
-    hash = SymbolHash(name);
-    sym = table->hash[hash];
 
+    if (!table->hash) {
+        return NULL;
+    }
+    sym = table->hash[hash & (table->hash_size - 1)];
     if (nocase) {
         while (sym) {
-            if (!strcasecmp(sym->our_name, name)) {
+            if (sym->our_name == name || (sym->hash == hash && !strcasecmp(sym->our_name, name))) {
                 return sym;
             }
             sym = sym->next;
         }
     } else {
         while (sym) {
-            if (!strcmp(sym->our_name, name)) {
+            if (sym->our_name == name || (sym->hash == hash && !strcmp(sym->our_name, name))) {
                 return sym;
             }
             sym = sym->next;
         }
     }
-    /* symbol was not found, give up */
-    /* it's up to our caller to look through a containing context */
     return NULL;
 }
 
+/*
+ * string interning: InternString returns one canonical copy of each
+ * distinct spelling, so names that went through it may be compared
+ * by pointer. The comparison is case sensitive; case insensitive
+ * lookups still have to fall back on strcasecmp.
+ */
+typedef struct InternEntry {
+    struct InternEntry *next;
+    unsigned hash;
+    char str[1];
+} InternEntry;
+
+static struct {
+    InternEntry **hash;
+    unsigned hash_size;
+    unsigned count;
+    Arena mem;
+} internTable;
+
+static void
+GrowInternTable(void)
+{
+    unsigned newsize = internTable.hash_size ? 2*internTable.hash_size : 1024;
+    InternEntry **newhash = (InternEntry **)calloc(newsize, sizeof(InternEntry *));
+    InternEntry *E, *next;
+    unsigned i;
+
+    if (!newhash) {
+        fprintf(stderr, "FATAL ERROR: out of memory\n");
+        abort();
+    }
+    for (i = 0; i < internTable.hash_size; i++) {
+        for (E = internTable.hash[i]; E; E = next) {
+            next = E->next;
+            E->next = newhash[E->hash & (newsize-1)];
+            newhash[E->hash & (newsize-1)] = E;
+        }
+    }
+    free(internTable.hash);
+    internTable.hash = newhash;
+    internTable.hash_size = newsize;
+}
+
+const char *
+InternString(const char *str)
+{
+    unsigned hash;
+    size_t len;
+    InternEntry *E;
+
+    if (!str) {
+        return NULL;
+    }
+    // the empty string is very common (immediate operands), so
+    // give it a fixed address that needs no lookup or lock
+    if (!str[0]) {
+        return "";
+    }
+    hash = TableHash(str);
+    WorkPoolLock();
+    if (internTable.hash) {
+        for (E = internTable.hash[hash & (internTable.hash_size-1)]; E; E = E->next) {
+            if (E->str == str || (E->hash == hash && !strcmp(E->str, str))) {
+                WorkPoolUnlock();
+                return E->str;
+            }
+        }
+    }
+    if (internTable.count >= internTable.hash_size) {
+        if (!internTable.hash) {
+            ArenaInit(&internTable.mem, 0);
+        }
+        GrowInternTable();
+    }
+    len = strlen(str);
+    E = (InternEntry *)ArenaAlloc(&internTable.mem, sizeof(*E) + len);
+    CountAlloc(sizeof(*E) + len);
+    E->hash = hash;
+    memcpy(E->str, str, len+1);
+    E->next = internTable.hash[hash & (internTable.hash_size-1)];
+    internTable.hash[hash & (internTable.hash_size-1)] = E;
+    internTable.count++;
+    WorkPoolUnlock();
+    return E->str;
+}
+
+/* find a symbol in the table */
+//extern inline Symbol *FindSymbol(SymbolTable *table, const char *name);
+
+#define TableIsNoCase(table) ((((table)->flags & SYMTAB_FLAG_NOCASE) != 0) && !gl_caseSensitive)
+
+Symbol *
+FindSymbolEx(SymbolTable *table, const char *name,int forceCaseSens)
+{
+    int nocase = TableIsNoCase(table);
+    if (forceCaseSens) nocase = forceCaseSens < 0; // 1 forces case sensitive, -1 forces case insensitive
+
+    /* if the symbol was not found it's up to our caller to look
+       through a containing context */
+    return FindSymbolHashed(table, name, TableHash(name), nocase);
+}
+
 //
 // like FindSymbol, but goes back through previous contexts too
 //
@@ -71,10 +198,13 @@ Symbol *
 FindSymbolInContext(SymbolTable *table, const char *name)
 {
     Symbol *sym;
-    if (!table) return NULL;
-    sym = FindSymbolEx(table, name, 0);
-    if (sym) return sym;
-    return FindSymbolInContext(table->next, name);
+    unsigned hash = TableHash(name);
+    while (table) {
+        sym = FindSymbolHashed(table, name, hash, TableIsNoCase(table));
+        if (sym) return sym;
+        table = table->next;
+    }
+    return NULL;
 }
 
 /* find a symbol in a table or in any of its links */
@@ -83,12 +213,12 @@ static Symbol *
 doLookupSymbolInTable(SymbolTable *table, const char *name, int level)
 {
     Symbol *sym = NULL;
+    SymbolTable *t;
+    unsigned hash;
     if (!table) return NULL;
-    sym = FindSymbol(table, name);
-    if (!sym) {
-        if (table->next) {
-           sym = doLookupSymbolInTable(table->next, name, level);
-	}
+    hash = TableHash(name);
+    for (t = table; t && !sym; t = t->next) {
+        sym = FindSymbolHashed(t, name, hash, TableIsNoCase(t));
     }
     if (sym && IsAlias(sym)) {
         // have to look it up again
@@ -127,16 +257,11 @@ LookupSymbolInTable(SymbolTable *table, const char *name)
 Symbol *
 FindSymbolByOffsetAndKind(SymbolTable *table, int offset, int kind)
 {
-    Symbol *sym = NULL;
-    int hash;
-    for (hash = 0; hash < SYMTABLE_HASH_SIZE; hash++) {
-        sym = table->hash[hash];
-        while (sym) {
-            if (sym->offset == offset && sym->kind == kind)
-            {
-                return sym;
-            }
-            sym = sym->next;
+    Symbol *sym;
+    for (sym = table->i_first; sym; sym = sym->i_next) {
+        if (sym->offset == offset && sym->kind == kind)
+        {
+            return sym;
         }
     }
     /* could not find it */
@@ -175,6 +300,42 @@ NewSymbol(void)
     return sym;
 }
 
+/*
+ * double the number of buckets in a table
+ */
+static void
+GrowSymbolTable(SymbolTable *table)
+{
+    unsigned newsize = table->hash_size ? 2*table->hash_size : SYMTABLE_INITIAL_HASH_SIZE;
+    Symbol **newhash = (Symbol **)calloc(newsize, sizeof(Symbol *));
+    Symbol *sym, *next;
+    unsigned i, j;
+
+    if (!newhash) {
+        fprintf(stderr, "FATAL ERROR: out of memory\n");
+        abort();
+    }
+    /* keep the relative order within each chain, so that
+       lookups of duplicate names still find the newest one */
+    for (i = 0; i < table->hash_size; i++) {
+        Symbol **tail[2];
+        j = i;
+        tail[0] = &newhash[i];
+        tail[1] = &newhash[i + table->hash_size];
+        for (sym = table->hash[i]; sym; sym = next) {
+            next = sym->next;
+            j = (sym->hash & table->hash_size) ? 1 : 0;
+            *tail[j] = sym;
+            tail[j] = &sym->next;
+        }
+        *tail[0] = NULL;
+        *tail[1] = NULL;
+    }
+    free(table->hash);
+    table->hash = newhash;
+    table->hash_size = newsize;
+}
+
 /*
  * add a symbol to the table
  * returns NULL if there was a conflict
@@ -183,45 +344,28 @@ Symbol *
 AddSymbol(SymbolTable *table, const char *name, int type, void *val, const char *user_name)
 {
     unsigned hash;
+    Symbol **bucket;
     Symbol *sym;
-    int nocase = ((table->flags & SYMTAB_FLAG_NOCASE) != 0) && !gl_caseSensitive;
+    int nocase = TableIsNoCase(table);
     
-    hash = SymbolHash(name);
-    sym = table->hash[hash];
-    if (nocase) {
-        while (sym) {
-            if (!strcasecmp(sym->our_name, name)) {
-                if (sym->kind == SYM_WEAK_ALIAS) {
-                    // it's OK to override aliases
-                    break;
-                }
-                return NULL;
-            }
-            sym = sym->next;
-        }
-    } else {
-        while (sym) {
-            if (!strcmp(sym->our_name, name)) {
-                if (sym->kind == SYM_WEAK_ALIAS) {
-                    // it's OK to override aliases
-                    break;
-                }
-                return NULL;
-            }
-            sym = sym->next;
-        }
-    }
-
+    hash = TableHash(name);
+    sym = FindSymbolHashed(table, name, hash, nocase);
     if (sym) {
         // it's OK for us to override a weak alias
         if (sym->kind != SYM_WEAK_ALIAS) {
-            fprintf(stderr, "Duplicate definition for symbol `%s'\n", user_name);
+            return NULL;
         }
     }
+    if (table->count >= table->hash_size) {
+        GrowSymbolTable(table);
+    }
     
     sym = NewSymbol();
-    sym->next = table->hash[hash];
-    table->hash[hash] = sym;
+    sym->hash = hash;
+    bucket = &table->hash[hash & (table->hash_size - 1)];
+    sym->next = *bucket;
+    *bucket = sym;
+    table->count++;
     // now link into global list
     if (table->i_last) {
         table->i_last->i_next = sym;
@@ -231,8 +375,8 @@ AddSymbol(SymbolTable *table, const char *name, int type, void *val, const char
     }
     sym->i_next = 0;
 
-    sym->our_name = name;
-    sym->user_name = user_name ? user_name : name;
+    sym->our_name = InternString(name);
+    sym->user_name = user_name ? user_name : sym->our_name;
     sym->kind = (Symtype)type;
     sym->v.ptr = val;
     sym->module = 0;
@@ -240,6 +384,25 @@ AddSymbol(SymbolTable *table, const char *name, int type, void *val, const char
     return sym;
 }
 
+/*
+ * free all the symbols in a table, and its buckets, leaving an empty
+ * table; only for scratch tables that nothing else points into
+ */
+void
+FreeSymbolTable(SymbolTable *table)
+{
+    Symbol *sym, *next;
+
+    for (sym = table->i_first; sym; sym = next) {
+        next = sym->i_next;
+        free(sym);
+    }
+    free(table->hash);
+    table->hash = NULL;
+    table->hash_size = table->count = 0;
+    table->i_first = table->i_last = NULL;
+}
+
 Symbol *
 AddInternalSymbol(SymbolTable *table, const char *name, int type, void *val, const char *user_name)
 {
@@ -47,6 +47,7 @@ typedef union {
 //
 typedef struct symbol {
     struct symbol *next;  /* next in hash table */
+    unsigned      hash;   /* full (case folded) hash of our_name */
     const char   *user_name;   /* name given by the user */
     const char   *our_name;    /* internal compiler name */
     Symtype       kind;   /* kind of symbol */
@@ -77,11 +78,18 @@ typedef struct symbol {
  *  function symbols -> module symbols -> global symbols
  */
 
-/* make this a power of two, please */
-#define SYMTABLE_HASH_SIZE 128
+/*
+ * the bucket array is allocated on the first insertion and doubles
+ * in size whenever the table holds more symbols than buckets;
+ * an all-zero SymbolTable is a valid empty table
+ * make this a power of two, please
+ */
+#define SYMTABLE_INITIAL_HASH_SIZE 16
 
 typedef struct symtab {
-    Symbol *hash[SYMTABLE_HASH_SIZE];
+    Symbol **hash;        /* buckets, NULL until something is added */
+    unsigned hash_size;   /* number of buckets */
+    unsigned count;       /* number of symbols in the table */
     struct symtab *next;
     unsigned flags;
     Symbol *i_first;  // for iterating over symbols
@@ -90,6 +98,8 @@ typedef struct symtab {
 #define SYMTAB_FLAG_NOCASE 0x01  /* do case insensitive comparisons */
 
 unsigned RawSymbolHash(const char *str);
+unsigned TableHash(const char *str);
+const char *InternString(const char *str);
 unsigned SymbolHash(const char *str);
 Symbol *AddSymbol(SymbolTable *table, const char *name, int type, void *val, const char *user_name);
 Symbol *FindSymbolEx(SymbolTable *table, const char *name,int forceCaseSens);
@@ -99,6 +109,9 @@ Symbol *LookupSymbolInTable(SymbolTable *table, const char *name);
 #define FindSymbol(t, n) FindSymbolEx( (t), (n), 0)
 Symbol *FindSymbolInContext(SymbolTable *table, const char *name);
 
+/* free all the symbols in a table that nothing else refers to */
+void FreeSymbolTable(SymbolTable *table);
+
 /* like AddSymbol, but sets the SYMF_INTERNAL flag */
 Symbol *AddInternalSymbol(SymbolTable *table, const char *name, int type, void *val, const char *user_name);
 
@@ -0,0 +1,1128 @@
+/*
+ * Precompiled image of the system module
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * Every compile starts by lexing and parsing the Spin source of the
+ * built in system functions (the .spin files in sys), and for a
+ * small program that is most of the work. At build time mksysimage
+ * does that parse for the common targets and records the results:
+ * the AST lists hanging off the module, the constants and aliases
+ * the parser put into its symbol table, and the line information
+ * the AST nodes refer to. InitGlobalModule then rebuilds those from
+ * the image instead of parsing. ProcessModule and everything after
+ * it run as before, since they depend on the optimization flags.
+ *
+ * An image is only used if the options that affect lexing and
+ * parsing are the same as when it was made; otherwise we parse.
+ *
+ * The compile cache uses the same format to save the parse of
+ * ordinary Spin objects (StartParseImage and FinishParseImage around
+ * the parse, LoadParseImage instead of it). Such an image also lists
+ * the OBJ children the parse found, which loading parses again in the
+ * same order, and the names the lexer looked up in them (for
+ * "child.name"); if a child no longer gives the same answer the image
+ * is not used, and the object is parsed with the children already
+ * loaded. A parse that depends on anything else outside its own text
+ * and the options (e.g. a type from a child object, or a directive
+ * changing the options) is not saved.
+ *
+ * An image is a sequence of unsigned LEB128 numbers (signed values
+ * are zigzag encoded):
+ *   magic, the option key
+ *   strings: count, then for each a flag (1 if interned) and the
+ *     bytes including the trailing 0
+ *   nodes: count, then for each the kind, the data, left, right
+ *     and line index + 1 (0 if the node has no line information)
+ *   OBJ children: count, then for each the name, the parameter
+ *     list node and the fromUsing flag
+ *   lookups in children: count, then for each the child index + 1,
+ *     the name and what was found (see LookupKind)
+ *   the module's AST fields, then its scalar fields
+ *   symbols added by the parser
+ *   the lexer state and its line information
+ *   the temporary variable counter
+ * Strings are referred to as index + 1 and nodes as index + 1 +
+ * the number of shared nodes, with 0 meaning NULL.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <string.h>
+#include "spinc.h"
+#include "sysimage.h"
+
+#define SYSIMAGE_MAGIC 0x53495331  /* "SIS1" */
+#define MODIMAGE_MAGIC 0x4d4f4431  /* "MOD1" */
+
+extern SymbolTable pasmWords;
+extern Instruction *instr;
+
+#ifdef FLEXSPIN_SYSIMAGE
+#include "sysimage_data.h"
+static const unsigned char *const sysImages[] = {
+    sysimage_p1, sysimage_p2, sysimage_p1rom, sysimage_p2nu, NULL
+};
+#else
+static const unsigned char *const sysImages[] = { NULL };
+#endif
+
+/* options the parse of the system code depends on */
+#define NUM_KEYS 10
+static void
+GetImageKey(int *key)
+{
+    key[0] = gl_p2;
+    key[1] = gl_output;
+    key[2] = gl_interp_kind;
+    key[3] = gl_debug;
+    key[4] = gl_brkdebug;
+    key[5] = gl_fixedreal;
+    key[6] = gl_srccomments;
+    key[7] = gl_tab_stops;
+    key[8] = gl_run_charset;
+    key[9] = gl_gas_dat;
+}
+
+/* nodes created before the system module that the parse may share */
+static AST **sharedNodes[] = {
+    &ast_type_long, &ast_type_word, &ast_type_byte,
+    &ast_type_c_boolean_small, &ast_type_basic_boolean_small,
+    &ast_type_c_boolean, &ast_type_basic_boolean,
+    &ast_type_unsigned_long, &ast_type_signed_word, &ast_type_signed_byte,
+    &ast_type_float, &ast_type_float64, &ast_type_string,
+    &ast_type_generic, &ast_type_const_generic, &ast_type_void,
+    &ast_type_ptr_long64, &ast_type_ptr_long, &ast_type_ptr_word,
+    &ast_type_ptr_byte, &ast_type_ptr_void, &ast_type_bitfield,
+    &ast_type_long64, &ast_type_unsigned_long64, &ast_type_generic_funcptr,
+    &ast_type_sendptr, &ast_type_recvptr,
+};
+#define NUM_SHARED (sizeof(sharedNodes)/sizeof(sharedNodes[0]))
+
+/* module fields holding parse results */
+static const size_t moduleNodes[] = {
+    offsetof(Module, conblock),
+    offsetof(Module, datblock),
+    offsetof(Module, pendingvarblock),
+    offsetof(Module, finalvarblock),
+    offsetof(Module, objblock),
+    offsetof(Module, funcblock),
+    offsetof(Module, topcomment),
+    offsetof(Module, botcomment),
+    offsetof(Module, objparams),
+    offsetof(Module, datblock_tail),
+    offsetof(Module, conblock_tail),
+    offsetof(Module, parse_tail),
+    offsetof(Module, datannotations),
+    offsetof(Module, bas_data),
+    offsetof(Module, bas_data_tail),
+    offsetof(Module, body),
+    offsetof(Module, type),
+};
+#define NUM_MODULE_NODES (sizeof(moduleNodes)/sizeof(moduleNodes[0]))
+#define MODULE_NODE(P, i) (*(AST **)((char *)(P) + moduleNodes[i]))
+
+/* module fields the parse must leave alone */
+static const size_t modulePointers[] = {
+    offsetof(Module, functions),
+    offsetof(Module, Lptr),
+    offsetof(Module, name_space),
+    offsetof(Module, fullname),
+    offsetof(Module, basename),
+    offsetof(Module, classname),
+    offsetof(Module, outfilename),
+    offsetof(Module, datname),
+    offsetof(Module, bedata),
+    offsetof(Module, subclasses),
+    offsetof(Module, superclass),
+    offsetof(Module, parent),
+};
+#define NUM_MODULE_POINTERS (sizeof(modulePointers)/sizeof(modulePointers[0]))
+#define MODULE_POINTER(P, i) (*(void **)((char *)(P) + modulePointers[i]))
+
+/* an OBJ child of an object whose parse is being saved */
+typedef struct ImageChild {
+    const char *name;
+    AST *params;
+    Module *module;
+} ImageChild;
+
+/* a name the lexer looked up in an OBJ child */
+typedef struct ImageLookup {
+    Module *module;
+    const char *name;
+    int kind;
+} ImageLookup;
+
+/* how the data of a node is stored */
+enum {
+    DATA_INT,       /* an integer */
+    DATA_STRING,    /* a string */
+    DATA_NODE,      /* another node */
+    DATA_INSTR,     /* index into the instruction table */
+    DATA_NAME,      /* hardware register or modifier, found by name */
+    DATA_IMM,       /* immediate modifier made by AstInstrModifier */
+    DATA_MODULE,    /* an OBJ child, by its index in the image */
+    DATA_NONE,      /* a pointer that cannot be saved */
+};
+
+static int
+DataKind(AST *ast)
+{
+    switch (ast->kind) {
+    case AST_IDENTIFIER:
+    case AST_TEMP_IDENTIFIER:
+    case AST_STRING:
+    case AST_BYTECODE:
+    case AST_COMMENT:
+    case AST_SRCCOMMENT:
+    case AST_ANNOTATION:
+        return DATA_STRING;
+    case AST_PUBFUNC:
+    case AST_PRIFUNC:
+    case AST_ARRAYTYPE:
+        return DATA_NODE;
+    case AST_OBJECT:
+        return DATA_MODULE;
+    case AST_SYMBOL:
+        return DATA_NONE;
+    case AST_INSTR:
+        return DATA_INSTR;
+    case AST_HWREG:
+    case AST_INSTRMODIFIER:
+        return DATA_NAME;
+    default:
+        return DATA_INT;
+    }
+}
+
+static uint64_t
+ZigZag(int64_t x)
+{
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+static int64_t
+UnZigZag(uint64_t x)
+{
+    return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+/*
+ * what a lookup of a name in another object found, as far as the
+ * lexer is concerned; -1 if the result refers into that object
+ */
+static int
+LookupKind(Symbol *sym)
+{
+    AST *typ;
+
+    if (!sym) {
+        return 0;
+    }
+    if (sym->kind == SYM_TYPEDEF) {
+        return -1;
+    }
+    if (sym->kind == SYM_VARIABLE) {
+        typ = (AST *)sym->v.ptr;
+        if (typ && (typ->kind == AST_OBJECT || typ->kind == AST_TYPEDEF)) {
+            return -1;
+        }
+        return 1;
+    }
+    return 2;
+}
+
+/*
+ * reading an image
+ */
+
+static uint64_t
+GetNum(const unsigned char **pp)
+{
+    const unsigned char *p = *pp;
+    uint64_t x = 0;
+    int shift = 0;
+    unsigned c;
+
+    do {
+        c = *p++;
+        x |= (uint64_t)(c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *pp = p;
+    return x;
+}
+
+typedef struct ImageReader {
+    const unsigned char *p;
+    const char **strs;
+    AST *nodes;
+    AST *shared[NUM_SHARED];
+} ImageReader;
+
+static const char *
+GetString(ImageReader *R)
+{
+    uint64_t n = GetNum(&R->p);
+    return n ? R->strs[n-1] : NULL;
+}
+
+static AST *
+GetNode(ImageReader *R)
+{
+    uint64_t n = GetNum(&R->p);
+    if (n == 0) {
+        return NULL;
+    }
+    if (n <= NUM_SHARED) {
+        return R->shared[n-1];
+    }
+    return &R->nodes[n-1-NUM_SHARED];
+}
+
+static int
+ReadImage(Module *P, const unsigned char *image, unsigned magic, const int *key, ParseImageCapture *cap)
+{
+    ImageReader R;
+    LexStream *L;
+    LineInfo info;
+    Symbol *sym;
+    Module **children;
+    ImageChild rec;
+    AST *params;
+    size_t i, count, numnodes, numchildren;
+    int kind, flags, offset, fromUsing;
+    int same = 1;
+    const char *name, *user_name;
+    void *val;
+
+    R.p = image;
+    if (GetNum(&R.p) != magic) {
+        return 0;
+    }
+    for (i = 0; i < NUM_KEYS; i++) {
+        if (UnZigZag(GetNum(&R.p)) != key[i]) {
+            return 0;
+        }
+    }
+    /* the module is left alone until we know the image can be used */
+    L = P->Lptr ? P->Lptr : (LexStream *)calloc(sizeof(*L), 1);
+
+    /* strings */
+    count = GetNum(&R.p);
+    R.strs = (const char **)malloc(count * sizeof(*R.strs));
+    for (i = 0; i < count; i++) {
+        int interned = GetNum(&R.p);
+        name = (const char *)R.p;
+        R.p += strlen(name) + 1;
+        R.strs[i] = interned ? InternString(name) : AstStrdup(name);
+    }
+
+    /* nodes */
+    for (i = 0; i < NUM_SHARED; i++) {
+        R.shared[i] = *sharedNodes[i];
+    }
+    numnodes = GetNum(&R.p);
+    R.nodes = (AST *)AstAlloc(numnodes * sizeof(AST));
+    for (i = 0; i < numnodes; i++) {
+        AST *ast = &R.nodes[i];
+        uint64_t lineidx;
+
+        ast->kind = (enum astkind)GetNum(&R.p);
+        switch (GetNum(&R.p)) {
+        case DATA_INT:
+        case DATA_MODULE:
+            /* modules are filled in once the children are loaded */
+            ast->d.ival = (uint64_t)UnZigZag(GetNum(&R.p));
+            break;
+        case DATA_STRING:
+            ast->d.string = GetString(&R);
+            break;
+        case DATA_NODE:
+            ast->d.ptr = (void *)GetNode(&R);
+            break;
+        case DATA_INSTR:
+            ast->d.ptr = (void *)&instr[GetNum(&R.p)];
+            break;
+        case DATA_NAME:
+            sym = FindSymbol(&pasmWords, GetString(&R));
+            ast->d.ptr = sym ? sym->v.ptr : NULL;
+            break;
+        case DATA_IMM:
+            ast->d.ptr = AstInstrModifier((int32_t)UnZigZag(GetNum(&R.p)))->d.ptr;
+            break;
+        }
+        ast->left = GetNode(&R);
+        ast->right = GetNode(&R);
+        lineidx = GetNum(&R.p);
+        if (lineidx) {
+            ast->lexdata = L;
+            ast->lineidx = (int)(lineidx - 1);
+        } else {
+            ast->lexdata = NULL;
+            ast->lineidx = 0;
+        }
+    }
+
+    /* OBJ children */
+    numchildren = GetNum(&R.p);
+    children = (Module **)malloc((numchildren + 1) * sizeof(*children));
+    for (i = 0; i < numchildren; i++) {
+        name = GetString(&R);
+        params = GetNode(&R);
+        fromUsing = GetNum(&R.p);
+        children[i] = ParseFile(name, params);
+        children[i]->fromUsing = fromUsing;
+        if (cap) {
+            rec.name = name;
+            rec.params = params;
+            rec.module = children[i];
+            flexbuf_addmem(&cap->replay, (const char *)&rec, sizeof(rec));
+        }
+    }
+
+    /* the children must still give the same answers */
+    count = GetNum(&R.p);
+    for (i = 0; i < count; i++) {
+        size_t idx = GetNum(&R.p);
+        name = GetString(&R);
+        kind = GetNum(&R.p);
+        if (same && LookupKind(LookupSymbolInTable(&children[idx-1]->objsyms, name)) != kind) {
+            same = 0;
+        }
+    }
+    if (!same) {
+        free(children);
+        free(R.strs);
+        if (L != P->Lptr) {
+            free(L);
+        }
+        return 0;
+    }
+    P->Lptr = L;
+
+    /* module */
+    for (i = 0; i < NUM_MODULE_NODES; i++) {
+        if (GetNum(&R.p)) {
+            MODULE_NODE(P, i) = GetNode(&R);
+        }
+    }
+    P->varsize = UnZigZag(GetNum(&R.p));
+    P->datsize = UnZigZag(GetNum(&R.p));
+    P->pasmLabels = GetNum(&R.p);
+    P->volatileVariables = GetNum(&R.p);
+    P->sawToken = GetNum(&R.p);
+    P->codeCog = GetNum(&R.p);
+    P->datHasCode = GetNum(&R.p);
+    P->gasPasm = GetNum(&R.p);
+    P->isUnion = GetNum(&R.p);
+    P->isInterface = GetNum(&R.p);
+    P->defaultPrivate = GetNum(&R.p);
+    P->longOnly = GetNum(&R.p);
+    P->fromUsing = GetNum(&R.p);
+    P->isPacked = GetNum(&R.p);
+    P->mainLanguage = GetNum(&R.p);
+    P->curLanguage = GetNum(&R.p);
+    P->curLangVersion = GetNum(&R.p);
+
+    /* symbols */
+    count = GetNum(&R.p);
+    for (i = 0; i < count; i++) {
+        kind = GetNum(&R.p);
+        flags = GetNum(&R.p);
+        offset = UnZigZag(GetNum(&R.p));
+        name = GetString(&R);
+        user_name = GetString(&R);
+        if (kind == SYM_WEAK_ALIAS) {
+            val = (void *)GetString(&R);
+        } else {
+            val = (void *)GetNode(&R);
+        }
+        sym = AddSymbol(&P->objsyms, name, kind, val, user_name);
+        sym->flags = flags;
+        sym->offset = offset;
+    }
+
+    /* lexer */
+    name = GetString(&R);
+    strToLex(L, "", 0, name, GetNum(&R.p));
+    L->language_version = GetNum(&R.p);
+    L->block_type = GetNum(&R.p);
+    L->lineCounter = GetNum(&R.p);
+    L->colCounter = GetNum(&R.p);
+    L->firstNonBlank = GetNum(&R.p);
+    L->eoln = GetNum(&R.p);
+    L->eof = GetNum(&R.p);
+    L->flags = GetNum(&R.p);
+    L->lastGlobal = GetString(&R);
+    count = GetNum(&R.p);
+    for (i = 0; i < count; i++) {
+        info.fileName = GetString(&R);
+        info.lineno = GetNum(&R.p);
+        info.linedata = (char *)GetString(&R);
+        flexbuf_addmem(&L->lineInfo, (char *)&info, sizeof(info));
+    }
+
+    i = GetNum(&R.p);
+    if (magic == SYSIMAGE_MAGIC) {
+        SetTempVariableBase((int)i, 0);
+    }
+
+    for (i = 0; i < numnodes; i++) {
+        if (R.nodes[i].kind == AST_OBJECT) {
+            size_t idx = (size_t)R.nodes[i].d.ival;
+            R.nodes[i].d.ptr = idx ? (void *)children[idx-1] : NULL;
+        }
+    }
+    free(children);
+    free(R.strs);
+    return 1;
+}
+
+/*
+ * writing an image (only done by mksysimage)
+ */
+
+static FILE *captureFile;
+static const char *captureName;
+static Module captureBefore;    /* the module before the parse */
+static Symbol *captureLastSym;  /* its last symbol */
+
+/* innermost parse being captured for the compile cache */
+static ParseImageCapture *activeCapture;
+
+typedef struct ImageWriter {
+    Flexbuf *out;
+    LexStream *L;
+
+    /* for module images a failure stops the save rather than the program */
+    int soft;
+    char failed[128];
+    ImageChild *children;
+    size_t numchildren;
+    ImageLookup *lookups;
+    size_t numlookups;
+
+    /* nodes in order of their index, with a hash from address to index */
+    AST **nodes;
+    size_t numnodes, maxnodes;
+    size_t *nodeslot;
+    size_t nodemask;
+
+    /* likewise for strings */
+    const char **strs;
+    size_t numstrs, maxstrs;
+    size_t *strslot;
+    size_t strmask;
+} ImageWriter;
+
+static void
+ImageFail(ImageWriter *W, const char *fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    if (W->soft) {
+        if (!W->failed[0]) {
+            vsnprintf(W->failed, sizeof(W->failed), fmt, args);
+        }
+        va_end(args);
+        return;
+    }
+    fprintf(stderr, "mksysimage: ");
+    vfprintf(stderr, fmt, args);
+    fprintf(stderr, "\n");
+    va_end(args);
+    exit(1);
+}
+
+static void
+PutNum(ImageWriter *W, uint64_t x)
+{
+    do {
+        unsigned c = x & 0x7f;
+        x >>= 7;
+        if (x) c |= 0x80;
+        flexbuf_addchar(W->out, c);
+    } while (x);
+}
+
+static size_t
+PtrHash(const void *p)
+{
+    uintptr_t x = (uintptr_t)p;
+    x ^= x >> 17;
+    x *= 0x9e3779b1U;
+    return (size_t)(x ^ (x >> 15));
+}
+
+static size_t *
+GrowSlots(size_t *oldslot, size_t oldmask, size_t *newmask, size_t (*hashfn)(void *, size_t), void *arg)
+{
+    size_t size = oldslot ? 2*(oldmask+1) : 1024;
+    size_t *slot = (size_t *)calloc(size, sizeof(*slot));
+    size_t i, h;
+
+    for (i = 0; oldslot && i <= oldmask; i++) {
+        if (oldslot[i]) {
+            h = hashfn(arg, oldslot[i]-1) & (size-1);
+            while (slot[h]) h = (h+1) & (size-1);
+            slot[h] = oldslot[i];
+        }
+    }
+    free(oldslot);
+    *newmask = size-1;
+    return slot;
+}
+
+static size_t
+NodeHashAt(void *arg, size_t idx)
+{
+    return PtrHash(((ImageWriter *)arg)->nodes[idx]);
+}
+
+static size_t
+StrHashAt(void *arg, size_t idx)
+{
+    return TableHash(((ImageWriter *)arg)->strs[idx]);
+}
+
+/* find or add a string, returning its reference */
+static size_t
+StringRef(ImageWriter *W, const char *s)
+{
+    size_t h;
+
+    if (!s) {
+        return 0;
+    }
+    if (2*(W->numstrs+1) > W->strmask) {
+        W->strslot = GrowSlots(W->strslot, W->strmask, &W->strmask, StrHashAt, W);
+    }
+    h = TableHash(s) & W->strmask;
+    while (W->strslot[h]) {
+        const char *t = W->strs[W->strslot[h]-1];
+        if (!strcmp(s, t) && (InternString(s) == s) == (InternString(t) == t)) {
+            return W->strslot[h];
+        }
+        h = (h+1) & W->strmask;
+    }
+    if (W->numstrs == W->maxstrs) {
+        W->maxstrs = W->maxstrs ? 2*W->maxstrs : 1024;
+        W->strs = (const char **)realloc(W->strs, W->maxstrs * sizeof(*W->strs));
+    }
+    W->strs[W->numstrs++] = s;
+    W->strslot[h] = W->numstrs;
+    return W->numstrs;
+}
+
+static void
+PutString(ImageWriter *W, const char *s)
+{
+    PutNum(W, StringRef(W, s));
+}
+
+/* find or add a node, returning its reference */
+static size_t
+NodeRef(ImageWriter *W, AST *ast)
+{
+    size_t h;
+    size_t i;
+
+    if (!ast) {
+        return 0;
+    }
+    for (i = 0; i < NUM_SHARED; i++) {
+        if (ast == *sharedNodes[i]) {
+            return i+1;
+        }
+    }
+    if (2*(W->numnodes+1) > W->nodemask) {
+        W->nodeslot = GrowSlots(W->nodeslot, W->nodemask, &W->nodemask, NodeHashAt, W);
+    }
+    h = PtrHash(ast) & W->nodemask;
+    while (W->nodeslot[h]) {
+        if (W->nodes[W->nodeslot[h]-1] == ast) {
+            return W->nodeslot[h] + NUM_SHARED;
+        }
+        h = (h+1) & W->nodemask;
+    }
+    if (ast->lexdata && ast->lexdata != W->L) {
+        ImageFail(W, "node of kind %d was not made by this parse", ast->kind);
+    }
+    if (W->numnodes == W->maxnodes) {
+        W->maxnodes = W->maxnodes ? 2*W->maxnodes : 4096;
+        W->nodes = (AST **)realloc(W->nodes, W->maxnodes * sizeof(*W->nodes));
+    }
+    W->nodes[W->numnodes++] = ast;
+    W->nodeslot[h] = W->numnodes;
+    return W->numnodes + NUM_SHARED;
+}
+
+static void
+PutNode(ImageWriter *W, AST *ast)
+{
+    PutNum(W, NodeRef(W, ast));
+}
+
+/* returns 1 if a symbol table entry whose value is ptr can be found by name */
+static int
+FoundByName(const char *name, void *ptr)
+{
+    Symbol *sym = FindSymbol(&pasmWords, name);
+    return sym && sym->v.ptr == ptr;
+}
+
+static void
+PutNodeData(ImageWriter *W, AST *ast)
+{
+    int kind = DataKind(ast);
+    const char *name;
+    size_t idx;
+
+    switch (kind) {
+    case DATA_INT:
+        /* catch node kinds that really hold a pointer */
+        if ( (ast->d.ival >> 40) != 0 && (ast->d.ival >> 40) != 0xffffff ) {
+            ImageFail(W, "node of kind %d holds %llx, which looks like a pointer", ast->kind, (unsigned long long)ast->d.ival);
+        }
+        PutNum(W, DATA_INT);
+        PutNum(W, ZigZag((int64_t)ast->d.ival));
+        break;
+    case DATA_STRING:
+        PutNum(W, DATA_STRING);
+        PutString(W, ast->d.string);
+        break;
+    case DATA_NODE:
+        PutNum(W, DATA_NODE);
+        PutNode(W, (AST *)ast->d.ptr);
+        break;
+    case DATA_INSTR:
+        for (idx = 0; instr[idx].name; idx++) {
+            if (&instr[idx] == (Instruction *)ast->d.ptr) break;
+        }
+        if (!instr[idx].name) {
+            ImageFail(W, "instruction not found in table");
+        }
+        PutNum(W, DATA_INSTR);
+        PutNum(W, idx);
+        break;
+    case DATA_NAME:
+        /* HwReg and InstrModifier both start with the name */
+        name = *(const char **)ast->d.ptr;
+        if (FoundByName(name, ast->d.ptr)) {
+            PutNum(W, DATA_NAME);
+            PutString(W, name);
+        } else if (ast->kind == AST_INSTRMODIFIER && (!strcmp(name, "#") || !strcmp(name, "##"))) {
+            PutNum(W, DATA_IMM);
+            PutNum(W, ZigZag((int32_t)((InstrModifier *)ast->d.ptr)->modifier));
+        } else {
+            ImageFail(W, "cannot find %s by name", name);
+        }
+        break;
+    case DATA_MODULE:
+        for (idx = 0; idx < W->numchildren; idx++) {
+            if (W->children[idx].module == (Module *)ast->d.ptr) break;
+        }
+        if (ast->d.ptr && idx == W->numchildren) {
+            ImageFail(W, "object is not an OBJ child of this module");
+        }
+        PutNum(W, DATA_MODULE);
+        PutNum(W, ZigZag(ast->d.ptr ? (int64_t)idx + 1 : 0));
+        break;
+    default:
+        ImageFail(W, "node of kind %d holds a pointer", ast->kind);
+        PutNum(W, DATA_INT);
+        PutNum(W, 0);
+        break;
+    }
+}
+
+static void
+PutLexer(ImageWriter *W, LexStream *L)
+{
+    LineInfo *info = (LineInfo *)flexbuf_peek(&L->lineInfo);
+    size_t i, count = getLineInfoIndex(L);
+
+    PutString(W, L->fileName);
+    PutNum(W, L->language);
+    PutNum(W, L->language_version);
+    PutNum(W, L->block_type);
+    PutNum(W, L->lineCounter);
+    PutNum(W, L->colCounter);
+    PutNum(W, L->firstNonBlank);
+    PutNum(W, L->eoln);
+    PutNum(W, L->eof);
+    PutNum(W, L->flags);
+    PutString(W, L->lastGlobal);
+    PutNum(W, count);
+    for (i = 0; i < count; i++) {
+        PutString(W, info[i].fileName);
+        PutNum(W, info[i].lineno);
+        PutString(W, info[i].linedata);
+    }
+}
+
+/*
+ * write the image of the parse of P; "before" is the module as it was
+ * before the parse and lastSym its last symbol. Returns the image, or
+ * NULL if W->soft is set and the parse could not be saved.
+ */
+static unsigned char *
+WriteImage(ImageWriter *W, Module *P, const Module *before, Symbol *lastSym, unsigned magic, size_t *lenp)
+{
+    Flexbuf head, nodes, body;
+    Symbol *sym;
+    size_t i, count;
+    int key[NUM_KEYS];
+
+    for (i = 0; i < NUM_MODULE_POINTERS; i++) {
+        if (MODULE_POINTER(P, i) != MODULE_POINTER(before, i)) {
+            ImageFail(W, "module field at offset %u changed by the parse", (unsigned)modulePointers[i]);
+        }
+    }
+    flexbuf_init(&head, 1024);
+    flexbuf_init(&nodes, 1024*1024);
+    flexbuf_init(&body, 1024*1024);
+    W->L = P->Lptr;
+
+    /*
+     * nodes and strings get their numbers as they are found, so
+     * write the module and symbols first, then the nodes (which
+     * may find more nodes as they go), and last the strings
+     */
+    W->out = &body;
+    PutNum(W, W->numchildren);
+    for (i = 0; i < W->numchildren; i++) {
+        PutString(W, W->children[i].name);
+        PutNode(W, W->children[i].params);
+        PutNum(W, W->children[i].module->fromUsing);
+    }
+    PutNum(W, W->numlookups);
+    for (i = 0; i < W->numlookups; i++) {
+        size_t idx;
+        for (idx = 0; idx < W->numchildren; idx++) {
+            if (W->children[idx].module == W->lookups[i].module) break;
+        }
+        if (idx == W->numchildren) {
+            ImageFail(W, "looked up %s in an object that is not an OBJ child", W->lookups[i].name);
+        }
+        PutNum(W, idx + 1);
+        PutString(W, W->lookups[i].name);
+        PutNum(W, W->lookups[i].kind);
+    }
+    for (i = 0; i < NUM_MODULE_NODES; i++) {
+        if (MODULE_NODE(P, i) == MODULE_NODE(before, i)) {
+            PutNum(W, 0);
+        } else {
+            PutNum(W, 1);
+            PutNode(W, MODULE_NODE(P, i));
+        }
+    }
+    PutNum(W, ZigZag(P->varsize));
+    PutNum(W, ZigZag(P->datsize));
+    PutNum(W, P->pasmLabels);
+    PutNum(W, P->volatileVariables);
+    PutNum(W, P->sawToken);
+    PutNum(W, P->codeCog);
+    PutNum(W, P->datHasCode);
+    PutNum(W, P->gasPasm);
+    PutNum(W, P->isUnion);
+    PutNum(W, P->isInterface);
+    PutNum(W, P->defaultPrivate);
+    PutNum(W, P->longOnly);
+    PutNum(W, P->fromUsing);
+    PutNum(W, P->isPacked);
+    PutNum(W, P->mainLanguage);
+    PutNum(W, P->curLanguage);
+    PutNum(W, P->curLangVersion);
+
+    count = 0;
+    for (sym = lastSym ? lastSym->i_next : P->objsyms.i_first; sym; sym = sym->i_next) {
+        count++;
+    }
+    PutNum(W, count);
+    for (sym = lastSym ? lastSym->i_next : P->objsyms.i_first; sym; sym = sym->i_next) {
+        if (sym->module || sym->def) {
+            ImageFail(W, "symbol %s has module information", sym->our_name);
+        }
+        PutNum(W, sym->kind);
+        PutNum(W, sym->flags);
+        PutNum(W, ZigZag(sym->offset));
+        PutString(W, sym->our_name);
+        PutString(W, sym->user_name == sym->our_name ? NULL : sym->user_name);
+        switch (sym->kind) {
+        case SYM_WEAK_ALIAS:
+            PutString(W, (const char *)sym->v.ptr);
+            break;
+        case SYM_CONSTANT:
+        case SYM_FLOAT_CONSTANT:
+        case SYM_TYPEDEF:
+        case SYM_VARIABLE:
+            PutNode(W, (AST *)sym->v.ptr);
+            break;
+        default:
+            ImageFail(W, "cannot save symbol %s of kind %d", sym->our_name, sym->kind);
+            PutNum(W, 0);
+            break;
+        }
+    }
+    PutLexer(W, P->Lptr);
+    i = SetTempVariableBase(0, 0);
+    SetTempVariableBase(i, 0);
+    PutNum(W, i);
+
+    W->out = &nodes;
+    for (i = 0; i < W->numnodes; i++) {
+        AST *ast = W->nodes[i];
+        PutNum(W, ast->kind);
+        PutNodeData(W, ast);
+        PutNode(W, ast->left);
+        PutNode(W, ast->right);
+        PutNum(W, ast->lexdata ? ast->lineidx + 1 : 0);
+    }
+
+    W->out = &head;
+    PutNum(W, magic);
+    GetImageKey(key);
+    for (i = 0; i < NUM_KEYS; i++) {
+        PutNum(W, ZigZag(key[i]));
+    }
+    PutNum(W, W->numstrs);
+    for (i = 0; i < W->numstrs; i++) {
+        PutNum(W, InternString(W->strs[i]) == W->strs[i]);
+        flexbuf_addmem(&head, W->strs[i], strlen(W->strs[i]) + 1);
+    }
+    PutNum(W, W->numnodes);
+    flexbuf_addmem(&head, flexbuf_peek(&nodes), flexbuf_curlen(&nodes));
+    flexbuf_addmem(&head, flexbuf_peek(&body), flexbuf_curlen(&body));
+    flexbuf_delete(&nodes);
+    flexbuf_delete(&body);
+    free(W->nodes);
+    free(W->nodeslot);
+    free(W->strs);
+    free(W->strslot);
+
+    *lenp = flexbuf_curlen(&head);
+    if (W->failed[0]) {
+        flexbuf_delete(&head);
+        return NULL;
+    }
+    return (unsigned char *)flexbuf_get(&head);
+}
+
+void
+SaveSystemImage(Module *P)
+{
+    ImageWriter W;
+    unsigned char *data;
+    size_t i, len;
+
+    if (!captureFile) {
+        return;
+    }
+    if (gl_errors) {
+        fprintf(stderr, "mksysimage: errors in the system code\n");
+        exit(1);
+    }
+    memset(&W, 0, sizeof(W));
+    data = WriteImage(&W, P, &captureBefore, captureLastSym, SYSIMAGE_MAGIC, &len);
+    fprintf(captureFile, "static const unsigned char %s[] = {", captureName);
+    for (i = 0; i < len; i++) {
+        fprintf(captureFile, "%s0x%02x,", (i % 16) ? " " : "\n    ", data[i]);
+    }
+    fprintf(captureFile, "\n};\n");
+    free(data);
+}
+
+void
+CaptureSystemImage(FILE *f, const char *name)
+{
+    captureFile = f;
+    captureName = name;
+}
+
+int
+LoadSystemImage(Module *P)
+{
+    int key[NUM_KEYS];
+    int i;
+
+    if (captureFile) {
+        captureBefore = *P;
+        captureLastSym = P->objsyms.i_last;
+        return 0;
+    }
+    GetImageKey(key);
+    for (i = 0; sysImages[i]; i++) {
+        if (ReadImage(P, sysImages[i], SYSIMAGE_MAGIC, key, NULL)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * parse images of ordinary objects
+ */
+
+static int
+TempCount(void)
+{
+    int n = SetTempVariableBase(0, 0);
+
+    SetTempVariableBase(n, 0);
+    return n;
+}
+
+/* the capture a parse of module P belongs to (P may be a struct in it) */
+static ParseImageCapture *
+CaptureFor(Module *P)
+{
+    for (; P; P = P->superclass) {
+        if (activeCapture && activeCapture->P == P) {
+            return activeCapture;
+        }
+    }
+    return NULL;
+}
+
+void
+StartParseImage(ParseImageCapture *cap, Module *P)
+{
+    memset(cap, 0, sizeof(*cap));
+    cap->P = P;
+    cap->before = *P;
+    cap->lastSym = P->objsyms.i_last;
+    cap->tempnum = TempCount();
+    cap->messages = gl_errors + gl_warning_count;
+    flexbuf_init(&cap->children, 8*sizeof(ImageChild));
+    flexbuf_init(&cap->lookups, 64*sizeof(ImageLookup));
+    flexbuf_init(&cap->replay, 8*sizeof(ImageChild));
+    cap->outer = activeCapture;
+    activeCapture = cap;
+}
+
+int
+LoadParseImage(ParseImageCapture *cap, const unsigned char *image)
+{
+    int key[NUM_KEYS];
+
+    GetImageKey(key);
+    if (ReadImage(cap->P, image, MODIMAGE_MAGIC, key, cap)) {
+        activeCapture = cap->outer;
+        flexbuf_delete(&cap->children);
+        flexbuf_delete(&cap->lookups);
+        flexbuf_delete(&cap->replay);
+        return 1;
+    }
+    /* the children are loaded now, and will be reused by the parse */
+    cap->childTemps = TempCount() - cap->tempnum;
+    return 0;
+}
+
+unsigned char *
+FinishParseImage(ParseImageCapture *cap, size_t *len, const char **why)
+{
+    static char reason[160];
+    ImageWriter W;
+    unsigned char *data = NULL;
+
+    activeCapture = cap->outer;
+    memset(&W, 0, sizeof(W));
+    W.soft = 1;
+    W.children = (ImageChild *)flexbuf_peek(&cap->children);
+    W.numchildren = flexbuf_curlen(&cap->children) / sizeof(ImageChild);
+    W.lookups = (ImageLookup *)flexbuf_peek(&cap->lookups);
+    W.numlookups = flexbuf_curlen(&cap->lookups) / sizeof(ImageLookup);
+    *why = NULL;
+    if (cap->blocked) {
+        *why = cap->blocked;
+    } else if (gl_errors + gl_warning_count != cap->messages) {
+        /* loading the image would not repeat them */
+        *why = "messages were printed";
+    } else if (TempCount() - cap->tempnum != cap->childTemps) {
+        /* their names would depend on what was parsed first */
+        *why = "it makes temporary names";
+    } else {
+        /* the parse gives the module its lexer, and LoadParseImage makes one */
+        cap->before.Lptr = cap->P->Lptr;
+        data = WriteImage(&W, cap->P, &cap->before, cap->lastSym, MODIMAGE_MAGIC, len);
+        if (!data) {
+            snprintf(reason, sizeof(reason), "%s", W.failed);
+            *why = reason;
+        }
+    }
+    flexbuf_delete(&cap->children);
+    flexbuf_delete(&cap->lookups);
+    flexbuf_delete(&cap->replay);
+    return data;
+}
+
+void
+ParseImageBlock(const char *why)
+{
+    ParseImageCapture *cap = CaptureFor(current);
+
+    if (cap && !cap->blocked) {
+        cap->blocked = why;
+    }
+}
+
+void
+ParseImageLookup(Module *obj, const char *name, Symbol *sym)
+{
+    ParseImageCapture *cap = CaptureFor(current);
+    ImageLookup *old, rec;
+    size_t i, n;
+
+    if (!cap || cap->blocked) {
+        return;
+    }
+    rec.kind = LookupKind(sym);
+    if (rec.kind < 0) {
+        cap->blocked = "it uses a type from another object";
+        return;
+    }
+    old = (ImageLookup *)flexbuf_peek(&cap->lookups);
+    n = flexbuf_curlen(&cap->lookups) / sizeof(ImageLookup);
+    for (i = 0; i < n; i++) {
+        if (old[i].module == obj && !strcmp(old[i].name, name)) {
+            return;
+        }
+    }
+    rec.module = obj;
+    rec.name = strdup(name);
+    flexbuf_addmem(&cap->lookups, (const char *)&rec, sizeof(rec));
+}
+
+Module *
+ParseImageChild(const char *name, AST *params)
+{
+    ParseImageCapture *cap = CaptureFor(current);
+    ImageChild *replay, rec;
+    Module *P = NULL;
+    int start = TempCount();
+
+    if (cap && cap->replayed < flexbuf_curlen(&cap->replay) / sizeof(ImageChild)) {
+        replay = (ImageChild *)flexbuf_peek(&cap->replay) + cap->replayed;
+        if (!strcmp(replay->name, name) && AstMatch(replay->params, params)) {
+            P = replay->module;
+            cap->replayed++;
+        }
+    }
+    if (!P) {
+        P = ParseFile(name, params);
+    }
+    if (cap) {
+        cap->childTemps += TempCount() - start;
+        rec.name = name;
+        rec.params = params;
+        rec.module = P;
+        flexbuf_addmem(&cap->children, (const char *)&rec, sizeof(rec));
+    }
+    return P;
+}
@@ -0,0 +1,79 @@
+/*
+ * Precompiled image of the system module
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ */
+
+#ifndef SYSIMAGE_H_
+#define SYSIMAGE_H_
+
+#include <stdio.h>
+
+/*
+ * fill in the system module P with the results of parsing the
+ * built in system code, using an image made at build time for the
+ * current target and options; returns 1 on success, or 0 if there
+ * is no matching image and the code must be parsed as usual
+ */
+int LoadSystemImage(Module *P);
+
+/*
+ * called after the system code has been parsed; if an image is being
+ * captured, write the parse results out
+ */
+void SaveSystemImage(Module *P);
+
+/*
+ * make the next InitGlobalModule parse the system code and write
+ * an image of it to f as a C array called "name" (for mksysimage)
+ */
+void CaptureSystemImage(FILE *f, const char *name);
+
+/*
+ * images of the parse of an ordinary Spin object, kept by the
+ * compile cache (see spinc.c)
+ */
+typedef struct ParseImageCapture {
+    struct ParseImageCapture *outer;  /* capture of the object being parsed around this one */
+    Module *P;
+    Module before;          /* the module before the parse */
+    Symbol *lastSym;        /* its last symbol */
+    int tempnum;            /* temporary variable counter at the start */
+    int childTemps;         /* temporaries used by OBJ children */
+    int messages;           /* errors and warnings printed before the parse */
+    const char *blocked;    /* why the parse cannot be saved, or NULL */
+    Flexbuf children;       /* OBJ children, in the order they were parsed */
+    Flexbuf lookups;        /* names looked up in them */
+    Flexbuf replay;         /* children loaded by a failed LoadParseImage */
+    size_t replayed;        /* how many of those the parse has used */
+} ParseImageCapture;
+
+/* called just before module P is parsed */
+void StartParseImage(ParseImageCapture *cap, Module *P);
+
+/*
+ * fill in the module being captured from an image instead of parsing
+ * it; returns 1 on success, which ends the capture. Returns 0 if the
+ * image cannot be used, in which case the module should be parsed as
+ * usual (reusing any OBJ children the image already loaded) and
+ * FinishParseImage called
+ */
+int LoadParseImage(ParseImageCapture *cap, const unsigned char *image);
+
+/*
+ * called just after the parse; returns a freshly allocated image and
+ * its length, or NULL (with *why set) if the parse did something an
+ * image cannot record
+ */
+unsigned char *FinishParseImage(ParseImageCapture *cap, size_t *len, const char **why);
+
+/* note that the current parse cannot be saved in an image */
+void ParseImageBlock(const char *why);
+
+/* note that the lexer looked up name in the OBJ child obj, and found sym */
+void ParseImageLookup(Module *obj, const char *name, Symbol *sym);
+
+/* parse the OBJ child name with parameters params (replaces ParseFile) */
+Module *ParseImageChild(const char *name, AST *params);
+
+#endif
@@ -22,7 +22,7 @@ typedef int Token;
 Module *current;
 Module *allparse;
 Module *systemModule;
-Function *curfunc;
+THREAD_LOCAL Function *curfunc;
 SymbolTable *currentTypes;
 
 AST *ast_type_long, *ast_type_word, *ast_type_byte, *ast_type_float;
@@ -64,6 +64,10 @@ int BCgetDAToffset(Module *P, bool absolute, AST *errloc, bool printErrors) {
     return -1;
 }
 
+// and one for the compile cache
+void ParseImageLookup(Module *obj, const char *name, Symbol *sym) {
+}
+
 static void EXPECTEQfn(long x, long val, int line) {
     if (x != val) {
         fprintf(stderr, "test failed at line %d of %s: expected %ld got %ld\n",
@@ -388,8 +392,10 @@ void PrintExpr(Flexbuf *f, AST *expr, int flags) {
     flexbuf_addstr(f, "expression");
 }
 
-// dummy for tracking source files
+// dummies for tracking source files
 void AddSourceFile(const char *shortName, const char *longName) {
 }
+void CacheNoteMissing(const char *fullName) {
+}
 
 int GetCurrentLang() { return LANG_DEFAULT; }
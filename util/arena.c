@@ -0,0 +1,135 @@
+/*
+ * Simple bump pointer ("arena") allocator.
+ *
+ * MIT Licensed; see terms at the end of flexbuf.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "arena.h"
+
+#define DEFAULT_CHUNKSIZE (1024*1024)
+
+/* everything handed out is aligned to this */
+#define ARENA_ALIGN 16
+
+struct ArenaChunk {
+    ArenaChunk *next;
+    size_t size;   /* usable bytes in data[] */
+    size_t top;    /* offset of first free byte */
+    union {
+        long double ld;
+        void *p;
+        long long ll;
+    } data[1];
+};
+
+static ArenaChunk *
+newChunk(Arena *A, size_t need)
+{
+    ArenaChunk *C;
+    ArenaChunk **prevp;
+    size_t size = A->chunksize;
+
+    if (need > size) {
+        size = need;
+    }
+    /* see if a spare chunk is big enough */
+    for (prevp = &A->spare; (C = *prevp) != NULL; prevp = &C->next) {
+        if (C->size >= need) {
+            *prevp = C->next;
+            C->top = 0;
+            return C;
+        }
+    }
+    C = (ArenaChunk *)malloc(sizeof(*C) + size);
+    if (!C) {
+        fprintf(stderr, "FATAL ERROR: out of memory\n");
+        abort();
+    }
+    C->size = size;
+    C->top = 0;
+    A->reserved += size;
+    return C;
+}
+
+void
+ArenaInit(Arena *A, size_t chunksize)
+{
+    memset(A, 0, sizeof(*A));
+    A->chunksize = chunksize ? chunksize : DEFAULT_CHUNKSIZE;
+}
+
+void *
+ArenaAlloc(Arena *A, size_t size)
+{
+    ArenaChunk *C = A->chunks;
+    char *r;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if (!C || C->top + size > C->size) {
+        C = newChunk(A, size);
+        C->next = A->chunks;
+        A->chunks = C;
+    }
+    r = ((char *)C->data) + C->top;
+    C->top += size;
+    A->used += size;
+    if (A->used > A->peak) {
+        A->peak = A->used;
+    }
+    return (void *)r;
+}
+
+void *
+ArenaCalloc(Arena *A, size_t size)
+{
+    void *r = ArenaAlloc(A, size);
+    memset(r, 0, size);
+    return r;
+}
+
+char *
+ArenaStrdup(Arena *A, const char *s)
+{
+    size_t len = strlen(s) + 1;
+    char *r = (char *)ArenaAlloc(A, len);
+    memcpy(r, s, len);
+    return r;
+}
+
+void
+ArenaReset(Arena *A)
+{
+    ArenaChunk *C, *next;
+
+    for (C = A->chunks; C; C = next) {
+        next = C->next;
+#ifdef ARENA_DEBUG
+        /* make stale pointers obvious, and never re-use the chunk */
+        memset(C->data, 0xdb, C->size);
+        A->reserved -= C->size;
+        free(C);
+        continue;
+#endif
+        C->next = A->spare;
+        A->spare = C;
+    }
+    A->chunks = NULL;
+    A->used = 0;
+}
+
+void
+ArenaFree(Arena *A)
+{
+    ArenaChunk *C, *next;
+
+    ArenaReset(A);
+    for (C = A->spare; C; C = next) {
+        next = C->next;
+        free(C);
+    }
+    A->spare = NULL;
+    A->reserved = 0;
+}
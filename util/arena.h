@@ -0,0 +1,42 @@
+/*
+ * Simple bump pointer ("arena") allocator.
+ * Objects are carved sequentially out of large chunks and are
+ * never freed individually; instead the whole arena is reset at once.
+ *
+ * MIT Licensed; see terms at the end of flexbuf.c
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+#include <stddef.h>
+
+typedef struct ArenaChunk ArenaChunk;
+
+typedef struct Arena {
+    ArenaChunk *chunks;  /* chunks in use; the first one is being filled */
+    ArenaChunk *spare;   /* chunks kept around by ArenaReset for re-use */
+    size_t chunksize;    /* default size of a new chunk */
+    size_t used;         /* bytes currently handed out */
+    size_t reserved;     /* bytes obtained from malloc */
+    size_t peak;         /* high water mark of "used" */
+} Arena;
+
+/* initialize an arena; chunksize of 0 means use a default */
+void ArenaInit(Arena *A, size_t chunksize);
+
+/* allocate memory from an arena; never returns NULL */
+void *ArenaAlloc(Arena *A, size_t size);
+
+/* allocate zero filled memory */
+void *ArenaCalloc(Arena *A, size_t size);
+
+/* copy a string into the arena */
+char *ArenaStrdup(Arena *A, const char *s);
+
+/* release everything allocated so far; the memory is kept for re-use */
+void ArenaReset(Arena *A);
+
+/* release everything and give the memory back to the system */
+void ArenaFree(Arena *A);
+
+#endif
@@ -0,0 +1,128 @@
+/*
+ * Minimal worker pool for running independent jobs in parallel.
+ *
+ * MIT Licensed; see terms at the end of flexbuf.c
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "workpool.h"
+
+#ifdef FLEXSPIN_THREADS
+#include <pthread.h>
+
+/* the compiler recurses deeply in places, so give workers a big stack */
+#define WORKER_STACK_SIZE (8*1024*1024)
+
+typedef struct WorkPool {
+    pthread_mutex_t lock;
+    int next;
+    int count;
+    WorkFunc func;
+    void *arg;
+} WorkPool;
+
+static pthread_mutex_t sharedLock;
+static int poolActive;
+
+static void *
+workerThread(void *ptr)
+{
+    WorkPool *W = (WorkPool *)ptr;
+    int n;
+
+    for(;;) {
+        pthread_mutex_lock(&W->lock);
+        n = W->next++;
+        pthread_mutex_unlock(&W->lock);
+        if (n >= W->count) break;
+        W->func(W->arg, n);
+    }
+    return NULL;
+}
+
+void
+WorkPoolRun(int threads, int count, WorkFunc func, void *arg)
+{
+    static int initDone;
+    WorkPool W;
+    pthread_t *tids;
+    pthread_attr_t attr;
+    int started = 0;
+    int i;
+
+    if (threads > count) {
+        threads = count;
+    }
+    if (threads <= 1 || poolActive) {
+        for (i = 0; i < count; i++) {
+            func(arg, i);
+        }
+        return;
+    }
+    if (!initDone) {
+        pthread_mutexattr_t mattr;
+        pthread_mutexattr_init(&mattr);
+        pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&sharedLock, &mattr);
+        pthread_mutexattr_destroy(&mattr);
+        initDone = 1;
+    }
+    pthread_mutex_init(&W.lock, NULL);
+    W.next = 0;
+    W.count = count;
+    W.func = func;
+    W.arg = arg;
+
+    tids = (pthread_t *)calloc(threads, sizeof(*tids));
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, WORKER_STACK_SIZE);
+    poolActive = 1;
+    /* the calling thread is one of the workers */
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&tids[started], &attr, workerThread, (void *)&W) != 0) {
+            break;
+        }
+        started++;
+    }
+    workerThread((void *)&W);
+    for (i = 0; i < started; i++) {
+        pthread_join(tids[i], NULL);
+    }
+    poolActive = 0;
+    pthread_attr_destroy(&attr);
+    pthread_mutex_destroy(&W.lock);
+    free(tids);
+}
+
+void
+WorkPoolLock(void)
+{
+    if (poolActive) {
+        pthread_mutex_lock(&sharedLock);
+    }
+}
+
+void
+WorkPoolUnlock(void)
+{
+    if (poolActive) {
+        pthread_mutex_unlock(&sharedLock);
+    }
+}
+
+#else
+
+void
+WorkPoolRun(int threads, int count, WorkFunc func, void *arg)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        func(arg, i);
+    }
+}
+
+void WorkPoolLock(void) {}
+void WorkPoolUnlock(void) {}
+
+#endif
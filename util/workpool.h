@@ -0,0 +1,35 @@
+/*
+ * Minimal worker pool for running independent jobs in parallel.
+ * Uses POSIX threads if FLEXSPIN_THREADS is defined; otherwise
+ * every job simply runs on the calling thread.
+ *
+ * MIT Licensed; see terms at the end of flexbuf.c
+ */
+
+#ifndef WORKPOOL_H_
+#define WORKPOOL_H_
+
+#ifdef FLEXSPIN_THREADS
+#define THREAD_LOCAL __thread
+#else
+#define THREAD_LOCAL
+#endif
+
+typedef void (*WorkFunc)(void *arg, int n);
+
+/*
+ * call func(arg, n) for every n from 0 to count-1, using up to
+ * "threads" threads (including the caller); returns once all the
+ * jobs are finished. Jobs are handed out in increasing order of n,
+ * but may finish in any order.
+ */
+void WorkPoolRun(int threads, int count, WorkFunc func, void *arg);
+
+/*
+ * lock for tables shared between jobs; the lock is recursive, and
+ * costs nothing when no pool is running
+ */
+void WorkPoolLock(void);
+void WorkPoolUnlock(void);
+
+#endif
@@ -0,0 +1,428 @@
+/*
+ * Watch mode: keep recompiling a program as its sources change
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ *
+ * With --watch the program is compiled, and then compiled again each
+ * time one of the files it read changes, or a line is read from
+ * standard input, until standard input is closed.
+ *
+ * The compiler keeps its state in globals and the optimizer works on
+ * the whole program, so a rebuild cannot redo just the changed modules
+ * in place. Instead, just before each source file is parsed the
+ * compile forks a paused copy of itself (a snapshot). A snapshot holds
+ * all the work done up to that point: the system module and every file
+ * parsed so far. For a rebuild the server resumes the latest snapshot
+ * taken before any changed file was read; the snapshot forks again and
+ * the copy finishes the compile from there, so only the files from
+ * that point on are parsed again. The snapshot itself stays paused for
+ * later rebuilds.
+ *
+ * Compile processes report to the server over a pipe, a line at a time:
+ *    in PATH       the compile has read PATH
+ *    snap PID      process PID is a snapshot taken at this point
+ *    done STATUS   the compile finished with exit status STATUS
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "spinc.h"
+#include "watch.h"
+
+#ifdef WIN32
+
+void
+WatchStart(void)
+{
+    fprintf(stderr, "--watch is not supported on this platform\n");
+    exit(2);
+}
+
+void WatchSnapshot(void) {}
+void WatchNoteInput(const char *fullName) {}
+
+#else
+
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/select.h>
+#include <sys/time.h>
+
+#define MAX_SNAPSHOTS 64      /* per compile */
+#define POLL_MSEC     200     /* how often to check the sources */
+#define MAX_MSG       4200
+
+/*
+ * state of the compile processes
+ */
+static int msgFd = -1;        /* write end of the pipe to the server */
+static int lifeFd = -1;       /* at EOF when the server has exited */
+static int notedSinceSnap;    /* files read since the last snapshot */
+static int numSnaps;          /* snapshots taken by this compile */
+static volatile sig_atomic_t resumeFlag;
+
+/*
+ * state of the server
+ */
+typedef struct WatchInput {
+    char *name;
+    unsigned long long hash;  /* of the contents when read */
+} WatchInput;
+
+typedef struct WatchSnap {
+    pid_t pid;
+    size_t ninputs;           /* files read before the snapshot */
+} WatchSnap;
+
+static Flexbuf inputs;        /* holds WatchInput */
+static Flexbuf snaps;         /* holds WatchSnap */
+
+#define NUM_INPUTS (flexbuf_curlen(&inputs) / sizeof(WatchInput))
+#define NUM_SNAPS  (flexbuf_curlen(&snaps) / sizeof(WatchSnap))
+#define INPUT(i)   (((WatchInput *)flexbuf_peek(&inputs)) + (i))
+#define SNAP(i)    (((WatchSnap *)flexbuf_peek(&snaps)) + (i))
+
+static void
+SendMessage(const char *fmt, ...)
+{
+    char buf[MAX_MSG];
+    va_list args;
+    int len, r;
+    char *ptr = buf;
+
+    va_start(args, fmt);
+    len = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (len >= (int)sizeof(buf)) {
+        return;
+    }
+    while (len > 0) {
+        r = write(msgFd, ptr, len);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) break;
+        ptr += r;
+        len -= r;
+    }
+}
+
+static void
+OnResume(int sig)
+{
+    resumeFlag = 1;
+}
+
+/*
+ * wait to be resumed; then fork a process to finish the compile and
+ * report its exit status. Returns only in that process.
+ */
+static void
+SnapshotLoop(void)
+{
+    sigset_t waitmask;
+    fd_set rd;
+    pid_t pid;
+    int status, code;
+
+    sigprocmask(SIG_BLOCK, NULL, &waitmask);
+    sigdelset(&waitmask, SIGUSR1);
+    for (;;) {
+        while (!resumeFlag) {
+            FD_ZERO(&rd);
+            FD_SET(lifeFd, &rd);
+            if (pselect(lifeFd + 1, &rd, NULL, NULL, NULL, &waitmask) > 0) {
+                /* the server has exited */
+                _exit(0);
+            }
+        }
+        resumeFlag = 0;
+        pid = fork();
+        if (pid == 0) {
+            return;
+        }
+        code = 2;
+        if (pid > 0 && waitpid(pid, &status, 0) == pid) {
+            if (WIFEXITED(status)) {
+                code = WEXITSTATUS(status);
+            } else if (WIFSIGNALED(status)) {
+                code = 128 + WTERMSIG(status);
+            }
+        }
+        SendMessage("done %d\n", code);
+    }
+}
+
+void
+WatchSnapshot(void)
+{
+    pid_t pid;
+
+    if (msgFd < 0 || notedSinceSnap == 0 || numSnaps >= MAX_SNAPSHOTS) {
+        return;
+    }
+    fflush(stdout);
+    fflush(stderr);
+    pid = fork();
+    if (pid < 0) {
+        return;
+    }
+    notedSinceSnap = 0;
+    numSnaps++;
+    if (pid > 0) {
+        /* carry on with the compile */
+        SendMessage("snap %d\n", (int)pid);
+        return;
+    }
+    SnapshotLoop();
+}
+
+void
+WatchNoteInput(const char *fullName)
+{
+    if (msgFd >= 0 && !strchr(fullName, '\n')) {
+        SendMessage("in %s\n", fullName);
+        notedSinceSnap++;
+    }
+}
+
+/*
+ * server side
+ */
+
+/* FNV-1a hash of a file's contents, or 0 if it cannot be read */
+static unsigned long long
+HashContents(const char *name)
+{
+    unsigned long long h = 14695981039346656037ULL;
+    unsigned char buf[BUFSIZ];
+    size_t n, i;
+    FILE *f = fopen(name, "rb");
+
+    if (!f) {
+        return 0;
+    }
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0) {
+        for (i = 0; i < n; i++) {
+            h = (h ^ buf[i]) * 1099511628211ULL;
+        }
+    }
+    fclose(f);
+    return h ? h : 1;
+}
+
+static void
+AddInput(const char *name)
+{
+    WatchInput w;
+    size_t i;
+
+    for (i = 0; i < NUM_INPUTS; i++) {
+        if (!strcmp(INPUT(i)->name, name)) {
+            return;
+        }
+    }
+    w.name = strdup(name);
+    w.hash = HashContents(name);
+    flexbuf_addmem(&inputs, (const char *)&w, sizeof(w));
+}
+
+static void
+AddSnap(pid_t pid)
+{
+    WatchSnap s;
+
+    s.pid = pid;
+    s.ninputs = NUM_INPUTS;
+    flexbuf_addmem(&snaps, (const char *)&s, sizeof(s));
+}
+
+/*
+ * throw away the snapshots after snapshot k, and the files read after it
+ */
+static void
+Truncate(size_t k)
+{
+    size_t i;
+
+    for (i = k + 1; i < NUM_SNAPS; i++) {
+        kill(SNAP(i)->pid, SIGKILL);
+    }
+    snaps.len = (k + 1) * sizeof(WatchSnap);
+    for (i = SNAP(k)->ninputs; i < NUM_INPUTS; i++) {
+        free(INPUT(i)->name);
+    }
+    inputs.len = SNAP(k)->ninputs * sizeof(WatchInput);
+}
+
+static double
+Now(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*
+ * rebuild, starting from snapshot k; returns the exit status
+ */
+static int
+Build(FILE *msgs, size_t k)
+{
+    char line[MAX_MSG];
+    double start = Now();
+    size_t reused;
+    int status = -1;
+
+    Truncate(k);
+    while (kill(SNAP(k)->pid, SIGUSR1) != 0) {
+        if (k == 0) {
+            fprintf(stderr, "watch: compile process has exited\n");
+            exit(2);
+        }
+        Truncate(--k);
+    }
+    reused = SNAP(k)->ninputs;
+    while (status < 0 && fgets(line, sizeof(line), msgs)) {
+        line[strcspn(line, "\n")] = 0;
+        if (!strncmp(line, "in ", 3)) {
+            AddInput(line + 3);
+        } else if (!strncmp(line, "snap ", 5)) {
+            AddSnap((pid_t)atoi(line + 5));
+        } else if (!strncmp(line, "done ", 5)) {
+            status = atoi(line + 5);
+        }
+    }
+    if (status < 0) {
+        fprintf(stderr, "watch: compile process has exited\n");
+        exit(2);
+    }
+    printf("watch: %s in %.3fs (%u of %u files reused)\n",
+           status ? "failed" : "compiled", Now() - start,
+           (unsigned)reused, (unsigned)NUM_INPUTS);
+    fflush(stdout);
+    return status;
+}
+
+/*
+ * find the latest snapshot that comes before any changed file;
+ * if report is set, say which file changed
+ */
+static size_t
+PickSnapshot(int report)
+{
+    size_t i, k;
+
+    for (i = 0; i < NUM_INPUTS; i++) {
+        if (HashContents(INPUT(i)->name) != INPUT(i)->hash) {
+            break;
+        }
+    }
+    if (i == NUM_INPUTS && report) {
+        return (size_t)-1;
+    }
+    if (i < NUM_INPUTS && report) {
+        printf("watch: %s changed\n", INPUT(i)->name);
+        fflush(stdout);
+    }
+    for (k = NUM_SNAPS - 1; k > 0 && SNAP(k)->ninputs > i; --k)
+        ;
+    return k;
+}
+
+/*
+ * wait for a source file to change or a line on standard input; returns
+ * the snapshot to rebuild from, or -1 at the end of standard input
+ */
+static size_t
+WaitForChange(void)
+{
+    char buf[256];
+    struct timeval tv;
+    fd_set rd;
+    size_t k;
+    int n;
+
+    for (;;) {
+        FD_ZERO(&rd);
+        FD_SET(0, &rd);
+        tv.tv_sec = 0;
+        tv.tv_usec = POLL_MSEC * 1000;
+        if (select(1, &rd, NULL, NULL, &tv) > 0) {
+            n = read(0, buf, sizeof(buf));
+            if (n <= 0) {
+                return (size_t)-1;
+            }
+            if (memchr(buf, '\n', n)) {
+                return PickSnapshot(0);
+            }
+            continue;
+        }
+        k = PickSnapshot(1);
+        if (k != (size_t)-1) {
+            return k;
+        }
+    }
+}
+
+void
+WatchStart(void)
+{
+    int msgPipe[2], lifePipe[2];
+    struct sigaction sa;
+    sigset_t mask;
+    pid_t root;
+    FILE *msgs;
+    size_t k;
+    int status;
+
+    if (pipe(msgPipe) < 0 || pipe(lifePipe) < 0) {
+        perror("--watch");
+        exit(2);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = OnResume;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR1, &sa, NULL);
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGUSR1);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+
+    fflush(stdout);
+    fflush(stderr);
+    root = fork();
+    if (root < 0) {
+        perror("--watch");
+        exit(2);
+    }
+    if (root == 0) {
+        /* the first snapshot, taken before anything is parsed */
+        close(msgPipe[0]);
+        close(lifePipe[1]);
+        msgFd = msgPipe[1];
+        lifeFd = lifePipe[0];
+        SnapshotLoop();
+        return;
+    }
+    close(msgPipe[1]);
+    close(lifePipe[0]);
+    msgs = fdopen(msgPipe[0], "r");
+    flexbuf_init(&inputs, 64 * sizeof(WatchInput));
+    flexbuf_init(&snaps, 16 * sizeof(WatchSnap));
+    AddSnap(root);
+
+    status = Build(msgs, 0);
+    while ((k = WaitForChange()) != (size_t)-1) {
+        status = Build(msgs, k);
+    }
+    for (k = 0; k < NUM_SNAPS; k++) {
+        kill(SNAP(k)->pid, SIGKILL);
+    }
+    waitpid(root, NULL, 0);
+    exit(status);
+}
+
+#endif
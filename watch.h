@@ -0,0 +1,29 @@
+/*
+ * Watch mode: keep recompiling a program as its sources change
+ * Copyright (c) 2025 Total Spectrum Software Inc.
+ * MIT Licensed; see terms in flexspin.c
+ */
+
+#ifndef WATCH_H_
+#define WATCH_H_
+
+/*
+ * enter watch mode; called once the command line has been processed.
+ * The calling process becomes the watch server and never returns;
+ * only the processes that are to run a compile return from this.
+ */
+void WatchStart(void);
+
+/*
+ * called before each source file is parsed; saves the state of the
+ * compile so far, so a later rebuild can start from here if none of
+ * the files read up to now have changed
+ */
+void WatchSnapshot(void);
+
+/*
+ * record a file read by the compile
+ */
+void WatchNoteInput(const char *fullName);
+
+#endif